@@ -3,8 +3,10 @@
 //
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "assembler.h"
 #include "general_types.h"
@@ -12,134 +14,1109 @@
 #include "symbol_handler.h"
 #include "command_transformer.h"
 #include "code_exporter.h"
+#include "diagnostics.h"
+#include "worker_pool.h"
+#include "directory_walker.h"
+#include "source_manifest.h"
+#include "source_reader.h"
+#include "assembly_pipeline.h"
+#include "assembly_trace.h"
+#include "performance_counters.h"
+#include "source_partitions.h"
+#include "memory_accounting.h"
+#include "assembly_probes.h"
 
-int handle_source_file(int verbose_mode, const char* file_path);
+/* How many started files may wait to be assembled, with their content already loaded, before starting more blocks. */
+#define MAXIMUM_RUNNING_JOB_COUNT (SOURCE_READ_BATCH_SIZE * 4)
+
+struct source_file_job {
+    char* file_path;
+    char* output_file_path; // NULL to use the one of the batch options.
+    t_source_buffer source; // Loaded ahead by the batch, or NULL content if it is loaded when assembled.
+    size_t size; // Only used to start the biggest files first.
+    size_t order;
+    int result;
+    char* diagnostics;
+    size_t diagnostics_length;
+    int is_done;
+    t_assembly_statistics statistics; // Only recorded if the batch has a summary.
+
+    struct assembly_batch* batch;
+    struct source_file_job* next;
+};
+
+typedef struct source_file_job t_source_file_job;
+
+/* Source files assembled by the workers, whose diagnostics are printed in the same order the files were added. */
+struct assembly_batch {
+    const t_assembler_options* options;
+    t_worker_pool* pool; // NULL if the files are assembled right away by the calling thread.
+    t_assembler_context* context; // Only used when there is no pool.
+    t_source_reader* reader;
+
+    /* Added files whose content is loaded all at once, before they are assembled. */
+    t_source_file_job* unloaded_jobs[SOURCE_READ_BATCH_SIZE];
+    size_t unloaded_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t job_done;
+    pthread_mutex_t adding_lock;
+
+    t_source_file_job* first_job;
+    t_source_file_job* last_job;
+    size_t running_count; // Started, and so possibly holding their loaded content, but not done yet.
+    size_t file_count;
+    size_t failed_count;
+
+    t_statistics_summary* summary; // NULL unless statistics were requested.
+};
+
+typedef struct assembly_batch t_assembly_batch;
+
+int create_assembly_batch(t_assembly_batch** batch, const t_assembler_options* options);
+int add_source_file_to_batch(t_assembly_batch* batch, const char* file_path, const char* output_file_path);
+t_source_file_job* create_batch_job(t_assembly_batch* batch, const char* file_path, const char* output_file_path);
+int start_batch_job(t_assembly_batch* batch, t_source_file_job* job);
+int compare_jobs_by_size(const void* first, const void* second);
+void wait_for_running_jobs(t_assembly_batch* batch, size_t maximum_running_count);
+int add_found_source_file_to_batch(const char* file_path, void* argument);
+int add_manifest_entry_to_batch(const char* file_path, const char* output_file_path, void* argument);
+int load_and_start_jobs(t_assembly_batch* batch);
+void report_finished_jobs(t_assembly_batch* batch, int wait_for_all);
+size_t finish_assembly_batch(t_assembly_batch* batch);
+int assemble_job(t_source_file_job* job, t_assembler_context* context);
+void run_source_file_job(void* argument, void* worker_context);
+
+/* The program of a source file, ready to be exported into any artifact. */
+struct translated_program {
+    t_array_list* commands_buffer;
+    t_array_list* user_symbols; // NULL unless the symbols artifact was requested.
+    unsigned int* instructions_buffer;
+};
+
+typedef struct translated_program t_translated_program;
+
+int translate_source(const t_assembler_options* options, t_assembler_context* context, const char* content,
+                     size_t length, int artifacts, t_translated_program* program);
+void dispose_translated_program(t_translated_program* program);
+int restore_cached_artifacts(const t_assembler_options* options, const char* file_path, unsigned long long source_hash,
+                             size_t source_length);
+int export_artifacts(const t_assembler_options* options, const char* file_path, const t_array_list* commands_buffer,
+                     const t_array_list* user_symbols, const unsigned int* instructions_buffer,
+                     unsigned long long source_hash, size_t source_length);
+
+int start_assembler(const t_assembler_options* options, int file_count, char** file_names) {
+    if (options == NULL) {
+        report_error("Internal Error: 'options' is NULL at 'start_assembler'.\n");
+        return -1;
+    }
 
-int start_assembler(int verbose_mode, int file_count, char** file_names) {
     if (file_count <= 0) {
-        printf("Internal Error: 'file_count' is equal to, or below, 0 at 'start_assembler'.\n");
+        report_error("Internal Error: 'file_count' is equal to, or below, 0 at 'start_assembler'.\n");
         return -1;
     }
 
     if (file_names == NULL) {
-        printf("Internal Error: 'file_names' is NULL at 'start_assembler'.\n");
+        report_error("Internal Error: 'file_names' is NULL at 'start_assembler'.\n");
         return -1;
     }
 
     for (int i = 0; i < file_count; i++) {
-        char* file_name = file_names[i];
-
-        if (file_name == NULL) {
-            printf("Internal Error: 'file_names' contains NULL values at 'start_assembler'.\n");
+        if (file_names[i] == NULL) {
+            report_error("Internal Error: 'file_names' contains NULL values at 'start_assembler'.\n");
             return -1;
         }
+    }
 
-        int result = handle_source_file(verbose_mode, file_name);
+    t_assembly_batch* batch;
 
-        if (result < 0) {
-            printf("Error: failed to handle source file '%s' at 'start_assembler'.\n", file_name);
+    if (create_assembly_batch(&batch, options) < 0) {
+        return -1;
+    }
+
+    /* Assembled right away, so that their diagnostics are printed live, in order. */
+    if (batch->pool == NULL) {
+        for (int i = 0; i < file_count; i++) {
+            if (add_source_file_to_batch(batch, file_names[i], NULL) < 0) {
+                finish_assembly_batch(batch);
+                return -1;
+            }
+        }
+
+        return (finish_assembly_batch(batch) > 0) ? 0 : 1;
+    }
+
+    t_source_file_job** jobs = allocate_memory(sizeof(t_source_file_job*) * file_count);
+
+    if (jobs == NULL) {
+        finish_assembly_batch(batch);
+        report_error("Internal Error: failed to allocate memory for 'jobs' at 'start_assembler'.\n");
+        return -1;
+    }
+
+    /* The biggest files start first, so that none of them is left running alone once the rest are done. The
+     * diagnostics are still reported in the order of the file names. */
+    int result = 1;
+
+    for (int i = 0; i < file_count; i++) {
+        jobs[i] = create_batch_job(batch, file_names[i], NULL);
+
+        /* The jobs already created are still started, since the batch waits for all of them. */
+        if (jobs[i] == NULL) {
+            result = -1;
+            file_count = i;
+            break;
+        }
+
+        struct stat file_status;
+
+        if ((strcmp(file_names[i], STANDARD_INPUT_PATH) != 0) && (stat(file_names[i], &file_status) == 0)) {
+            jobs[i]->size = (size_t)file_status.st_size;
+        }
+    }
+
+    qsort(jobs, (size_t)file_count, sizeof(t_source_file_job*), compare_jobs_by_size);
+
+    for (int i = 0; i < file_count; i++) {
+        if (start_batch_job(batch, jobs[i]) < 0) {
+            result = -1;
+        }
+    }
+
+    release_memory(jobs);
+
+    size_t failed_count = finish_assembly_batch(batch);
+
+    if (result < 0) {
+        return -1;
+    }
+
+    return (failed_count > 0) ? 0 : 1;
+}
+
+/* Every source file under 'root_path' is assembled, already while the rest of the tree is still being walked. */
+int start_assembler_using_directory(const t_assembler_options* options, const char* root_path) {
+    if (options == NULL) {
+        report_error("Internal Error: 'options' is NULL at 'start_assembler_using_directory'.\n");
+        return -1;
+    }
+
+    if (root_path == NULL) {
+        report_error("Internal Error: 'root_path' is NULL at 'start_assembler_using_directory'.\n");
+        return -1;
+    }
+
+    t_assembly_batch* batch;
+
+    if (create_assembly_batch(&batch, options) < 0) {
+        return -1;
+    }
+
+    size_t walker_count = (options->job_count > 0) ? (size_t)options->job_count : get_available_processor_count();
+    int result = walk_source_directory(root_path, walker_count, add_found_source_file_to_batch, batch);
+
+    size_t failed_count = finish_assembly_batch(batch);
+
+    if (result < 0) {
+        return -1;
+    }
+
+    return ((result == 0) || (failed_count > 0)) ? 0 : 1;
+}
+
+/* The walking threads find files concurrently, while the batch expects them to be added one at a time. */
+int add_found_source_file_to_batch(const char* file_path, void* argument) {
+    t_assembly_batch* batch = argument;
+
+    pthread_mutex_lock(&batch->adding_lock);
+    int result = add_source_file_to_batch(batch, file_path, NULL);
+    pthread_mutex_unlock(&batch->adding_lock);
+
+    return result;
+}
+
+/* The files of the manifest are assembled while it is still being read, and a single summary is reported at the end. */
+int start_assembler_using_manifest(const t_assembler_options* options, const char* manifest_path) {
+    if (options == NULL) {
+        report_error("Internal Error: 'options' is NULL at 'start_assembler_using_manifest'.\n");
+        return -1;
+    }
+
+    if (manifest_path == NULL) {
+        report_error("Internal Error: 'manifest_path' is NULL at 'start_assembler_using_manifest'.\n");
+        return -1;
+    }
+
+    t_assembly_batch* batch;
+
+    if (create_assembly_batch(&batch, options) < 0) {
+        return -1;
+    }
+
+    long result = read_source_manifest(manifest_path, add_manifest_entry_to_batch, batch);
+
+    size_t file_count = batch->file_count;
+    size_t failed_count = finish_assembly_batch(batch);
+
+    if (result < 0) {
+        return -1;
+    }
+
+    report("Assembled %lu of %lu source files, %lu failed.\n", file_count - failed_count, file_count, failed_count);
+
+    return (failed_count > 0) ? 0 : 1;
+}
+
+int add_manifest_entry_to_batch(const char* file_path, const char* output_file_path, void* argument) {
+    return add_source_file_to_batch(argument, file_path, output_file_path);
+}
+
+int create_assembly_batch(t_assembly_batch** batch, const t_assembler_options* options) {
+    t_assembly_batch* assembly_batch = allocate_memory(sizeof(t_assembly_batch));
+
+    if (assembly_batch == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'assembly_batch' at 'create_assembly_batch'.\n");
+        return -1;
+    }
+
+    assembly_batch->options = options;
+    assembly_batch->pool = NULL;
+    assembly_batch->context = NULL;
+    assembly_batch->reader = NULL;
+    assembly_batch->unloaded_count = 0L;
+    assembly_batch->first_job = NULL;
+    assembly_batch->last_job = NULL;
+    assembly_batch->running_count = 0L;
+    assembly_batch->file_count = 0L;
+    assembly_batch->failed_count = 0L;
+    assembly_batch->summary = NULL;
+
+    pthread_mutex_init(&assembly_batch->lock, NULL);
+    pthread_cond_init(&assembly_batch->job_done, NULL);
+    pthread_mutex_init(&assembly_batch->adding_lock, NULL);
+
+    size_t job_count = (options->job_count > 0) ? (size_t)options->job_count : get_available_processor_count();
+
+    /* The assembled code of several files can not be interleaved on stdout. */
+    if (options->output_to_standard_output) {
+        job_count = 1;
+    }
+
+    int result = (job_count > 1) ?
+                 create_worker_pool(&assembly_batch->pool, job_count, create_assembler_context, dispose_assembler_context) :
+                 ((assembly_batch->context = create_assembler_context(0)) != NULL) ? 1 : -1;
+
+    if ((result > 0) && (create_source_reader(&assembly_batch->reader) < 0)) {
+        report_error("Internal Error: failed to allocate memory for 'reader' at 'create_assembly_batch'.\n");
+        result = -1;
+    }
+
+    if ((result > 0) && (options->statistics_format != NO_STATISTICS) &&
+        (create_statistics_summary(&assembly_batch->summary, options->statistics_format) < 0)) {
+        dispose_source_reader(assembly_batch->reader);
+        result = -1;
+    }
+
+    if (result < 0) {
+        if (assembly_batch->pool != NULL) {
+            dispose_worker_pool(assembly_batch->pool);
         }
+
+        dispose_assembler_context(assembly_batch->context);
+
+        pthread_mutex_destroy(&assembly_batch->lock);
+        pthread_cond_destroy(&assembly_batch->job_done);
+        pthread_mutex_destroy(&assembly_batch->adding_lock);
+        release_memory(assembly_batch);
+        return -1;
     }
 
+    *batch = assembly_batch;
+
     return 1;
 }
 
-int start_assembler_using_current_directory(int verbose_mode) {
-    const char* CURRENT_DIRECTORY = ".";
-    DIR* directory = opendir(CURRENT_DIRECTORY);
+int add_source_file_to_batch(t_assembly_batch* batch, const char* file_path, const char* output_file_path) {
+    t_source_file_job* job = create_batch_job(batch, file_path, output_file_path);
 
-    if (directory == NULL) {
-        printf("Internal Error: could not open the current directory at 'start_assembler_using_current_directory'.\n");
+    if (job == NULL) {
         return -1;
     }
 
-    const int FILE_EXTENSION_LENGTH = 4;
+    return start_batch_job(batch, job);
+}
+
+/* Adds a job to the batch, which waits for it from now on, but does not start it. */
+t_source_file_job* create_batch_job(t_assembly_batch* batch, const char* file_path, const char* output_file_path) {
+    t_source_file_job* job = allocate_memory(sizeof(t_source_file_job));
+
+    if (job == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'job' at 'create_batch_job'.\n");
+        return NULL;
+    }
+
+    job->file_path = allocate_memory(sizeof(char) * (strlen(file_path) + 1));
+
+    if (job->file_path == NULL) {
+        release_memory(job);
+        report_error("Internal Error: failed to allocate memory for 'file_path' at 'create_batch_job'.\n");
+        return NULL;
+    }
+
+    strcpy(job->file_path, file_path);
+    job->output_file_path = NULL;
+
+    if (output_file_path != NULL) {
+        job->output_file_path = allocate_memory(sizeof(char) * (strlen(output_file_path) + 1));
+
+        if (job->output_file_path == NULL) {
+            release_memory(job->file_path);
+            release_memory(job);
+            report_error("Internal Error: failed to allocate memory for 'output_file_path' at 'create_batch_job'.\n");
+            return NULL;
+        }
+
+        strcpy(job->output_file_path, output_file_path);
+    }
+
+    job->source.content = NULL;
+    job->source.length = 0L;
+    job->size = 0L;
+    job->order = batch->file_count;
+    job->result = 0;
+    job->diagnostics = NULL;
+    job->diagnostics_length = 0L;
+    job->is_done = 0;
+    initialize_assembly_statistics(&job->statistics);
+    job->batch = batch;
+    job->next = NULL;
+
+    batch->file_count++;
+
+    pthread_mutex_lock(&batch->lock);
+
+    if (batch->last_job == NULL) {
+        batch->first_job = job;
+    }
+    else {
+        batch->last_job->next = job;
+    }
+
+    batch->last_job = job;
+
+    pthread_mutex_unlock(&batch->lock);
+
+    return job;
+}
+
+/* Jobs are loaded, and then assembled, in groups of SOURCE_READ_BATCH_SIZE. */
+int start_batch_job(t_assembly_batch* batch, t_source_file_job* job) {
+    batch->unloaded_jobs[batch->unloaded_count++] = job;
+
+    if (batch->unloaded_count < SOURCE_READ_BATCH_SIZE) {
+        return 1;
+    }
+
+    return load_and_start_jobs(batch);
+}
 
-    struct dirent* directory_entry = readdir(directory);
-    while (directory_entry) {
-        /* If it's an 'asm' file type, handles it. */
-        if (directory_entry->d_type == DT_REG) {
-            size_t file_name_length = strlen(directory_entry->d_name);
+/* Biggest first, and in the order they were added when they have the same size. */
+int compare_jobs_by_size(const void* first, const void* second) {
+    const t_source_file_job* first_job = *(t_source_file_job* const*)first;
+    const t_source_file_job* second_job = *(t_source_file_job* const*)second;
 
-            if (file_name_length > FILE_EXTENSION_LENGTH) {
-                char* file_name = directory_entry->d_name;
+    if (first_job->size != second_job->size) {
+        return (first_job->size > second_job->size) ? -1 : 1;
+    }
 
-                if ((file_name[file_name_length - 4] == '.') &&
-                    ((file_name[file_name_length - 3] == 'a') || (file_name[file_name_length - 3] == 'A')) &&
-                    ((file_name[file_name_length - 2] == 's') || (file_name[file_name_length - 2] == 'S')) &&
-                    ((file_name[file_name_length - 1] == 'm') || (file_name[file_name_length - 1] == 'M'))) {
-                    int result = handle_source_file(verbose_mode, file_name);
+    return (first_job->order < second_job->order) ? -1 : (first_job->order > second_job->order);
+}
 
-                    if (result == -1) {
-                        printf("Error: failed to treat source file '%s' at 'start_assembler_using_current_directory'.\n",
-                               file_name);
-                    }
-                }
+/* Loads the content of the unloaded jobs with a single batch of reads, and then assembles them, either right away or
+ * by submitting them to the pool. */
+int load_and_start_jobs(t_assembly_batch* batch) {
+    const char* file_paths[SOURCE_READ_BATCH_SIZE];
+    t_source_buffer sources[SOURCE_READ_BATCH_SIZE];
+    size_t count = batch->unloaded_count;
+    int result = 1;
+
+    batch->unloaded_count = 0L;
+
+    if (count == 0) {
+        return 1;
+    }
+
+    /* Keeps the loaded content, waiting to be assembled, from growing with the number of files. */
+    wait_for_running_jobs(batch, MAXIMUM_RUNNING_JOB_COUNT);
+
+    for (size_t i = 0; i < count; i++) {
+        file_paths[i] = batch->unloaded_jobs[i]->file_path;
+    }
+
+    /* Pipelined files are streamed by their own reader instead. */
+    if (batch->options->is_pipelined) {
+        for (size_t i = 0; i < count; i++) {
+            sources[i].content = NULL;
+            sources[i].length = 0L;
+        }
+    }
+    else {
+        uint64_t started_at = get_monotonic_nanoseconds();
+        uint64_t traced_at = begin_trace_event();
+
+        SHACK_PROBE2(step__start, READ_STEP, "read");
+        begin_counted_step(READ_STEP);
+        begin_accounted_step(READ_STEP);
+        load_source_files(batch->reader, file_paths, sources, count);
+        end_accounted_step(READ_STEP);
+        end_counted_step(READ_STEP);
+        SHACK_PROBE2(step__done, READ_STEP, "read");
+
+        end_trace_event("load sources", traced_at);
+
+        /* Loaded all at once, so each file is charged with an even share of the time. */
+        uint64_t share = (get_monotonic_nanoseconds() - started_at) / count;
+
+        for (size_t i = 0; i < count; i++) {
+            batch->unloaded_jobs[i]->statistics.step_nanoseconds[READ_STEP] += share;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        batch->unloaded_jobs[i]->source = sources[i];
+
+        if (sources[i].content != NULL) {
+            batch->unloaded_jobs[i]->size = sources[i].length;
+        }
+    }
+
+    /* Files found while walking a directory, or read from a manifest, are at least sorted within each group. */
+    if (batch->pool != NULL) {
+        qsort(batch->unloaded_jobs, count, sizeof(t_source_file_job*), compare_jobs_by_size);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        t_source_file_job* job = batch->unloaded_jobs[i];
+
+        if (batch->pool == NULL) {
+            /* Diagnostics are printed as they happen, so they stay in order with the code written to stdout. */
+            if (batch->summary != NULL) {
+                begin_statistics_capture(&job->statistics);
             }
+
+            uint64_t traced_at = begin_trace_event();
+            int job_result = assemble_job(job, batch->context);
+
+            end_file_trace_event(job->file_path, traced_at);
+            end_statistics_capture();
+
+            if (job_result < 0) {
+                report_error("Error: failed to handle source file '%s'.\n", job->file_path);
+            }
+
+            pthread_mutex_lock(&batch->lock);
+            job->result = job_result;
+            job->is_done = 1;
+            pthread_mutex_unlock(&batch->lock);
         }
+        else {
+            pthread_mutex_lock(&batch->lock);
+            batch->running_count++;
+            pthread_mutex_unlock(&batch->lock);
 
-        directory_entry = readdir(directory);
+            if (submit_task_to_worker_pool(batch->pool, run_source_file_job, job) < 0) {
+                /* Still in the list, so it gets released while reporting. */
+                pthread_mutex_lock(&batch->lock);
+                dispose_source_buffer(&job->source);
+                job->result = -1;
+                job->is_done = 1;
+                batch->running_count--;
+                pthread_mutex_unlock(&batch->lock);
+                result = -1;
+            }
+        }
     }
 
-    return 1;
+    /* Keeps the list of pending jobs short while the rest are being added. */
+    report_finished_jobs(batch, 0);
+
+    return result;
+}
+
+void wait_for_running_jobs(t_assembly_batch* batch, size_t maximum_running_count) {
+    pthread_mutex_lock(&batch->lock);
+
+    while (batch->running_count > maximum_running_count) {
+        pthread_cond_wait(&batch->job_done, &batch->lock);
+    }
+
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/* Prints, in order, the diagnostics of the finished jobs at the front of the batch, and releases them. */
+void report_finished_jobs(t_assembly_batch* batch, int wait_for_all) {
+    pthread_mutex_lock(&batch->lock);
+
+    while (batch->first_job != NULL) {
+        t_source_file_job* job = batch->first_job;
+
+        if (!job->is_done) {
+            if (!wait_for_all) {
+                break;
+            }
+
+            pthread_cond_wait(&batch->job_done, &batch->lock);
+            continue;
+        }
+
+        batch->first_job = job->next;
+
+        if (batch->first_job == NULL) {
+            batch->last_job = NULL;
+        }
+
+        pthread_mutex_unlock(&batch->lock);
+
+        if (job->diagnostics != NULL) {
+            report_text(job->diagnostics, job->diagnostics_length);
+            release_memory(job->diagnostics);
+        }
+
+        if (job->result < 0) {
+            batch->failed_count++;
+        }
+
+        if (batch->summary != NULL) {
+            add_file_to_statistics_summary(batch->summary, job->file_path, job->result, &job->statistics);
+        }
+
+        release_memory(job->file_path);
+        release_memory(job->output_file_path);
+        release_memory(job);
+
+        pthread_mutex_lock(&batch->lock);
+    }
+
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/* Waits for every file of the batch, releases it, and returns how many files failed. */
+size_t finish_assembly_batch(t_assembly_batch* batch) {
+    load_and_start_jobs(batch);
+    report_finished_jobs(batch, 1);
+
+    if (batch->summary != NULL) {
+        if (batch->options->statistics_path != NULL) {
+            write_statistics_summary(batch->summary, batch->options->statistics_path);
+        }
+        else {
+            report_statistics_summary(batch->summary);
+        }
+        dispose_statistics_summary(batch->summary);
+    }
+
+    if (batch->pool != NULL) {
+        dispose_worker_pool(batch->pool);
+    }
+    else {
+        dispose_assembler_context(batch->context);
+    }
+
+    dispose_source_reader(batch->reader);
+
+    size_t failed_count = batch->failed_count;
+
+    pthread_mutex_destroy(&batch->lock);
+    pthread_cond_destroy(&batch->job_done);
+    pthread_mutex_destroy(&batch->adding_lock);
+    release_memory(batch);
+
+    return failed_count;
+}
+
+/* Assembles the file of the job, using its content if it was already loaded, and releases that content. */
+int assemble_job(t_source_file_job* job, t_assembler_context* context) {
+    t_assembler_options options = *job->batch->options;
+
+    if (job->output_file_path != NULL) {
+        options.output_file_path = job->output_file_path;
+    }
+
+    if (job->source.content == NULL) {
+        return assemble_source_file(&options, context, job->file_path);
+    }
+
+    int result = assemble_loaded_source_file(&options, context, job->file_path, &job->source);
+
+    dispose_source_buffer(&job->source);
+    return result;
+}
+
+void run_source_file_job(void* argument, void* worker_context) {
+    t_source_file_job* job = argument;
+    t_assembler_context* context = worker_context;
+    t_job_server* job_server = job->batch->options->job_server;
+
+    clear_diagnostics(&context->diagnostics);
+    begin_diagnostics_capture(&context->diagnostics);
+
+    if (job->batch->summary != NULL) {
+        begin_statistics_capture(&job->statistics);
+    }
+
+    /* Without a token the file is still assembled, only outside of the limits of make. */
+    int token = IMPLICIT_JOB_TOKEN;
+    int has_token = (job_server != NULL) && (acquire_job_token(job_server, &token) > 0);
+
+    uint64_t traced_at = begin_trace_event();
+    int result = assemble_job(job, context);
+
+    end_file_trace_event(job->file_path, traced_at);
+
+    if (has_token) {
+        release_job_token(job_server, token);
+    }
+
+    if (result < 0) {
+        report_error("Error: failed to handle source file '%s'.\n", job->file_path);
+    }
+
+    end_statistics_capture();
+    end_diagnostics_capture();
+
+    /* Only files which reported something need their own copy of the diagnostics. */
+    char* diagnostics = NULL;
+
+    if (context->diagnostics.length > 0) {
+        diagnostics = allocate_memory(sizeof(char) * context->diagnostics.length);
+
+        if (diagnostics != NULL) {
+            memcpy(diagnostics, context->diagnostics.buffer, context->diagnostics.length);
+        }
+    }
+
+    pthread_mutex_lock(&job->batch->lock);
+
+    job->result = result;
+    job->diagnostics = diagnostics;
+    job->diagnostics_length = (diagnostics != NULL) ? context->diagnostics.length : 0L;
+    job->is_done = 1;
+    job->batch->running_count--;
+
+    pthread_cond_broadcast(&job->batch->job_done);
+    pthread_mutex_unlock(&job->batch->lock);
 }
 
-int handle_source_file(int verbose_mode, const char* file_path) {
+void* create_assembler_context(size_t worker_index) {
+    (void)worker_index; // Every worker gets the same kind of context.
+
+    t_assembler_context* context = allocate_memory(sizeof(t_assembler_context));
+
+    if (context == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'context' at 'create_assembler_context'.\n");
+        return NULL;
+    }
+
+    if (create_symbol_table(&context->symbol_table) < 0) {
+        release_memory(context);
+        return NULL;
+    }
+
+    initialize_diagnostics(&context->diagnostics);
+
+    return context;
+}
+
+void dispose_assembler_context(void* worker_context) {
+    t_assembler_context* context = worker_context;
+
+    if (context == NULL) {
+        return;
+    }
+
+    dispose_symbol_table(context->symbol_table);
+    dispose_diagnostics(&context->diagnostics);
+    release_memory(context);
+}
+
+int assemble_source_file(const t_assembler_options* options, t_assembler_context* context, const char* file_path) {
     if (file_path == NULL) {
-        printf("Internal Error: 'file_path' is null at 'handle_source_file'.\n");
+        report_error("Internal Error: 'file_path' is null at 'assemble_source_file'.\n");
         return -1;
     }
 
-    t_array_list* commands_buffer;
+    if (options->is_pipelined) {
+        t_pipeline_statistics statistics;
 
-    int result = create_array_list(&commands_buffer);
+        SHACK_PROBE2(file__start, file_path, 0);
+        int result = assemble_source_file_pipelined(options, context, file_path, &statistics);
+        SHACK_PROBE4(file__done, file_path, result, 0, 0);
 
-    if (result < 0) {
-        printf("Internal Error: failed to create an array list at 'handle_source_file'.\n");
+        if (options->verbose_mode) {
+            report_pipeline_statistics(&statistics);
+        }
+
+        return result;
+    }
+
+    t_source_buffer source;
+
+    begin_assembly_step(READ_STEP);
+    int is_loaded = (load_source_file(file_path, &source) > 0);
+    end_assembly_step(READ_STEP);
+
+    if (!is_loaded) {
+        report_error("Internal Error: failed to read source file '%s' at 'assemble_source_file'.\n", file_path);
         return -1;
     }
 
-    result = read_source_file(verbose_mode, file_path, commands_buffer);
+    int result = assemble_loaded_source_file(options, context, file_path, &source);
 
-    if (result < 0) {
-        dispose_array_list(commands_buffer);
-        printf("Internal Error: failed to read source file '%s' at 'handle_source_file'.\n", file_path);
+    dispose_source_buffer(&source);
+    return result;
+}
+
+int assemble_loaded_source_file(const t_assembler_options* options, t_assembler_context* context,
+                                const char* file_path, const t_source_buffer* source) {
+    unsigned long long source_hash = HASH_SEED;
+
+    SHACK_PROBE2(file__start, file_path, source->length);
+
+    if (options->cache != NULL) {
+        source_hash = get_hash_of_bytes(source->content, source->length, HASH_SEED);
+
+        int result = restore_cached_artifacts(options, file_path, source_hash, source->length);
+
+        if (result != 0) {
+            SHACK_PROBE4(file__done, file_path, result, source->length, 0);
+            return result;
+        }
+    }
+
+    record_source_statistics(source->content, source->length);
+
+    t_translated_program program;
+
+    if (translate_source(options, context, source->content, source->length, options->artifacts, &program) < 0) {
+        SHACK_PROBE4(file__done, file_path, -1, source->length, 0);
         return -1;
     }
 
-    result = sync_symbol_addresses(commands_buffer);
+    begin_assembly_step(EXPORT_STEP);
+    int result = export_artifacts(options, file_path, program.commands_buffer, program.user_symbols,
+                                  program.instructions_buffer, source_hash, source->length);
+    end_assembly_step(EXPORT_STEP);
+
+    /* Labels are commands too, but not instructions. */
+    SHACK_PROBE4(file__done, file_path, (result < 0) ? -1 : 1, source->length,
+                 get_instruction_count(program.instructions_buffer));
+
+    dispose_translated_program(&program);
 
     if (result < 0) {
-        dispose_array_list(commands_buffer);
+        report_error("Internal Error: failed to export code to an output file at 'assemble_source_file'.\n");
         return -1;
     }
 
-    unsigned int* instructions_buffer = translate_instructions_into_binary(commands_buffer);
+    return 1;
+}
 
-    if (instructions_buffer == NULL) {
-        dispose_array_list(commands_buffer);
+int assemble_source_to_sink(const t_assembler_options* options, t_assembler_context* context, const char* content,
+                            size_t length, t_output_sink* sink) {
+    if ((content == NULL) || (sink == NULL)) {
+        report_error("Internal Error: 'content' or 'sink' is NULL at 'assemble_source_to_sink'.\n");
         return -1;
     }
 
-    result = export_instructions_to_file(instructions_buffer, file_path);
+    t_translated_program program;
 
-    if (result < 0) {
-        dispose_array_list(commands_buffer);
-        printf("Internal Error: failed to export code to an output file at 'handle_source_file'.\n");
+    if (translate_source(options, context, content, length, HACK_ARTIFACT, &program) < 0) {
+        return -1;
+    }
+
+    int result = export_instructions_to_sink(program.instructions_buffer, sink);
+
+    dispose_translated_program(&program);
+
+    return result;
+}
+
+int assemble_source_to_words(const t_assembler_options* options, t_assembler_context* context, const char* content,
+                             size_t length, uint16_t** words, size_t* word_count) {
+    if ((content == NULL) || (words == NULL) || (word_count == NULL)) {
+        report_error("Internal Error: 'content', 'words' or 'word_count' is NULL at 'assemble_source_to_words'.\n");
+        return -1;
+    }
+
+    t_translated_program program;
+
+    if (translate_source(options, context, content, length, HACK_ARTIFACT, &program) < 0) {
+        return -1;
+    }
+
+    size_t instruction_count = get_instruction_count(program.instructions_buffer);
+
+    /* Never NULL, even for a program without instructions. */
+    uint16_t* rom = allocate_memory(sizeof(uint16_t) * ((instruction_count > 0) ? instruction_count : 1));
+
+    if (rom == NULL) {
+        dispose_translated_program(&program);
+        report_error("Internal Error: failed to allocate memory for 'rom' at 'assemble_source_to_words'.\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < instruction_count; i++) {
+        rom[i] = (uint16_t)program.instructions_buffer[i];
+    }
+
+    dispose_translated_program(&program);
+
+    *words = rom;
+    *word_count = instruction_count;
+
+    return 1;
+}
+
+/* Parses, syncs and translates 'content' using the symbol table of 'context'. */
+int translate_source(const t_assembler_options* options, t_assembler_context* context, const char* content,
+                     size_t length, int artifacts, t_translated_program* program) {
+    program->commands_buffer = NULL;
+    program->user_symbols = NULL;
+    program->instructions_buffer = NULL;
+
+    if (create_array_list(&program->commands_buffer) < 0) {
+        report_error("Internal Error: failed to create an array list at 'translate_source'.\n");
         return -1;
     }
 
-    free(instructions_buffer);
+    if ((artifacts & SYMBOLS_ARTIFACT) && (create_hash_map(&program->user_symbols) < 0)) {
+        dispose_translated_program(program);
+        report_error("Internal Error: failed to create a hash map at 'translate_source'.\n");
+        return -1;
+    }
 
-    result = dispose_commands_from_buffer(commands_buffer);
+    /* Verbose mode reports every instruction as it is parsed, which only makes sense in order. */
+    int result = options->verbose_mode ? 0 :
+                 translate_source_in_partitions(content, length, context->symbol_table, program->commands_buffer,
+                                                program->user_symbols, &program->instructions_buffer);
 
     if (result < 0) {
-        dispose_array_list(commands_buffer);
-        printf("Internal Error: failed to dispose content of commands buffer at 'handle_source_file'.\n");
+        dispose_translated_program(program);
         return -1;
     }
 
-    dispose_array_list(commands_buffer);
+    if (result == 0) {
+        begin_assembly_step(PARSE_STEP);
+        result = parse_source_buffer(options->verbose_mode, content, length, program->commands_buffer);
+        end_assembly_step(PARSE_STEP);
+
+        if (result < 0) {
+            dispose_translated_program(program);
+            report_error("Internal Error: failed to parse the source code at 'translate_source'.\n");
+            return -1;
+        }
+
+        begin_assembly_step(SYNC_STEP);
+        result = sync_symbol_addresses_using_table(program->commands_buffer, context->symbol_table,
+                                                   program->user_symbols);
+        end_assembly_step(SYNC_STEP);
+
+        if (result < 0) {
+            dispose_translated_program(program);
+            return -1;
+        }
+
+        begin_assembly_step(TRANSLATE_STEP);
+        program->instructions_buffer = translate_instructions_into_binary(program->commands_buffer);
+        end_assembly_step(TRANSLATE_STEP);
+
+        if (program->instructions_buffer == NULL) {
+            dispose_translated_program(program);
+            return -1;
+        }
+    }
+
+    record_command_statistics(program->commands_buffer);
 
     return 1;
-}
\ No newline at end of file
+}
+
+void dispose_translated_program(t_translated_program* program) {
+    release_memory(program->instructions_buffer);
+    dispose_hash_map(program->user_symbols);
+
+    if (program->commands_buffer != NULL) {
+        if (dispose_commands_from_buffer(program->commands_buffer) < 0) {
+            report_error("Internal Error: failed to dispose content of commands buffer at "
+                         "'dispose_translated_program'.\n");
+        }
+
+        dispose_array_list(program->commands_buffer);
+    }
+
+    program->commands_buffer = NULL;
+    program->user_symbols = NULL;
+    program->instructions_buffer = NULL;
+}
+
+/* Returns 1 if every requested artifact was restored from the cache, or 0 if any of them is not cached. */
+int restore_cached_artifacts(const t_assembler_options* options, const char* file_path, unsigned long long source_hash,
+                             size_t source_length) {
+    const int ARTIFACTS[] = { HACK_ARTIFACT, BINARY_ARTIFACT, SYMBOLS_ARTIFACT, LISTING_ARTIFACT };
+    const size_t ARTIFACTS_COUNT = sizeof(ARTIFACTS) / sizeof(ARTIFACTS[0]);
+
+    int cached_files[sizeof(ARTIFACTS) / sizeof(ARTIFACTS[0])];
+    size_t cached_file_sizes[sizeof(ARTIFACTS) / sizeof(ARTIFACTS[0])];
+    int result = 1;
+
+    for (size_t i = 0; i < ARTIFACTS_COUNT; i++) {
+        cached_files[i] = -1;
+
+        if ((result > 0) && (options->artifacts & ARTIFACTS[i])) {
+            const char* extension = get_artifact_extension(ARTIFACTS[i]);
+
+            result = open_cached_artifact(options->cache, get_build_cache_key(source_hash, source_length, extension),
+                                          extension, &cached_files[i], &cached_file_sizes[i]);
+        }
+    }
+
+    for (size_t i = 0; (result > 0) && (i < ARTIFACTS_COUNT); i++) {
+        if (cached_files[i] < 0) {
+            continue;
+        }
+
+        t_output_sink* sink;
+
+        result = create_output_sink_for_source_file(options, file_path, ARTIFACTS[i], &sink);
+
+        if (result > 0) {
+            result = write_file_to_output_sink(sink, cached_files[i], cached_file_sizes[i]);
+
+            if (result > 0) {
+                result = commit_output_sink(sink);
+            }
+
+            dispose_output_sink(sink);
+        }
+    }
+
+    for (size_t i = 0; i < ARTIFACTS_COUNT; i++) {
+        if (cached_files[i] >= 0) {
+            close(cached_files[i]);
+        }
+    }
+
+    if (result > 0) {
+        atomic_fetch_add(&options->cache->hit_count, 1);
+        SHACK_PROBE2(cache__hit, file_path, source_hash);
+    }
+    else if (result == 0) {
+        atomic_fetch_add(&options->cache->miss_count, 1);
+        SHACK_PROBE2(cache__miss, file_path, source_hash);
+    }
+
+    return result;
+}
+
+/* Every artifact is written from the same in memory program, so each one only adds its own formatting. */
+int export_artifacts(const t_assembler_options* options, const char* file_path, const t_array_list* commands_buffer,
+                     const t_array_list* user_symbols, const unsigned int* instructions_buffer,
+                     unsigned long long source_hash, size_t source_length) {
+    const int ARTIFACTS[] = { HACK_ARTIFACT, BINARY_ARTIFACT, SYMBOLS_ARTIFACT, LISTING_ARTIFACT };
+    const size_t ARTIFACTS_COUNT = sizeof(ARTIFACTS) / sizeof(ARTIFACTS[0]);
+
+    for (size_t i = 0; i < ARTIFACTS_COUNT; i++) {
+        int artifact = ARTIFACTS[i];
+
+        if (!(options->artifacts & artifact)) {
+            continue;
+        }
+
+        t_output_sink* sink;
+
+        if (create_output_sink_for_source_file(options, file_path, artifact, &sink) < 0) {
+            return -1;
+        }
+
+        int result;
+
+        if (artifact == HACK_ARTIFACT) {
+            result = export_instructions_to_sink(instructions_buffer, sink);
+        }
+        else if (artifact == BINARY_ARTIFACT) {
+            result = export_binary_to_sink(instructions_buffer, sink);
+        }
+        else if (artifact == SYMBOLS_ARTIFACT) {
+            result = export_symbols_to_sink(user_symbols, sink);
+        }
+        else {
+            result = export_listing_to_sink(commands_buffer, instructions_buffer, sink);
+        }
+
+        if (result > 0) {
+            result = commit_output_sink(sink);
+        }
+
+        if (result > 0) {
+            record_written_bytes(sink->length);
+        }
+
+        /* Failing to cache an artifact does not make the source file fail. */
+        if ((result > 0) && (options->cache != NULL) && (sink->type == FILE_SINK)) {
+            const char* extension = get_artifact_extension(artifact);
+
+            store_artifact_in_build_cache(options->cache, get_build_cache_key(source_hash, source_length, extension),
+                                          extension, sink->file_path);
+        }
+
+        dispose_output_sink(sink);
+
+        if (result < 0) {
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+const char* get_artifact_extension(int artifact) {
+    return (artifact == HACK_ARTIFACT) ? HACK_EXTENSION :
+           (artifact == BINARY_ARTIFACT) ? BINARY_EXTENSION :
+           (artifact == SYMBOLS_ARTIFACT) ? SYMBOLS_EXTENSION : LISTING_EXTENSION;
+}
+
+int create_output_sink_for_source_file(const t_assembler_options* options, const char* file_path, int artifact,
+                                       t_output_sink** sink) {
+    int is_standard_input = (strcmp(file_path, STANDARD_INPUT_PATH) == 0);
+
+    if (artifact == HACK_ARTIFACT) {
+        if (options->output_to_standard_output || (is_standard_input && (options->output_file_path == NULL))) {
+            /* Anything already printed must reach stdout before the assembled code does. */
+            flush_diagnostics();
+            return create_descriptor_sink(sink, STDOUT_FILENO);
+        }
+
+        if (options->output_file_path != NULL) {
+            return create_file_sink(sink, options->output_file_path);
+        }
+    }
+
+    const char* base_file_path = (options->output_file_path != NULL) ? options->output_file_path : file_path;
+
+    if (strcmp(base_file_path, STANDARD_INPUT_PATH) == 0) {
+        report_error("Error: an output file path is required in order to export more artifacts from the standard "
+                     "input.\n");
+        return -1;
+    }
+
+    char* output_file_path = get_output_file_path(base_file_path, get_artifact_extension(artifact));
+
+    if (output_file_path == NULL) {
+        return -1;
+    }
+
+    int result = create_file_sink(sink, output_file_path);
+
+    release_memory(output_file_path);
+    return result;
+}
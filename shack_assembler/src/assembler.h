@@ -5,7 +5,85 @@
 #ifndef SHACK_ASSEMBLER_ASSEMBLER_H
 #define SHACK_ASSEMBLER_ASSEMBLER_H
 
-int start_assembler(int verbose_mode, int file_count, char** file_names);
-int start_assembler_using_current_directory(int verbose_mode);
+#include <stddef.h>
+#include <stdint.h>
+
+#include "assembly_statistics.h"
+#include "build_cache.h"
+#include "diagnostics.h"
+#include "general_types.h"
+#include "job_server.h"
+#include "output_sink.h"
+#include "source_parser.h"
+
+/* ARTIFACTS */
+
+#define HACK_ARTIFACT 0b1
+#define BINARY_ARTIFACT 0b10
+#define SYMBOLS_ARTIFACT 0b100
+#define LISTING_ARTIFACT 0b1000
+
+struct assembler_options {
+    int verbose_mode;
+    int artifacts;
+    int job_count; // Source files assembled at the same time, 0 meaning one per available processor.
+
+    /* Where the assembled code goes: next to the source file by default, or to stdout / a given path. The rest of
+     * the artifacts are placed next to the source file, or next to the given path. */
+    int output_to_standard_output;
+    const char* output_file_path;
+
+    t_build_cache* cache; // NULL if no cache should be used.
+
+    /* When run by make, every file assembled by a worker waits for a token of its job server. */
+    t_job_server* job_server; // NULL if not run by make, in which case 'job_count' is the only limit.
+
+    /* Each file is streamed through a reader, parser, encoder and writer thread. Only the hack artifact is written. */
+    int is_pipelined;
+
+    /* Every file of a batch is timed step by step, and reported once the batch is done. */
+    t_statistics_format statistics_format;
+    const char* statistics_path; // NULL to report them along with the rest of the messages.
+};
+
+typedef struct assembler_options t_assembler_options;
+
+/* Per worker state, reused across all the source files the worker assembles. */
+struct assembler_context {
+    t_diagnostics diagnostics;
+    t_array_list* symbol_table; // Only holds the predefined symbols between source files.
+};
+
+typedef struct assembler_context t_assembler_context;
+
+/* All of them return 1 if every source file was assembled, 0 if any of them failed, and -1 on internal errors. */
+int start_assembler(const t_assembler_options* options, int file_count, char** file_names);
+int start_assembler_using_directory(const t_assembler_options* options, const char* root_path);
+int start_assembler_using_manifest(const t_assembler_options* options, const char* manifest_path);
+
+/* The file extension of each artifact, such as 'hack'. */
+const char* get_artifact_extension(int artifact);
+
+/* Contexts are created and disposed through 'void*' so that they can be handed to a worker pool. */
+void* create_assembler_context(size_t worker_index);
+void dispose_assembler_context(void* worker_context);
+
+/* Writes every requested artifact of a single source file, the same way 'start_assembler' would. */
+int assemble_source_file(const t_assembler_options* options, t_assembler_context* context, const char* file_path);
+int assemble_loaded_source_file(const t_assembler_options* options, t_assembler_context* context,
+                                const char* file_path, const t_source_buffer* source);
+
+/* The sink an artifact of 'file_path' is written to, following the output options. */
+int create_output_sink_for_source_file(const t_assembler_options* options, const char* file_path, int artifact,
+                                       t_output_sink** sink);
+
+/* Writes the assembled code of 'content' into 'sink' without committing it. */
+int assemble_source_to_sink(const t_assembler_options* options, t_assembler_context* context, const char* content,
+                            size_t length, t_output_sink* sink);
+
+/* Translates 'content' into ROM words, without touching any file. The words must be released with
+ * 'release_memory'. */
+int assemble_source_to_words(const t_assembler_options* options, t_assembler_context* context, const char* content,
+                             size_t length, uint16_t** words, size_t* word_count);
 
 #endif //SHACK_ASSEMBLER_ASSEMBLER_H
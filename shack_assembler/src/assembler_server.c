@@ -0,0 +1,749 @@
+//
+// assembler_server.c: serves assembling requests over a Unix domain socket, so that a build system which assembles
+// thousands of small files pays neither the process start up nor the predefined symbol table for each one of them.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "assembler_server.h"
+#include "code_exporter.h"
+#include "diagnostics.h"
+#include "source_parser.h"
+#include "worker_pool.h"
+#include "memory_accounting.h"
+
+#define SERVER_SELF_EXECUTABLE_PATH "/proc/self/exe"
+
+struct server_connection {
+    int descriptor;
+    struct assembler_server* server;
+
+    struct server_connection* previous;
+    struct server_connection* next;
+};
+
+typedef struct server_connection t_server_connection;
+
+struct assembler_server {
+    const t_assembler_options* options;
+
+    /* Open connections, so that they can be shut down when the server stops. */
+    pthread_mutex_t lock;
+    t_server_connection* first_connection;
+};
+
+typedef struct assembler_server t_assembler_server;
+
+static volatile sig_atomic_t is_server_stopping = 0;
+
+int create_server_socket(const char* socket_path, struct sockaddr_un* address);
+int bind_server_socket(int server_socket, const char* socket_path, const struct sockaddr_un* address);
+void stop_assembler_server(int signal_number);
+void serve_connection(void* argument, void* worker_context);
+int handle_server_request(const t_assembler_options* options, t_assembler_context* context,
+                          const t_server_request_header* request, const char* payload, t_output_sink* output);
+int add_artifact_paths_to_output(const char* file_path, int artifacts, t_output_sink* output);
+void remove_server_connection(t_server_connection* connection);
+int receive_all(int descriptor, void* bytes, size_t length);
+int send_all(int descriptor, const void* bytes, size_t length);
+int print_server_response(const t_assembler_options* options, const char* file_path, t_server_response* response,
+                          int writes_code);
+double get_elapsed_seconds(const struct timespec* start);
+
+int run_assembler_server(const t_assembler_options* options, const char* socket_path) {
+    if ((options == NULL) || (socket_path == NULL)) {
+        report_error("Internal Error: 'options' or 'socket_path' is NULL at 'run_assembler_server'.\n");
+        return -1;
+    }
+
+    struct sockaddr_un address;
+    int server_socket = create_server_socket(socket_path, &address);
+
+    if (server_socket < 0) {
+        return -1;
+    }
+
+    if ((bind_server_socket(server_socket, socket_path, &address) < 0) || (listen(server_socket, SOMAXCONN) < 0)) {
+        report_error("Error: could not listen on '%s': %s.\n", socket_path, strerror(errno));
+        close(server_socket);
+        return -1;
+    }
+
+    t_assembler_server server = {
+        .options = options,
+        .first_connection = NULL,
+    };
+
+    pthread_mutex_init(&server.lock, NULL);
+
+    /* Only the accepting thread gets the stop signals, so that they interrupt 'accept'. */
+    sigset_t stop_signals;
+    sigset_t previous_signals;
+
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &previous_signals);
+
+    size_t worker_count = (options->job_count > 0) ? (size_t)options->job_count : get_available_processor_count();
+    t_worker_pool* pool;
+
+    int result = create_worker_pool(&pool, worker_count, create_assembler_context, dispose_assembler_context);
+
+    pthread_sigmask(SIG_SETMASK, &previous_signals, NULL);
+
+    if (result < 0) {
+        pthread_mutex_destroy(&server.lock);
+        close(server_socket);
+        unlink(socket_path);
+        return -1;
+    }
+
+    struct sigaction stop_action;
+    struct sigaction previous_interrupt_action;
+    struct sigaction previous_terminate_action;
+
+    memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = stop_assembler_server;
+    sigemptyset(&stop_action.sa_mask);
+
+    is_server_stopping = 0;
+    sigaction(SIGINT, &stop_action, &previous_interrupt_action);
+    sigaction(SIGTERM, &stop_action, &previous_terminate_action);
+
+    if (options->verbose_mode) {
+        report("Listening on '%s' with %lu workers.\n", socket_path, worker_count);
+        flush_diagnostics();
+    }
+
+    result = 1;
+
+    while (!is_server_stopping) {
+        int descriptor = accept(server_socket, NULL, NULL);
+
+        if (descriptor < 0) {
+            if ((errno == EINTR) || (errno == ECONNABORTED)) {
+                continue;
+            }
+
+            report_error("Error: failed to accept a connection on '%s': %s.\n", socket_path, strerror(errno));
+            result = -1;
+            break;
+        }
+
+        t_server_connection* connection = allocate_memory(sizeof(t_server_connection));
+
+        if (connection == NULL) {
+            report_error("Internal Error: failed to allocate memory for 'connection' at 'run_assembler_server'.\n");
+            close(descriptor);
+            continue;
+        }
+
+        connection->descriptor = descriptor;
+        connection->server = &server;
+        connection->previous = NULL;
+
+        pthread_mutex_lock(&server.lock);
+
+        connection->next = server.first_connection;
+
+        if (server.first_connection != NULL) {
+            server.first_connection->previous = connection;
+        }
+
+        server.first_connection = connection;
+
+        pthread_mutex_unlock(&server.lock);
+
+        if (submit_task_to_worker_pool(pool, serve_connection, connection) < 0) {
+            remove_server_connection(connection);
+        }
+    }
+
+    sigaction(SIGINT, &previous_interrupt_action, NULL);
+    sigaction(SIGTERM, &previous_terminate_action, NULL);
+
+    close(server_socket);
+    unlink(socket_path);
+
+    /* Idle clients would keep their workers waiting forever. */
+    pthread_mutex_lock(&server.lock);
+
+    for (t_server_connection* connection = server.first_connection; connection != NULL; connection = connection->next) {
+        shutdown(connection->descriptor, SHUT_RDWR);
+    }
+
+    pthread_mutex_unlock(&server.lock);
+
+    dispose_worker_pool(pool);
+    pthread_mutex_destroy(&server.lock);
+
+    return result;
+}
+
+void stop_assembler_server(int signal_number) {
+    (void)signal_number; // Only installed for SIGINT and SIGTERM, which both stop the server.
+
+    is_server_stopping = 1;
+}
+
+int create_server_socket(const char* socket_path, struct sockaddr_un* address) {
+    if (strlen(socket_path) >= sizeof(address->sun_path)) {
+        report_error("Error: the socket path '%s' is too long.\n", socket_path);
+        return -1;
+    }
+
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, socket_path);
+
+    int descriptor = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (descriptor < 0) {
+        report_error("Internal Error: failed to create a socket at 'create_server_socket': %s.\n", strerror(errno));
+        return -1;
+    }
+
+    return descriptor;
+}
+
+/* A socket left behind by a server which did not stop cleanly is replaced, while a live one is never taken over. */
+int bind_server_socket(int server_socket, const char* socket_path, const struct sockaddr_un* address) {
+    if (bind(server_socket, (const struct sockaddr*)address, sizeof(struct sockaddr_un)) == 0) {
+        return 1;
+    }
+
+    if (errno != EADDRINUSE) {
+        return -1;
+    }
+
+    /* Whatever is at the path and is not a socket, such as a source file given by mistake, is never removed. */
+    struct stat socket_status;
+
+    if ((lstat(socket_path, &socket_status) < 0) || !S_ISSOCK(socket_status.st_mode)) {
+        errno = EADDRINUSE;
+        return -1;
+    }
+
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (probe < 0) {
+        return -1;
+    }
+
+    int is_alive = (connect(probe, (const struct sockaddr*)address, sizeof(struct sockaddr_un)) == 0) ||
+                   (errno != ECONNREFUSED);
+
+    close(probe);
+
+    if (is_alive) {
+        errno = EADDRINUSE;
+        return -1;
+    }
+
+    if (unlink(socket_path) < 0) {
+        return -1;
+    }
+
+    return (bind(server_socket, (const struct sockaddr*)address, sizeof(struct sockaddr_un)) == 0) ? 1 : -1;
+}
+
+/* Answers every request of a connection, in order, until the client closes it. */
+void serve_connection(void* argument, void* worker_context) {
+    t_server_connection* connection = argument;
+    t_assembler_context* context = worker_context;
+    const t_assembler_options* options = connection->server->options;
+
+    t_output_sink* output = NULL;
+
+    if (create_memory_sink(&output) < 0) {
+        remove_server_connection(connection);
+        return;
+    }
+
+    while (1) {
+        t_server_request_header request;
+
+        if (receive_all(connection->descriptor, &request, sizeof(request)) <= 0) {
+            break;
+        }
+
+        if (request.length > MAXIMUM_REQUEST_LENGTH) {
+            break;
+        }
+
+        char* payload = allocate_memory(sizeof(char) * (request.length + 1));
+
+        if (payload == NULL) {
+            break;
+        }
+
+        if (receive_all(connection->descriptor, payload, request.length) <= 0) {
+            release_memory(payload);
+            break;
+        }
+
+        payload[request.length] = '\0';
+        output->length = 0L;
+
+        clear_diagnostics(&context->diagnostics);
+        begin_diagnostics_capture(&context->diagnostics);
+
+        int result = handle_server_request(options, context, &request, payload, output);
+
+        end_diagnostics_capture();
+        release_memory(payload);
+
+        t_server_response_header response = {
+            .result = result,
+            .reserved = 0,
+            .diagnostics_length = context->diagnostics.length,
+            .output_length = output->length,
+        };
+
+        if ((send_all(connection->descriptor, &response, sizeof(response)) < 0) ||
+            (send_all(connection->descriptor, context->diagnostics.buffer, context->diagnostics.length) < 0) ||
+            (send_all(connection->descriptor, output->buffer, output->length) < 0)) {
+            break;
+        }
+    }
+
+    dispose_output_sink(output);
+    remove_server_connection(connection);
+}
+
+int handle_server_request(const t_assembler_options* options, t_assembler_context* context,
+                          const t_server_request_header* request, const char* payload, t_output_sink* output) {
+    t_assembler_options request_options = {
+        .verbose_mode = (int)request->verbose_mode,
+        .artifacts = (int)request->artifacts,
+        .job_count = 1,
+        .output_to_standard_output = 0,
+        .output_file_path = NULL,
+        .cache = options->cache,
+    };
+
+    if (request->type == ASSEMBLE_SOURCE_REQUEST) {
+        return assemble_source_to_sink(&request_options, context, payload, request->length, output);
+    }
+
+    if (request->type != ASSEMBLE_FILE_REQUEST) {
+        report_error("Error: unknown request type %u.\n", request->type);
+        return -1;
+    }
+
+    if ((request->length == 0) || (payload[0] != '/') || (strlen(payload) != request->length)) {
+        report_error("Error: '%s' is not an absolute source file path.\n", payload);
+        return -1;
+    }
+
+    if (assemble_source_file(&request_options, context, payload) < 0) {
+        report_error("Error: failed to handle source file '%s'.\n", payload);
+        return -1;
+    }
+
+    return add_artifact_paths_to_output(payload, request_options.artifacts, output);
+}
+
+/* The paths of the written artifacts, one per line. */
+int add_artifact_paths_to_output(const char* file_path, int artifacts, t_output_sink* output) {
+    const int ARTIFACTS[] = { HACK_ARTIFACT, BINARY_ARTIFACT, SYMBOLS_ARTIFACT, LISTING_ARTIFACT };
+    const size_t ARTIFACTS_COUNT = sizeof(ARTIFACTS) / sizeof(ARTIFACTS[0]);
+
+    for (size_t i = 0; i < ARTIFACTS_COUNT; i++) {
+        if (!(artifacts & ARTIFACTS[i])) {
+            continue;
+        }
+
+        char* output_file_path = get_output_file_path(file_path, get_artifact_extension(ARTIFACTS[i]));
+
+        if (output_file_path == NULL) {
+            return -1;
+        }
+
+        int result = write_to_output_sink(output, output_file_path, strlen(output_file_path));
+
+        release_memory(output_file_path);
+
+        if ((result < 0) || (write_to_output_sink(output, "\n", 1) < 0)) {
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+void remove_server_connection(t_server_connection* connection) {
+    t_assembler_server* server = connection->server;
+
+    pthread_mutex_lock(&server->lock);
+
+    if (connection->previous != NULL) {
+        connection->previous->next = connection->next;
+    }
+    else {
+        server->first_connection = connection->next;
+    }
+
+    if (connection->next != NULL) {
+        connection->next->previous = connection->previous;
+    }
+
+    close(connection->descriptor);
+
+    pthread_mutex_unlock(&server->lock);
+
+    release_memory(connection);
+}
+
+/* Returns 0 if the other side closed the connection before sending anything. */
+int receive_all(int descriptor, void* bytes, size_t length) {
+    size_t received = 0L;
+
+    while (received < length) {
+        ssize_t count = recv(descriptor, (char*)bytes + received, length - received, 0);
+
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        if (count == 0) {
+            return (received == 0) ? 0 : -1;
+        }
+
+        received += (size_t)count;
+    }
+
+    return 1;
+}
+
+int send_all(int descriptor, const void* bytes, size_t length) {
+    size_t sent = 0L;
+
+    while (sent < length) {
+        ssize_t count = send(descriptor, (const char*)bytes + sent, length - sent, MSG_NOSIGNAL);
+
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        sent += (size_t)count;
+    }
+
+    return 1;
+}
+
+int connect_to_assembler_server(const char* socket_path, int* connection) {
+    struct sockaddr_un address;
+    int descriptor = create_server_socket(socket_path, &address);
+
+    if (descriptor < 0) {
+        return -1;
+    }
+
+    if (connect(descriptor, (const struct sockaddr*)&address, sizeof(address)) < 0) {
+        report_error("Error: could not connect to the server at '%s': %s.\n", socket_path, strerror(errno));
+        close(descriptor);
+        return -1;
+    }
+
+    *connection = descriptor;
+
+    return 1;
+}
+
+int send_server_request(int connection, int type, int artifacts, int verbose_mode, const char* payload, size_t length,
+                        t_server_response* response) {
+    t_server_request_header request = {
+        .type = (uint32_t)type,
+        .artifacts = (uint32_t)artifacts,
+        .verbose_mode = (uint32_t)verbose_mode,
+        .reserved = 0,
+        .length = length,
+    };
+
+    if (length > MAXIMUM_REQUEST_LENGTH) {
+        report_error("Error: the request is bigger than the %d bytes a server accepts.\n", MAXIMUM_REQUEST_LENGTH);
+        return -1;
+    }
+
+    response->diagnostics = NULL;
+    response->output = NULL;
+
+    if ((send_all(connection, &request, sizeof(request)) < 0) || (send_all(connection, payload, length) < 0)) {
+        report_error("Error: failed to send a request to the server: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    t_server_response_header header;
+
+    if (receive_all(connection, &header, sizeof(header)) <= 0) {
+        report_error("Error: the server closed the connection without answering.\n");
+        return -1;
+    }
+
+    response->result = header.result;
+    response->diagnostics_length = header.diagnostics_length;
+    response->output_length = header.output_length;
+    response->diagnostics = allocate_memory(sizeof(char) * (header.diagnostics_length + 1));
+    response->output = allocate_memory(sizeof(char) * (header.output_length + 1));
+
+    if ((response->diagnostics == NULL) || (response->output == NULL)) {
+        dispose_server_response(response);
+        report_error("Internal Error: failed to allocate memory for the response at 'send_server_request'.\n");
+        return -1;
+    }
+
+    if ((receive_all(connection, response->diagnostics, header.diagnostics_length) < 0) ||
+        (receive_all(connection, response->output, header.output_length) < 0)) {
+        dispose_server_response(response);
+        report_error("Error: the server closed the connection in the middle of an answer.\n");
+        return -1;
+    }
+
+    response->diagnostics[header.diagnostics_length] = '\0';
+    response->output[header.output_length] = '\0';
+
+    return 1;
+}
+
+void dispose_server_response(t_server_response* response) {
+    release_memory(response->diagnostics);
+    release_memory(response->output);
+    response->diagnostics = NULL;
+    response->output = NULL;
+}
+
+int start_assembler_client(const t_assembler_options* options, const char* socket_path, int file_count,
+                           char** file_names) {
+    if ((options == NULL) || (socket_path == NULL) || (file_names == NULL) || (file_count <= 0)) {
+        report_error("Internal Error: invalid arguments at 'start_assembler_client'.\n");
+        return -1;
+    }
+
+    int connection;
+
+    if (connect_to_assembler_server(socket_path, &connection) < 0) {
+        return -1;
+    }
+
+    size_t failed_count = 0L;
+
+    for (int i = 0; i < file_count; i++) {
+        const char* file_path = file_names[i];
+        int is_standard_input = (strcmp(file_path, STANDARD_INPUT_PATH) == 0);
+        int writes_code = options->output_to_standard_output || (options->output_file_path != NULL) ||
+                          is_standard_input;
+
+        /* The server only knows where to write files next to the sources, so the code is sent back instead. */
+        if (writes_code && (options->artifacts != HACK_ARTIFACT)) {
+            report_error("Error: only the assembled code can be written to stdout or to an output path through a "
+                         "server.\n");
+            close(connection);
+            return -1;
+        }
+
+        t_server_response response;
+        int result;
+
+        if (writes_code) {
+            t_source_buffer source;
+
+            if (load_source_file(file_path, &source) < 0) {
+                report_error("Error: failed to handle source file '%s'.\n", file_path);
+                failed_count++;
+                continue;
+            }
+
+            result = send_server_request(connection, ASSEMBLE_SOURCE_REQUEST, HACK_ARTIFACT, options->verbose_mode,
+                                         source.content, source.length, &response);
+
+            dispose_source_buffer(&source);
+        }
+        else {
+            char absolute_path[PATH_MAX];
+
+            if (realpath(file_path, absolute_path) == NULL) {
+                report_error("Internal Error: failed to read source file '%s' at "
+                             "'start_assembler_client'.\n", file_path);
+                report_error("Error: failed to handle source file '%s'.\n", file_path);
+                failed_count++;
+                continue;
+            }
+
+            result = send_server_request(connection, ASSEMBLE_FILE_REQUEST, options->artifacts, options->verbose_mode,
+                                         absolute_path, strlen(absolute_path), &response);
+        }
+
+        if (result < 0) {
+            close(connection);
+            return -1;
+        }
+
+        if (print_server_response(options, file_path, &response, writes_code) < 0) {
+            failed_count++;
+        }
+
+        dispose_server_response(&response);
+    }
+
+    close(connection);
+
+    return (failed_count > 0) ? 0 : 1;
+}
+
+/* Prints the diagnostics, and writes the assembled code when it was sent back. Returns -1 if the file failed. */
+int print_server_response(const t_assembler_options* options, const char* file_path, t_server_response* response,
+                          int writes_code) {
+    report_text(response->diagnostics, response->diagnostics_length);
+
+    if (response->result < 0) {
+        if (writes_code) {
+            report_error("Error: failed to handle source file '%s'.\n", file_path);
+        }
+
+        return -1;
+    }
+
+    if (!writes_code) {
+        return 1;
+    }
+
+    t_output_sink* sink;
+    int result;
+
+    if (options->output_file_path != NULL) {
+        result = create_file_sink(&sink, options->output_file_path);
+    }
+    else {
+        flush_diagnostics();
+        result = create_descriptor_sink(&sink, STDOUT_FILENO);
+    }
+
+    if (result > 0) {
+        result = write_to_output_sink(sink, response->output, response->output_length);
+
+        if (result > 0) {
+            result = commit_output_sink(sink);
+        }
+
+        dispose_output_sink(sink);
+    }
+
+    if (result < 0) {
+        report_error("Error: failed to handle source file '%s'.\n", file_path);
+        return -1;
+    }
+
+    return 1;
+}
+
+int run_assembler_client_benchmark(const char* socket_path, const char* file_path, size_t request_count) {
+    char absolute_path[PATH_MAX];
+
+    if ((request_count == 0) || (realpath(file_path, absolute_path) == NULL)) {
+        report_error("Error: the benchmark needs an existing source file and at least one request.\n");
+        return -1;
+    }
+
+    int connection;
+
+    if (connect_to_assembler_server(socket_path, &connection) < 0) {
+        return -1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (size_t i = 0; i < request_count; i++) {
+        t_server_response response;
+
+        if (send_server_request(connection, ASSEMBLE_FILE_REQUEST, HACK_ARTIFACT, 0, absolute_path,
+                                strlen(absolute_path), &response) < 0) {
+            close(connection);
+            return -1;
+        }
+
+        int result = response.result;
+
+        dispose_server_response(&response);
+
+        if (result < 0) {
+            close(connection);
+            report_error("Error: the server failed to assemble '%s'.\n", absolute_path);
+            return -1;
+        }
+    }
+
+    double server_seconds = get_elapsed_seconds(&start);
+
+    close(connection);
+
+    /* The same work, paying a new process for every file. */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (size_t i = 0; i < request_count; i++) {
+        pid_t process = fork();
+
+        if (process < 0) {
+            report_error("Internal Error: failed to fork at 'run_assembler_client_benchmark': %s.\n", strerror(errno));
+            return -1;
+        }
+
+        if (process == 0) {
+            int null_descriptor = open("/dev/null", O_WRONLY);
+
+            if (null_descriptor >= 0) {
+                dup2(null_descriptor, STDOUT_FILENO);
+            }
+
+            execl(SERVER_SELF_EXECUTABLE_PATH, "shack_assembler", absolute_path, (char*)NULL);
+            _exit(127);
+        }
+
+        int status;
+
+        if ((waitpid(process, &status, 0) < 0) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+            report_error("Error: the assembler process failed to assemble '%s'.\n", absolute_path);
+            return -1;
+        }
+    }
+
+    double process_seconds = get_elapsed_seconds(&start);
+
+    report("Server: %lu requests in %.3f s, %.1f requests per second, %.1f us per request.\n", request_count,
+           server_seconds, request_count / server_seconds, server_seconds * 1e6 / request_count);
+    report("Process per file: %lu requests in %.3f s, %.1f requests per second, %.1f us per request.\n", request_count,
+           process_seconds, request_count / process_seconds, process_seconds * 1e6 / request_count);
+    report("Speedup: %.2fx.\n", process_seconds / server_seconds);
+
+    return 1;
+}
+
+double get_elapsed_seconds(const struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (double)(end.tv_sec - start->tv_sec) + ((double)(end.tv_nsec - start->tv_nsec) / 1e9);
+}
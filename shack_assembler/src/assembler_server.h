@@ -0,0 +1,65 @@
+//
+// assembler_server.h: keeps warm assembler contexts behind a Unix domain socket, and the client which talks to it.
+//
+
+#ifndef SHACK_ASSEMBLER_ASSEMBLER_SERVER_H
+#define SHACK_ASSEMBLER_ASSEMBLER_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "assembler.h"
+
+/* REQUESTS */
+
+#define ASSEMBLE_FILE_REQUEST 1   // The payload is the absolute path of a source file, answered with the output paths.
+#define ASSEMBLE_SOURCE_REQUEST 2 // The payload is the source code itself, answered with the assembled code.
+
+#define MAXIMUM_REQUEST_LENGTH (64 * 1024 * 1024)
+
+/* Both sides run on the same machine, so the headers are sent in native byte order. */
+struct server_request_header {
+    uint32_t type;
+    uint32_t artifacts;
+    uint32_t verbose_mode;
+    uint32_t reserved;
+    uint64_t length;
+};
+
+typedef struct server_request_header t_server_request_header;
+
+struct server_response_header {
+    int32_t result;
+    uint32_t reserved;
+    uint64_t diagnostics_length;
+    uint64_t output_length;
+};
+
+typedef struct server_response_header t_server_response_header;
+
+struct server_response {
+    int result;
+    char* diagnostics;
+    size_t diagnostics_length;
+    char* output;
+    size_t output_length;
+};
+
+typedef struct server_response t_server_response;
+
+/* Serves requests, one connection per worker, until SIGINT or SIGTERM is received. */
+int run_assembler_server(const t_assembler_options* options, const char* socket_path);
+
+int connect_to_assembler_server(const char* socket_path, int* connection);
+int send_server_request(int connection, int type, int artifacts, int verbose_mode, const char* payload, size_t length,
+                        t_server_response* response);
+void dispose_server_response(t_server_response* response);
+
+/* Drop in replacement of 'start_assembler', which lets a running server do the work. */
+int start_assembler_client(const t_assembler_options* options, const char* socket_path, int file_count,
+                           char** file_names);
+
+/* Compares the requests per second of a running server against starting one process per file. */
+int run_assembler_client_benchmark(const char* socket_path, const char* file_path, size_t request_count);
+
+#endif //SHACK_ASSEMBLER_ASSEMBLER_SERVER_H
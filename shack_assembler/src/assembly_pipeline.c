@@ -0,0 +1,510 @@
+//
+// assembly_pipeline.c: assembles one source file with a thread per stage (reader, parser, encoder and writer), so that
+// reading, parsing, encoding and writing overlap instead of running one after another.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "assembly_pipeline.h"
+#include "assembly_trace.h"
+#include "code_exporter.h"
+#include "command_transformer.h"
+#include "diagnostics.h"
+#include "instruction.h"
+#include "output_sink.h"
+#include "source_parser.h"
+#include "spsc_queue.h"
+#include "symbol_handler.h"
+#include "memory_accounting.h"
+
+struct command_batch {
+    size_t first_command;
+    size_t last_command;
+};
+
+typedef struct command_batch t_command_batch;
+
+struct instruction_batch {
+    unsigned int* instructions;
+    size_t instruction_count;
+};
+
+typedef struct instruction_batch t_instruction_batch;
+
+/* Every queue carries pointers to heap batches, and ends with a NULL one. After a failure, the stages keep forwarding
+ * that NULL, and draining their input, so that none of them is left waiting. */
+struct pipeline {
+    const t_assembler_options* options;
+    const char* file_path;
+    int file;
+    t_array_list* commands_buffer;
+    t_output_sink* sink;
+
+    t_spsc_queue* chunks;
+    t_spsc_queue* command_batches;
+    t_spsc_queue* instruction_batches;
+
+    atomic_int has_failed;
+
+    /* What the stage threads report, printed by the calling thread once they are done. */
+    t_diagnostics stage_diagnostics[PIPELINE_STAGE_COUNT];
+};
+
+typedef struct pipeline t_pipeline;
+
+int create_pipeline_queues(t_pipeline* pipeline);
+void dispose_pipeline_queues(t_pipeline* pipeline);
+void* run_reader_stage(void* argument);
+void run_parser_stage(t_pipeline* pipeline, t_assembler_context* context);
+void* run_encoder_stage(void* argument);
+void* run_writer_stage(void* argument);
+void fail_pipeline(t_pipeline* pipeline);
+int has_pipeline_failed(t_pipeline* pipeline);
+void collect_pipeline_statistics(const t_pipeline* pipeline, t_pipeline_statistics* statistics);
+
+int assemble_source_file_pipelined(const t_assembler_options* options, t_assembler_context* context,
+                                   const char* file_path, t_pipeline_statistics* statistics) {
+    if ((options == NULL) || (context == NULL) || (file_path == NULL)) {
+        report_error("Internal Error: null arguments at 'assemble_source_file_pipelined'.\n");
+        return -1;
+    }
+
+    t_pipeline pipeline = {
+        .options = options,
+        .file_path = file_path,
+        .commands_buffer = NULL,
+        .sink = NULL,
+    };
+
+    int is_standard_input = (strcmp(file_path, STANDARD_INPUT_PATH) == 0);
+
+    pipeline.file = is_standard_input ? STDIN_FILENO : open(file_path, O_RDONLY | O_CLOEXEC);
+
+    if (pipeline.file < 0) {
+        report_error("Internal Error: failed to open file '%s'.\n", file_path);
+        return -1;
+    }
+
+    if (create_array_list(&pipeline.commands_buffer) < 0) {
+        if (!is_standard_input) {
+            close(pipeline.file);
+        }
+
+        report_error("Internal Error: failed to create an array list at 'assemble_source_file_pipelined'.\n");
+        return -1;
+    }
+
+    if ((create_pipeline_queues(&pipeline) < 0) ||
+        (create_output_sink_for_source_file(options, file_path, HACK_ARTIFACT, &pipeline.sink) < 0)) {
+        dispose_pipeline_queues(&pipeline);
+        dispose_array_list(pipeline.commands_buffer);
+
+        if (!is_standard_input) {
+            close(pipeline.file);
+        }
+
+        return -1;
+    }
+
+    atomic_init(&pipeline.has_failed, 0);
+
+    for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+        initialize_diagnostics(&pipeline.stage_diagnostics[i]);
+    }
+
+    pthread_t reader;
+    pthread_t encoder;
+    pthread_t writer;
+
+    int is_reader_started = (pthread_create(&reader, NULL, run_reader_stage, &pipeline) == 0);
+    int is_encoder_started = (pthread_create(&encoder, NULL, run_encoder_stage, &pipeline) == 0);
+    int is_writer_started = (pthread_create(&writer, NULL, run_writer_stage, &pipeline) == 0);
+
+    /* A stage without its thread is run here instead. Since the pipeline has already failed, it only forwards the end
+     * of its input, so running it after the previous stage can not block. */
+    if (!is_reader_started || !is_encoder_started || !is_writer_started) {
+        report_error("Internal Error: failed to start the pipeline threads at 'assemble_source_file_pipelined'.\n");
+        fail_pipeline(&pipeline);
+    }
+
+    if (!is_reader_started) {
+        run_reader_stage(&pipeline);
+    }
+
+    run_parser_stage(&pipeline, context);
+
+    if (!is_encoder_started) {
+        run_encoder_stage(&pipeline);
+    }
+
+    if (!is_writer_started) {
+        run_writer_stage(&pipeline);
+    }
+
+    if (is_reader_started) {
+        pthread_join(reader, NULL);
+    }
+
+    if (is_encoder_started) {
+        pthread_join(encoder, NULL);
+    }
+
+    if (is_writer_started) {
+        pthread_join(writer, NULL);
+    }
+
+    for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+        if (pipeline.stage_diagnostics[i].length > 0) {
+            report("%s", pipeline.stage_diagnostics[i].buffer);
+        }
+
+        dispose_diagnostics(&pipeline.stage_diagnostics[i]);
+    }
+
+    int result = has_pipeline_failed(&pipeline) ? -1 : commit_output_sink(pipeline.sink);
+
+    if (statistics != NULL) {
+        collect_pipeline_statistics(&pipeline, statistics);
+    }
+
+    dispose_output_sink(pipeline.sink);
+    dispose_pipeline_queues(&pipeline);
+
+    if (dispose_commands_from_buffer(pipeline.commands_buffer) < 0) {
+        report_error("Internal Error: failed to dispose content of commands buffer at "
+                     "'assemble_source_file_pipelined'.\n");
+    }
+
+    dispose_array_list(pipeline.commands_buffer);
+
+    if (!is_standard_input) {
+        close(pipeline.file);
+    }
+
+    return result;
+}
+
+void report_pipeline_statistics(const t_pipeline_statistics* statistics) {
+    const char* STAGE_NAMES[] = { "reader", "parser", "encoder", "writer" };
+
+    for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+        const t_pipeline_stage_statistics* stage = &statistics->stages[i];
+
+        report("Pipeline stage '%s': %lu batches, %lu input stalls, %lu output stalls, %.2f batches queued.\n",
+               STAGE_NAMES[i], stage->batch_count, stage->input_stall_count, stage->output_stall_count,
+               stage->input_occupancy);
+    }
+}
+
+int create_pipeline_queues(t_pipeline* pipeline) {
+    pipeline->chunks = NULL;
+    pipeline->command_batches = NULL;
+    pipeline->instruction_batches = NULL;
+
+    if ((create_spsc_queue(&pipeline->chunks, PIPELINE_QUEUE_CAPACITY) < 0) ||
+        (create_spsc_queue(&pipeline->command_batches, PIPELINE_QUEUE_CAPACITY) < 0) ||
+        (create_spsc_queue(&pipeline->instruction_batches, PIPELINE_QUEUE_CAPACITY) < 0)) {
+        dispose_pipeline_queues(pipeline);
+        return -1;
+    }
+
+    return 1;
+}
+
+void dispose_pipeline_queues(t_pipeline* pipeline) {
+    dispose_spsc_queue(pipeline->chunks);
+    dispose_spsc_queue(pipeline->command_batches);
+    dispose_spsc_queue(pipeline->instruction_batches);
+
+    pipeline->chunks = NULL;
+    pipeline->command_batches = NULL;
+    pipeline->instruction_batches = NULL;
+}
+
+/* Reads chunks of up to PIPELINE_CHUNK_SIZE bytes, cut after their last new line so that no line is split, since the
+ * parser handles each chunk on its own. The cut off part starts the next chunk. */
+void* run_reader_stage(void* argument) {
+    t_pipeline* pipeline = argument;
+    uint64_t traced_at = begin_trace_event();
+
+    begin_diagnostics_capture(&pipeline->stage_diagnostics[READER_STAGE]);
+
+    char* content = NULL;
+    size_t length = 0L;
+    int is_end_of_file = 0;
+
+    while (!is_end_of_file && !has_pipeline_failed(pipeline)) {
+        if (content == NULL) {
+            content = allocate_memory(sizeof(char) * (PIPELINE_CHUNK_SIZE + 1));
+
+            if (content == NULL) {
+                report_error("Internal Error: failed to allocate memory for 'content' at 'run_reader_stage'.\n");
+                fail_pipeline(pipeline);
+                break;
+            }
+        }
+
+        while (length < PIPELINE_CHUNK_SIZE) {
+            ssize_t count = read(pipeline->file, content + length, PIPELINE_CHUNK_SIZE - length);
+
+            if ((count < 0) && (errno == EINTR)) {
+                continue;
+            }
+
+            if (count <= 0) {
+                is_end_of_file = 1;
+
+                if (count < 0) {
+                    report_error("Error: failed to read file '%s'.\n", pipeline->file_path);
+                    fail_pipeline(pipeline);
+                }
+
+                break;
+            }
+
+            length += (size_t)count;
+        }
+
+        /* A line longer than a whole chunk can not be kept in one piece, and is split like any other long line. */
+        size_t chunk_length = length;
+
+        if (!is_end_of_file) {
+            while ((chunk_length > 0) && (content[chunk_length - 1] != '\n')) {
+                chunk_length--;
+            }
+
+            if (chunk_length == 0) {
+                chunk_length = length;
+            }
+        }
+
+        size_t remaining_length = length - chunk_length;
+        char* remaining_content = NULL;
+
+        if (remaining_length > 0) {
+            remaining_content = allocate_memory(sizeof(char) * (PIPELINE_CHUNK_SIZE + 1));
+
+            if (remaining_content == NULL) {
+                report_error("Internal Error: failed to allocate memory for 'remaining_content' at "
+                             "'run_reader_stage'.\n");
+                fail_pipeline(pipeline);
+                break;
+            }
+
+            memcpy(remaining_content, content + chunk_length, remaining_length);
+        }
+
+        t_source_buffer* chunk = (chunk_length > 0) ? allocate_memory(sizeof(t_source_buffer)) : NULL;
+
+        if (chunk != NULL) {
+            content[chunk_length] = '\0';
+            chunk->content = content;
+            chunk->length = chunk_length;
+
+            push_to_spsc_queue(pipeline->chunks, chunk);
+        }
+        else {
+            if (chunk_length > 0) {
+                report_error("Internal Error: failed to allocate memory for 'chunk' at 'run_reader_stage'.\n");
+                fail_pipeline(pipeline);
+            }
+
+            release_memory(content);
+        }
+
+        content = remaining_content;
+        length = remaining_length;
+    }
+
+    release_memory(content);
+    push_to_spsc_queue(pipeline->chunks, NULL);
+
+    end_diagnostics_capture();
+    end_trace_event("reader stage", traced_at);
+
+    return NULL;
+}
+
+/* Runs on the calling thread, since syncing the symbols uses the symbol table of its context. */
+void run_parser_stage(t_pipeline* pipeline, t_assembler_context* context) {
+    t_parse_position position = { .line_count = 0L, .source_line = 1L };
+    t_source_buffer* chunk;
+
+    while ((chunk = pop_from_spsc_queue(pipeline->chunks)) != NULL) {
+        uint64_t traced_at = begin_trace_event();
+
+        if (!has_pipeline_failed(pipeline) &&
+            (parse_source_chunk(pipeline->options->verbose_mode, chunk->content, chunk->length, &position,
+                                pipeline->commands_buffer) < 0)) {
+            report_error("Internal Error: failed to parse the source code at 'run_parser_stage'.\n");
+            fail_pipeline(pipeline);
+        }
+
+        dispose_source_buffer(chunk);
+        release_memory(chunk);
+
+        end_trace_event("parse chunk", traced_at);
+    }
+
+    /* Labels can be used before being defined, so no command is encoded until the whole file has been parsed. */
+    uint64_t traced_at = begin_trace_event();
+
+    if (!has_pipeline_failed(pipeline) &&
+        (sync_symbol_addresses_using_table(pipeline->commands_buffer, context->symbol_table, NULL) < 0)) {
+        fail_pipeline(pipeline);
+    }
+
+    end_trace_event("sync", traced_at);
+
+    size_t command_count = pipeline->commands_buffer->length;
+
+    for (size_t first = 0; (first < command_count) && !has_pipeline_failed(pipeline);
+         first += PIPELINE_COMMAND_BATCH_SIZE) {
+        t_command_batch* batch = allocate_memory(sizeof(t_command_batch));
+
+        if (batch == NULL) {
+            report_error("Internal Error: failed to allocate memory for 'batch' at 'run_parser_stage'.\n");
+            fail_pipeline(pipeline);
+            break;
+        }
+
+        batch->first_command = first;
+        batch->last_command = ((command_count - first) > PIPELINE_COMMAND_BATCH_SIZE) ?
+                              (first + PIPELINE_COMMAND_BATCH_SIZE) : command_count;
+
+        push_to_spsc_queue(pipeline->command_batches, batch);
+    }
+
+    push_to_spsc_queue(pipeline->command_batches, NULL);
+}
+
+void* run_encoder_stage(void* argument) {
+    t_pipeline* pipeline = argument;
+
+    begin_diagnostics_capture(&pipeline->stage_diagnostics[ENCODER_STAGE]);
+
+    t_command_batch* batch;
+
+    while ((batch = pop_from_spsc_queue(pipeline->command_batches)) != NULL) {
+        uint64_t traced_at = begin_trace_event();
+
+        if (!has_pipeline_failed(pipeline)) {
+            t_instruction_batch* instruction_batch = allocate_memory(sizeof(t_instruction_batch));
+            unsigned int* instructions = allocate_memory(sizeof(unsigned int) *
+                                                (batch->last_command - batch->first_command));
+
+            long instruction_count = -1;
+
+            if ((instruction_batch == NULL) || (instructions == NULL)) {
+                report_error("Internal Error: failed to allocate memory for 'instructions' at 'run_encoder_stage'.\n");
+            }
+            else {
+                instruction_count = translate_commands_into_binary(pipeline->commands_buffer, batch->first_command,
+                                                                   batch->last_command, instructions);
+            }
+
+            if (instruction_count < 0) {
+                release_memory(instruction_batch);
+                release_memory(instructions);
+                fail_pipeline(pipeline);
+            }
+            else {
+                instruction_batch->instructions = instructions;
+                instruction_batch->instruction_count = (size_t)instruction_count;
+
+                push_to_spsc_queue(pipeline->instruction_batches, instruction_batch);
+            }
+        }
+
+        release_memory(batch);
+
+        end_trace_event("encode batch", traced_at);
+    }
+
+    push_to_spsc_queue(pipeline->instruction_batches, NULL);
+
+    end_diagnostics_capture();
+
+    return NULL;
+}
+
+/* The output ends up the same as 'export_instructions_to_sink' would write it: a new line between instructions, none
+ * after the last one. */
+void* run_writer_stage(void* argument) {
+    t_pipeline* pipeline = argument;
+
+    begin_diagnostics_capture(&pipeline->stage_diagnostics[WRITER_STAGE]);
+
+    /* The largest batch, plus the new line separating it from the previous one. */
+    char* text = allocate_memory(sizeof(char) * (get_output_size(PIPELINE_COMMAND_BATCH_SIZE) + 1));
+
+    if (text == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'text' at 'run_writer_stage'.\n");
+        fail_pipeline(pipeline);
+    }
+
+    int is_first_batch = 1;
+    t_instruction_batch* batch;
+
+    while ((batch = pop_from_spsc_queue(pipeline->instruction_batches)) != NULL) {
+        uint64_t traced_at = begin_trace_event();
+
+        if (!has_pipeline_failed(pipeline) && (batch->instruction_count > 0)) {
+            size_t offset = is_first_batch ? 0 : 1;
+
+            text[0] = '\n';
+            format_instructions_into_buffer(batch->instructions, batch->instruction_count, 0,
+                                            batch->instruction_count, text + offset);
+
+            if (write_to_output_sink(pipeline->sink, text, get_output_size(batch->instruction_count) + offset) < 0) {
+                report_error("Internal Error: failed to export code to an output file at 'run_writer_stage'.\n");
+                fail_pipeline(pipeline);
+            }
+
+            is_first_batch = 0;
+        }
+
+        release_memory(batch->instructions);
+        release_memory(batch);
+
+        end_trace_event("write batch", traced_at);
+    }
+
+    release_memory(text);
+
+    end_diagnostics_capture();
+
+    return NULL;
+}
+
+void fail_pipeline(t_pipeline* pipeline) {
+    atomic_store(&pipeline->has_failed, 1);
+}
+
+int has_pipeline_failed(t_pipeline* pipeline) {
+    return atomic_load_explicit(&pipeline->has_failed, memory_order_relaxed);
+}
+
+void collect_pipeline_statistics(const t_pipeline* pipeline, t_pipeline_statistics* statistics) {
+    const t_spsc_queue* inputs[PIPELINE_STAGE_COUNT] = {
+        NULL, pipeline->chunks, pipeline->command_batches, pipeline->instruction_batches,
+    };
+    const t_spsc_queue* outputs[PIPELINE_STAGE_COUNT] = {
+        pipeline->chunks, pipeline->command_batches, pipeline->instruction_batches, NULL,
+    };
+
+    for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+        t_pipeline_stage_statistics* stage = &statistics->stages[i];
+
+        stage->batch_count = (outputs[i] != NULL) ? outputs[i]->push_count : inputs[i]->pop_count;
+        stage->input_stall_count = (inputs[i] != NULL) ? inputs[i]->empty_stall_count : 0L;
+        stage->output_stall_count = (outputs[i] != NULL) ? outputs[i]->full_stall_count : 0L;
+        stage->input_occupancy = (inputs[i] != NULL) ? get_spsc_queue_occupancy(inputs[i]) : 0.0;
+    }
+}
@@ -0,0 +1,50 @@
+//
+// assembly_pipeline.h: assembles one source file with a thread per stage (reader, parser, encoder and writer), so that
+// reading, parsing, encoding and writing overlap instead of running one after another.
+//
+
+#ifndef SHACK_ASSEMBLER_ASSEMBLY_PIPELINE_H
+#define SHACK_ASSEMBLER_ASSEMBLY_PIPELINE_H
+
+#include <stddef.h>
+
+#include "assembler.h"
+
+#define PIPELINE_CHUNK_SIZE (256 * 1024)
+#define PIPELINE_COMMAND_BATCH_SIZE 8192
+#define PIPELINE_QUEUE_CAPACITY 8
+
+enum pipeline_stage {
+    READER_STAGE,  // Reads the source in chunks ended by a new line.
+    PARSER_STAGE,  // Parses the chunks, and once all of them are parsed, syncs the symbols and splits the commands.
+    ENCODER_STAGE, // Translates each batch of commands into binary.
+    WRITER_STAGE,  // Formats and writes each batch of instructions.
+    PIPELINE_STAGE_COUNT,
+};
+
+typedef enum pipeline_stage t_pipeline_stage;
+
+struct pipeline_stage_statistics {
+    size_t batch_count;        // Batches handed to the next stage (or written, for the writer).
+    size_t input_stall_count;  // Times the stage waited for the previous one.
+    size_t output_stall_count; // Times the stage waited for the next one.
+    double input_occupancy;    // Average batches waiting in front of the stage.
+};
+
+typedef struct pipeline_stage_statistics t_pipeline_stage_statistics;
+
+struct pipeline_statistics {
+    t_pipeline_stage_statistics stages[PIPELINE_STAGE_COUNT];
+};
+
+typedef struct pipeline_statistics t_pipeline_statistics;
+
+/* Only the hack artifact is produced. Labels can be used before they are defined, so encoding can only start once the
+ * whole file is parsed: reading overlaps parsing, and encoding overlaps writing. */
+int assemble_source_file_pipelined(const t_assembler_options* options, t_assembler_context* context,
+                                   const char* file_path, t_pipeline_statistics* statistics);
+
+/* Reports the batches, stalls and occupancy of every stage, to spot the one slowing down the rest. */
+void report_pipeline_statistics(const t_pipeline_statistics* statistics);
+
+#endif //SHACK_ASSEMBLER_ASSEMBLY_PIPELINE_H
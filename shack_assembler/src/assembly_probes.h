@@ -0,0 +1,34 @@
+//
+// assembly_probes.h: USDT probes at the boundaries of every file, step, cache lookup and hash map resize, so that
+// bpftrace or perf can follow a running assembler without rebuilding it.
+//
+
+#ifndef SHACK_ASSEMBLER_ASSEMBLY_PROBES_H
+#define SHACK_ASSEMBLER_ASSEMBLY_PROBES_H
+
+/* Probes are only a no-op instruction and a note in the binary until a tracer attaches to them, such as with
+ * 'bpftrace -e "usdt:./shack_assembler:shack:step__done { printf(\"%s\n\", str(arg1)); }"'. Without <sys/sdt.h> they
+ * are left out, and their arguments are never evaluated. The probes of the provider 'shack' are:
+ *
+ *     file__start(path, size)                               'size' is 0 for files streamed by the pipeline.
+ *     file__done(path, result, size, instruction_count)
+ *     step__start(step, name)                               'step' is a 't_assembly_step'.
+ *     step__done(step, name)
+ *     symbols__synced(symbol_count, command_count)          Labels and variables of the file.
+ *     cache__hit(path, source_hash)
+ *     cache__miss(path, source_hash)
+ *     hash_map__resize(length, old_capacity, new_capacity)  Also when rebuilt in place.
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define SHACK_PROBE2(name, first, second) DTRACE_PROBE2(shack, name, first, second)
+#define SHACK_PROBE3(name, first, second, third) DTRACE_PROBE3(shack, name, first, second, third)
+#define SHACK_PROBE4(name, first, second, third, fourth) DTRACE_PROBE4(shack, name, first, second, third, fourth)
+#else
+#define SHACK_PROBE2(name, first, second) ((void)0)
+#define SHACK_PROBE3(name, first, second, third) ((void)0)
+#define SHACK_PROBE4(name, first, second, third, fourth) ((void)0)
+#endif
+
+#endif //SHACK_ASSEMBLER_ASSEMBLY_PROBES_H
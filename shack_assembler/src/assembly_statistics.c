@@ -0,0 +1,383 @@
+//
+// assembly_statistics.c: times the steps of assembling each source file, counts what it contains and produces, and
+// reports it for a whole batch of files.
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "assembly_statistics.h"
+#include "assembly_trace.h"
+#include "diagnostics.h"
+#include "instruction.h"
+#include "memory_accounting.h"
+#include "performance_counters.h"
+#include "assembly_probes.h"
+
+#define DEFAULT_STATISTICS_SUMMARY_CAPACITY 16
+
+static const char* STEP_NAMES[ASSEMBLY_STEP_COUNT] = { "read", "parse", "sync", "translate", "export" };
+
+static _Thread_local t_assembly_statistics* current_statistics = NULL;
+static _Thread_local uint64_t step_started_at[ASSEMBLY_STEP_COUNT];
+
+/* Of the current capture, which may release what it did not allocate. */
+static _Thread_local long long live_byte_count = 0L;
+
+double get_statistics_seconds(const t_assembly_statistics* statistics);
+void report_text_statistics(const t_assembly_statistics* statistics, double seconds);
+void report_json_statistics(const t_assembly_statistics* statistics, double seconds);
+void report_json_string(const char* text);
+
+void initialize_assembly_statistics(t_assembly_statistics* statistics) {
+    memset(statistics, 0, sizeof(t_assembly_statistics));
+}
+
+void add_assembly_statistics(t_assembly_statistics* total, const t_assembly_statistics* statistics) {
+    for (size_t i = 0; i < ASSEMBLY_STEP_COUNT; i++) {
+        total->step_nanoseconds[i] += statistics->step_nanoseconds[i];
+    }
+
+    total->file_count += statistics->file_count;
+    total->line_count += statistics->line_count;
+    total->comment_line_count += statistics->comment_line_count;
+    total->a_command_count += statistics->a_command_count;
+    total->c_command_count += statistics->c_command_count;
+    total->l_command_count += statistics->l_command_count;
+    total->symbol_count += statistics->symbol_count;
+    total->variable_count += statistics->variable_count;
+    total->read_byte_count += statistics->read_byte_count;
+    total->written_byte_count += statistics->written_byte_count;
+    total->allocation_count += statistics->allocation_count;
+    total->allocated_byte_count += statistics->allocated_byte_count;
+
+    if (statistics->peak_live_byte_count > total->peak_live_byte_count) {
+        total->peak_live_byte_count = statistics->peak_live_byte_count;
+    }
+}
+
+void begin_statistics_capture(t_assembly_statistics* statistics) {
+    current_statistics = statistics;
+    live_byte_count = 0L;
+}
+
+void end_statistics_capture(void) {
+    current_statistics = NULL;
+}
+
+uint64_t get_monotonic_nanoseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000000000ull) + (uint64_t)now.tv_nsec;
+}
+
+void begin_assembly_step(t_assembly_step step) {
+    SHACK_PROBE2(step__start, step, STEP_NAMES[step]);
+    step_started_at[step] = (current_statistics != NULL) ? get_monotonic_nanoseconds() : begin_trace_event();
+    begin_counted_step(step);
+    begin_accounted_step(step);
+}
+
+void end_assembly_step(t_assembly_step step) {
+    end_accounted_step(step);
+    end_counted_step(step);
+
+    if (current_statistics != NULL) {
+        current_statistics->step_nanoseconds[step] += get_monotonic_nanoseconds() - step_started_at[step];
+    }
+
+    end_trace_event(STEP_NAMES[step], step_started_at[step]);
+    SHACK_PROBE2(step__done, step, STEP_NAMES[step]);
+}
+
+const char* get_assembly_step_name(t_assembly_step step) {
+    return STEP_NAMES[step];
+}
+
+/* A separate pass over the source, so that counting the comment lines costs the parser nothing. */
+void record_source_statistics(const char* content, size_t length) {
+    if (current_statistics == NULL) {
+        return;
+    }
+
+    size_t line_count = 0L;
+    size_t comment_line_count = 0L;
+    size_t position = 0L;
+
+    while (position < length) {
+        const char* new_line = memchr(content + position, '\n', length - position);
+        size_t end = (new_line != NULL) ? (size_t)(new_line - content) : length;
+
+        while ((position < end) && ((content[position] == ' ') || (content[position] == '\t'))) {
+            position++;
+        }
+
+        if (((position + 1) < end) && (content[position] == '/') && (content[position + 1] == '/')) {
+            comment_line_count++;
+        }
+
+        line_count++;
+        position = end + 1;
+    }
+
+    current_statistics->line_count += line_count;
+    current_statistics->comment_line_count += comment_line_count;
+    current_statistics->read_byte_count += length;
+}
+
+void record_command_statistics(const t_array_list* commands_buffer) {
+    if (current_statistics == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < commands_buffer->length; i++) {
+        const t_instruction* command = commands_buffer->item[i];
+
+        if (command->type == A_COMMAND) {
+            current_statistics->a_command_count++;
+        }
+        else if (command->type == C_COMMAND) {
+            current_statistics->c_command_count++;
+        }
+        else {
+            current_statistics->l_command_count++;
+        }
+    }
+}
+
+void record_symbol_statistics(size_t symbol_count, size_t variable_count) {
+    if (current_statistics != NULL) {
+        current_statistics->symbol_count += symbol_count;
+        current_statistics->variable_count += variable_count;
+    }
+}
+
+void record_written_bytes(size_t byte_count) {
+    if (current_statistics != NULL) {
+        current_statistics->written_byte_count += byte_count;
+    }
+}
+
+void record_memory_statistics(size_t allocated_byte_count, size_t released_byte_count) {
+    if (current_statistics == NULL) {
+        return;
+    }
+
+    if (allocated_byte_count > 0) {
+        current_statistics->allocation_count++;
+        current_statistics->allocated_byte_count += allocated_byte_count;
+    }
+
+    live_byte_count += (long long)allocated_byte_count - (long long)released_byte_count;
+
+    if ((live_byte_count > 0) && ((size_t)live_byte_count > current_statistics->peak_live_byte_count)) {
+        current_statistics->peak_live_byte_count = (size_t)live_byte_count;
+    }
+}
+
+int create_statistics_summary(t_statistics_summary** summary, t_statistics_format format) {
+    t_statistics_summary* statistics_summary = allocate_memory(sizeof(t_statistics_summary));
+
+    if (statistics_summary == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'statistics_summary' at "
+                     "'create_statistics_summary'.\n");
+        return -1;
+    }
+
+    statistics_summary->format = format;
+    statistics_summary->started_at = get_monotonic_nanoseconds();
+    statistics_summary->files = NULL;
+    statistics_summary->file_count = 0L;
+    statistics_summary->capacity = 0L;
+    initialize_assembly_statistics(&statistics_summary->total);
+
+    *summary = statistics_summary;
+
+    return 1;
+}
+
+int add_file_to_statistics_summary(t_statistics_summary* summary, const char* file_path, int result,
+                                   const t_assembly_statistics* statistics) {
+    if (summary->file_count == summary->capacity) {
+        size_t new_capacity = (summary->capacity > 0) ? (summary->capacity * 2) : DEFAULT_STATISTICS_SUMMARY_CAPACITY;
+        t_file_statistics* new_files = reallocate_memory(summary->files, sizeof(t_file_statistics) * new_capacity);
+
+        if (new_files == NULL) {
+            report_error("Internal Error: failed to allocate memory for 'files' at "
+                         "'add_file_to_statistics_summary'.\n");
+            return -1;
+        }
+
+        summary->files = new_files;
+        summary->capacity = new_capacity;
+    }
+
+    t_file_statistics* file = &summary->files[summary->file_count];
+
+    file->file_path = allocate_memory(sizeof(char) * (strlen(file_path) + 1));
+
+    if (file->file_path == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'file_path' at "
+                     "'add_file_to_statistics_summary'.\n");
+        return -1;
+    }
+
+    strcpy(file->file_path, file_path);
+    file->result = result;
+    file->statistics = *statistics;
+    file->statistics.file_count = 1;
+
+    add_assembly_statistics(&summary->total, &file->statistics);
+    summary->file_count++;
+
+    return 1;
+}
+
+void report_statistics_summary(const t_statistics_summary* summary) {
+    double wall_seconds = (double)(get_monotonic_nanoseconds() - summary->started_at) / 1e9;
+
+    if (summary->format == JSON_STATISTICS) {
+        report("{\n  \"files\": [");
+
+        for (size_t i = 0; i < summary->file_count; i++) {
+            const t_file_statistics* file = &summary->files[i];
+
+            report("%s\n    {\"path\": ", (i > 0) ? "," : "");
+            report_json_string(file->file_path);
+            report(", \"result\": %d, ", file->result);
+            report_json_statistics(&file->statistics, get_statistics_seconds(&file->statistics));
+            report("}");
+        }
+
+        report("%s],\n  \"total\": {\"files\": %lu, \"wall_seconds\": %.6f, ", (summary->file_count > 0) ? "\n  " : "",
+               summary->file_count, wall_seconds);
+        report_json_statistics(&summary->total, wall_seconds);
+        report("}\n}\n");
+        return;
+    }
+
+    for (size_t i = 0; i < summary->file_count; i++) {
+        const t_file_statistics* file = &summary->files[i];
+
+        report("Statistics of '%s'%s:\n", file->file_path, (file->result < 0) ? " (failed)" : "");
+        report_text_statistics(&file->statistics, get_statistics_seconds(&file->statistics));
+    }
+
+    report("Statistics of %lu source files, in %.3f s:\n", summary->file_count, wall_seconds);
+    report_text_statistics(&summary->total, wall_seconds);
+}
+
+int write_statistics_summary(const t_statistics_summary* summary, const char* file_path) {
+    t_diagnostics text;
+
+    initialize_diagnostics(&text);
+    begin_diagnostics_capture(&text);
+    report_statistics_summary(summary);
+    end_diagnostics_capture();
+
+    FILE* file = fopen(file_path, "w");
+    int result = ((file != NULL) && (fwrite(text.buffer, sizeof(char), text.length, file) == text.length)) ? 1 : -1;
+
+    if ((file != NULL) && (fclose(file) != 0)) {
+        result = -1;
+    }
+
+    if (result < 0) {
+        report_error("Error: could not write the statistics into '%s': %s.\n", file_path, strerror(errno));
+    }
+
+    dispose_diagnostics(&text);
+    return result;
+}
+
+void dispose_statistics_summary(t_statistics_summary* summary) {
+    if (summary == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < summary->file_count; i++) {
+        release_memory(summary->files[i].file_path);
+    }
+
+    release_memory(summary->files);
+    release_memory(summary);
+}
+
+/* The time spent in every step of a file, which is what its rates are measured against. */
+double get_statistics_seconds(const t_assembly_statistics* statistics) {
+    uint64_t nanoseconds = 0L;
+
+    for (size_t i = 0; i < ASSEMBLY_STEP_COUNT; i++) {
+        nanoseconds += statistics->step_nanoseconds[i];
+    }
+
+    return (double)nanoseconds / 1e9;
+}
+
+void report_text_statistics(const t_assembly_statistics* statistics, double seconds) {
+    size_t instruction_count = statistics->a_command_count + statistics->c_command_count;
+
+    report("    Time:");
+
+    for (size_t i = 0; i < ASSEMBLY_STEP_COUNT; i++) {
+        report("%s %s %.3f ms", (i > 0) ? "," : "", STEP_NAMES[i], (double)statistics->step_nanoseconds[i] / 1e6);
+    }
+
+    report(".\n");
+    report("    Source: %lu lines (%lu only comments), %lu bytes read.\n", statistics->line_count,
+           statistics->comment_line_count, statistics->read_byte_count);
+    report("    Program: %lu A, %lu C and %lu L commands, %lu symbols (%lu variables), %lu bytes written.\n",
+           statistics->a_command_count, statistics->c_command_count, statistics->l_command_count,
+           statistics->symbol_count, statistics->variable_count, statistics->written_byte_count);
+    report("    Rate: %.2f MB/s, %.0f instructions/s.\n",
+           (seconds > 0) ? ((double)statistics->read_byte_count / 1e6 / seconds) : 0.0,
+           (seconds > 0) ? ((double)instruction_count / seconds) : 0.0);
+
+    if (statistics->allocation_count > 0) {
+        report("    Memory: %zu allocations (%zu bytes), peak of %zu bytes live.\n", statistics->allocation_count,
+               statistics->allocated_byte_count, statistics->peak_live_byte_count);
+    }
+}
+
+void report_json_statistics(const t_assembly_statistics* statistics, double seconds) {
+    size_t instruction_count = statistics->a_command_count + statistics->c_command_count;
+
+    report("\"seconds\": {");
+
+    for (size_t i = 0; i < ASSEMBLY_STEP_COUNT; i++) {
+        report("%s\"%s\": %.6f", (i > 0) ? ", " : "", STEP_NAMES[i], (double)statistics->step_nanoseconds[i] / 1e9);
+    }
+
+    report("}, \"lines\": %lu, \"comment_lines\": %lu, \"a_commands\": %lu, \"c_commands\": %lu, \"l_commands\": %lu, "
+           "\"symbols\": %lu, \"variables\": %lu, \"bytes_read\": %lu, \"bytes_written\": %lu, "
+           "\"allocations\": %zu, \"bytes_allocated\": %zu, \"peak_live_bytes\": %zu, "
+           "\"megabytes_per_second\": %.3f, \"instructions_per_second\": %.0f",
+           statistics->line_count, statistics->comment_line_count, statistics->a_command_count,
+           statistics->c_command_count, statistics->l_command_count, statistics->symbol_count,
+           statistics->variable_count, statistics->read_byte_count, statistics->written_byte_count,
+           statistics->allocation_count, statistics->allocated_byte_count, statistics->peak_live_byte_count,
+           (seconds > 0) ? ((double)statistics->read_byte_count / 1e6 / seconds) : 0.0,
+           (seconds > 0) ? ((double)instruction_count / seconds) : 0.0);
+}
+
+void report_json_string(const char* text) {
+    report("\"");
+
+    for (const char* character = text; *character != '\0'; character++) {
+        if ((*character == '"') || (*character == '\\')) {
+            report("\\%c", *character);
+        }
+        else if ((unsigned char)*character < 0x20) {
+            report("\\u%04x", (unsigned int)(unsigned char)*character);
+        }
+        else {
+            report("%c", *character);
+        }
+    }
+
+    report("\"");
+}
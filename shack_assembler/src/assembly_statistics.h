@@ -0,0 +1,107 @@
+//
+// assembly_statistics.h: times the steps of assembling each source file, counts what it contains and produces, and
+// reports it for a whole batch of files.
+//
+
+#ifndef SHACK_ASSEMBLER_ASSEMBLY_STATISTICS_H
+#define SHACK_ASSEMBLER_ASSEMBLY_STATISTICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "general_types.h"
+
+enum statistics_format {
+    NO_STATISTICS,
+    TEXT_STATISTICS,
+    JSON_STATISTICS,
+};
+
+typedef enum statistics_format t_statistics_format;
+
+enum assembly_step {
+    READ_STEP,      // Loading the source file.
+    PARSE_STEP,     // Turning its lines into commands.
+    SYNC_STEP,      // Giving an address to every label and variable.
+    TRANSLATE_STEP, // Turning the commands into binary.
+    EXPORT_STEP,    // Writing every requested artifact.
+    ASSEMBLY_STEP_COUNT,
+};
+
+typedef enum assembly_step t_assembly_step;
+
+struct assembly_statistics {
+    uint64_t step_nanoseconds[ASSEMBLY_STEP_COUNT];
+
+    size_t file_count;
+    size_t line_count;
+    size_t comment_line_count; // Lines with nothing but a comment.
+    size_t a_command_count;
+    size_t c_command_count;
+    size_t l_command_count;
+    size_t symbol_count;       // Labels and variables defined by the program.
+    size_t variable_count;
+    size_t read_byte_count;
+    size_t written_byte_count;
+
+    size_t allocation_count;     // Only counted while accounting the memory.
+    size_t allocated_byte_count;
+    size_t peak_live_byte_count; // The most bytes allocated by the file, and not yet released, at once.
+};
+
+typedef struct assembly_statistics t_assembly_statistics;
+
+void initialize_assembly_statistics(t_assembly_statistics* statistics);
+void add_assembly_statistics(t_assembly_statistics* total, const t_assembly_statistics* statistics);
+
+/* Until the capture ends, the steps run by the calling thread, and everything it records, are added to 'statistics'.
+ * Without a capture, timing a step or recording anything does nothing. */
+void begin_statistics_capture(t_assembly_statistics* statistics);
+void end_statistics_capture(void);
+
+/* Steps are timed with a monotonic clock, and traced and counted as well while tracing or counting. */
+uint64_t get_monotonic_nanoseconds(void);
+void begin_assembly_step(t_assembly_step step);
+void end_assembly_step(t_assembly_step step);
+const char* get_assembly_step_name(t_assembly_step step);
+
+void record_source_statistics(const char* content, size_t length);
+void record_command_statistics(const t_array_list* commands_buffer);
+void record_symbol_statistics(size_t symbol_count, size_t variable_count);
+void record_written_bytes(size_t byte_count);
+void record_memory_statistics(size_t allocated_byte_count, size_t released_byte_count);
+
+/* The statistics of every file of a batch, in the order they are added, and their totals. */
+struct file_statistics {
+    char* file_path;
+    int result;
+    t_assembly_statistics statistics;
+};
+
+typedef struct file_statistics t_file_statistics;
+
+struct statistics_summary {
+    t_statistics_format format;
+    uint64_t started_at;
+
+    t_file_statistics* files;
+    size_t file_count;
+    size_t capacity;
+
+    t_assembly_statistics total;
+};
+
+typedef struct statistics_summary t_statistics_summary;
+
+int create_statistics_summary(t_statistics_summary** summary, t_statistics_format format);
+int add_file_to_statistics_summary(t_statistics_summary* summary, const char* file_path, int result,
+                                   const t_assembly_statistics* statistics);
+
+/* Reports every file and the totals, with the rates measured against the time since the summary was created. */
+void report_statistics_summary(const t_statistics_summary* summary);
+
+/* Same as 'report_statistics_summary', but into the file at 'file_path', which is replaced. */
+int write_statistics_summary(const t_statistics_summary* summary, const char* file_path);
+void dispose_statistics_summary(t_statistics_summary* summary);
+
+#endif //SHACK_ASSEMBLER_ASSEMBLY_STATISTICS_H
@@ -0,0 +1,295 @@
+//
+// assembly_trace.c: records when every file, step and stage ran, on which thread, and writes it as a Chrome trace
+// (loadable by Perfetto or chrome://tracing) to spot scheduling gaps and stragglers.
+//
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "assembly_trace.h"
+#include "assembly_statistics.h"
+#include "diagnostics.h"
+#include "memory_accounting.h"
+
+struct trace_event {
+    const char* name;
+    char* file_path; // Owned, and NULL unless the event is a whole file.
+    uint64_t started_at;
+    uint64_t ended_at;
+};
+
+typedef struct trace_event t_trace_event;
+
+struct trace_chunk {
+    t_trace_event events[TRACE_CHUNK_EVENT_COUNT];
+    size_t event_count;
+
+    struct trace_chunk* next;
+};
+
+typedef struct trace_chunk t_trace_chunk;
+
+/* Only written by its own thread, and only read once tracing has stopped. */
+struct trace_buffer {
+    long thread_id;
+    t_trace_chunk* first_chunk;
+    t_trace_chunk* last_chunk;
+
+    struct trace_buffer* next;
+};
+
+typedef struct trace_buffer t_trace_buffer;
+
+struct assembly_trace {
+    char* trace_path;
+    uint64_t started_at;
+    atomic_int is_tracing;
+    atomic_uint generation; // Tells the buffers of a previous trace apart, since threads keep pointing to them.
+
+    pthread_mutex_t lock; // Taken to add a buffer.
+    t_trace_buffer* first_buffer;
+};
+
+typedef struct assembly_trace t_assembly_trace;
+
+static t_assembly_trace trace = {
+    .trace_path = NULL,
+    .started_at = 0L,
+    .is_tracing = 0,
+    .generation = 0,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .first_buffer = NULL,
+};
+
+static _Thread_local t_trace_buffer* current_trace_buffer = NULL;
+static _Thread_local unsigned int current_trace_generation = 0;
+
+void record_trace_event(const char* name, char* file_path, uint64_t started_at);
+t_trace_buffer* get_current_trace_buffer(void);
+int write_trace_events(FILE* file);
+void write_json_string(FILE* file, const char* text);
+void dispose_trace_buffers(void);
+
+int start_assembly_trace(const char* trace_path) {
+    if (trace_path == NULL) {
+        report_error("Internal Error: 'trace_path' is NULL at 'start_assembly_trace'.\n");
+        return -1;
+    }
+
+    trace.trace_path = allocate_memory(sizeof(char) * (strlen(trace_path) + 1));
+
+    if (trace.trace_path == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'trace_path' at 'start_assembly_trace'.\n");
+        return -1;
+    }
+
+    strcpy(trace.trace_path, trace_path);
+    trace.started_at = get_monotonic_nanoseconds();
+
+    atomic_fetch_add(&trace.generation, 1);
+    atomic_store_explicit(&trace.is_tracing, 1, memory_order_release);
+
+    return 1;
+}
+
+/* Expected to be called once every traced thread is done, since their buffers are read without a lock. */
+int stop_assembly_trace(void) {
+    if (!atomic_load(&trace.is_tracing)) {
+        return 1;
+    }
+
+    atomic_store(&trace.is_tracing, 0);
+
+    FILE* file = fopen(trace.trace_path, "w");
+    int result = 1;
+
+    if ((file == NULL) || (write_trace_events(file) < 0)) {
+        report_error("Error: failed to write the trace into '%s'.\n", trace.trace_path);
+        result = -1;
+    }
+
+    if ((file != NULL) && (fclose(file) != 0) && (result > 0)) {
+        report_error("Error: failed to write the trace into '%s'.\n", trace.trace_path);
+        result = -1;
+    }
+
+    dispose_trace_buffers();
+    release_memory(trace.trace_path);
+    trace.trace_path = NULL;
+
+    return result;
+}
+
+uint64_t begin_trace_event(void) {
+    if (!atomic_load_explicit(&trace.is_tracing, memory_order_relaxed)) {
+        return 0L;
+    }
+
+    return get_monotonic_nanoseconds();
+}
+
+void end_trace_event(const char* name, uint64_t started_at) {
+    if (started_at != 0) {
+        record_trace_event(name, NULL, started_at);
+    }
+}
+
+void end_file_trace_event(const char* file_path, uint64_t started_at) {
+    if (started_at == 0) {
+        return;
+    }
+
+    char* file_path_copy = allocate_memory(sizeof(char) * (strlen(file_path) + 1));
+
+    if (file_path_copy != NULL) {
+        strcpy(file_path_copy, file_path);
+        record_trace_event(file_path_copy, file_path_copy, started_at);
+    }
+}
+
+/* Events which can not be recorded, for lack of memory, are dropped. */
+void record_trace_event(const char* name, char* file_path, uint64_t started_at) {
+    t_trace_buffer* buffer = atomic_load_explicit(&trace.is_tracing, memory_order_relaxed) ?
+                             get_current_trace_buffer() : NULL;
+
+    if (buffer == NULL) {
+        release_memory(file_path);
+        return;
+    }
+
+    if ((buffer->last_chunk == NULL) || (buffer->last_chunk->event_count == TRACE_CHUNK_EVENT_COUNT)) {
+        t_trace_chunk* chunk = allocate_memory(sizeof(t_trace_chunk));
+
+        if (chunk == NULL) {
+            release_memory(file_path);
+            return;
+        }
+
+        chunk->event_count = 0L;
+        chunk->next = NULL;
+
+        if (buffer->last_chunk == NULL) {
+            buffer->first_chunk = chunk;
+        }
+        else {
+            buffer->last_chunk->next = chunk;
+        }
+
+        buffer->last_chunk = chunk;
+    }
+
+    t_trace_event* event = &buffer->last_chunk->events[buffer->last_chunk->event_count++];
+
+    event->name = name;
+    event->file_path = file_path;
+    event->started_at = started_at;
+    event->ended_at = get_monotonic_nanoseconds();
+}
+
+t_trace_buffer* get_current_trace_buffer(void) {
+    unsigned int generation = atomic_load_explicit(&trace.generation, memory_order_relaxed);
+
+    if ((current_trace_buffer != NULL) && (current_trace_generation == generation)) {
+        return current_trace_buffer;
+    }
+
+    t_trace_buffer* buffer = allocate_memory(sizeof(t_trace_buffer));
+
+    if (buffer == NULL) {
+        return NULL;
+    }
+
+    buffer->thread_id = (long)syscall(SYS_gettid);
+    buffer->first_chunk = NULL;
+    buffer->last_chunk = NULL;
+
+    pthread_mutex_lock(&trace.lock);
+    buffer->next = trace.first_buffer;
+    trace.first_buffer = buffer;
+    pthread_mutex_unlock(&trace.lock);
+
+    current_trace_buffer = buffer;
+    current_trace_generation = generation;
+
+    return buffer;
+}
+
+/* Complete events ("X"), with their times in microseconds since the trace started. */
+int write_trace_events(FILE* file) {
+    long process_id = (long)getpid();
+    int is_first_event = 1;
+
+    fprintf(file, "{\"traceEvents\": [");
+
+    for (t_trace_buffer* buffer = trace.first_buffer; buffer != NULL; buffer = buffer->next) {
+        fprintf(file, "%s\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %ld, \"tid\": %ld, "
+                      "\"args\": {\"name\": \"thread %ld\"}}", is_first_event ? "" : ",", process_id,
+                buffer->thread_id, buffer->thread_id);
+        is_first_event = 0;
+
+        for (t_trace_chunk* chunk = buffer->first_chunk; chunk != NULL; chunk = chunk->next) {
+            for (size_t i = 0; i < chunk->event_count; i++) {
+                const t_trace_event* event = &chunk->events[i];
+                uint64_t started_at = (event->started_at > trace.started_at) ? (event->started_at - trace.started_at) : 0;
+
+                fprintf(file, ",\n  {\"name\": ");
+                write_json_string(file, event->name);
+                fprintf(file, ", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %ld, "
+                              "\"tid\": %ld}", (event->file_path != NULL) ? "file" : "step",
+                        (double)started_at / 1e3, (double)(event->ended_at - event->started_at) / 1e3, process_id,
+                        buffer->thread_id);
+            }
+        }
+    }
+
+    fprintf(file, "\n], \"displayTimeUnit\": \"ms\"}\n");
+
+    return ferror(file) ? -1 : 1;
+}
+
+void write_json_string(FILE* file, const char* text) {
+    fputc('"', file);
+
+    for (const char* character = text; *character != '\0'; character++) {
+        if ((*character == '"') || (*character == '\\')) {
+            fprintf(file, "\\%c", *character);
+        }
+        else if ((unsigned char)*character < 0x20) {
+            fprintf(file, "\\u%04x", (unsigned int)(unsigned char)*character);
+        }
+        else {
+            fputc(*character, file);
+        }
+    }
+
+    fputc('"', file);
+}
+
+void dispose_trace_buffers(void) {
+    pthread_mutex_lock(&trace.lock);
+
+    while (trace.first_buffer != NULL) {
+        t_trace_buffer* buffer = trace.first_buffer;
+
+        while (buffer->first_chunk != NULL) {
+            t_trace_chunk* chunk = buffer->first_chunk;
+
+            for (size_t i = 0; i < chunk->event_count; i++) {
+                release_memory(chunk->events[i].file_path);
+            }
+
+            buffer->first_chunk = chunk->next;
+            release_memory(chunk);
+        }
+
+        trace.first_buffer = buffer->next;
+        release_memory(buffer);
+    }
+
+    pthread_mutex_unlock(&trace.lock);
+}
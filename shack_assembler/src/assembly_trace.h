@@ -0,0 +1,23 @@
+//
+// assembly_trace.h: records when every file, step and stage ran, on which thread, and writes it as a Chrome trace
+// (loadable by Perfetto or chrome://tracing) to spot scheduling gaps and stragglers.
+//
+
+#ifndef SHACK_ASSEMBLER_ASSEMBLY_TRACE_H
+#define SHACK_ASSEMBLER_ASSEMBLY_TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_CHUNK_EVENT_COUNT 4096
+
+/* Events are only recorded between these two calls. Stopping writes every recorded event into 'trace_path'. */
+int start_assembly_trace(const char* trace_path);
+int stop_assembly_trace(void);
+
+/* Returns the time an event begins, or 0 when not tracing, in which case ending the event does nothing. Events are
+ * appended to a buffer of the calling thread, without any lock. 'name' must outlive the trace, unlike 'file_path'. */
+uint64_t begin_trace_event(void);
+void end_trace_event(const char* name, uint64_t started_at);
+void end_file_trace_event(const char* file_path, uint64_t started_at);
+
+#endif //SHACK_ASSEMBLER_ASSEMBLY_TRACE_H
@@ -0,0 +1,1025 @@
+//
+// bench_shack.c: times every step and engine of the assembler on generated programs, and on real programs scaled up,
+// reporting the median of several runs so that the numbers can be compared between builds.
+//
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "assembler.h"
+#include "assembly_statistics.h"
+#include "diagnostics.h"
+#include "memory_accounting.h"
+#include "worker_pool.h"
+#include "workload_generator.h"
+
+#define DEFAULT_BENCH_RUN_COUNT 5
+#define DEFAULT_BENCH_SCALE 10
+#define BENCH_PATH_CAPACITY 4096
+
+/* The scaling check assembles every axis at sizes from 1k instructions up to the largest one, a decade apart, and
+ * fails if the time grows faster than this power of the size. From 1k to 1M, n log n grows as n^1.10. */
+#define MINIMUM_SCALING_SIZE 1000
+#define DEFAULT_MAXIMUM_SCALING_SIZE 1000000
+#define MAXIMUM_SCALING_EXPONENT 1.25
+#define SCALING_SAMPLE_NANOSECONDS 20000000 // Small sizes are repeated for at least this long, to time them reliably.
+
+/* The gate fails if a metric grows past its baseline by more than its tolerance. Allocations are the same on every
+ * run, while times vary with the load of the machine, hence their wider tolerance, and the floor below which a
+ * slower step is not reported. */
+#define DEFAULT_GATE_ALLOCATION_TOLERANCE 2
+#define DEFAULT_GATE_TIME_TOLERANCE 50
+#define MINIMUM_GATED_MILLISECONDS 1.0
+#define GATE_INSTRUCTION_COUNT 100000
+#define GATE_WORKLOAD_COUNT 3
+#define GATE_BUILD_CAPACITY 64
+
+/* Times and bytes depend on how the assembler was built, so they are only gated against a baseline recorded by the
+ * same kind of build: the CMake build type, and whether it runs under a sanitizer, which changes the allocator. */
+#ifndef SHACK_BUILD_TYPE
+#define SHACK_BUILD_TYPE ""
+#endif
+
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define GATE_SANITIZER_SUFFIX "+sanitizer"
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer) || __has_feature(memory_sanitizer)
+#define GATE_SANITIZER_SUFFIX "+sanitizer"
+#endif
+#endif
+
+#ifndef GATE_SANITIZER_SUFFIX
+#define GATE_SANITIZER_SUFFIX ""
+#endif
+
+enum gate_metric {
+    ALLOCATIONS_METRIC,
+    ALLOCATED_BYTES_METRIC,
+    READ_METRIC, // Followed by the median milliseconds of every other step.
+    GATE_METRIC_COUNT = READ_METRIC + ASSEMBLY_STEP_COUNT,
+};
+
+static const char* GATE_METRIC_NAMES[GATE_METRIC_COUNT] = {
+    "allocations", "bytes_allocated", "read_ms", "parse_ms", "sync_ms", "translate_ms", "export_ms",
+};
+
+static const char* GATE_WORKLOAD_NAMES[GATE_WORKLOAD_COUNT] = { "synthetic", "labels", "lines" };
+
+struct gate_baseline {
+    char build[GATE_BUILD_CAPACITY]; // Empty if the baseline does not tell.
+    double metrics[GATE_WORKLOAD_COUNT][GATE_METRIC_COUNT];
+    int is_known[GATE_WORKLOAD_COUNT][GATE_METRIC_COUNT];
+};
+
+typedef struct gate_baseline t_gate_baseline;
+
+enum bench_engine {
+    SERIAL_ENGINE,    // One file on the calling thread, step after step.
+    PARALLEL_ENGINE,  // On a worker pool, where big files are split into partitions.
+    PIPELINED_ENGINE, // A thread per stage.
+    BENCH_ENGINE_COUNT,
+};
+
+typedef enum bench_engine t_bench_engine;
+
+static const char* ENGINE_NAMES[BENCH_ENGINE_COUNT] = { "serial", "parallel", "pipelined" };
+
+/* The wall time, and then the time of every step, of each run. */
+#define BENCH_SAMPLE_WIDTH (ASSEMBLY_STEP_COUNT + 1)
+
+struct bench_run {
+    const t_assembler_options* options;
+    const char* file_path;
+    int result;
+    t_assembly_statistics statistics;
+};
+
+typedef struct bench_run t_bench_run;
+
+struct bench_workload {
+    char name[BENCH_PATH_CAPACITY];
+    char path[BENCH_PATH_CAPACITY];
+    size_t length;
+    size_t instruction_count; // Known once the serial engine assembled it.
+};
+
+typedef struct bench_workload t_bench_workload;
+
+int create_bench_directory(char* directory, size_t capacity);
+int parse_bench_number(const char* argument, const char* command, size_t minimum, size_t* value);
+int write_bench_workload(t_bench_workload* workload, const char* directory, const char* name, const char* content,
+                         size_t length);
+void remove_bench_workload(const t_bench_workload* workload);
+int run_bench_engine(t_bench_engine engine, t_bench_workload* workload, size_t run_count, size_t job_count);
+int run_bench_once(t_bench_engine engine, t_bench_run* run, t_worker_pool* pool, t_assembler_context* context,
+                   uint64_t* samples);
+void run_bench_task(void* argument, void* worker_context);
+uint64_t get_median_sample(const uint64_t* samples, size_t run_count, size_t offset);
+int compare_samples(const void* first, const void* second);
+int run_scaling_check(size_t maximum_size, size_t run_count);
+int measure_scaling_axis(const char* name, const t_workload_shape* shape, size_t maximum_size, size_t run_count,
+                         t_assembler_context* context, double* exponent);
+void initialize_gate_shapes(t_workload_shape* shapes);
+int run_performance_gate(const char* baseline_path, int is_writing_baseline, size_t run_count,
+                         size_t allocation_tolerance, size_t time_tolerance);
+int measure_gate_workload(const t_workload_shape* shape, const char* directory, const char* name, size_t run_count,
+                          double* metrics);
+int read_gate_baseline(const char* baseline_path, t_gate_baseline* baseline);
+int write_gate_baseline(const char* baseline_path, double metrics[GATE_WORKLOAD_COUNT][GATE_METRIC_COUNT]);
+const char* skip_json_space(const char* position);
+const char* read_json_key(const char* position, const char** key, size_t* key_length);
+long find_gate_name(const char** names, size_t name_count, const char* key, size_t key_length);
+const char* get_gate_build(void);
+
+int main(int argc, char** argv) {
+    const char* RUNS_COMMAND = "--runs";
+    const char* JOBS_COMMAND = "--jobs";
+    const char* SCALE_COMMAND = "--scale";
+    const char* INSTRUCTIONS_COMMAND = "--instructions";
+    const char* LABELS_COMMAND = "--labels";
+    const char* VARIABLES_COMMAND = "--variables";
+    const char* COMMENTS_COMMAND = "--comments";
+    const char* LINE_LENGTH_COMMAND = "--line-length";
+    const char* A_COMMANDS_COMMAND = "--a-commands";
+    const char* SEED_COMMAND = "--seed";
+    const char* SCALING_COMMAND = "--scaling";
+    const char* GATE_COMMAND = "--gate";
+    const char* WRITE_BASELINE_COMMAND = "--write-baseline";
+    const char* TOLERANCE_COMMAND = "--tolerance";
+    const char* TIME_TOLERANCE_COMMAND = "--time-tolerance";
+
+    t_workload_shape shape;
+    initialize_workload_shape(&shape);
+
+    size_t run_count = DEFAULT_BENCH_RUN_COUNT;
+    size_t job_count = get_available_processor_count();
+    size_t scale = DEFAULT_BENCH_SCALE;
+    size_t label_density = shape.label_density;
+    size_t comment_ratio = shape.comment_ratio;
+    size_t a_command_ratio = shape.a_command_ratio;
+    size_t seed = (size_t)shape.seed;
+    int first_sample = argc;
+    size_t maximum_scaling_size = 0L;
+    const char* baseline_path = NULL;
+    int is_writing_baseline = 0;
+    size_t allocation_tolerance = DEFAULT_GATE_ALLOCATION_TOLERANCE;
+    size_t time_tolerance = DEFAULT_GATE_TIME_TOLERANCE;
+
+    /* Partitions are only stolen by a second worker, even on a single processor. */
+    if (job_count < 2) {
+        job_count = 2;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        int result;
+
+        if (strncmp(argv[i], "--", 2) != 0) {
+            first_sample = i;
+            break;
+        }
+
+        if (strcmp(argv[i], SCALING_COMMAND) == 0) {
+            maximum_scaling_size = DEFAULT_MAXIMUM_SCALING_SIZE;
+            continue;
+        }
+
+        if ((strncmp(argv[i], GATE_COMMAND, strlen(GATE_COMMAND)) == 0) && (argv[i][strlen(GATE_COMMAND)] == '=')) {
+            baseline_path = argv[i] + strlen(GATE_COMMAND) + 1;
+            is_writing_baseline = 0;
+            continue;
+        }
+
+        if ((strncmp(argv[i], WRITE_BASELINE_COMMAND, strlen(WRITE_BASELINE_COMMAND)) == 0) &&
+            (argv[i][strlen(WRITE_BASELINE_COMMAND)] == '=')) {
+            baseline_path = argv[i] + strlen(WRITE_BASELINE_COMMAND) + 1;
+            is_writing_baseline = 1;
+            continue;
+        }
+
+        if (((result = parse_bench_number(argv[i], RUNS_COMMAND, 1, &run_count)) == 0) &&
+            ((result = parse_bench_number(argv[i], SCALING_COMMAND, MINIMUM_SCALING_SIZE * 10,
+                                          &maximum_scaling_size)) == 0) &&
+            ((result = parse_bench_number(argv[i], TOLERANCE_COMMAND, 0, &allocation_tolerance)) == 0) &&
+            ((result = parse_bench_number(argv[i], TIME_TOLERANCE_COMMAND, 0, &time_tolerance)) == 0) &&
+            ((result = parse_bench_number(argv[i], JOBS_COMMAND, 1, &job_count)) == 0) &&
+            ((result = parse_bench_number(argv[i], SCALE_COMMAND, 1, &scale)) == 0) &&
+            ((result = parse_bench_number(argv[i], INSTRUCTIONS_COMMAND, 1, &shape.instruction_count)) == 0) &&
+            ((result = parse_bench_number(argv[i], LABELS_COMMAND, 0, &label_density)) == 0) &&
+            ((result = parse_bench_number(argv[i], VARIABLES_COMMAND, 0, &shape.variable_count)) == 0) &&
+            ((result = parse_bench_number(argv[i], COMMENTS_COMMAND, 0, &comment_ratio)) == 0) &&
+            ((result = parse_bench_number(argv[i], LINE_LENGTH_COMMAND, 0, &shape.line_length)) == 0) &&
+            ((result = parse_bench_number(argv[i], A_COMMANDS_COMMAND, 0, &a_command_ratio)) == 0) &&
+            ((result = parse_bench_number(argv[i], SEED_COMMAND, 0, &seed)) == 0)) {
+            report_error("Error: unknown command '%s'.\n", argv[i]);
+            result = -1;
+        }
+
+        if (result < 0) {
+            report("Usage: %s [--runs=N] [--jobs=N] [--scale=N] [--instructions=N] [--labels=PER_THOUSAND] "
+                   "[--variables=N] [--comments=PERCENT] [--line-length=N] [--a-commands=PERCENT] [--seed=N] "
+                   "[sample.asm ...]\n"
+                   "       %s --scaling[=MAXIMUM_INSTRUCTIONS] [--runs=N]\n"
+                   "       %s --gate=BASELINE.json | --write-baseline=BASELINE.json [--runs=N] [--tolerance=PERCENT] "
+                   "[--time-tolerance=PERCENT]\n", argv[0], argv[0], argv[0]);
+            return -1;
+        }
+    }
+
+    shape.label_density = (unsigned int)label_density;
+    shape.comment_ratio = (unsigned int)comment_ratio;
+    shape.a_command_ratio = (unsigned int)a_command_ratio;
+    shape.seed = (uint64_t)seed;
+
+    if (maximum_scaling_size > 0) {
+        return (run_scaling_check(maximum_scaling_size, run_count) > 0) ? 0 : -1;
+    }
+
+    if (baseline_path != NULL) {
+        return (run_performance_gate(baseline_path, is_writing_baseline, run_count, allocation_tolerance,
+                                     time_tolerance) > 0) ? 0 : -1;
+    }
+
+    char directory[BENCH_PATH_CAPACITY];
+
+    if (create_bench_directory(directory, sizeof(directory)) < 0) {
+        return -1;
+    }
+
+    size_t workload_count = 1 + (size_t)(argc - first_sample);
+    t_bench_workload* workloads = allocate_memory(sizeof(t_bench_workload) * workload_count);
+    size_t written_count = 0L;
+    int result = (workloads != NULL) ? 1 : -1;
+
+    if (result > 0) {
+        char* content = NULL;
+        size_t length = 0L;
+
+        result = generate_workload(&shape, &content, &length);
+
+        if (result > 0) {
+            result = write_bench_workload(&workloads[written_count], directory, "synthetic", content, length);
+            written_count += (result > 0) ? 1 : 0;
+        }
+
+        release_memory(content);
+    }
+
+    for (int i = first_sample; (result > 0) && (i < argc); i++) {
+        t_source_buffer source;
+        char* content = NULL;
+        size_t length = 0L;
+        char name[BENCH_PATH_CAPACITY];
+        const char* file_name = strrchr(argv[i], '/');
+        const char* extension = NULL;
+
+        if (load_source_file(argv[i], &source) < 0) {
+            report_error("Error: could not load the sample program '%s'.\n", argv[i]);
+            result = -1;
+            break;
+        }
+
+        result = scale_workload(source.content, source.length, scale, &content, &length);
+        dispose_source_buffer(&source);
+
+        file_name = (file_name != NULL) ? (file_name + 1) : argv[i];
+        extension = strrchr(file_name, '.');
+
+        snprintf(name, sizeof(name), "%lu_%.*s_x%lu", written_count,
+                 (int)((extension != NULL) ? (size_t)(extension - file_name) : strlen(file_name)), file_name, scale);
+
+        if (result > 0) {
+            result = write_bench_workload(&workloads[written_count], directory, name, content, length);
+            written_count += (result > 0) ? 1 : 0;
+        }
+
+        release_memory(content);
+    }
+
+    if (result > 0) {
+        report("Every engine runs once to warm up, and then %lu times. Times are medians, with %lu jobs in parallel.\n",
+               run_count, job_count);
+    }
+
+    for (size_t i = 0; (result > 0) && (i < written_count); i++) {
+        report("Workload '%s': %lu bytes.\n", workloads[i].name, workloads[i].length);
+
+        for (size_t engine = 0; (result > 0) && (engine < BENCH_ENGINE_COUNT); engine++) {
+            result = run_bench_engine((t_bench_engine)engine, &workloads[i], run_count, job_count);
+        }
+    }
+
+    for (size_t i = 0; i < written_count; i++) {
+        remove_bench_workload(&workloads[i]);
+    }
+
+    rmdir(directory);
+    release_memory(workloads);
+
+    if (result < 0) {
+        report_error("Error: the benchmark failed.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int create_bench_directory(char* directory, size_t capacity) {
+    const char* temporary_path = getenv("TMPDIR");
+
+    snprintf(directory, capacity, "%s/bench_shack.XXXXXX", (temporary_path != NULL) ? temporary_path : "/tmp");
+
+    if (mkdtemp(directory) == NULL) {
+        report_error("Error: could not create a directory for the workloads: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    return 1;
+}
+
+/* Returns 1 if 'argument' is 'command=N' with N at least 'minimum', 0 if it is another command, and -1 otherwise. */
+int parse_bench_number(const char* argument, const char* command, size_t minimum, size_t* value) {
+    size_t command_length = strlen(command);
+
+    if ((strncmp(argument, command, command_length) != 0) || (argument[command_length] != '=')) {
+        return 0;
+    }
+
+    const char* number = argument + command_length + 1;
+    char* end = NULL;
+    unsigned long long parsed_value = strtoull(number, &end, 10);
+
+    if ((end == number) || (*end != '\0') || (*number == '-') || (parsed_value < minimum)) {
+        report_error("Error: '%s' expects a number, at least %lu.\n", argument, minimum);
+        return -1;
+    }
+
+    *value = (size_t)parsed_value;
+
+    return 1;
+}
+
+int write_bench_workload(t_bench_workload* workload, const char* directory, const char* name, const char* content,
+                         size_t length) {
+    snprintf(workload->name, sizeof(workload->name), "%s", name);
+    snprintf(workload->path, sizeof(workload->path), "%s/%s.asm", directory, name);
+    workload->length = length;
+    workload->instruction_count = 0L;
+
+    FILE* file = fopen(workload->path, "wb");
+
+    if (file == NULL) {
+        report_error("Error: could not create the workload '%s': %s.\n", workload->path, strerror(errno));
+        return -1;
+    }
+
+    size_t written_length = fwrite(content, sizeof(char), length, file);
+
+    if ((fclose(file) != 0) || (written_length != length)) {
+        unlink(workload->path);
+        report_error("Error: could not write the workload '%s'.\n", workload->path);
+        return -1;
+    }
+
+    return 1;
+}
+
+/* Removes the workload and the program assembled out of it. */
+void remove_bench_workload(const t_bench_workload* workload) {
+    char output_path[BENCH_PATH_CAPACITY];
+    size_t path_length = strlen(workload->path);
+
+    snprintf(output_path, sizeof(output_path), "%.*s.%s", (int)(path_length - 4), workload->path,
+             get_artifact_extension(HACK_ARTIFACT));
+
+    unlink(workload->path);
+    unlink(output_path);
+}
+
+int run_bench_engine(t_bench_engine engine, t_bench_workload* workload, size_t run_count, size_t job_count) {
+    t_assembler_options options = {
+        .verbose_mode = 0,
+        .artifacts = HACK_ARTIFACT,
+        .job_count = 1,
+        .output_to_standard_output = 0,
+        .output_file_path = NULL,
+        .cache = NULL,
+        .job_server = NULL,
+        .is_pipelined = (engine == PIPELINED_ENGINE),
+        .statistics_format = NO_STATISTICS,
+    };
+
+    t_bench_run run = { .options = &options, .file_path = workload->path, .result = 1 };
+    t_worker_pool* pool = NULL;
+    t_assembler_context* context = NULL;
+    uint64_t* samples = allocate_memory(sizeof(uint64_t) * BENCH_SAMPLE_WIDTH * (run_count + 1));
+    int result = (samples != NULL) ? 1 : -1;
+
+    if ((result > 0) && (engine == PARALLEL_ENGINE)) {
+        result = create_worker_pool(&pool, job_count, create_assembler_context, dispose_assembler_context);
+    }
+    else if (result > 0) {
+        context = create_assembler_context(0);
+        result = (context != NULL) ? 1 : -1;
+    }
+
+    /* The first run only warms up the caches and the allocator. */
+    for (size_t i = 0; (result > 0) && (i <= run_count); i++) {
+        result = run_bench_once(engine, &run, pool, context, &samples[BENCH_SAMPLE_WIDTH * i]);
+    }
+
+    if (result > 0) {
+        const uint64_t* timed_samples = &samples[BENCH_SAMPLE_WIDTH];
+        double seconds = (double)get_median_sample(timed_samples, run_count, 0) / 1e9;
+
+        if (engine == SERIAL_ENGINE) {
+            workload->instruction_count = run.statistics.a_command_count + run.statistics.c_command_count;
+        }
+
+        report("    %-9s %9.3f ms, %8.2f MB/s, %11.0f instructions/s", ENGINE_NAMES[engine], seconds * 1e3,
+               (seconds > 0) ? ((double)workload->length / 1e6 / seconds) : 0.0,
+               (seconds > 0) ? ((double)workload->instruction_count / seconds) : 0.0);
+
+        /* The stages of the pipeline overlap, so they are not timed one by one. */
+        if (engine != PIPELINED_ENGINE) {
+            for (size_t step = 0; step < ASSEMBLY_STEP_COUNT; step++) {
+                report("%s%s %.3f ms", (step > 0) ? ", " : " (", get_assembly_step_name((t_assembly_step)step),
+                       (double)get_median_sample(timed_samples, run_count, step + 1) / 1e6);
+            }
+
+            report(")");
+        }
+
+        report(".\n");
+    }
+
+    dispose_worker_pool(pool);
+    dispose_assembler_context(context);
+    release_memory(samples);
+
+    if (run.result < 0) {
+        report_error("Error: the %s engine failed to assemble '%s'.\n", ENGINE_NAMES[engine], workload->path);
+    }
+
+    return (run.result < 0) ? -1 : result;
+}
+
+int run_bench_once(t_bench_engine engine, t_bench_run* run, t_worker_pool* pool, t_assembler_context* context,
+                   uint64_t* samples) {
+    uint64_t started_at = get_monotonic_nanoseconds();
+
+    if (engine == PARALLEL_ENGINE) {
+        if (submit_task_to_worker_pool(pool, run_bench_task, run) < 0) {
+            return -1;
+        }
+
+        wait_for_worker_pool(pool);
+    }
+    else {
+        run_bench_task(run, context);
+    }
+
+    samples[0] = get_monotonic_nanoseconds() - started_at;
+
+    for (size_t step = 0; step < ASSEMBLY_STEP_COUNT; step++) {
+        samples[step + 1] = run->statistics.step_nanoseconds[step];
+    }
+
+    return (run->result < 0) ? -1 : 1;
+}
+
+/* Captures the statistics on the thread which assembles the file, being the one its steps are timed on. */
+void run_bench_task(void* argument, void* worker_context) {
+    t_bench_run* run = argument;
+
+    initialize_assembly_statistics(&run->statistics);
+    begin_statistics_capture(&run->statistics);
+
+    run->result = assemble_source_file(run->options, worker_context, run->file_path);
+
+    end_statistics_capture();
+}
+
+uint64_t get_median_sample(const uint64_t* samples, size_t run_count, size_t offset) {
+    uint64_t* values = allocate_memory(sizeof(uint64_t) * run_count);
+
+    if (values == NULL) {
+        return samples[offset];
+    }
+
+    for (size_t i = 0; i < run_count; i++) {
+        values[i] = samples[(BENCH_SAMPLE_WIDTH * i) + offset];
+    }
+
+    qsort(values, run_count, sizeof(uint64_t), compare_samples);
+
+    uint64_t median = ((run_count % 2) == 1) ? values[run_count / 2] :
+                      ((values[(run_count / 2) - 1] + values[run_count / 2]) / 2);
+
+    release_memory(values);
+
+    return median;
+}
+
+int compare_samples(const void* first, const void* second) {
+    uint64_t first_sample = *(const uint64_t*)first;
+    uint64_t second_sample = *(const uint64_t*)second;
+
+    return (first_sample > second_sample) - (first_sample < second_sample);
+}
+
+/* Each axis grows one thing the assembler keeps track of, in memory only, so that the disk does not hide it. */
+int run_scaling_check(size_t maximum_size, size_t run_count) {
+    t_workload_shape label_shape;
+    t_workload_shape variable_shape;
+    t_workload_shape constant_shape;
+    t_workload_shape line_shape;
+
+    initialize_workload_shape(&label_shape);
+    label_shape.label_density = 500;
+    label_shape.variable_count = 0L;
+    label_shape.comment_ratio = 0;
+    label_shape.a_command_ratio = 100;
+
+    /* Variables can only grow up to the RAM, past which the references to them keep growing instead. */
+    initialize_workload_shape(&variable_shape);
+    variable_shape.label_density = 0;
+    variable_shape.variable_count = MAXIMUM_WORKLOAD_VARIABLE_COUNT;
+    variable_shape.comment_ratio = 0;
+    variable_shape.a_command_ratio = 100;
+
+    initialize_workload_shape(&constant_shape);
+    constant_shape.label_density = 0;
+    constant_shape.variable_count = 0L;
+    constant_shape.comment_ratio = 0;
+    constant_shape.a_command_ratio = 100;
+
+    initialize_workload_shape(&line_shape);
+    line_shape.comment_ratio = 50;
+    line_shape.line_length = 80;
+
+    const char* AXIS_NAMES[] = { "labels", "variables", "constants", "lines" };
+    const t_workload_shape* AXIS_SHAPES[] = { &label_shape, &variable_shape, &constant_shape, &line_shape };
+    const size_t AXIS_COUNT = sizeof(AXIS_NAMES) / sizeof(AXIS_NAMES[0]);
+
+    t_assembler_context* context = create_assembler_context(0);
+    size_t failed_count = 0L;
+    int result = (context != NULL) ? 1 : -1;
+
+    if (result > 0) {
+        report("Scaling from %d to %lu instructions, with the median of %lu runs per size. Every axis must grow at most "
+               "as n^%.2f.\n", MINIMUM_SCALING_SIZE, maximum_size, run_count, MAXIMUM_SCALING_EXPONENT);
+    }
+
+    for (size_t i = 0; (result > 0) && (i < AXIS_COUNT); i++) {
+        double exponent = 0.0;
+
+        result = measure_scaling_axis(AXIS_NAMES[i], AXIS_SHAPES[i], maximum_size, run_count, context, &exponent);
+
+        if ((result > 0) && (exponent > MAXIMUM_SCALING_EXPONENT)) {
+            report_error("Error: the %s axis grows as n^%.2f, worse than n log n.\n", AXIS_NAMES[i], exponent);
+            failed_count++;
+        }
+    }
+
+    dispose_assembler_context(context);
+
+    if (result < 0) {
+        return -1;
+    }
+
+    return (failed_count > 0) ? 0 : 1;
+}
+
+/* Fits the exponent with least squares, over the logarithms of the sizes and their median times. */
+int measure_scaling_axis(const char* name, const t_workload_shape* shape, size_t maximum_size, size_t run_count,
+                         t_assembler_context* context, double* exponent) {
+    t_assembler_options options = {
+        .verbose_mode = 0,
+        .artifacts = HACK_ARTIFACT,
+        .job_count = 1,
+        .output_to_standard_output = 0,
+        .output_file_path = NULL,
+        .cache = NULL,
+        .job_server = NULL,
+        .is_pipelined = 0,
+        .statistics_format = NO_STATISTICS,
+    };
+
+    uint64_t* samples = allocate_memory(sizeof(uint64_t) * BENCH_SAMPLE_WIDTH * run_count);
+    double sum_x = 0.0;
+    double sum_y = 0.0;
+    double sum_xx = 0.0;
+    double sum_xy = 0.0;
+    size_t point_count = 0L;
+    int result = (samples != NULL) ? 1 : -1;
+
+    report("    %-9s", name);
+
+    for (size_t size = MINIMUM_SCALING_SIZE; (result > 0) && (size <= maximum_size); size *= 10) {
+        t_workload_shape sized_shape = *shape;
+        char* content = NULL;
+        size_t length = 0L;
+        size_t repeat_count = 1L;
+
+        sized_shape.instruction_count = size;
+
+        if (sized_shape.variable_count > size) {
+            sized_shape.variable_count = size;
+        }
+
+        result = generate_workload(&sized_shape, &content, &length);
+
+        for (size_t run = 0; (result > 0) && (run <= run_count); run++) {
+            uint64_t started_at = get_monotonic_nanoseconds();
+
+            for (size_t j = 0; (result > 0) && (j < repeat_count); j++) {
+                uint16_t* words = NULL;
+                size_t word_count = 0L;
+
+                result = assemble_source_to_words(&options, context, content, length, &words, &word_count);
+                release_memory(words);
+            }
+
+            uint64_t nanoseconds = get_monotonic_nanoseconds() - started_at;
+
+            /* The first run warms up, and tells how many times the rest must repeat the size. */
+            if (run == 0) {
+                repeat_count = (nanoseconds < SCALING_SAMPLE_NANOSECONDS) ?
+                               ((SCALING_SAMPLE_NANOSECONDS / ((nanoseconds > 0) ? nanoseconds : 1)) + 1) : 1;
+            }
+            else {
+                samples[BENCH_SAMPLE_WIDTH * (run - 1)] = nanoseconds / repeat_count;
+            }
+        }
+
+        release_memory(content);
+
+        if (result < 0) {
+            report("\n");
+            report_error("Error: failed to assemble the %s axis at %lu instructions.\n", name, size);
+            break;
+        }
+
+        double seconds = (double)get_median_sample(samples, run_count, 0) / 1e9;
+        double x = log((double)size);
+        double y = log((seconds > 0) ? seconds : 1e-9);
+
+        sum_x += x;
+        sum_y += y;
+        sum_xx += x * x;
+        sum_xy += x * y;
+        point_count++;
+
+        report(" %lu: %.3f ms,", size, seconds * 1e3);
+    }
+
+    release_memory(samples);
+
+    if (result < 0) {
+        return -1;
+    }
+
+    *exponent = ((point_count * sum_xx) - (sum_x * sum_x) > 0) ?
+                (((point_count * sum_xy) - (sum_x * sum_y)) / ((point_count * sum_xx) - (sum_x * sum_x))) : 1.0;
+
+    report(" n^%.2f.\n", *exponent);
+
+    return 1;
+}
+
+/* The default program, one made mostly of labels, and one of long commented lines, so that a regression in the symbol
+ * table or in the scanning of lines does not hide behind the other steps. */
+void initialize_gate_shapes(t_workload_shape* shapes) {
+    for (size_t i = 0; i < GATE_WORKLOAD_COUNT; i++) {
+        initialize_workload_shape(&shapes[i]);
+        shapes[i].instruction_count = GATE_INSTRUCTION_COUNT;
+    }
+
+    shapes[1].label_density = 500;
+    shapes[1].a_command_ratio = 100;
+
+    shapes[2].comment_ratio = 50;
+    shapes[2].line_length = 120;
+}
+
+/* Measures the gate workloads, and either compares them with the baseline, or writes them as the new baseline. */
+int run_performance_gate(const char* baseline_path, int is_writing_baseline, size_t run_count,
+                         size_t allocation_tolerance, size_t time_tolerance) {
+    t_workload_shape shapes[GATE_WORKLOAD_COUNT];
+    t_gate_baseline baseline;
+    double metrics[GATE_WORKLOAD_COUNT][GATE_METRIC_COUNT];
+    char directory[BENCH_PATH_CAPACITY];
+
+    if (!is_writing_baseline && (read_gate_baseline(baseline_path, &baseline) < 0)) {
+        return -1;
+    }
+
+    if (create_bench_directory(directory, sizeof(directory)) < 0) {
+        return -1;
+    }
+
+    initialize_gate_shapes(shapes);
+    start_memory_accounting(0);
+
+    int result = 1;
+
+    for (size_t i = 0; (result > 0) && (i < GATE_WORKLOAD_COUNT); i++) {
+        result = measure_gate_workload(&shapes[i], directory, GATE_WORKLOAD_NAMES[i], run_count, metrics[i]);
+    }
+
+    rmdir(directory);
+
+    if (result < 0) {
+        return -1;
+    }
+
+    if (is_writing_baseline) {
+        return write_gate_baseline(baseline_path, metrics);
+    }
+
+    size_t regressed_count = 0L;
+    int is_same_build = (strcmp(baseline.build, get_gate_build()) == 0);
+
+    report("Gate against '%s', allocations within %lu%% and times within %lu%% of it:\n", baseline_path,
+           allocation_tolerance, time_tolerance);
+
+    if (!is_same_build) {
+        report_warning("Warning: only allocations are gated, since the baseline was recorded by a '%s' build, and this "
+                       "is a '%s' one.\n", (baseline.build[0] != '\0') ? baseline.build : "unknown", get_gate_build());
+    }
+
+    for (size_t i = 0; i < GATE_WORKLOAD_COUNT; i++) {
+        for (size_t j = 0; j < GATE_METRIC_COUNT; j++) {
+            double value = metrics[i][j];
+            int precision = (j < READ_METRIC) ? 0 : 3;
+
+            if (!baseline.is_known[i][j]) {
+                report("    %-9s %-15s %14.*f, not in the baseline.\n", GATE_WORKLOAD_NAMES[i], GATE_METRIC_NAMES[j],
+                       precision, value);
+                continue;
+            }
+
+            double expected = baseline.metrics[i][j];
+            size_t tolerance = (j < READ_METRIC) ? allocation_tolerance : time_tolerance;
+            int has_regressed = (value > (expected * (1.0 + ((double)tolerance / 100.0))));
+
+            if ((j >= READ_METRIC) && ((value - expected) < MINIMUM_GATED_MILLISECONDS)) {
+                has_regressed = 0;
+            }
+
+            if ((j != ALLOCATIONS_METRIC) && !is_same_build) {
+                has_regressed = 0;
+            }
+
+            report("    %-9s %-15s %14.*f, baseline %14.*f, %+7.1f%%%s\n", GATE_WORKLOAD_NAMES[i],
+                   GATE_METRIC_NAMES[j], precision, value, precision, expected,
+                   (expected > 0) ? (((value / expected) - 1.0) * 100.0) : 0.0, has_regressed ? ", regressed." : ".");
+
+            regressed_count += (size_t)has_regressed;
+        }
+    }
+
+    if (regressed_count > 0) {
+        report_error("Error: %lu metrics regressed past their tolerance.\n", regressed_count);
+        return -1;
+    }
+
+    return 1;
+}
+
+/* Steps are the median of 'run_count' serial runs, after one to warm up, while allocations are those of the last run,
+ * which only change with the code. */
+int measure_gate_workload(const t_workload_shape* shape, const char* directory, const char* name, size_t run_count,
+                          double* metrics) {
+    t_assembler_options options = {
+        .verbose_mode = 0,
+        .artifacts = HACK_ARTIFACT,
+        .job_count = 1,
+        .output_to_standard_output = 0,
+        .output_file_path = NULL,
+        .cache = NULL,
+        .job_server = NULL,
+        .is_pipelined = 0,
+        .statistics_format = NO_STATISTICS,
+    };
+
+    t_bench_workload workload;
+    char* content = NULL;
+    size_t length = 0L;
+
+    if (generate_workload(shape, &content, &length) < 0) {
+        return -1;
+    }
+
+    int result = write_bench_workload(&workload, directory, name, content, length);
+
+    release_memory(content);
+
+    if (result < 0) {
+        return -1;
+    }
+
+    t_bench_run run = { .options = &options, .file_path = workload.path, .result = 1 };
+    t_assembler_context* context = create_assembler_context(0);
+    uint64_t* samples = allocate_memory(sizeof(uint64_t) * BENCH_SAMPLE_WIDTH * (run_count + 1));
+
+    result = ((context != NULL) && (samples != NULL)) ? 1 : -1;
+
+    for (size_t i = 0; (result > 0) && (i <= run_count); i++) {
+        result = run_bench_once(SERIAL_ENGINE, &run, NULL, context, &samples[BENCH_SAMPLE_WIDTH * i]);
+    }
+
+    if (result > 0) {
+        metrics[ALLOCATIONS_METRIC] = (double)run.statistics.allocation_count;
+        metrics[ALLOCATED_BYTES_METRIC] = (double)run.statistics.allocated_byte_count;
+
+        for (size_t step = 0; step < ASSEMBLY_STEP_COUNT; step++) {
+            metrics[READ_METRIC + step] = (double)get_median_sample(&samples[BENCH_SAMPLE_WIDTH], run_count,
+                                                                    step + 1) / 1e6;
+        }
+    }
+    else {
+        report_error("Error: failed to assemble the gate workload '%s'.\n", workload.path);
+    }
+
+    dispose_assembler_context(context);
+    release_memory(samples);
+    remove_bench_workload(&workload);
+
+    return result;
+}
+
+/* Reads the object written by 'write_gate_baseline', holding an object of numbers for every workload. Workloads and
+ * metrics it does not know are skipped, so that a baseline can outlive the gate which wrote it. */
+int read_gate_baseline(const char* baseline_path, t_gate_baseline* baseline) {
+    t_source_buffer source;
+
+    memset(baseline, 0, sizeof(t_gate_baseline));
+
+    if (load_source_file(baseline_path, &source) < 0) {
+        report_error("Error: could not read the baseline '%s'.\n", baseline_path);
+        return -1;
+    }
+
+    const char* position = skip_json_space(source.content);
+    int result = (*position == '{') ? 1 : -1;
+
+    if (result > 0) {
+        position = skip_json_space(position + 1);
+    }
+
+    while ((result > 0) && (*position == '"')) {
+        const char* key = NULL;
+        size_t key_length = 0L;
+
+        position = read_json_key(position, &key, &key_length);
+
+        /* The only string is the build which recorded the baseline. */
+        if ((position != NULL) && (*position == '"')) {
+            const char* end = strchr(position + 1, '"');
+
+            if (end == NULL) {
+                result = -1;
+                break;
+            }
+
+            if ((key_length == strlen("build")) && (strncmp(key, "build", key_length) == 0)) {
+                snprintf(baseline->build, sizeof(baseline->build), "%.*s", (int)(end - position - 1), position + 1);
+            }
+
+            position = skip_json_space(end + 1);
+            position = skip_json_space((*position == ',') ? (position + 1) : position);
+            continue;
+        }
+
+        if ((position == NULL) || (*position != '{')) {
+            result = -1;
+            break;
+        }
+
+        long workload = find_gate_name(GATE_WORKLOAD_NAMES, GATE_WORKLOAD_COUNT, key, key_length);
+
+        position = skip_json_space(position + 1);
+
+        while (*position == '"') {
+            position = read_json_key(position, &key, &key_length);
+
+            char* end = NULL;
+            double value = (position != NULL) ? strtod(position, &end) : 0.0;
+
+            if ((position == NULL) || (end == position)) {
+                result = -1;
+                break;
+            }
+
+            long metric = find_gate_name(GATE_METRIC_NAMES, GATE_METRIC_COUNT, key, key_length);
+
+            if ((workload >= 0) && (metric >= 0)) {
+                baseline->metrics[workload][metric] = value;
+                baseline->is_known[workload][metric] = 1;
+            }
+
+            position = skip_json_space(end);
+            position = skip_json_space((*position == ',') ? (position + 1) : position);
+        }
+
+        if ((result < 0) || (*position != '}')) {
+            result = -1;
+            break;
+        }
+
+        position = skip_json_space(position + 1);
+        position = skip_json_space((*position == ',') ? (position + 1) : position);
+    }
+
+    if ((result > 0) && (*position != '}')) {
+        result = -1;
+    }
+
+    dispose_source_buffer(&source);
+
+    if (result < 0) {
+        report_error("Error: the baseline '%s' is not an object holding an object of numbers for every workload.\n",
+                     baseline_path);
+    }
+
+    return result;
+}
+
+int write_gate_baseline(const char* baseline_path, double metrics[GATE_WORKLOAD_COUNT][GATE_METRIC_COUNT]) {
+    FILE* file = fopen(baseline_path, "w");
+
+    if (file == NULL) {
+        report_error("Error: could not create the baseline '%s': %s.\n", baseline_path, strerror(errno));
+        return -1;
+    }
+
+    fprintf(file, "{\n  \"build\": \"%s\",\n", get_gate_build());
+
+    for (size_t i = 0; i < GATE_WORKLOAD_COUNT; i++) {
+        fprintf(file, "  \"%s\": {\n", GATE_WORKLOAD_NAMES[i]);
+
+        for (size_t j = 0; j < GATE_METRIC_COUNT; j++) {
+            fprintf(file, "    \"%s\": %.*f%s\n", GATE_METRIC_NAMES[j], (j < READ_METRIC) ? 0 : 3, metrics[i][j],
+                    ((j + 1) < GATE_METRIC_COUNT) ? "," : "");
+        }
+
+        fprintf(file, "  }%s\n", ((i + 1) < GATE_WORKLOAD_COUNT) ? "," : "");
+    }
+
+    fprintf(file, "}\n");
+
+    if (fclose(file) != 0) {
+        report_error("Error: could not write the baseline '%s'.\n", baseline_path);
+        return -1;
+    }
+
+    report("Baseline written to '%s'.\n", baseline_path);
+
+    return 1;
+}
+
+const char* skip_json_space(const char* position) {
+    while ((*position == ' ') || (*position == '\t') || (*position == '\n') || (*position == '\r')) {
+        position++;
+    }
+
+    return position;
+}
+
+/* Reads '"key":', without escapes, returning what follows it, or NULL if it is not there. */
+const char* read_json_key(const char* position, const char** key, size_t* key_length) {
+    const char* end = strchr(position + 1, '"');
+
+    if (end == NULL) {
+        return NULL;
+    }
+
+    *key = position + 1;
+    *key_length = (size_t)(end - position - 1);
+    position = skip_json_space(end + 1);
+
+    return (*position == ':') ? skip_json_space(position + 1) : NULL;
+}
+
+/* Returns the index of the name equal to 'key', or -1 if there is none. */
+long find_gate_name(const char** names, size_t name_count, const char* key, size_t key_length) {
+    for (size_t i = 0; i < name_count; i++) {
+        if ((strlen(names[i]) == key_length) && (strncmp(names[i], key, key_length) == 0)) {
+            return (long)i;
+        }
+    }
+
+    return -1;
+}
+
+/* Such as 'Release', or 'Debug+sanitizer', and 'none' if CMake was given no build type. */
+const char* get_gate_build(void) {
+    static const char* BUILD = SHACK_BUILD_TYPE GATE_SANITIZER_SUFFIX;
+
+    return (BUILD[0] == '\0') ? "none" : ((BUILD[0] == '+') ? ("none" GATE_SANITIZER_SUFFIX) : BUILD);
+}
@@ -0,0 +1,324 @@
+//
+// build_cache.c: persistent, content addressed, cache of the artifacts produced for each source file.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "build_cache.h"
+#include "general_types.h"
+#include "output_sink.h"
+#include "diagnostics.h"
+#include "memory_accounting.h"
+
+#ifndef SHACK_ASSEMBLER_VERSION
+#define SHACK_ASSEMBLER_VERSION "unknown"
+#endif
+
+#define DIRECTORY_SEPARATOR '/'
+#define CACHE_DIRECTORY_MODE 0755
+#define KEY_CHARACTERS 32
+#define OLD_KEY_CHARACTERS 16
+#define MAX_EXTENSION_LENGTH 8
+
+struct cached_artifact {
+    char* path;
+    size_t size;
+    time_t last_use;
+};
+
+typedef struct cached_artifact t_cached_artifact;
+
+char* get_cached_artifact_path(t_build_cache* cache, t_build_cache_key key, const char* artifact_extension);
+int is_cached_artifact_name(const char* name);
+int compare_cached_artifacts_by_last_use(const void* first, const void* second);
+int create_directories(const char* directory_path);
+
+int create_build_cache(t_build_cache** cache, const char* directory_path, size_t maximum_size) {
+    if ((cache == NULL) || (directory_path == NULL)) {
+        report_error("Internal Error: null arguments at 'create_build_cache'.\n");
+        return -1;
+    }
+
+    if (create_directories(directory_path) < 0) {
+        report_error("Error: could not create the cache directory '%s'.\n", directory_path);
+        return -1;
+    }
+
+    t_build_cache* build_cache = allocate_memory(sizeof(t_build_cache));
+
+    if (build_cache == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'build_cache' at 'create_build_cache'.\n");
+        return -1;
+    }
+
+    build_cache->directory_path = duplicate_string(directory_path);
+
+    if (build_cache->directory_path == NULL) {
+        release_memory(build_cache);
+        report_error("Internal Error: failed to allocate memory for 'directory_path' at 'create_build_cache'.\n");
+        return -1;
+    }
+
+    build_cache->maximum_size = maximum_size;
+    atomic_init(&build_cache->hit_count, 0);
+    atomic_init(&build_cache->miss_count, 0);
+
+    *cache = build_cache;
+
+    return 1;
+}
+
+t_build_cache_key get_build_cache_key(unsigned long long source_hash, size_t source_length,
+                                      const char* artifact_extension) {
+    unsigned long long check = get_hash_of_bytes(SHACK_ASSEMBLER_VERSION, strlen(SHACK_ASSEMBLER_VERSION), HASH_SEED);
+    check = get_hash_of_bytes(artifact_extension, strlen(artifact_extension) + 1, check); // +1, so '\0' separates them.
+
+    t_build_cache_key key = {
+        .source_hash = source_hash,
+        .check = get_hash_of_bytes(&source_length, sizeof(source_length), check),
+    };
+
+    return key;
+}
+
+int open_cached_artifact(t_build_cache* cache, t_build_cache_key key, const char* artifact_extension,
+                         int* descriptor, size_t* size) {
+    char* path = get_cached_artifact_path(cache, key, artifact_extension);
+
+    if (path == NULL) {
+        return -1;
+    }
+
+    /* Once open, the artifact stays readable even if another process evicts it meanwhile. */
+    int cached_file = open(path, O_RDONLY | O_CLOEXEC);
+    release_memory(path);
+
+    if (cached_file < 0) {
+        return 0;
+    }
+
+    struct stat status;
+
+    if ((fstat(cached_file, &status) < 0) || !S_ISREG(status.st_mode)) {
+        close(cached_file);
+        return 0;
+    }
+
+    /* Marks it as recently used, many file systems do not keep access times. */
+    futimens(cached_file, NULL);
+
+    *descriptor = cached_file;
+    *size = (size_t)status.st_size;
+
+    return 1;
+}
+
+int store_artifact_in_build_cache(t_build_cache* cache, t_build_cache_key key, const char* artifact_extension,
+                                  const char* file_path) {
+    int source_file = open(file_path, O_RDONLY | O_CLOEXEC);
+
+    if (source_file < 0) {
+        report_warning("Warning: could not open '%s' in order to cache it.\n", file_path);
+        return -1;
+    }
+
+    struct stat status;
+
+    if (fstat(source_file, &status) < 0) {
+        close(source_file);
+        report_warning("Warning: could not open '%s' in order to cache it.\n", file_path);
+        return -1;
+    }
+
+    char* path = get_cached_artifact_path(cache, key, artifact_extension);
+
+    if (path == NULL) {
+        close(source_file);
+        return -1;
+    }
+
+    /* Written to a temporary file and renamed, so concurrent readers only ever see whole artifacts. */
+    t_output_sink* sink;
+
+    if (create_file_sink(&sink, path) < 0) {
+        release_memory(path);
+        close(source_file);
+        return -1;
+    }
+
+    int result = write_file_to_output_sink(sink, source_file, (size_t)status.st_size);
+
+    if (result > 0) {
+        result = commit_output_sink(sink);
+    }
+
+    dispose_output_sink(sink);
+    release_memory(path);
+    close(source_file);
+
+    return result;
+}
+
+int evict_build_cache(t_build_cache* cache) {
+    if (cache == NULL) {
+        report_error("Internal Error: null 'cache' at 'evict_build_cache'.\n");
+        return -1;
+    }
+
+    DIR* directory = opendir(cache->directory_path);
+
+    if (directory == NULL) {
+        report_error("Error: could not open the cache directory '%s'.\n", cache->directory_path);
+        return -1;
+    }
+
+    t_cached_artifact* artifacts = NULL;
+    size_t artifact_count = 0;
+    size_t artifact_capacity = 0;
+    size_t total_size = 0;
+    int result = 1;
+
+    struct dirent* directory_entry;
+    while ((directory_entry = readdir(directory)) != NULL) {
+        if (!is_cached_artifact_name(directory_entry->d_name)) {
+            continue;
+        }
+
+        struct stat status;
+
+        if (fstatat(dirfd(directory), directory_entry->d_name, &status, AT_SYMLINK_NOFOLLOW) < 0) {
+            continue;
+        }
+
+        if (artifact_count == artifact_capacity) {
+            size_t new_capacity = (artifact_capacity > 0) ? (artifact_capacity * 2) : DEFAULT_ARRAY_LIST_STEP;
+            t_cached_artifact* new_artifacts = reallocate_memory(artifacts, sizeof(t_cached_artifact) * new_capacity);
+
+            if (new_artifacts == NULL) {
+                report_error("Internal Error: failed to allocate memory for 'artifacts' at 'evict_build_cache'.\n");
+                result = -1;
+                break;
+            }
+
+            artifacts = new_artifacts;
+            artifact_capacity = new_capacity;
+        }
+
+        artifacts[artifact_count].path = duplicate_string(directory_entry->d_name);
+        artifacts[artifact_count].size = (size_t)status.st_size;
+        artifacts[artifact_count].last_use = status.st_mtime;
+
+        if (artifacts[artifact_count].path == NULL) {
+            report_error("Internal Error: failed to allocate memory for 'path' at 'evict_build_cache'.\n");
+            result = -1;
+            break;
+        }
+
+        total_size += artifacts[artifact_count].size;
+        artifact_count++;
+    }
+
+    if ((result > 0) && (total_size > cache->maximum_size)) {
+        qsort(artifacts, artifact_count, sizeof(t_cached_artifact), compare_cached_artifacts_by_last_use);
+
+        for (size_t i = 0; (i < artifact_count) && (total_size > cache->maximum_size); i++) {
+            /* Another process may have evicted it already. */
+            if ((unlinkat(dirfd(directory), artifacts[i].path, 0) == 0) || (errno == ENOENT)) {
+                total_size -= artifacts[i].size;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < artifact_count; i++) {
+        release_memory(artifacts[i].path);
+    }
+
+    release_memory(artifacts);
+    closedir(directory);
+
+    return result;
+}
+
+void dispose_build_cache(t_build_cache* cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    release_memory(cache->directory_path);
+    release_memory(cache);
+}
+
+char* get_cached_artifact_path(t_build_cache* cache, t_build_cache_key key, const char* artifact_extension) {
+    size_t path_length = strlen(cache->directory_path) + 1 + KEY_CHARACTERS + 1 + strlen(artifact_extension);
+    char* path = allocate_memory(sizeof(char) * (path_length + 1)); // +1, in order to add '\0' at the end.
+
+    if (path == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'path' at 'get_cached_artifact_path'.\n");
+        return NULL;
+    }
+
+    sprintf(path, "%s%c%016llx%016llx.%s", cache->directory_path, DIRECTORY_SEPARATOR, key.source_hash, key.check,
+            artifact_extension);
+
+    return path;
+}
+
+/* Artifacts are named '<32 hexadecimal digits>.<extension>', anything else (e.g. temporary files) is left alone. The
+ * ones named with the 16 digits of older versions are never hit anymore, but still evicted. */
+int is_cached_artifact_name(const char* name) {
+    int key_length = 0;
+
+    while ((key_length < KEY_CHARACTERS) && (((name[key_length] >= '0') && (name[key_length] <= '9')) ||
+                                             ((name[key_length] >= 'a') && (name[key_length] <= 'f')))) {
+        key_length++;
+    }
+
+    if (((key_length != KEY_CHARACTERS) && (key_length != OLD_KEY_CHARACTERS)) || (name[key_length] != '.')) {
+        return 0;
+    }
+
+    size_t extension_length = strlen(name + key_length + 1);
+
+    return (extension_length > 0) && (extension_length <= MAX_EXTENSION_LENGTH) &&
+           (strchr(name + key_length + 1, '.') == NULL);
+}
+
+int compare_cached_artifacts_by_last_use(const void* first, const void* second) {
+    time_t first_last_use = ((const t_cached_artifact*)first)->last_use;
+    time_t second_last_use = ((const t_cached_artifact*)second)->last_use;
+
+    return (first_last_use > second_last_use) - (first_last_use < second_last_use);
+}
+
+/* Same as 'mkdir -p'. */
+int create_directories(const char* directory_path) {
+    char* path = duplicate_string(directory_path);
+
+    if (path == NULL) {
+        return -1;
+    }
+
+    for (char* separator = strchr(path + 1, DIRECTORY_SEPARATOR); separator != NULL;
+         separator = strchr(separator + 1, DIRECTORY_SEPARATOR)) {
+        *separator = '\0';
+
+        if ((mkdir(path, CACHE_DIRECTORY_MODE) < 0) && (errno != EEXIST)) {
+            release_memory(path);
+            return -1;
+        }
+
+        *separator = DIRECTORY_SEPARATOR;
+    }
+
+    int result = ((mkdir(path, CACHE_DIRECTORY_MODE) < 0) && (errno != EEXIST)) ? -1 : 1;
+
+    release_memory(path);
+    return result;
+}
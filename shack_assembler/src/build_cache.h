@@ -0,0 +1,49 @@
+//
+// build_cache.h: persistent, content addressed, cache of the artifacts produced for each source file.
+//
+
+#ifndef SHACK_ASSEMBLER_BUILD_CACHE_H
+#define SHACK_ASSEMBLER_BUILD_CACHE_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define DEFAULT_BUILD_CACHE_MAXIMUM_SIZE (256ull * 1024ull * 1024ull)
+
+/* Only the counters change once created, so a single cache can be shared by all the workers. */
+struct build_cache {
+    char* directory_path;
+    size_t maximum_size;
+
+    atomic_size_t hit_count;
+    atomic_size_t miss_count;
+};
+
+typedef struct build_cache t_build_cache;
+
+int create_build_cache(t_build_cache** cache, const char* directory_path, size_t maximum_size);
+
+/* The key depends on the source bytes, the assembler version and the kind of artifact. The source hash is kept as it
+ * is, instead of being hashed once more, so that a hit always needs both the same source hash and the same length. */
+struct build_cache_key {
+    unsigned long long source_hash;
+    unsigned long long check; // Of the assembler version, the kind of artifact and the source length.
+};
+
+typedef struct build_cache_key t_build_cache_key;
+
+t_build_cache_key get_build_cache_key(unsigned long long source_hash, size_t source_length,
+                                      const char* artifact_extension);
+
+/* Returns 1 and an open descriptor if the artifact is cached, or 0 if it is not. */
+int open_cached_artifact(t_build_cache* cache, t_build_cache_key key, const char* artifact_extension,
+                         int* descriptor, size_t* size);
+int store_artifact_in_build_cache(t_build_cache* cache, t_build_cache_key key, const char* artifact_extension,
+                                  const char* file_path);
+
+/* Removes the least recently used artifacts until the cache fits within its maximum size. */
+int evict_build_cache(t_build_cache* cache);
+
+void dispose_build_cache(t_build_cache* cache);
+
+#endif //SHACK_ASSEMBLER_BUILD_CACHE_H
@@ -6,69 +6,402 @@
 #include <string.h>
 
 #define EXTENSION_SEPARATOR '.'
-#define OUTPUT_EXTENSION "hack"
-#define VALUE_OF_16_BITS 65536u
+#define DIRECTORY_SEPARATOR '/'
+#define INSTRUCTION_BITS 16
+#define WRITE_CHUNK_INSTRUCTIONS 65536 // Instructions formatted per write when the sink can not be written in place.
+#define BYTES_PER_BINARY_INSTRUCTION 2
+#define TEXT_CHUNK_SIZE 65536
+#define MAX_TEXT_LINE_SIZE 1024 // Generously above the longest line an instruction of 256 characters can produce.
 
 #include "code_exporter.h"
+#include "instruction.h"
+#include "diagnostics.h"
+#include "memory_accounting.h"
+
+struct text_chunk {
+    char* data;
+    size_t length;
+    t_output_sink* sink;
+};
+
+typedef struct text_chunk t_text_chunk;
+
+int export_instructions_using_writes(const unsigned int* instructions, size_t instruction_count, size_t output_size,
+                                     t_output_sink* sink);
+void format_binary_instructions_into_buffer(const unsigned int* instructions, size_t first_instruction,
+                                            size_t last_instruction, unsigned char* output);
+int create_text_chunk(t_text_chunk* chunk, t_output_sink* sink);
+int reserve_text_chunk_line(t_text_chunk* chunk);
+int flush_text_chunk(t_text_chunk* chunk);
+void dispose_text_chunk(t_text_chunk* chunk);
+size_t format_instruction_source(const t_instruction* instruction, char* output, size_t output_size);
 
 int export_instructions_to_file(const unsigned int* instructions, const char* source_file_path) {
     if (instructions == NULL) {
-        printf("Internal Error: null 'instructions' at 'export_instructions_to_file'.\n");
+        report_error("Internal Error: null 'instructions' at 'export_instructions_to_file'.\n");
         return -1;
     }
 
     if (source_file_path == NULL) {
-        printf("Internal Error: null 'source_file_path' at 'export_instructions_to_file'.\n");
+        report_error("Internal Error: null 'source_file_path' at 'export_instructions_to_file'.\n");
         return -1;
     }
 
-    char* output_file_path = malloc(sizeof(char) * (strlen(source_file_path) + strlen(OUTPUT_EXTENSION)));
+    char* output_file_path = get_output_file_path(source_file_path, HACK_EXTENSION);
 
     if (output_file_path == NULL) {
-        printf("Internal Error: null 'output_file_path' at 'export_instructions_to_file'.\n");
         return -1;
     }
 
-    if (strchr(source_file_path, EXTENSION_SEPARATOR) == NULL) {
-        printf("Internal Error: 'source_file_path' does not contain an extension separator at 'export_instructions_to_file'.\n");
+    t_output_sink* sink;
+
+    if (create_file_sink(&sink, output_file_path) < 0) {
+        release_memory(output_file_path);
         return -1;
     }
 
-    size_t extension_separator_position = (strchr(source_file_path, EXTENSION_SEPARATOR) - source_file_path);
+    int result = export_instructions_to_sink(instructions, sink);
 
-    for (size_t i = 0; i <= extension_separator_position; i++) {
-        output_file_path[i] = source_file_path[i];
+    if (result > 0) {
+        result = commit_output_sink(sink);
     }
 
-    char* output_extension = OUTPUT_EXTENSION;
+    dispose_output_sink(sink);
 
-    for (size_t i = 0; i < strlen(output_extension); i++) {
-        output_file_path[i + extension_separator_position + 1] = output_extension[i];
+    if (result < 0) {
+        report_error("Error: failed to write output file '%s'.\n", output_file_path);
+        release_memory(output_file_path);
+        return -1;
     }
 
-    output_file_path[extension_separator_position + 1 + strlen(output_extension)] = '\0';
+    release_memory(output_file_path);
+    return 1;
+}
 
-    FILE* output_file = fopen(output_file_path, "w");
+int export_instructions_to_sink(const unsigned int* instructions, t_output_sink* sink) {
+    if (instructions == NULL) {
+        report_error("Internal Error: null 'instructions' at 'export_instructions_to_sink'.\n");
+        return -1;
+    }
 
-    for (size_t i = 0; instructions[i] != -1; i++) {
+    if (sink == NULL) {
+        report_error("Internal Error: null 'sink' at 'export_instructions_to_sink'.\n");
+        return -1;
+    }
+
+    size_t instruction_count = get_instruction_count(instructions);
+    size_t output_size = get_output_size(instruction_count);
+
+    char* output;
+    int result = reserve_output_sink_region(sink, output_size, &output);
+
+    if (result == 0) {
+        return export_instructions_using_writes(instructions, instruction_count, output_size, sink);
+    }
+    else if (result < 0) {
+        return -1;
+    }
+
+    format_instructions_into_buffer(instructions, instruction_count, 0, instruction_count, output);
+
+    return release_output_sink_region(sink);
+}
+
+size_t get_instruction_count(const unsigned int* instructions) {
+    size_t instruction_count = 0;
+
+    while (instructions[instruction_count] != -1) {
+        instruction_count++;
+    }
+
+    return instruction_count;
+}
+
+size_t get_output_size(size_t instruction_count) {
+    if (instruction_count == 0) {
+        return 0;
+    }
+
+    /* Every instruction takes 16 characters plus a new line, except the last one which has no new line. */
+    return (instruction_count * (INSTRUCTION_BITS + 1)) - 1;
+}
+
+void format_instructions_into_buffer(const unsigned int* instructions, size_t instruction_count,
+                                     size_t first_instruction, size_t last_instruction, char* output) {
+    char* position = output;
+
+    for (size_t i = first_instruction; (i < last_instruction) && (i < instruction_count); i++) {
         unsigned int instruction = instructions[i];
 
-        for (int j = 0; j < 16; j++) {
-            instruction = instruction << 1u;
+        for (int j = 0; j < INSTRUCTION_BITS; j++) {
+            position[j] = (char)('0' + ((instruction >> (unsigned int)(INSTRUCTION_BITS - 1 - j)) & 1u));
+        }
+
+        position += INSTRUCTION_BITS;
+
+        if ((i + 1) < instruction_count) {
+            *position = '\n';
+            position++;
+        }
+    }
+}
+
+/* Replaces the extension of the file name, not of the directories, e.g. './dir/prog.asm' -> './dir/prog.hack'. */
+char* get_output_file_path(const char* source_file_path, const char* output_extension) {
+    if ((source_file_path == NULL) || (output_extension == NULL)) {
+        report_error("Internal Error: null arguments at 'get_output_file_path'.\n");
+        return NULL;
+    }
+
+    const char* file_name = strrchr(source_file_path, DIRECTORY_SEPARATOR);
+    file_name = (file_name == NULL) ? source_file_path : (file_name + 1);
+
+    const char* extension_separator = strrchr(file_name, EXTENSION_SEPARATOR);
+
+    /* Hidden files, such as '.asm', have no extension but a name. */
+    if ((extension_separator == NULL) || (extension_separator == file_name)) {
+        extension_separator = file_name + strlen(file_name);
+    }
+
+    size_t name_length = extension_separator - source_file_path;
+    size_t output_extension_length = strlen(output_extension);
+
+    // +1 for the separator, +1 in order to add '\0' at the end.
+    char* output_file_path = allocate_memory(sizeof(char) * (name_length + 1 + output_extension_length + 1));
+
+    if (output_file_path == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'output_file_path' at 'get_output_file_path'.\n");
+        return NULL;
+    }
+
+    memcpy(output_file_path, source_file_path, name_length);
+    output_file_path[name_length] = EXTENSION_SEPARATOR;
+    memcpy(output_file_path + name_length + 1, output_extension, output_extension_length);
+    output_file_path[name_length + 1 + output_extension_length] = '\0';
+
+    return output_file_path;
+}
+
+int export_instructions_using_writes(const unsigned int* instructions, size_t instruction_count, size_t output_size,
+                                     t_output_sink* sink) {
+    if (output_size == 0) {
+        return 1;
+    }
+
+    size_t chunk_size = WRITE_CHUNK_INSTRUCTIONS * (INSTRUCTION_BITS + 1);
+    char* chunk = allocate_memory(sizeof(char) * chunk_size);
+
+    if (chunk == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'chunk' at 'export_instructions_using_writes'.\n");
+        return -1;
+    }
+
+    for (size_t first = 0; first < instruction_count; first += WRITE_CHUNK_INSTRUCTIONS) {
+        size_t last = first + WRITE_CHUNK_INSTRUCTIONS;
+        size_t offset = first * (INSTRUCTION_BITS + 1);
+
+        if (last > instruction_count) {
+            last = instruction_count;
+        }
+
+        size_t end = (last == instruction_count) ? output_size : (last * (INSTRUCTION_BITS + 1));
+
+        format_instructions_into_buffer(instructions, instruction_count, first, last, chunk);
+
+        if (write_to_output_sink(sink, chunk, end - offset) < 0) {
+            release_memory(chunk);
+            return -1;
+        }
+    }
+
+    release_memory(chunk);
+    return 1;
+}
+
+/* Every instruction is stored as a big-endian 16 bits word. */
+int export_binary_to_sink(const unsigned int* instructions, t_output_sink* sink) {
+    if ((instructions == NULL) || (sink == NULL)) {
+        report_error("Internal Error: null arguments at 'export_binary_to_sink'.\n");
+        return -1;
+    }
+
+    size_t instruction_count = get_instruction_count(instructions);
+    size_t output_size = instruction_count * BYTES_PER_BINARY_INSTRUCTION;
+
+    char* output;
+    int result = reserve_output_sink_region(sink, output_size, &output);
 
-            if (instruction & VALUE_OF_16_BITS) {
-                fprintf(output_file, "1");
-            }
-            else {
-                fprintf(output_file, "0");
-            }
+    if (result > 0) {
+        format_binary_instructions_into_buffer(instructions, 0, instruction_count, (unsigned char*)output);
+        return release_output_sink_region(sink);
+    }
+    else if (result < 0) {
+        return -1;
+    }
+
+    unsigned char* chunk = allocate_memory(sizeof(unsigned char) * WRITE_CHUNK_INSTRUCTIONS * BYTES_PER_BINARY_INSTRUCTION);
+
+    if (chunk == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'chunk' at 'export_binary_to_sink'.\n");
+        return -1;
+    }
+
+    for (size_t first = 0; first < instruction_count; first += WRITE_CHUNK_INSTRUCTIONS) {
+        size_t last = (first + WRITE_CHUNK_INSTRUCTIONS < instruction_count) ? (first + WRITE_CHUNK_INSTRUCTIONS) :
+                      instruction_count;
+
+        format_binary_instructions_into_buffer(instructions, first, last, chunk);
+
+        if (write_to_output_sink(sink, (const char*)chunk, (last - first) * BYTES_PER_BINARY_INSTRUCTION) < 0) {
+            release_memory(chunk);
+            return -1;
         }
+    }
 
-        if (instructions[i + 1] != -1) {
-            fprintf(output_file, "\n");
+    release_memory(chunk);
+    return 1;
+}
+
+/* One 'SYMBOL ADDRESS' line per label or variable, in definition order. */
+int export_symbols_to_sink(const t_array_list* user_symbols, t_output_sink* sink) {
+    if ((user_symbols == NULL) || (sink == NULL)) {
+        report_error("Internal Error: null arguments at 'export_symbols_to_sink'.\n");
+        return -1;
+    }
+
+    t_text_chunk chunk;
+
+    if (create_text_chunk(&chunk, sink) < 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < user_symbols->length; i++) {
+        t_map_entry* entry = user_symbols->item[i];
+
+        if (reserve_text_chunk_line(&chunk) < 0) {
+            dispose_text_chunk(&chunk);
+            return -1;
         }
+
+        chunk.length += snprintf(chunk.data + chunk.length, MAX_TEXT_LINE_SIZE, "%.*s %lu\n",
+                                 (int)entry->key_length, (const char*)entry->key, *((size_t*)entry->value));
+    }
+
+    int result = flush_text_chunk(&chunk);
+
+    dispose_text_chunk(&chunk);
+    return result;
+}
+
+/* One 'ROM_ADDRESS WORD SOURCE_LINE SOURCE' line per instruction. Labels only show their source line and source. */
+int export_listing_to_sink(const t_array_list* commands_buffer, const unsigned int* instructions, t_output_sink* sink) {
+    if ((commands_buffer == NULL) || (instructions == NULL) || (sink == NULL)) {
+        report_error("Internal Error: null arguments at 'export_listing_to_sink'.\n");
+        return -1;
+    }
+
+    t_text_chunk chunk;
+
+    if (create_text_chunk(&chunk, sink) < 0) {
+        return -1;
     }
 
-    fclose(output_file);
+    char source[MAX_TEXT_LINE_SIZE / 2];
+    char word[INSTRUCTION_BITS + 1];
+    size_t rom_address = 0;
+
+    for (size_t i = 0; i < commands_buffer->length; i++) {
+        const t_instruction* instruction = commands_buffer->item[i];
+
+        if (reserve_text_chunk_line(&chunk) < 0) {
+            dispose_text_chunk(&chunk);
+            return -1;
+        }
+
+        format_instruction_source(instruction, source, sizeof(source));
+
+        if (instruction->type == L_COMMAND) {
+            chunk.length += snprintf(chunk.data + chunk.length, MAX_TEXT_LINE_SIZE, "%5s  %16s  %6lu  %s\n",
+                                     "", "", instruction->source_line, source);
+        }
+        else {
+            /* Formatted as if it was the last instruction, so no new line is appended. */
+            format_instructions_into_buffer(instructions, rom_address + 1, rom_address, rom_address + 1, word);
+            word[INSTRUCTION_BITS] = '\0';
+
+            chunk.length += snprintf(chunk.data + chunk.length, MAX_TEXT_LINE_SIZE, "%05lu  %s  %6lu  %s\n",
+                                     rom_address, word, instruction->source_line, source);
+            rom_address++;
+        }
+    }
+
+    int result = flush_text_chunk(&chunk);
+
+    dispose_text_chunk(&chunk);
+    return result;
+}
+
+void format_binary_instructions_into_buffer(const unsigned int* instructions, size_t first_instruction,
+                                            size_t last_instruction, unsigned char* output) {
+    for (size_t i = first_instruction; i < last_instruction; i++) {
+        *(output++) = (unsigned char)((instructions[i] >> 8u) & 0xFFu);
+        *(output++) = (unsigned char)(instructions[i] & 0xFFu);
+    }
+}
+
+int create_text_chunk(t_text_chunk* chunk, t_output_sink* sink) {
+    chunk->data = allocate_memory(sizeof(char) * TEXT_CHUNK_SIZE);
+
+    if (chunk->data == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'data' at 'create_text_chunk'.\n");
+        return -1;
+    }
+
+    chunk->length = 0L;
+    chunk->sink = sink;
+
     return 1;
-}
\ No newline at end of file
+}
+
+/* Makes sure there is room for a whole line, flushing the chunk into the sink otherwise. */
+int reserve_text_chunk_line(t_text_chunk* chunk) {
+    if ((chunk->length + MAX_TEXT_LINE_SIZE) <= TEXT_CHUNK_SIZE) {
+        return 1;
+    }
+
+    return flush_text_chunk(chunk);
+}
+
+int flush_text_chunk(t_text_chunk* chunk) {
+    if (chunk->length == 0) {
+        return 1;
+    }
+
+    int result = write_to_output_sink(chunk->sink, chunk->data, chunk->length);
+    chunk->length = 0L;
+
+    return result;
+}
+
+void dispose_text_chunk(t_text_chunk* chunk) {
+    release_memory(chunk->data);
+    chunk->data = NULL;
+}
+
+/* Rebuilds the instruction, as written without whitespaces nor comments, from its parsed fields. */
+size_t format_instruction_source(const t_instruction* instruction, char* output, size_t output_size) {
+    if (instruction->type == A_COMMAND) {
+        return snprintf(output, output_size, "@%s", instruction->symbol);
+    }
+
+    if (instruction->type == L_COMMAND) {
+        return snprintf(output, output_size, "(%s)", instruction->symbol);
+    }
+
+    return snprintf(output, output_size, "%s%s%s%s%s",
+                    (instruction->destination != NULL) ? instruction->destination : "",
+                    (instruction->destination != NULL) ? "=" : "",
+                    instruction->computation,
+                    (instruction->jump != NULL) ? ";" : "",
+                    (instruction->jump != NULL) ? instruction->jump : "");
+}
@@ -7,6 +7,30 @@
 
 #include <stdlib.h>
 
+#include "general_types.h"
+#include "output_sink.h"
+
+#define HACK_EXTENSION "hack"
+#define BINARY_EXTENSION "bin"
+#define SYMBOLS_EXTENSION "sym"
+#define LISTING_EXTENSION "lst"
+
 int export_instructions_to_file(const unsigned int* instructions, const char* source_file_path);
+int export_instructions_to_sink(const unsigned int* instructions, t_output_sink* sink);
+
+/* Additional artifacts, all of them built from the already parsed, synced and translated program. */
+int export_binary_to_sink(const unsigned int* instructions, t_output_sink* sink);
+int export_symbols_to_sink(const t_array_list* user_symbols, t_output_sink* sink);
+int export_listing_to_sink(const t_array_list* commands_buffer, const unsigned int* instructions, t_output_sink* sink);
+
+char* get_output_file_path(const char* source_file_path, const char* output_extension);
+
+size_t get_instruction_count(const unsigned int* instructions);
+size_t get_output_size(size_t instruction_count);
+
+/* Writes the instructions in [first_instruction, last_instruction) into 'output', which must point at the output
+ * position of 'first_instruction'. Disjoint ranges can be formatted concurrently into the same mapping. */
+void format_instructions_into_buffer(const unsigned int* instructions, size_t instruction_count,
+                                     size_t first_instruction, size_t last_instruction, char* output);
 
 #endif //SHACK_ASSEMBLER_CODE_EXPORTER_H
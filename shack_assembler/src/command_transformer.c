@@ -9,6 +9,8 @@
 
 #include "command_transformer.h"
 #include "instruction.h"
+#include "diagnostics.h"
+#include "memory_accounting.h"
 
 #define C_INSTRUCTION_HEADER 0b1110000000000000
 #define MEMORY_INSTRUCTION_MODE 0b0001000000000000
@@ -59,12 +61,12 @@
 #define EQUAL_TO_ZERO 0b010
 #define LOWER_THAN_ZERO 0b100
 
+int translate_command(const t_instruction* command, unsigned int* binary);
 size_t get_number_from_string(const char* string);
-size_t power(size_t base, size_t power);
 
 unsigned int* translate_instructions_into_binary(const t_array_list* commands_buffer) {
     if (commands_buffer == NULL) {
-        printf("Internal Error: null 'commands_buffer' at 'translate_instructions_into_binary'.\n");
+        report_error("Internal Error: null 'commands_buffer' at 'translate_instructions_into_binary'.\n");
         return NULL;
     }
 
@@ -74,7 +76,7 @@ unsigned int* translate_instructions_into_binary(const t_array_list* commands_bu
         t_instruction* command = commands_buffer->item[i];
 
         if (command == NULL) {
-            printf("Internal Error: null 'command' at 'translate_instructions_into_binary'.\n");
+            report_error("Internal Error: null 'command' at 'translate_instructions_into_binary'.\n");
             return NULL;
         }
 
@@ -83,180 +85,197 @@ unsigned int* translate_instructions_into_binary(const t_array_list* commands_bu
         }
     }
 
-    unsigned int* buffer = malloc(sizeof(unsigned int) * (instruction_count + 1));
+    unsigned int* buffer = allocate_memory(sizeof(unsigned int) * (instruction_count + 1));
 
     if (buffer == NULL) {
-        printf("Internal Error: could not allocate memory for 'buffer' at 'translate_instructions_into_binary'.\n");
+        report_error("Internal Error: could not allocate memory for 'buffer' at "
+                     "'translate_instructions_into_binary'.\n");
         return NULL;
     }
 
-    for (unsigned int i = 0, j = 0; (i < commands_buffer->length) && (j < instruction_count); i++) {
+    if (translate_commands_into_binary(commands_buffer, 0, commands_buffer->length, buffer) < 0) {
+        release_memory(buffer);
+        return NULL;
+    }
+
+    buffer[instruction_count] = -1;
+
+    return buffer;
+}
+
+long translate_commands_into_binary(const t_array_list* commands_buffer, size_t first_command, size_t last_command,
+                                    unsigned int* instructions) {
+    long instruction_count = 0;
+
+    for (size_t i = first_command; (i < last_command) && (i < commands_buffer->length); i++) {
         t_instruction* command = commands_buffer->item[i];
 
         if (command == NULL) {
-            printf("Internal Error: null 'command' at 'translate_instructions_into_binary'.\n");
-            return NULL;
+            report_error("Internal Error: null 'command' at 'translate_commands_into_binary'.\n");
+            return -1;
         }
 
-        size_t instruction;
+        int result = translate_command(command, &instructions[instruction_count]);
 
-        if (command->type == C_COMMAND) {
-            instruction = C_INSTRUCTION_HEADER;
+        if (result < 0) {
+            return -1;
+        }
 
-            if (command->computation == NULL) {
-                printf("Internal Error: 'commands_buffer' contains invalid data at 'translate_instructions_into_binary'.\n");
-                return NULL;
-            }
+        instruction_count += result;
+    }
 
-            char* computation = command->computation;
-            if (strchr(computation, MEMORY) != NULL) {
-                instruction += MEMORY_INSTRUCTION_MODE;
-            }
+    return instruction_count;
+}
 
-            if (strcmp(computation, "0") == 0) {
-                instruction += ZERO;
-            }
-            else if (strcmp(computation, "1") == 0) {
-                instruction += ONE;
-            }
-            else if (strcmp(computation, "-1") == 0) {
-                instruction += NEGATIVE_ONE;
-            }
-            else if (strcmp(computation, "D") == 0) {
-                instruction += D_REGISTER_VALUE;
-            }
-            else if ((strcmp(computation, "A") == 0) || (strcmp(computation, "M") == 0)) {
-                instruction += A_REGISTER_VALUE;
-            }
-            else if (strcmp(computation, "!D" ) == 0) {
-                instruction += NOT_BITWISE_D_REGISTER;
-            }
-            else if ((strcmp(computation, "!A") == 0) || (strcmp(computation, "!M") == 0)) {
-                instruction = instruction + NOT_BITWISE_A_REGISTER; // clang tidy, freaks out if += in here...
-            }
-            else if (strcmp(computation, "-D") == 0) {
-                instruction += NEGATIVE_D_REGISTER;
-            }
-            else if ((strcmp(computation, "-A") == 0) || (strcmp(computation, "-M") == 0)) {
-                instruction += NEGATIVE_A_REGISTER;
+/* Returns 1 and stores the binary of 'command' if it is an instruction, 0 if it is a label, or -1 on errors. */
+int translate_command(const t_instruction* command, unsigned int* binary) {
+    size_t instruction;
+
+    if (command->type == C_COMMAND) {
+        instruction = C_INSTRUCTION_HEADER;
+
+        if (command->computation == NULL) {
+            report_error("Internal Error: 'commands_buffer' contains invalid data at 'translate_command'.\n");
+            return -1;
+        }
+
+        char* computation = command->computation;
+        if (strchr(computation, MEMORY) != NULL) {
+            instruction += MEMORY_INSTRUCTION_MODE;
+        }
+
+        if (strcmp(computation, "0") == 0) {
+            instruction += ZERO;
+        }
+        else if (strcmp(computation, "1") == 0) {
+            instruction += ONE;
+        }
+        else if (strcmp(computation, "-1") == 0) {
+            instruction += NEGATIVE_ONE;
+        }
+        else if (strcmp(computation, "D") == 0) {
+            instruction += D_REGISTER_VALUE;
+        }
+        else if ((strcmp(computation, "A") == 0) || (strcmp(computation, "M") == 0)) {
+            instruction += A_REGISTER_VALUE;
+        }
+        else if (strcmp(computation, "!D" ) == 0) {
+            instruction += NOT_BITWISE_D_REGISTER;
+        }
+        else if ((strcmp(computation, "!A") == 0) || (strcmp(computation, "!M") == 0)) {
+            instruction = instruction + NOT_BITWISE_A_REGISTER; // clang tidy, freaks out if += in here...
+        }
+        else if (strcmp(computation, "-D") == 0) {
+            instruction += NEGATIVE_D_REGISTER;
+        }
+        else if ((strcmp(computation, "-A") == 0) || (strcmp(computation, "-M") == 0)) {
+            instruction += NEGATIVE_A_REGISTER;
+        }
+        else if (strcmp(computation, "D+1") == 0) {
+            instruction += INCREMENT_D_REGISTER;
+        }
+        else if ((strcmp(computation, "A+1") == 0) || (strcmp(computation, "M+1") == 0)) {
+            instruction += INCREMENT_A_REGISTER;
+        }
+        else if (strcmp(computation, "D-1") == 0) {
+            instruction += DECREASE_D_REGISTER;
+        }
+        else if ((strcmp(computation, "A-1") == 0) || (strcmp(computation, "M-1") == 0)) {
+            instruction += DECREASE_A_REGISTER;
+        }
+        else if ((strcmp(computation, "D+A") == 0) || (strcmp(computation, "A+D") == 0) ||
+                 (strcmp(computation, "D+M") == 0) || (strcmp(computation, "M+D") == 0)) {
+            instruction += SUM_D_REGISTER_AND_A_REGISTER;
+        }
+        else if ((strcmp(computation, "D-A") == 0) || (strcmp(computation, "D-M") == 0)) {
+            instruction += SUB_D_REGISTER_AND_A_REGISTER;
+        }
+        else if ((strcmp(computation, "A-D") == 0) || (strcmp(computation, "M-D") == 0)) {
+            instruction += SUB_A_REGISTER_AND_D_REGISTER;
+        }
+        else if ((strcmp(computation, "D&A") == 0) || (strcmp(computation, "D&M") == 0)) {
+            instruction += BITWISE_AND_D_REGISTER_AND_A_REGISTER;
+        }
+        else if ((strcmp(computation, "D|A") == 0) || (strcmp(computation, "D|M") == 0)) {
+            instruction += BITWISE_OR_D_REGISTER_AND_A_REGISTER;
+        }
+        else {
+            report_error("Error: unknown computation command '%s'.\n", computation);
+            return -1;
+        }
+
+        if (command->destination != NULL) {
+            char* destination = command->destination;
+
+            if (strchr(destination, MEMORY) != NULL) {
+                instruction += MEMORY_DESTINATION;
             }
-            else if (strcmp(computation, "D+1") == 0) {
-                instruction += INCREMENT_D_REGISTER;
+
+            if (strchr(destination, A_REGISTER) != NULL) {
+                instruction += A_REGISTER_DESTINATION;
             }
-            else if ((strcmp(computation, "A+1") == 0) || (strcmp(computation, "M+1") == 0)) {
-                instruction += INCREMENT_A_REGISTER;
+
+            if (strchr(destination, D_REGISTER) != NULL) {
+                instruction += D_REGISTER_DESTINATION;
             }
-            else if (strcmp(computation, "D-1") == 0) {
-                instruction += DECREASE_D_REGISTER;
+        }
+
+        if (command->jump != NULL) {
+            char* jump = command->jump;
+
+            if (strcmp(jump, JUMP_EQUAL_TO_ZERO) == 0) {
+                instruction += EQUAL_TO_ZERO;
             }
-            else if ((strcmp(computation, "A-1") == 0) || (strcmp(computation, "M-1") == 0)) {
-                instruction += DECREASE_A_REGISTER;
+            else if (strcmp(jump, JUMP_GREATER_THAN_ZERO) == 0) {
+                instruction += GREATER_THAN_ZERO;
             }
-            else if ((strcmp(computation, "D+A") == 0) || (strcmp(computation, "A+D") == 0) ||
-                     (strcmp(computation, "D+M") == 0) || (strcmp(computation, "M+D") == 0)) {
-                instruction += SUM_D_REGISTER_AND_A_REGISTER;
+            else if (strcmp(jump, JUMP_GREATER_OR_EQUAL_TO_ZERO) == 0) {
+                instruction += EQUAL_TO_ZERO + GREATER_THAN_ZERO;
             }
-            else if ((strcmp(computation, "D-A") == 0) || (strcmp(computation, "D-M") == 0)) {
-                instruction += SUB_D_REGISTER_AND_A_REGISTER;
+            else if (strcmp(jump, JUMP_LOWER_THAN_ZERO) == 0) {
+                instruction += LOWER_THAN_ZERO;
             }
-            else if ((strcmp(computation, "A-D") == 0) || (strcmp(computation, "M-D") == 0)) {
-                instruction += SUB_A_REGISTER_AND_D_REGISTER;
+            else if (strcmp(jump, JUMP_LOWER_OR_EQUAL_TO_ZERO) == 0) {
+                instruction += EQUAL_TO_ZERO + LOWER_THAN_ZERO;
             }
-            else if ((strcmp(computation, "D&A") == 0) || (strcmp(computation, "D&M") == 0)) {
-                instruction += BITWISE_AND_D_REGISTER_AND_A_REGISTER;
+            else if (strcmp(jump, JUMP_NOT_EQUAL_TO_ZERO) == 0) {
+                instruction += LOWER_THAN_ZERO + GREATER_THAN_ZERO;
             }
-            else if ((strcmp(computation, "D|A") == 0) || (strcmp(computation, "D|M") == 0)) {
-                instruction += BITWISE_OR_D_REGISTER_AND_A_REGISTER;
+            else if (strcmp(jump, JUMP) == 0) {
+                instruction += EQUAL_TO_ZERO + GREATER_THAN_ZERO + LOWER_THAN_ZERO;
             }
             else {
-                printf("Error: unknown computation command '%s'.\n", computation);
-                return NULL;
-            }
-
-            if (command->destination != NULL) {
-                char* destination = command->destination;
-
-                if (strchr(destination, MEMORY) != NULL) {
-                    instruction += MEMORY_DESTINATION;
-                }
-
-                if (strchr(destination, A_REGISTER) != NULL) {
-                    instruction += A_REGISTER_DESTINATION;
-                }
-
-                if (strchr(destination, D_REGISTER) != NULL) {
-                    instruction += D_REGISTER_DESTINATION;
-                }
-            }
-
-            if (command->jump != NULL) {
-                char* jump = command->jump;
-
-                if (strcmp(jump, JUMP_EQUAL_TO_ZERO) == 0) {
-                    instruction += EQUAL_TO_ZERO;
-                }
-                else if (strcmp(jump, JUMP_GREATER_THAN_ZERO) == 0) {
-                    instruction += GREATER_THAN_ZERO;
-                }
-                else if (strcmp(jump, JUMP_GREATER_OR_EQUAL_TO_ZERO) == 0) {
-                    instruction += EQUAL_TO_ZERO + GREATER_THAN_ZERO;
-                }
-                else if (strcmp(jump, JUMP_LOWER_THAN_ZERO) == 0) {
-                    instruction += LOWER_THAN_ZERO;
-                }
-                else if (strcmp(jump, JUMP_LOWER_OR_EQUAL_TO_ZERO) == 0) {
-                    instruction += EQUAL_TO_ZERO + LOWER_THAN_ZERO;
-                }
-                else if (strcmp(jump, JUMP_NOT_EQUAL_TO_ZERO) == 0) {
-                    instruction += LOWER_THAN_ZERO + GREATER_THAN_ZERO;
-                }
-                else if (strcmp(jump, JUMP) == 0) {
-                    instruction += EQUAL_TO_ZERO + GREATER_THAN_ZERO + LOWER_THAN_ZERO;
-                }
-                else {
-                    printf("Error: invalid jump mnemonic '%s'.\n", jump);
-                    return NULL;
-                }
+                report_error("Error: invalid jump mnemonic '%s'.\n", jump);
+                return -1;
             }
-
-            buffer[j] = instruction;
-            j++;
         }
-        else if (command->type == A_COMMAND) {
-            if (isdigit(*(command->symbol))) {
-                instruction = get_number_from_string(command->symbol);
-            }
-            else {
-                instruction = command->address;
-            }
 
-            buffer[j] = instruction;
-            j++;
-        }
+        *binary = (unsigned int)instruction;
+        return 1;
     }
+    else if (command->type == A_COMMAND) {
+        if (isdigit(*(command->symbol))) {
+            instruction = get_number_from_string(command->symbol);
+        }
+        else {
+            instruction = command->address;
+        }
 
-    buffer[instruction_count] = -1;
+        *binary = (unsigned int)instruction;
+        return 1;
+    }
 
-    return buffer;
+    /* Labels are not instructions. */
+    return 0;
 }
 
+/* Horner's rule, so that each digit costs a single multiplication. */
 size_t get_number_from_string(const char* string) {
     size_t number = 0;
-    size_t string_size = strlen(string);
-    for (size_t i = 0; i < string_size; i++) {
 
-        number += ((string[i] - '0') * power(10, string_size - i));
+    for (const char* digit = string; *digit != '\0'; digit++) {
+        number = (number * 10) + (size_t)(*digit - '0');
     }
 
     return number;
 }
-
-size_t power(size_t base, size_t power) {
-    size_t result = 1;
-
-    for (size_t i = 0; i < power; i++) {
-        result *= (i == 0) ? 1 : base;
-    }
-
-    return result;
-}
\ No newline at end of file
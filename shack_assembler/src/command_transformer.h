@@ -9,4 +9,9 @@
 
 unsigned int* translate_instructions_into_binary(const t_array_list* commands_buffer);
 
+/* Translates the commands in [first_command, last_command) into 'instructions', which must have room for one
+ * instruction per command. Returns how many instructions were stored (labels store none), or -1 on errors. */
+long translate_commands_into_binary(const t_array_list* commands_buffer, size_t first_command, size_t last_command,
+                                    unsigned int* instructions);
+
 #endif //SHACK_ASSEMBLER_COMMAND_TRANSFORMER_H
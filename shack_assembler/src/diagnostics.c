@@ -0,0 +1,492 @@
+//
+// diagnostics.c: reports errors and messages, either to stdout (right away, or through a background logger) or into a
+// per thread capture buffer.
+//
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "diagnostics.h"
+
+#define DEFAULT_DIAGNOSTICS_CAPACITY 256
+#define DIAGNOSTICS_MESSAGE_SIZE 512
+#define DIAGNOSTICS_RING_SIZE (64 * 1024)
+#define DIAGNOSTICS_STREAM_BUFFER_SIZE (64 * 1024)
+
+/* Written only by its thread (the tail) and read only by the drainer (the head), both of them counting every byte ever
+ * pushed, so that the used space is always 'tail - head'. */
+struct diagnostics_ring {
+    char* buffer;
+    size_t capacity;
+    atomic_size_t head;
+    atomic_size_t tail;
+    atomic_int is_abandoned; // Its thread finished, so it is freed once drained.
+
+    struct diagnostics_ring* next;
+};
+
+typedef struct diagnostics_ring t_diagnostics_ring;
+
+struct diagnostics_logger {
+    pthread_mutex_t drain_lock; // Taken to drain the rings, to write into stdout, and to add or remove a ring.
+    t_diagnostics_ring* first_ring;
+
+    pthread_mutex_t wake_lock;
+    pthread_cond_t has_messages;
+    atomic_int has_pending_messages;
+    int is_stopping;
+
+    pthread_key_t ring_key;
+    pthread_t drainer;
+    atomic_int is_running;
+};
+
+typedef struct diagnostics_logger t_diagnostics_logger;
+
+static t_diagnostics_logger logger = {
+    .drain_lock = PTHREAD_MUTEX_INITIALIZER,
+    .first_ring = NULL,
+    .wake_lock = PTHREAD_MUTEX_INITIALIZER,
+    .has_messages = PTHREAD_COND_INITIALIZER,
+    .has_pending_messages = 0,
+    .is_stopping = 0,
+    .is_running = 0,
+};
+
+static atomic_int diagnostics_level = DEBUG_DIAGNOSTICS;
+
+/* NULL until redirected, since 'stdout' is not a constant. Only changed with 'drain_lock' taken. */
+static FILE* diagnostics_stream = NULL;
+
+static _Thread_local t_diagnostics* current_diagnostics = NULL;
+static _Thread_local t_diagnostics_ring* current_ring = NULL;
+
+void report_with_arguments(const char* format, va_list arguments);
+int append_to_diagnostics(t_diagnostics* diagnostics, const char* format, va_list arguments);
+int append_text_to_diagnostics(t_diagnostics* diagnostics, const char* text, size_t length);
+int reserve_diagnostics_capacity(t_diagnostics* diagnostics, size_t required_capacity);
+void write_to_logger(const char* text, size_t length);
+t_diagnostics_ring* get_current_ring(void);
+int push_to_ring(t_diagnostics_ring* ring, const char* text, size_t length);
+void drain_rings(void);
+void abandon_ring(void* ring);
+void* run_diagnostics_drainer(void* argument);
+FILE* get_diagnostics_stream(void);
+
+void report(const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+
+    if (INFO_DIAGNOSTICS <= atomic_load_explicit(&diagnostics_level, memory_order_relaxed)) {
+        report_with_arguments(format, arguments);
+    }
+
+    va_end(arguments);
+}
+
+void report_at_level(t_diagnostics_level level, const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+
+    if ((int)level <= atomic_load_explicit(&diagnostics_level, memory_order_relaxed)) {
+        report_with_arguments(format, arguments);
+    }
+
+    va_end(arguments);
+}
+
+void report_text(const char* text, size_t length) {
+    if ((current_diagnostics != NULL) && (append_text_to_diagnostics(current_diagnostics, text, length) > 0)) {
+        return;
+    }
+
+    if (atomic_load_explicit(&logger.is_running, memory_order_acquire)) {
+        write_to_logger(text, length);
+    }
+    else {
+        fwrite(text, sizeof(char), length, get_diagnostics_stream());
+    }
+}
+
+void set_diagnostics_level(t_diagnostics_level level) {
+    atomic_store_explicit(&diagnostics_level, (int)level, memory_order_relaxed);
+}
+
+void set_diagnostics_stream(FILE* stream) {
+    pthread_mutex_lock(&logger.drain_lock);
+    drain_rings();
+    fflush(get_diagnostics_stream());
+    diagnostics_stream = stream;
+    pthread_mutex_unlock(&logger.drain_lock);
+}
+
+void report_with_arguments(const char* format, va_list arguments) {
+    if (current_diagnostics != NULL) {
+        va_list arguments_copy;
+        va_copy(arguments_copy, arguments);
+
+        int result = append_to_diagnostics(current_diagnostics, format, arguments_copy);
+        va_end(arguments_copy);
+
+        if (result > 0) {
+            return;
+        }
+    }
+
+    if (!atomic_load_explicit(&logger.is_running, memory_order_acquire)) {
+        vfprintf(get_diagnostics_stream(), format, arguments);
+        return;
+    }
+
+    /* Most messages fit in 'message', the rest are formatted once more into a buffer of their size. */
+    char message[DIAGNOSTICS_MESSAGE_SIZE];
+    va_list arguments_copy;
+    va_copy(arguments_copy, arguments);
+
+    int message_length = vsnprintf(message, DIAGNOSTICS_MESSAGE_SIZE, format, arguments_copy);
+    va_end(arguments_copy);
+
+    if (message_length < 0) {
+        return;
+    }
+
+    if (message_length < DIAGNOSTICS_MESSAGE_SIZE) {
+        write_to_logger(message, (size_t)message_length);
+        return;
+    }
+
+    char* long_message = malloc(sizeof(char) * ((size_t)message_length + 1));
+
+    if (long_message == NULL) {
+        write_to_logger(message, DIAGNOSTICS_MESSAGE_SIZE - 1);
+        return;
+    }
+
+    vsnprintf(long_message, (size_t)message_length + 1, format, arguments);
+    write_to_logger(long_message, (size_t)message_length);
+    free(long_message);
+}
+
+int start_diagnostics_logger(void) {
+    if (atomic_load(&logger.is_running)) {
+        return 1;
+    }
+
+    if (pthread_key_create(&logger.ring_key, abandon_ring) != 0) {
+        report_error("Internal Error: could not create the key of the rings at 'start_diagnostics_logger'.\n");
+        return -1;
+    }
+
+    /* Only the drainer writes into stdout from now on, so it can be fully buffered and flushed once idle. */
+    setvbuf(stdout, NULL, _IOFBF, DIAGNOSTICS_STREAM_BUFFER_SIZE);
+
+    logger.is_stopping = 0;
+
+    if (pthread_create(&logger.drainer, NULL, run_diagnostics_drainer, NULL) != 0) {
+        pthread_key_delete(logger.ring_key);
+        report_error("Internal Error: could not start the thread of the logger at 'start_diagnostics_logger'.\n");
+        return -1;
+    }
+
+    atomic_store_explicit(&logger.is_running, 1, memory_order_release);
+
+    return 1;
+}
+
+void stop_diagnostics_logger(void) {
+    if (!atomic_load(&logger.is_running)) {
+        return;
+    }
+
+    pthread_mutex_lock(&logger.wake_lock);
+    logger.is_stopping = 1;
+    pthread_cond_signal(&logger.has_messages);
+    pthread_mutex_unlock(&logger.wake_lock);
+
+    pthread_join(logger.drainer, NULL);
+
+    pthread_mutex_lock(&logger.drain_lock);
+    atomic_store_explicit(&logger.is_running, 0, memory_order_release);
+
+    drain_rings();
+
+    while (logger.first_ring != NULL) {
+        t_diagnostics_ring* ring = logger.first_ring;
+
+        logger.first_ring = ring->next;
+        free(ring->buffer);
+        free(ring);
+    }
+
+    fflush(get_diagnostics_stream());
+    pthread_mutex_unlock(&logger.drain_lock);
+
+    pthread_key_delete(logger.ring_key);
+    current_ring = NULL;
+}
+
+void flush_diagnostics(void) {
+    if (!atomic_load_explicit(&logger.is_running, memory_order_acquire)) {
+        fflush(get_diagnostics_stream());
+        return;
+    }
+
+    pthread_mutex_lock(&logger.drain_lock);
+    drain_rings();
+    fflush(get_diagnostics_stream());
+    pthread_mutex_unlock(&logger.drain_lock);
+}
+
+void begin_diagnostics_capture(t_diagnostics* diagnostics) {
+    diagnostics->previous_capture = current_diagnostics;
+    current_diagnostics = diagnostics;
+}
+
+void end_diagnostics_capture(void) {
+    if (current_diagnostics != NULL) {
+        t_diagnostics* diagnostics = current_diagnostics;
+
+        current_diagnostics = diagnostics->previous_capture;
+        diagnostics->previous_capture = NULL;
+    }
+}
+
+void initialize_diagnostics(t_diagnostics* diagnostics) {
+    diagnostics->buffer = NULL;
+    diagnostics->length = 0L;
+    diagnostics->capacity = 0L;
+    diagnostics->previous_capture = NULL;
+}
+
+void clear_diagnostics(t_diagnostics* diagnostics) {
+    diagnostics->length = 0L;
+
+    if (diagnostics->buffer != NULL) {
+        diagnostics->buffer[0] = '\0';
+    }
+}
+
+void dispose_diagnostics(t_diagnostics* diagnostics) {
+    if (diagnostics->buffer != NULL) {
+        free(diagnostics->buffer);
+    }
+
+    initialize_diagnostics(diagnostics);
+}
+
+int append_to_diagnostics(t_diagnostics* diagnostics, const char* format, va_list arguments) {
+    va_list arguments_copy;
+    va_copy(arguments_copy, arguments);
+
+    int message_length = vsnprintf(NULL, 0, format, arguments_copy);
+    va_end(arguments_copy);
+
+    if (message_length < 0) {
+        return -1;
+    }
+
+    // +1, in order to add '\0' at the end.
+    if (reserve_diagnostics_capacity(diagnostics, diagnostics->length + (size_t)message_length + 1) < 0) {
+        return -1;
+    }
+
+    vsnprintf(diagnostics->buffer + diagnostics->length, diagnostics->capacity - diagnostics->length, format, arguments);
+    diagnostics->length += (size_t)message_length;
+
+    return 1;
+}
+
+int append_text_to_diagnostics(t_diagnostics* diagnostics, const char* text, size_t length) {
+    if (reserve_diagnostics_capacity(diagnostics, diagnostics->length + length + 1) < 0) {
+        return -1;
+    }
+
+    memcpy(diagnostics->buffer + diagnostics->length, text, length);
+    diagnostics->length += length;
+    diagnostics->buffer[diagnostics->length] = '\0';
+
+    return 1;
+}
+
+int reserve_diagnostics_capacity(t_diagnostics* diagnostics, size_t required_capacity) {
+    if (required_capacity > diagnostics->capacity) {
+        size_t new_capacity = (diagnostics->capacity > 0) ? diagnostics->capacity : DEFAULT_DIAGNOSTICS_CAPACITY;
+
+        while (new_capacity < required_capacity) {
+            new_capacity *= 2;
+        }
+
+        char* new_buffer = realloc(diagnostics->buffer, sizeof(char) * new_capacity);
+
+        if (new_buffer == NULL) {
+            return -1;
+        }
+
+        diagnostics->buffer = new_buffer;
+        diagnostics->capacity = new_capacity;
+    }
+
+    return 1;
+}
+
+/* Queues 'text' on the ring of the calling thread, and wakes the drainer up if it was not already told about it. */
+void write_to_logger(const char* text, size_t length) {
+    t_diagnostics_ring* ring = get_current_ring();
+
+    if ((ring == NULL) || (length > (ring->capacity / 2))) {
+        /* Written right away, after whatever this thread queued before, to keep its order. */
+        pthread_mutex_lock(&logger.drain_lock);
+        drain_rings();
+        fwrite(text, sizeof(char), length, get_diagnostics_stream());
+        pthread_mutex_unlock(&logger.drain_lock);
+        return;
+    }
+
+    while (push_to_ring(ring, text, length) < 0) {
+        /* Full: instead of waiting for the drainer, this thread drains the rings itself. */
+        pthread_mutex_lock(&logger.drain_lock);
+        drain_rings();
+        pthread_mutex_unlock(&logger.drain_lock);
+    }
+
+    if (atomic_exchange_explicit(&logger.has_pending_messages, 1, memory_order_acq_rel) == 0) {
+        pthread_mutex_lock(&logger.wake_lock);
+        pthread_cond_signal(&logger.has_messages);
+        pthread_mutex_unlock(&logger.wake_lock);
+    }
+}
+
+t_diagnostics_ring* get_current_ring(void) {
+    if (current_ring != NULL) {
+        return current_ring;
+    }
+
+    t_diagnostics_ring* ring = malloc(sizeof(t_diagnostics_ring));
+
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    ring->buffer = malloc(sizeof(char) * DIAGNOSTICS_RING_SIZE);
+
+    if (ring->buffer == NULL) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->capacity = DIAGNOSTICS_RING_SIZE;
+    atomic_init(&ring->head, 0L);
+    atomic_init(&ring->tail, 0L);
+    atomic_init(&ring->is_abandoned, 0);
+
+    pthread_mutex_lock(&logger.drain_lock);
+    ring->next = logger.first_ring;
+    logger.first_ring = ring;
+    pthread_mutex_unlock(&logger.drain_lock);
+
+    pthread_setspecific(logger.ring_key, ring);
+    current_ring = ring;
+
+    return ring;
+}
+
+/* Messages are published whole, so the drainer never writes half of one. */
+int push_to_ring(t_diagnostics_ring* ring, const char* text, size_t length) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if ((ring->capacity - (tail - head)) < length) {
+        return -1;
+    }
+
+    size_t offset = tail % ring->capacity;
+    size_t first_length = ring->capacity - offset;
+
+    if (first_length > length) {
+        first_length = length;
+    }
+
+    memcpy(ring->buffer + offset, text, first_length);
+    memcpy(ring->buffer, text + first_length, length - first_length);
+
+    atomic_store_explicit(&ring->tail, tail + length, memory_order_release);
+
+    return 1;
+}
+
+/* Expects 'drain_lock' to be taken. */
+void drain_rings(void) {
+    t_diagnostics_ring** link = &logger.first_ring;
+
+    while (*link != NULL) {
+        t_diagnostics_ring* ring = *link;
+        int is_abandoned = atomic_load_explicit(&ring->is_abandoned, memory_order_acquire);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+        while (head < tail) {
+            size_t offset = head % ring->capacity;
+            size_t length = ring->capacity - offset;
+
+            if (length > (tail - head)) {
+                length = tail - head;
+            }
+
+            fwrite(ring->buffer + offset, sizeof(char), length, get_diagnostics_stream());
+            head += length;
+        }
+
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+
+        if (is_abandoned) {
+            *link = ring->next;
+            free(ring->buffer);
+            free(ring);
+        }
+        else {
+            link = &ring->next;
+        }
+    }
+}
+
+/* Called when a thread with a ring finishes. Whatever it left in the ring is still written by the drainer. */
+void abandon_ring(void* ring) {
+    atomic_store_explicit(&((t_diagnostics_ring*)ring)->is_abandoned, 1, memory_order_release);
+}
+
+void* run_diagnostics_drainer(void* argument) {
+    (void)argument; // The logger is global.
+
+    pthread_mutex_lock(&logger.wake_lock);
+
+    while (!logger.is_stopping) {
+        if (!atomic_exchange_explicit(&logger.has_pending_messages, 0, memory_order_acq_rel)) {
+            pthread_cond_wait(&logger.has_messages, &logger.wake_lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&logger.wake_lock);
+        pthread_mutex_lock(&logger.drain_lock);
+        drain_rings();
+
+        /* Idle, so whatever is buffered is flushed instead of waiting for more. */
+        if (!atomic_load_explicit(&logger.has_pending_messages, memory_order_acquire)) {
+            fflush(get_diagnostics_stream());
+        }
+
+        pthread_mutex_unlock(&logger.drain_lock);
+        pthread_mutex_lock(&logger.wake_lock);
+    }
+
+    pthread_mutex_unlock(&logger.wake_lock);
+
+    return NULL;
+}
+
+FILE* get_diagnostics_stream(void) {
+    return (diagnostics_stream != NULL) ? diagnostics_stream : stdout;
+}
@@ -0,0 +1,74 @@
+//
+// diagnostics.h: reports errors and messages, either to stdout (right away, or through a background logger) or into a
+// per thread capture buffer.
+//
+
+#ifndef SHACK_ASSEMBLER_DIAGNOSTICS_H
+#define SHACK_ASSEMBLER_DIAGNOSTICS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+struct diagnostics {
+    char* buffer;
+    size_t length;
+    size_t capacity;
+
+    struct diagnostics* previous_capture; // Restored once this capture ends.
+};
+
+typedef struct diagnostics t_diagnostics;
+
+enum diagnostics_level {
+    ERROR_DIAGNOSTICS,
+    WARNING_DIAGNOSTICS,
+    INFO_DIAGNOSTICS,
+    DEBUG_DIAGNOSTICS,
+};
+
+typedef enum diagnostics_level t_diagnostics_level;
+
+/* Same as 'printf', but redirected into the capture of the calling thread if there is one. It reports at the info
+ * level, while the messages starting with "Error:", "Internal Error:" or "Warning:" go through their own level. */
+void report(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void report_at_level(t_diagnostics_level level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+#define report_error(...) report_at_level(ERROR_DIAGNOSTICS, __VA_ARGS__)
+#define report_warning(...) report_at_level(WARNING_DIAGNOSTICS, __VA_ARGS__)
+
+/* Appends 'length' bytes as they are, e.g. diagnostics captured by another thread. */
+void report_text(const char* text, size_t length);
+
+/* Messages of a less important level than 'level' are dropped. Everything is reported by default. */
+void set_diagnostics_level(t_diagnostics_level level);
+
+/* Messages are written into 'stream' instead of stdout from now on, e.g. stderr while stdout carries assembled code.
+ * Whatever was reported before is written into the previous one first. */
+void set_diagnostics_stream(FILE* stream);
+
+/* Per instruction messages, which are compiled out of the hot loops unless SHACK_DEBUG_LOGGING is defined. */
+#ifdef SHACK_DEBUG_LOGGING
+#define report_debug(...) report_at_level(DEBUG_DIAGNOSTICS, __VA_ARGS__)
+#else
+#define report_debug(...) ((void)0)
+#endif
+
+/* Once started, the messages which are not captured are queued on a ring buffer of their thread, and written to
+ * stdout by a background thread, so that reporting never waits for stdout. Only the messages of each thread keep
+ * their order. Without it, messages are printed right away. */
+int start_diagnostics_logger(void);
+void stop_diagnostics_logger(void);
+
+/* Waits until everything reported so far is on stdout, e.g. before writing something else to it. */
+void flush_diagnostics(void);
+
+/* Everything reported by the calling thread, until the capture ends, is appended to 'diagnostics'. Captures can be
+ * nested, in which case ending one resumes the previous one. */
+void begin_diagnostics_capture(t_diagnostics* diagnostics);
+void end_diagnostics_capture(void);
+
+void initialize_diagnostics(t_diagnostics* diagnostics);
+void clear_diagnostics(t_diagnostics* diagnostics);
+void dispose_diagnostics(t_diagnostics* diagnostics);
+
+#endif //SHACK_ASSEMBLER_DIAGNOSTICS_H
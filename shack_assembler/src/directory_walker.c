@@ -0,0 +1,336 @@
+//
+// directory_walker.c: discovers the source files of a directory tree using several threads.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "directory_walker.h"
+#include "diagnostics.h"
+#include "memory_accounting.h"
+
+#define DIRECTORY_SEPARATOR '/'
+
+/* A directory stays open while any of its subdirectories is pending, which are opened relative to it. */
+struct open_directory {
+    DIR* directory;
+    size_t reference_count; // Guarded by the lock of the walk.
+};
+
+typedef struct open_directory t_open_directory;
+
+struct pending_directory {
+    char* path;
+    const char* name; // The last part of 'path'.
+    t_open_directory* parent; // NULL for the root, which is opened by its path.
+
+    struct pending_directory* next;
+};
+
+typedef struct pending_directory t_pending_directory;
+
+/* Shared by all the walking threads: directories waiting to be read, and how many are still being read. */
+struct directory_walk {
+    pthread_mutex_t lock;
+    pthread_cond_t directory_available;
+
+    t_pending_directory* first_directory;
+    size_t unfinished_directory_count;
+
+    t_source_file_found_function on_source_file_found;
+    void* argument;
+
+    int result;
+};
+
+typedef struct directory_walk t_directory_walk;
+
+void* run_directory_walker(void* argument);
+int read_pending_directory(t_directory_walk* walk, const t_pending_directory* pending_directory);
+int add_pending_directory(t_directory_walk* walk, t_open_directory* parent, const char* parent_path,
+                          const char* directory_name);
+void dispose_pending_directory(t_directory_walk* walk, t_pending_directory* directory);
+void release_open_directory(t_directory_walk* walk, t_open_directory* directory);
+
+int has_source_file_extension(const char* file_name) {
+    size_t file_name_length = strlen(file_name);
+    size_t extension_length = strlen(SOURCE_FILE_EXTENSION);
+
+    return (file_name_length > extension_length) &&
+           (strcasecmp(file_name + (file_name_length - extension_length), SOURCE_FILE_EXTENSION) == 0);
+}
+
+int walk_source_directory(const char* root_path, size_t thread_count, t_source_file_found_function on_source_file_found,
+                          void* argument) {
+    if ((root_path == NULL) || (on_source_file_found == NULL)) {
+        report_error("Internal Error: null arguments at 'walk_source_directory'.\n");
+        return -1;
+    }
+
+    t_directory_walk walk;
+
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.directory_available, NULL);
+    walk.first_directory = NULL;
+    walk.unfinished_directory_count = 0L;
+    walk.on_source_file_found = on_source_file_found;
+    walk.argument = argument;
+    walk.result = 1;
+
+    if (add_pending_directory(&walk, NULL, NULL, root_path) < 0) {
+        pthread_mutex_destroy(&walk.lock);
+        pthread_cond_destroy(&walk.directory_available);
+        return -1;
+    }
+
+    thread_count = (thread_count > 0) ? thread_count : 1;
+    pthread_t* threads = allocate_memory(sizeof(pthread_t) * thread_count);
+
+    if (threads == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'threads' at 'walk_source_directory'.\n");
+        thread_count = 0;
+    }
+
+    size_t started_thread_count = 0;
+
+    for (size_t i = 0; i < thread_count; i++) {
+        if (pthread_create(&threads[i], NULL, run_directory_walker, &walk) != 0) {
+            break;
+        }
+
+        started_thread_count++;
+    }
+
+    /* Without any helper thread, the calling one walks the whole tree by itself. */
+    if (started_thread_count == 0) {
+        run_directory_walker(&walk);
+    }
+
+    for (size_t i = 0; i < started_thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    release_memory(threads);
+
+    while (walk.first_directory != NULL) {
+        t_pending_directory* directory = walk.first_directory;
+
+        walk.first_directory = directory->next;
+        dispose_pending_directory(&walk, directory);
+    }
+
+    pthread_mutex_destroy(&walk.lock);
+    pthread_cond_destroy(&walk.directory_available);
+
+    return walk.result;
+}
+
+void* run_directory_walker(void* argument) {
+    t_directory_walk* walk = argument;
+
+    pthread_mutex_lock(&walk->lock);
+
+    while (1) {
+        while ((walk->first_directory == NULL) && (walk->unfinished_directory_count > 0)) {
+            pthread_cond_wait(&walk->directory_available, &walk->lock);
+        }
+
+        /* Nothing queued, and nobody reading a directory which could queue more: the walk is over. */
+        if (walk->first_directory == NULL) {
+            break;
+        }
+
+        t_pending_directory* directory = walk->first_directory;
+        walk->first_directory = directory->next;
+
+        int has_failed = (walk->result < 0);
+
+        pthread_mutex_unlock(&walk->lock);
+
+        int result = has_failed ? -1 : read_pending_directory(walk, directory);
+
+        dispose_pending_directory(walk, directory);
+
+        pthread_mutex_lock(&walk->lock);
+
+        if (result < walk->result) {
+            walk->result = result;
+        }
+
+        walk->unfinished_directory_count--;
+
+        if (walk->unfinished_directory_count == 0) {
+            pthread_cond_broadcast(&walk->directory_available);
+        }
+    }
+
+    pthread_mutex_unlock(&walk->lock);
+
+    return NULL;
+}
+
+int read_pending_directory(t_directory_walk* walk, const t_pending_directory* pending_directory) {
+    const char* directory_path = pending_directory->path;
+
+    /* Relative to the parent, so that it is still the directory which was found, however long its path is. */
+    int directory_descriptor = (pending_directory->parent != NULL) ?
+                               openat(dirfd(pending_directory->parent->directory), pending_directory->name,
+                                      O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) :
+                               openat(AT_FDCWD, directory_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR* directory = (directory_descriptor >= 0) ? fdopendir(directory_descriptor) : NULL;
+
+    if (directory == NULL) {
+        if (directory_descriptor >= 0) {
+            close(directory_descriptor);
+        }
+
+        report_error("Error: could not open directory '%s'.\n", directory_path);
+        return 0;
+    }
+
+    t_open_directory* open_directory = allocate_memory(sizeof(t_open_directory));
+
+    if (open_directory == NULL) {
+        closedir(directory);
+        report_error("Internal Error: failed to allocate memory for 'open_directory' at 'read_pending_directory'.\n");
+        return -1;
+    }
+
+    /* Held by this thread until it is done reading it. */
+    open_directory->directory = directory;
+    open_directory->reference_count = 1;
+
+    int result = 1;
+    struct dirent* directory_entry;
+
+    while ((result > 0) && ((directory_entry = readdir(directory)) != NULL)) {
+        const char* name = directory_entry->d_name;
+
+        if ((strcmp(name, ".") == 0) || (strcmp(name, "..") == 0)) {
+            continue;
+        }
+
+        unsigned char type = directory_entry->d_type;
+
+        /* Some file systems do not report the type of the entries. */
+        if (type == DT_UNKNOWN) {
+            struct stat status;
+
+            if (fstatat(directory_descriptor, name, &status, AT_SYMLINK_NOFOLLOW) < 0) {
+                continue;
+            }
+
+            type = S_ISDIR(status.st_mode) ? DT_DIR : (S_ISREG(status.st_mode) ? DT_REG : DT_UNKNOWN);
+        }
+
+        if (type == DT_DIR) {
+            result = add_pending_directory(walk, open_directory, directory_path, name);
+        }
+        else if ((type == DT_REG) && has_source_file_extension(name)) {
+            char* file_path = join_paths(directory_path, name);
+
+            if (file_path == NULL) {
+                result = -1;
+                break;
+            }
+
+            if (walk->on_source_file_found(file_path, walk->argument) < 0) {
+                result = -1;
+            }
+
+            release_memory(file_path);
+        }
+    }
+
+    release_open_directory(walk, open_directory);
+
+    return result;
+}
+
+int add_pending_directory(t_directory_walk* walk, t_open_directory* parent, const char* parent_path,
+                          const char* directory_name) {
+    t_pending_directory* directory = allocate_memory(sizeof(t_pending_directory));
+
+    if (directory == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'directory' at 'add_pending_directory'.\n");
+        return -1;
+    }
+
+    directory->path = (parent_path == NULL) ? duplicate_string(directory_name) : join_paths(parent_path, directory_name);
+
+    if (directory->path == NULL) {
+        release_memory(directory);
+        report_error("Internal Error: failed to allocate memory for 'path' at 'add_pending_directory'.\n");
+        return -1;
+    }
+
+    directory->name = directory->path + (strlen(directory->path) - strlen(directory_name));
+    directory->parent = parent;
+
+    pthread_mutex_lock(&walk->lock);
+
+    if (parent != NULL) {
+        parent->reference_count++;
+    }
+
+    /* Last in, first out: the tree is walked depth first, so whole levels of it are never waiting at once. */
+    directory->next = walk->first_directory;
+    walk->first_directory = directory;
+    walk->unfinished_directory_count++;
+
+    pthread_cond_signal(&walk->directory_available);
+    pthread_mutex_unlock(&walk->lock);
+
+    return 1;
+}
+
+void dispose_pending_directory(t_directory_walk* walk, t_pending_directory* directory) {
+    if (directory->parent != NULL) {
+        release_open_directory(walk, directory->parent);
+    }
+
+    release_memory(directory->path);
+    release_memory(directory);
+}
+
+/* Closed once neither the thread reading it nor any of its pending subdirectories need it anymore. */
+void release_open_directory(t_directory_walk* walk, t_open_directory* directory) {
+    pthread_mutex_lock(&walk->lock);
+    int is_unused = (--directory->reference_count == 0);
+    pthread_mutex_unlock(&walk->lock);
+
+    if (is_unused) {
+        closedir(directory->directory);
+        release_memory(directory);
+    }
+}
+
+char* join_paths(const char* parent_path, const char* name) {
+    size_t parent_path_length = strlen(parent_path);
+    size_t name_length = strlen(name);
+    int needs_separator = (parent_path_length > 0) && (parent_path[parent_path_length - 1] != DIRECTORY_SEPARATOR);
+
+    // +1 in order to add '\0' at the end.
+    char* path = allocate_memory(sizeof(char) * (parent_path_length + needs_separator + name_length + 1));
+
+    if (path == NULL) {
+        return NULL;
+    }
+
+    memcpy(path, parent_path, parent_path_length);
+
+    if (needs_separator) {
+        path[parent_path_length] = DIRECTORY_SEPARATOR;
+    }
+
+    memcpy(path + parent_path_length + needs_separator, name, name_length + 1);
+
+    return path;
+}
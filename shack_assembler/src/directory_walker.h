@@ -0,0 +1,25 @@
+//
+// directory_walker.h: discovers the source files of a directory tree using several threads.
+//
+
+#ifndef SHACK_ASSEMBLER_DIRECTORY_WALKER_H
+#define SHACK_ASSEMBLER_DIRECTORY_WALKER_H
+
+#include <stddef.h>
+
+#define SOURCE_FILE_EXTENSION ".asm"
+
+/* Called, from any of the walking threads, for every source file found. Returns a negative value to stop the walk. */
+typedef int (*t_source_file_found_function)(const char* file_path, void* argument);
+
+int has_source_file_extension(const char* file_name);
+
+/* Returns 'parent_path/name', which must be released with 'release_memory', or NULL if it could not be allocated. */
+char* join_paths(const char* parent_path, const char* name);
+
+/* Returns 1 if the whole tree was walked, 0 if some directory could not be read, and -1 on errors. Symbolic links are
+ * not followed. */
+int walk_source_directory(const char* root_path, size_t thread_count, t_source_file_found_function on_source_file_found,
+                          void* argument);
+
+#endif //SHACK_ASSEMBLER_DIRECTORY_WALKER_H
@@ -1,7 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "general_types.h"
+#include "diagnostics.h"
+#include "memory_accounting.h"
+#include "assembly_probes.h"
+
+#define MINIMUM_HASH_MAP_INDEX_CAPACITY 64
+
+int add_entry_to_hash_map_index(t_array_list* hash_map, size_t entry_index);
+void remove_entry_from_hash_map_index(t_array_list* hash_map, size_t entry_index);
+int rebuild_hash_map_index(t_array_list* hash_map, size_t index_capacity);
+size_t find_hash_map_index_slot(const t_array_list* hash_map, const char* key, size_t key_length);
 
 int create_array_list(t_array_list** buffer) {
 	return create_custom_array_list(buffer, LIST, DEFAULT_ARRAY_LIST_STEP, DEFAULT_ARRAY_LIST_STEP);
@@ -24,15 +35,16 @@ int create_custom_array_list(t_array_list** buffer, t_array_list_type type, size
 		return -1;
 	}
 	
-	t_array_list* array_list = malloc(sizeof(t_array_list));
+	t_array_list* array_list = allocate_memory(sizeof(t_array_list));
 
 	if (array_list == NULL) {
 		return -1;
 	}
 
-	array_list->item = malloc(sizeof(void*) * starting_capacity);
+	array_list->item = allocate_memory(sizeof(void*) * starting_capacity);
 
 	if (array_list->item == NULL) {
+		release_memory(array_list);
 		return -1;
 	}
 
@@ -40,6 +52,8 @@ int create_custom_array_list(t_array_list** buffer, t_array_list_type type, size
 	array_list->capacity = starting_capacity;
 	array_list->increase_step = capacity_steps;
 	array_list->length = 0L;
+	array_list->index = NULL;
+	array_list->index_capacity = 0L;
 
 	*(buffer) = array_list;
 
@@ -51,11 +65,16 @@ int increment_array_list_capacity(t_array_list* array_list) {
 		return -1;
 	}
 
+	/* Doubling keeps adding n items linear, where growing by a fixed step would copy them n / step times. */
 	size_t new_capacity = (array_list->capacity) + (array_list->increase_step);
-	void** new_item_buffer = realloc(array_list->item, sizeof(void*) * new_capacity);
+
+	if (new_capacity < (array_list->capacity * 2)) {
+		new_capacity = array_list->capacity * 2;
+	}
+	void** new_item_buffer = reallocate_memory(array_list->item, sizeof(void*) * new_capacity);
 
 	if (new_item_buffer == NULL) {
-	    printf("Failed\n");
+	    report("Failed\n");
 		return -1;
 	}
 
@@ -74,10 +93,6 @@ int add_item_to_array_list(t_array_list* array_list, void* item) {
 		return -1;
 	}
 
-	if (has_item_array_list(array_list, item) > 0) {
-		return -1;
-	}
-
 	if ((array_list->capacity) <= (array_list->length)) {
 		if (increment_array_list_capacity(array_list) < 0) {
 			return -1;
@@ -90,6 +105,40 @@ int add_item_to_array_list(t_array_list* array_list, void* item) {
 	return 1;
 }
 
+/* Moves every item of 'source' to the end of 'destination', leaving 'source' empty. */
+int append_array_list(t_array_list* destination, t_array_list* source) {
+	if ((destination == NULL) || (source == NULL)) {
+		return -1;
+	}
+
+	size_t required_capacity = destination->length + source->length;
+
+	if (destination->capacity < required_capacity) {
+		void** new_item_buffer = reallocate_memory(destination->item, sizeof(void*) * required_capacity);
+
+		if (new_item_buffer == NULL) {
+			return -1;
+		}
+
+		destination->item = new_item_buffer;
+		destination->capacity = required_capacity;
+	}
+
+	memcpy(destination->item + destination->length, source->item, sizeof(void*) * source->length);
+	destination->length = required_capacity;
+	source->length = 0L;
+
+	if ((source->type == MAP) && (rebuild_hash_map_index(source, source->index_capacity) < 0)) {
+		return -1;
+	}
+
+	if (destination->type == MAP) {
+		return rebuild_hash_map_index(destination, destination->index_capacity);
+	}
+
+	return 1;
+}
+
 int add_entry_to_array_list(t_array_list* array_list, void* key, size_t key_length, void* value, size_t value_length) {
 	if (array_list == NULL) {
 		return -1;
@@ -111,7 +160,7 @@ int add_entry_to_array_list(t_array_list* array_list, void* key, size_t key_leng
 		return -1;
 	}
 
-	t_map_entry* entry = malloc(sizeof(t_map_entry));
+	t_map_entry* entry = allocate_memory(sizeof(t_map_entry));
 
 	if (entry == NULL) {
 		return -1;
@@ -121,8 +170,19 @@ int add_entry_to_array_list(t_array_list* array_list, void* key, size_t key_leng
 	entry->key_length = key_length;
 	entry->value = value;
 	entry->value_length = value_length;
-	
-	return add_item_to_array_list(array_list, entry);
+
+	if (add_item_to_array_list(array_list, entry) < 0) {
+		release_memory(entry);
+		return -1;
+	}
+
+	if ((array_list->type == MAP) && (add_entry_to_hash_map_index(array_list, array_list->length - 1) < 0)) {
+		array_list->length -= 1;
+		release_memory(entry);
+		return -1;
+	}
+
+	return 1;
 }
 
 int has_item_array_list(t_array_list* array_list, void* item) {
@@ -160,27 +220,11 @@ int contains_str_key_array_list(t_array_list* array_list, const char* key, size_
         return -1;
     }
 
-    for (int i = 0; i < array_list->length; i++) {
-        t_map_entry* entry = *(array_list->item + i);
-
-        if (entry->key_length == key_length) {
-            char* entry_key = (char*)entry->key;
-
-            for (int j = 0; j < key_length; j++) {
-                if (key[j] == entry_key[j]) {
-                    /* Detect if this is the last character */
-                    if ((j + 1) == key_length) {
-                        return 1;
-                    }
-                }
-                else {
-                    break;
-                }
-            }
-        }
+    if (array_list->index_capacity == 0) {
+        return 0;
     }
 
-    return 0;
+    return (array_list->index[find_hash_map_index_slot(array_list, key, key_length)] != 0) ? 1 : 0;
 }
 
 int contains_key_array_list(t_array_list* array_list, void* key, size_t key_length) {
@@ -286,27 +330,17 @@ void* get_value_with_str_key_from_array_list(t_array_list* array_list, const cha
         return NULL;
     }
 
-    for (int i = 0; i < array_list->length; i++) {
-        t_map_entry* entry = *(array_list->item + i);
-
-        if (entry->key_length == key_length) {
-            char* entry_key = (char*)entry->key;
-
-            for (int j = 0; j < key_length; j++) {
-                if (key[j] == entry_key[j]) {
-                    /* Detect if this is the last character */
-                    if ((j + 1) == key_length) {
-                        return entry->value;
-                    }
-                }
-                else {
-                    break;
-                }
-            }
-        }
+    if (array_list->index_capacity == 0) {
+        return NULL;
+    }
+
+    size_t position = array_list->index[find_hash_map_index_slot(array_list, key, key_length)];
+
+    if (position == 0) {
+        return NULL;
     }
 
-    return NULL;
+    return ((t_map_entry*)array_list->item[position - 1])->value;
 }
 
 void* get_value_with_key_from_array_list(t_array_list* array_list, void* key, size_t key_length) {
@@ -413,6 +447,11 @@ int remove_item_from_array_list(t_array_list* array_list, void* item) {
 
 	array_list->length -= 1;
 
+	/* Every entry after the removed one moved. */
+	if (array_list->type == MAP) {
+		return rebuild_hash_map_index(array_list, array_list->index_capacity);
+	}
+
 	return 1;
 }
 
@@ -421,5 +460,143 @@ void dispose_array_list(t_array_list* array_list) {
 		return;
 	}
 
-	free(array_list);
+	release_memory(array_list->index);
+	release_memory(array_list->item);
+	release_memory(array_list);
+}
+
+/* Frees the entries created by 'add_entry_to_array_list', but neither their keys nor their values. */
+void dispose_hash_map(t_array_list* hash_map) {
+	if (hash_map == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < hash_map->length; i++) {
+		release_memory(hash_map->item[i]);
+	}
+
+	dispose_array_list(hash_map);
+}
+
+void truncate_hash_map(t_array_list* hash_map, size_t length) {
+	if ((hash_map == NULL) || (length >= hash_map->length)) {
+		return;
+	}
+
+	for (size_t i = length; i < hash_map->length; i++) {
+		remove_entry_from_hash_map_index(hash_map, i);
+		release_memory(hash_map->item[i]);
+		hash_map->item[i] = NULL;
+	}
+
+	hash_map->length = length;
+}
+
+/* FNV-1a, 64 bits. Chaining is possible by passing a previous hash as 'seed'. */
+unsigned long long get_hash_of_bytes(const void* bytes, size_t length, unsigned long long seed) {
+	const unsigned char* data = bytes;
+	unsigned long long hash = seed;
+
+	for (size_t i = 0; i < length; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+/* Keys already in the index keep pointing to their first entry, the same one a search in order would find. The index
+ * is kept at most half full. */
+int add_entry_to_hash_map_index(t_array_list* hash_map, size_t entry_index) {
+	if (((hash_map->length * 2) > hash_map->index_capacity) &&
+		(rebuild_hash_map_index(hash_map, (hash_map->index_capacity > 0) ? (hash_map->index_capacity * 2) :
+		                                  MINIMUM_HASH_MAP_INDEX_CAPACITY) < 0)) {
+		return -1;
+	}
+
+	const t_map_entry* entry = hash_map->item[entry_index];
+	size_t slot = find_hash_map_index_slot(hash_map, entry->key, entry->key_length);
+
+	if (hash_map->index[slot] == 0) {
+		hash_map->index[slot] = entry_index + 1;
+	}
+
+	return 1;
+}
+
+/* Moves back the entries after the removed one, so that no probing sequence is broken. */
+void remove_entry_from_hash_map_index(t_array_list* hash_map, size_t entry_index) {
+	if (hash_map->index_capacity == 0) {
+		return;
+	}
+
+	const t_map_entry* entry = hash_map->item[entry_index];
+	size_t slot = find_hash_map_index_slot(hash_map, entry->key, entry->key_length);
+
+	if (hash_map->index[slot] != (entry_index + 1)) {
+		return;
+	}
+
+	hash_map->index[slot] = 0;
+
+	for (size_t next = (slot + 1) & (hash_map->index_capacity - 1); hash_map->index[next] != 0;
+		 next = (next + 1) & (hash_map->index_capacity - 1)) {
+		size_t position = hash_map->index[next];
+		const t_map_entry* moved_entry = hash_map->item[position - 1];
+
+		hash_map->index[next] = 0;
+		hash_map->index[find_hash_map_index_slot(hash_map, moved_entry->key, moved_entry->key_length)] = position;
+	}
+}
+
+int rebuild_hash_map_index(t_array_list* hash_map, size_t index_capacity) {
+	while ((hash_map->length * 2) > index_capacity) {
+		index_capacity = (index_capacity > 0) ? (index_capacity * 2) : MINIMUM_HASH_MAP_INDEX_CAPACITY;
+	}
+
+	if (index_capacity == 0) {
+		return 1;
+	}
+
+	size_t* index = allocate_zeroed_memory(index_capacity, sizeof(size_t));
+
+	if (index == NULL) {
+		report_error("Internal Error: failed to allocate memory for 'index' at 'rebuild_hash_map_index'.\n");
+		return -1;
+	}
+
+	SHACK_PROBE3(hash_map__resize, hash_map->length, hash_map->index_capacity, index_capacity);
+
+	release_memory(hash_map->index);
+	hash_map->index = index;
+	hash_map->index_capacity = index_capacity;
+
+	for (size_t i = 0; i < hash_map->length; i++) {
+		const t_map_entry* entry = hash_map->item[i];
+		size_t slot = find_hash_map_index_slot(hash_map, entry->key, entry->key_length);
+
+		if (hash_map->index[slot] == 0) {
+			hash_map->index[slot] = i + 1;
+		}
+	}
+
+	return 1;
+}
+
+/* The slot of the entry with 'key', or the free slot where it would go. The capacity is a power of two. */
+size_t find_hash_map_index_slot(const t_array_list* hash_map, const char* key, size_t key_length) {
+	size_t mask = hash_map->index_capacity - 1;
+	size_t slot = (size_t)get_hash_of_bytes(key, key_length, HASH_SEED) & mask;
+
+	while (hash_map->index[slot] != 0) {
+		const t_map_entry* entry = hash_map->item[hash_map->index[slot] - 1];
+
+		if ((entry->key_length == key_length) && (memcmp(entry->key, key, key_length) == 0)) {
+			break;
+		}
+
+		slot = (slot + 1) & mask;
+	}
+
+	return slot;
 }
\ No newline at end of file
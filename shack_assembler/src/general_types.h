@@ -3,6 +3,7 @@
 #include <stddef.h>
 
 #define DEFAULT_ARRAY_LIST_STEP 16
+#define HASH_SEED 0xcbf29ce484222325ull
 
 struct map_entry {
 	void* key;
@@ -24,8 +25,13 @@ struct array_list {
 	t_array_list_type type;
 	void** item;
 	size_t capacity;
-	size_t increase_step;
+	size_t increase_step; // The least the capacity grows by, as it otherwise doubles.
 	size_t length;
+
+	/* Maps only: where the entry of each string key is, plus one, by the hash of the key, with 0 for free slots. Keys
+	 * are only looked up through it, which keeps finding them constant however big the map grows. */
+	size_t* index;
+	size_t index_capacity;
 };
 
 typedef struct array_list t_array_list;
@@ -37,6 +43,7 @@ int create_custom_array_list(t_array_list** buffer, t_array_list_type type, size
 int increment_array_list_capacity(t_array_list* array_list);
 
 int add_item_to_array_list(t_array_list* array_list, void* item);
+int append_array_list(t_array_list* destination, t_array_list* source);
 int add_entry_to_array_list(t_array_list* array_list, void* key, size_t key_length, void* value, size_t value_length);
 
 int has_item_array_list(t_array_list* array_list, void* item);
@@ -52,4 +59,10 @@ void* get_item_from_array_list(t_array_list* array_list, size_t index);
 int remove_entry_from_array_list(t_array_list* array_list, void* key, size_t key_length);
 int remove_item_from_array_list(t_array_list* array_list, void* item);
 
-void dispose_array_list(t_array_list* array_list);
\ No newline at end of file
+void dispose_array_list(t_array_list* array_list);
+void dispose_hash_map(t_array_list* hash_map);
+
+/* Frees the entries from 'length' on, as 'dispose_hash_map' does, and keeps the rest. */
+void truncate_hash_map(t_array_list* hash_map, size_t length);
+
+unsigned long long get_hash_of_bytes(const void* bytes, size_t length, unsigned long long seed);
\ No newline at end of file
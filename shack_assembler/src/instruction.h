@@ -18,6 +18,7 @@ typedef enum instruction_type t_instruction_type;
 struct instruction {
     t_instruction_type type;
     size_t address;
+    size_t source_line; // Line of the source file, starting at 1, where the instruction was found.
 
     char* symbol;
     size_t symbol_length;
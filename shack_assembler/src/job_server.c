@@ -0,0 +1,192 @@
+//
+// job_server.c: shares the parallelism of a GNU make build, by taking its job tokens before assembling each file.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "job_server.h"
+#include "diagnostics.h"
+#include "memory_accounting.h"
+
+#define MAKE_FLAGS_VARIABLE "MAKEFLAGS"
+#define JOB_SERVER_AUTH_OPTION "--jobserver-auth="
+#define JOB_SERVER_FDS_OPTION "--jobserver-fds="
+#define JOB_SERVER_FIFO_PREFIX "fifo:"
+
+const char* find_job_server_option(const char* make_flags, size_t* length);
+int is_descriptor_open(int descriptor);
+
+int connect_to_job_server(t_job_server** job_server) {
+    const char* make_flags = getenv(MAKE_FLAGS_VARIABLE);
+
+    if (make_flags == NULL) {
+        return 0;
+    }
+
+    size_t length;
+    const char* option = find_job_server_option(make_flags, &length);
+
+    if (option == NULL) {
+        return 0;
+    }
+
+    char* value = duplicate_string_prefix(option, length);
+
+    if (value == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'value' at 'connect_to_job_server'.\n");
+        return -1;
+    }
+
+    int read_descriptor = -1;
+    int write_descriptor = -1;
+    int owns_descriptors = 0;
+
+    if (strncmp(value, JOB_SERVER_FIFO_PREFIX, strlen(JOB_SERVER_FIFO_PREFIX)) == 0) {
+        const char* fifo_path = value + strlen(JOB_SERVER_FIFO_PREFIX);
+
+        read_descriptor = open(fifo_path, O_RDWR | O_CLOEXEC);
+        write_descriptor = read_descriptor;
+        owns_descriptors = 1;
+
+        if (read_descriptor < 0) {
+            report_warning("Warning: could not open the make job server '%s', ignoring it.\n", fifo_path);
+        }
+    }
+    else if ((sscanf(value, "%d,%d", &read_descriptor, &write_descriptor) != 2) ||
+             !is_descriptor_open(read_descriptor) || !is_descriptor_open(write_descriptor)) {
+        /* make only passes the descriptors to recipes marked with '+', or which run $(MAKE). */
+        read_descriptor = -1;
+    }
+
+    release_memory(value);
+
+    if (read_descriptor < 0) {
+        return 0;
+    }
+
+    t_job_server* server = allocate_memory(sizeof(t_job_server));
+
+    if (server == NULL) {
+        if (owns_descriptors) {
+            close(read_descriptor);
+        }
+
+        report_error("Internal Error: failed to allocate memory for 'server' at 'connect_to_job_server'.\n");
+        return -1;
+    }
+
+    server->read_descriptor = read_descriptor;
+    server->write_descriptor = write_descriptor;
+    server->owns_descriptors = owns_descriptors;
+    server->is_implicit_token_taken = 0;
+    pthread_mutex_init(&server->lock, NULL);
+
+    *job_server = server;
+
+    return 1;
+}
+
+/* The last option wins, as make appends the one of the innermost make. */
+const char* find_job_server_option(const char* make_flags, size_t* length) {
+    const char* OPTIONS[] = { JOB_SERVER_AUTH_OPTION, JOB_SERVER_FDS_OPTION };
+    const char* last_option = NULL;
+    const char* value = NULL;
+
+    for (size_t i = 0; i < (sizeof(OPTIONS) / sizeof(OPTIONS[0])); i++) {
+        for (const char* found = strstr(make_flags, OPTIONS[i]); found != NULL; found = strstr(found + 1, OPTIONS[i])) {
+            if ((last_option == NULL) || (found > last_option)) {
+                last_option = found;
+                value = found + strlen(OPTIONS[i]);
+            }
+        }
+    }
+
+    if (value != NULL) {
+        *length = strcspn(value, " \t");
+    }
+
+    return value;
+}
+
+int is_descriptor_open(int descriptor) {
+    return (descriptor >= 0) && (fcntl(descriptor, F_GETFD) >= 0);
+}
+
+int acquire_job_token(t_job_server* job_server, int* token) {
+    pthread_mutex_lock(&job_server->lock);
+
+    if (!job_server->is_implicit_token_taken) {
+        job_server->is_implicit_token_taken = 1;
+        pthread_mutex_unlock(&job_server->lock);
+
+        *token = IMPLICIT_JOB_TOKEN;
+        return 1;
+    }
+
+    pthread_mutex_unlock(&job_server->lock);
+
+    while (1) {
+        unsigned char byte;
+        ssize_t count = read(job_server->read_descriptor, &byte, 1);
+
+        if (count == 1) {
+            *token = byte;
+            return 1;
+        }
+
+        if ((count < 0) && (errno == EINTR)) {
+            continue;
+        }
+
+        /* The descriptors are shared with make, which might have made them non blocking. */
+        if ((count < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            struct pollfd descriptor = {
+                .fd = job_server->read_descriptor,
+                .events = POLLIN,
+            };
+
+            poll(&descriptor, 1, -1);
+            continue;
+        }
+
+        report_warning("Warning: failed to take a token from the make job server.\n");
+        return -1;
+    }
+}
+
+void release_job_token(t_job_server* job_server, int token) {
+    if (token == IMPLICIT_JOB_TOKEN) {
+        pthread_mutex_lock(&job_server->lock);
+        job_server->is_implicit_token_taken = 0;
+        pthread_mutex_unlock(&job_server->lock);
+        return;
+    }
+
+    unsigned char byte = (unsigned char)token;
+
+    while (write(job_server->write_descriptor, &byte, 1) < 0) {
+        if (errno != EINTR) {
+            report_warning("Warning: failed to give a token back to the make job server.\n");
+            return;
+        }
+    }
+}
+
+void disconnect_from_job_server(t_job_server* job_server) {
+    if (job_server == NULL) {
+        return;
+    }
+
+    if (job_server->owns_descriptors) {
+        close(job_server->read_descriptor);
+    }
+
+    pthread_mutex_destroy(&job_server->lock);
+    release_memory(job_server);
+}
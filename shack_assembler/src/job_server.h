@@ -0,0 +1,34 @@
+//
+// job_server.h: shares the parallelism of a GNU make build, by taking its job tokens before assembling each file.
+//
+
+#ifndef SHACK_ASSEMBLER_JOB_SERVER_H
+#define SHACK_ASSEMBLER_JOB_SERVER_H
+
+#include <pthread.h>
+
+/* Every process started by make already owns one token, which is never read from or written to the job server. */
+#define IMPLICIT_JOB_TOKEN -1
+
+struct job_server {
+    int read_descriptor;
+    int write_descriptor;
+    int owns_descriptors; // Only when they were opened from a fifo path.
+
+    pthread_mutex_t lock;
+    int is_implicit_token_taken;
+};
+
+typedef struct job_server t_job_server;
+
+/* Connects to the job server described by the '--jobserver-auth' (or the older '--jobserver-fds') option of MAKEFLAGS,
+ * either 'fifo:PATH' or 'R,W'. Returns 1 if connected, 0 if there is no usable job server, and -1 on errors. */
+int connect_to_job_server(t_job_server** job_server);
+
+/* Blocks until a token is available. A token must always be released by the same process which acquired it. */
+int acquire_job_token(t_job_server* job_server, int* token);
+void release_job_token(t_job_server* job_server, int token);
+
+void disconnect_from_job_server(t_job_server* job_server);
+
+#endif //SHACK_ASSEMBLER_JOB_SERVER_H
@@ -7,19 +7,81 @@
 #include <string.h>
 
 #include "assembler.h"
+#include "assembler_server.h"
+#include "assembly_trace.h"
+#include "performance_counters.h"
+#include "diagnostics.h"
+#include "source_watcher.h"
+#include "memory_accounting.h"
+
+int get_artifacts_from_list(const char* list);
+const char* get_long_command_value(const char* argument, const char* command);
 
 int main(int argc, char** argv)
 {
+	/* Messages are written by a background thread, so that verbose runs are not slowed down by stdout. */
+	if (start_diagnostics_logger() > 0) {
+	    atexit(stop_diagnostics_logger);
+	}
+
 	if (argc > 1) {
 	    const char ALL_OPERATOR = '*';
 	    const char COMMAND_OPERATOR = '-';
 	    const char VERBOSE_MODE_COMMAND = 'v';
+	    const char STANDARD_OUTPUT_COMMAND = 'c';
+	    const char OUTPUT_FILE_COMMAND = 'o';
+	    const char ARTIFACTS_COMMAND = 'a';
+	    const char JOBS_COMMAND = 'j';
+	    const char DIRECTORY_COMMAND = 'd';
+	    const char* CURRENT_DIRECTORY = ".";
+	    const char* CACHE_COMMAND = "--cache";
+	    const char* CACHE_SIZE_COMMAND = "--cache-size";
+	    const char* SERVER_COMMAND = "--server";
+	    const char* CLIENT_COMMAND = "--client";
+	    const char* BENCHMARK_COMMAND = "--bench";
+	    const char* MANIFEST_COMMAND = "--manifest";
+	    const char* WATCH_COMMAND = "--watch";
+	    const char* DEBOUNCE_COMMAND = "--debounce";
+	    const char* PIPELINE_COMMAND = "--pipeline";
+	    const char* STATISTICS_COMMAND = "--stats";
+	    const char* STATISTICS_OUTPUT_COMMAND = "--stats-output";
+	    const char* TRACE_COMMAND = "--trace";
+	    const char* COUNTERS_COMMAND = "--counters";
+	    const char* MEMORY_COMMAND = "--memory";
+
+	    t_assembler_options options = {
+	        .verbose_mode = 0,
+	        .artifacts = HACK_ARTIFACT,
+	        .job_count = 1,
+	        .output_to_standard_output = 0,
+	        .output_file_path = NULL,
+	        .cache = NULL,
+	        .job_server = NULL,
+	        .is_pipelined = 0,
+	        .statistics_format = NO_STATISTICS,
+	        .statistics_path = NULL,
+	    };
+
+	    int has_job_count = 0;
 
-	    int program_mode = 0;
-	    int* index_for_file_names = malloc(sizeof(int) * argc);
+	    const char* cache_path = NULL;
+	    size_t cache_size = DEFAULT_BUILD_CACHE_MAXIMUM_SIZE;
+	    const char* server_socket_path = NULL;
+	    const char* client_socket_path = NULL;
+	    long benchmark_request_count = 0;
+	    const char* manifest_path = NULL;
+	    int is_watching = 0;
+	    long debounce_milliseconds = DEFAULT_WATCH_DEBOUNCE_MILLISECONDS;
+	    const char* trace_path = NULL;
+	    int is_counting = 0;
+	    int is_accounting_memory = 0;
+	    int is_tracking_leaks = 0;
+
+	    const char* root_path = NULL;
+	    int* index_for_file_names = allocate_memory(sizeof(int) * argc);
 
 	    if (index_for_file_names == NULL) {
-	        printf("Internal Error: could not allocate memory for 'index_for_file_names'.\n");
+	        report_error("Internal Error: could not allocate memory for 'index_for_file_names'.\n");
 	        return -1;
 	    }
 
@@ -31,7 +93,7 @@ int main(int argc, char** argv)
 
             if (arg_length == 1) {
                 if (argv[i][0] == ALL_OPERATOR) {
-                    program_mode += 0b10;
+                    root_path = CURRENT_DIRECTORY;
                 }
                 else {
                     index_for_file_names[file_count] = i;
@@ -41,11 +103,65 @@ int main(int argc, char** argv)
             else if (arg_length == 2) {
                 if (argv[i][0] == COMMAND_OPERATOR) {
                     if (argv[i][1] == VERBOSE_MODE_COMMAND) {
-                        program_mode += 0b1;
+                        options.verbose_mode = 1;
+                    }
+                    else if (argv[i][1] == STANDARD_OUTPUT_COMMAND) {
+                        options.output_to_standard_output = 1;
+                    }
+                    else if (argv[i][1] == OUTPUT_FILE_COMMAND) {
+                        if ((i + 1) >= argc) {
+                            release_memory(index_for_file_names);
+                            report_error("Error: missing output file path after '%s'.\n", argv[i]);
+                            return -1;
+                        }
+
+                        i++;
+                        options.output_file_path = argv[i];
+                    }
+                    else if (argv[i][1] == JOBS_COMMAND) {
+                        char* end = NULL;
+                        long job_count = ((i + 1) < argc) ? strtol(argv[i + 1], &end, 10) : -1;
+
+                        if ((end == NULL) || (end == argv[i + 1]) || (*end != '\0') || (job_count < 0)) {
+                            release_memory(index_for_file_names);
+                            report_error("Error: '%s' expects a number of jobs, 0 meaning one per "
+                                         "processor.\n", argv[i]);
+                            return -1;
+                        }
+
+                        i++;
+                        options.job_count = (int)job_count;
+                        has_job_count = 1;
+                    }
+                    else if (argv[i][1] == DIRECTORY_COMMAND) {
+                        if ((i + 1) >= argc) {
+                            release_memory(index_for_file_names);
+                            report_error("Error: missing directory path after '%s'.\n", argv[i]);
+                            return -1;
+                        }
+
+                        i++;
+                        root_path = argv[i];
+                    }
+                    else if (argv[i][1] == ARTIFACTS_COMMAND) {
+                        if ((i + 1) >= argc) {
+                            release_memory(index_for_file_names);
+                            report_error("Error: missing artifacts list after '%s'.\n", argv[i]);
+                            return -1;
+                        }
+
+                        i++;
+                        options.artifacts = get_artifacts_from_list(argv[i]);
+
+                        if (options.artifacts <= 0) {
+                            release_memory(index_for_file_names);
+                            report_error("Error: invalid artifacts list '%s', expected a comma separated list of 'hack', 'bin', 'sym' or 'lst'.\n", argv[i]);
+                            return -1;
+                        }
                     }
                     else {
-                        free(index_for_file_names);
-                        printf("Error: unknown command '%s'.\n", argv[i]);
+                        release_memory(index_for_file_names);
+                        report_error("Error: unknown command '%s'.\n", argv[i]);
                         return -1;
                     }
                 }
@@ -55,32 +171,294 @@ int main(int argc, char** argv)
                 }
             }
             else if (arg_length > 2) {
-                index_for_file_names[file_count] = i;
-                file_count++;
+                if ((argv[i][0] == COMMAND_OPERATOR) && (argv[i][1] == COMMAND_OPERATOR)) {
+                    const char* value;
+
+                    if (strcmp(argv[i], WATCH_COMMAND) == 0) {
+                        is_watching = 1;
+                    }
+                    else if (strcmp(argv[i], PIPELINE_COMMAND) == 0) {
+                        options.is_pipelined = 1;
+                    }
+                    else if (strcmp(argv[i], COUNTERS_COMMAND) == 0) {
+                        is_counting = 1;
+                    }
+                    else if (strcmp(argv[i], MEMORY_COMMAND) == 0) {
+                        is_accounting_memory = 1;
+                    }
+                    else if ((value = get_long_command_value(argv[i], MEMORY_COMMAND)) != NULL) {
+                        if (strcmp(value, "leaks") != 0) {
+                            release_memory(index_for_file_names);
+                            report_error("Error: '%s' expects 'leaks', if anything.\n", argv[i]);
+                            return -1;
+                        }
+
+                        is_accounting_memory = 1;
+                        is_tracking_leaks = 1;
+                    }
+                    else if (strcmp(argv[i], STATISTICS_COMMAND) == 0) {
+                        options.statistics_format = TEXT_STATISTICS;
+                    }
+                    else if ((value = get_long_command_value(argv[i], STATISTICS_COMMAND)) != NULL) {
+                        if (strcmp(value, "text") == 0) {
+                            options.statistics_format = TEXT_STATISTICS;
+                        }
+                        else if (strcmp(value, "json") == 0) {
+                            options.statistics_format = JSON_STATISTICS;
+                        }
+                        else {
+                            release_memory(index_for_file_names);
+                            report_error("Error: '%s' expects either 'text' or 'json'.\n", argv[i]);
+                            return -1;
+                        }
+                    }
+                    else if ((value = get_long_command_value(argv[i], STATISTICS_OUTPUT_COMMAND)) != NULL) {
+                        options.statistics_path = value;
+                    }
+                    else if ((value = get_long_command_value(argv[i], DEBOUNCE_COMMAND)) != NULL) {
+                        char* end = NULL;
+                        debounce_milliseconds = strtol(value, &end, 10);
+
+                        if ((end == value) || (*end != '\0') || (debounce_milliseconds < 0)) {
+                            release_memory(index_for_file_names);
+                            report_error("Error: '%s' expects a number of milliseconds.\n", argv[i]);
+                            return -1;
+                        }
+                    }
+                    else if ((value = get_long_command_value(argv[i], CACHE_COMMAND)) != NULL) {
+                        cache_path = value;
+                    }
+                    else if ((value = get_long_command_value(argv[i], CACHE_SIZE_COMMAND)) != NULL) {
+                        char* end = NULL;
+                        long megabytes = strtol(value, &end, 10);
+
+                        if ((end == value) || (*end != '\0') || (megabytes <= 0)) {
+                            release_memory(index_for_file_names);
+                            report_error("Error: '%s' expects a size in megabytes.\n", argv[i]);
+                            return -1;
+                        }
+
+                        cache_size = (size_t)megabytes * 1024 * 1024;
+                    }
+                    else if ((value = get_long_command_value(argv[i], SERVER_COMMAND)) != NULL) {
+                        server_socket_path = value;
+                    }
+                    else if ((value = get_long_command_value(argv[i], CLIENT_COMMAND)) != NULL) {
+                        client_socket_path = value;
+                    }
+                    else if ((value = get_long_command_value(argv[i], TRACE_COMMAND)) != NULL) {
+                        trace_path = value;
+                    }
+                    else if ((value = get_long_command_value(argv[i], MANIFEST_COMMAND)) != NULL) {
+                        manifest_path = value;
+                    }
+                    else if ((value = get_long_command_value(argv[i], BENCHMARK_COMMAND)) != NULL) {
+                        char* end = NULL;
+                        benchmark_request_count = strtol(value, &end, 10);
+
+                        if ((end == value) || (*end != '\0') || (benchmark_request_count <= 0)) {
+                            release_memory(index_for_file_names);
+                            report_error("Error: '%s' expects a number of requests.\n", argv[i]);
+                            return -1;
+                        }
+                    }
+                    else {
+                        release_memory(index_for_file_names);
+                        report_error("Error: unknown command '%s'.\n", argv[i]);
+                        return -1;
+                    }
+                }
+                else {
+                    index_for_file_names[file_count] = i;
+                    file_count++;
+                }
             }
             else {
-                free(index_for_file_names);
-                printf("Error: invalid empty command.\n");
+                release_memory(index_for_file_names);
+                report_error("Error: invalid empty command.\n");
                 return -1;
             }
         }
 
-        /* Handle directory source files, or all the passed file names */
-        if (program_mode >= 0b10) {
-            int result = start_assembler_using_current_directory(program_mode % 2);
+        /* While the assembled code goes to stdout, every message goes to stderr, so that the code can be piped. */
+        int writes_code_to_standard_output = options.output_to_standard_output;
+
+        for (int i = 0; (i < file_count) && (options.output_file_path == NULL); i++) {
+            if (strcmp(argv[index_for_file_names[i]], STANDARD_INPUT_PATH) == 0) {
+                writes_code_to_standard_output = 1;
+            }
+        }
+
+        if (writes_code_to_standard_output) {
+            set_diagnostics_stream(stderr);
+        }
+
+        /* A single output path can not hold the code of several source files. */
+        if ((options.output_file_path != NULL) && ((root_path != NULL) || (file_count != 1))) {
+            release_memory(index_for_file_names);
+            report_error("Error: an output file path can only be used with a single source file.\n");
+            return -1;
+        }
+
+        /* Every source file of a manifest brings its own output path, if any. */
+        if ((manifest_path != NULL) && ((root_path != NULL) || (file_count > 0) || (server_socket_path != NULL) ||
+                                        (client_socket_path != NULL) || options.output_to_standard_output)) {
+            release_memory(index_for_file_names);
+            report_error("Error: a manifest can not be combined with other source files, a server or stdout.\n");
+            return -1;
+        }
+
+        /* Watching keeps assembling files into place, one after the other, until it is interrupted. */
+        if (is_watching && ((manifest_path != NULL) || (server_socket_path != NULL) || (client_socket_path != NULL) ||
+                            options.output_to_standard_output)) {
+            release_memory(index_for_file_names);
+            report_error("Error: only source files or a directory can be watched, and never into stdout.\n");
+            return -1;
+        }
+
+        /* A server waits for its source files, while a client hands them to one. */
+        if ((server_socket_path != NULL) && ((client_socket_path != NULL) || (root_path != NULL) || (file_count > 0))) {
+            release_memory(index_for_file_names);
+            report_error("Error: a server takes no source files, they are sent by its clients.\n");
+            return -1;
+        }
+
+        /* The pipeline streams the hack artifact out of files it reads itself. */
+        if (options.is_pipelined && ((options.artifacts != HACK_ARTIFACT) || (cache_path != NULL) || is_watching ||
+                                     (server_socket_path != NULL) || (client_socket_path != NULL))) {
+            release_memory(index_for_file_names);
+            report_error("Error: '%s' only writes the hack artifact, without a cache, a server or watching.\n", PIPELINE_COMMAND);
+            return -1;
+        }
+
+        /* A path for the statistics is enough to ask for them, in text unless told otherwise. */
+        if ((options.statistics_path != NULL) && (options.statistics_format == NO_STATISTICS)) {
+            options.statistics_format = TEXT_STATISTICS;
+        }
+
+        /* Statistics are only gathered by the batches of this process, one step at a time. */
+        if ((options.statistics_format != NO_STATISTICS) && (options.is_pipelined || is_watching ||
+                                                             (server_socket_path != NULL) || (client_socket_path != NULL))) {
+            release_memory(index_for_file_names);
+            report_error("Error: '%s' can not be combined with a pipeline, a server or "
+                         "watching.\n", STATISTICS_COMMAND);
+            return -1;
+        }
+
+        if ((client_socket_path != NULL) && (root_path != NULL)) {
+            release_memory(index_for_file_names);
+            report_error("Error: a client can only send source files, not directories.\n");
+            return -1;
+        }
+
+        if ((benchmark_request_count > 0) && ((client_socket_path == NULL) || (file_count != 1))) {
+            release_memory(index_for_file_names);
+            report_error("Error: '%s' needs '%s' and a single source file.\n", BENCHMARK_COMMAND, CLIENT_COMMAND);
+            return -1;
+        }
+
+        if (benchmark_request_count > 0) {
+            int result = run_assembler_client_benchmark(client_socket_path, argv[index_for_file_names[0]],
+                                                        (size_t)benchmark_request_count);
+
+            release_memory(index_for_file_names);
+            return (result > 0) ? 0 : -1;
+        }
+
+        if ((root_path == NULL) && (server_socket_path == NULL) && (manifest_path == NULL) && (file_count == 0)) {
+            release_memory(index_for_file_names);
+            report_error("Error: No input file defined.\n");
+            return -1;
+        }
+
+        /* The leaks are reported once everything else is released, and before the logger stops. */
+        if (is_accounting_memory) {
+            start_memory_accounting(is_tracking_leaks);
+
+            if (is_tracking_leaks) {
+                atexit(report_memory_leaks);
+            }
+        }
+
+        if ((cache_path != NULL) && (create_build_cache(&options.cache, cache_path, cache_size) < 0)) {
+            release_memory(index_for_file_names);
+            return -1;
+        }
+
+        /* Under make, its tokens limit the parallelism, and '-j' only caps it. */
+        if ((server_socket_path == NULL) && (client_socket_path == NULL) && !is_watching &&
+            (connect_to_job_server(&options.job_server) > 0) && !has_job_count) {
+            options.job_count = 0;
+        }
+
+        /* A server keeps every level, since each client chooses whether its own run is verbose. */
+        if (server_socket_path == NULL) {
+            set_diagnostics_level(options.verbose_mode ? DEBUG_DIAGNOSTICS : INFO_DIAGNOSTICS);
+        }
+
+        if ((trace_path != NULL) && (start_assembly_trace(trace_path) < 0)) {
+            release_memory(index_for_file_names);
+            dispose_build_cache(options.cache);
+            disconnect_from_job_server(options.job_server);
+            return -1;
+        }
+
+        /* Without counters the files are still assembled, only without reporting them. */
+        if (is_counting && (start_performance_counters() < 0)) {
+            is_counting = 0;
+        }
+
+        int result;
+
+        /* Serve other processes, or handle the source files of a manifest, of a directory tree, or all the passed
+         * file names */
+        if (server_socket_path != NULL) {
+            result = run_assembler_server(&options, server_socket_path);
+        }
+        else if (is_watching) {
+            char** file_names = NULL;
+
+            if (root_path == NULL) {
+                file_names = allocate_memory(sizeof(char*) * file_count);
+
+                if (file_names == NULL) {
+                    release_memory(index_for_file_names);
+                    dispose_build_cache(options.cache);
+                    disconnect_from_job_server(options.job_server);
+                    report_error("Internal Error: failed to alloc memory for 'file_names'.\n");
+                    return -1;
+                }
+
+                for (int i = 0; i < file_count; i++) {
+                    file_names[i] = argv[index_for_file_names[i]];
+                }
+            }
+
+            result = watch_source_files(&options, root_path, file_count, file_names, debounce_milliseconds);
+            release_memory(file_names);
+        }
+        else if (manifest_path != NULL) {
+            result = start_assembler_using_manifest(&options, manifest_path);
 
             if (result < 0) {
-                free(index_for_file_names);
-                printf("Error: failed to start assembler using current directory.\n");
-                return -1;
+                report_error("Error: failed to start assembler using manifest '%s'.\n", manifest_path);
+            }
+        }
+        else if (root_path != NULL) {
+            result = start_assembler_using_directory(&options, root_path);
+
+            if (result < 0) {
+                report_error("Error: failed to start assembler using directory '%s'.\n", root_path);
             }
         }
         else {
-            char** file_names = malloc(sizeof(char*) * file_count);
+            char** file_names = allocate_memory(sizeof(char*) * file_count);
 
             if (file_names == NULL) {
-                free(index_for_file_names);
-                printf("Internal Error: failed to alloc memory for 'file_names'.\n");
+                release_memory(index_for_file_names);
+                dispose_build_cache(options.cache);
+                disconnect_from_job_server(options.job_server);
+                report_error("Internal Error: failed to alloc memory for 'file_names'.\n");
                 return -1;
             }
 
@@ -89,25 +467,105 @@ int main(int argc, char** argv)
                 file_names[i] = file_name;
             }
 
-            int result = start_assembler(program_mode, file_count, file_names);
+            if (client_socket_path != NULL) {
+                result = start_assembler_client(&options, client_socket_path, file_count, file_names);
+            }
+            else {
+                result = start_assembler(&options, file_count, file_names);
+            }
 
             if (((void*)*file_names) != ((void*)index_for_file_names)) {
-                free(file_names);
+                release_memory(file_names);
             }
 
             if (result < 0) {
-                free(index_for_file_names);
-                printf("Error: failed to start assembler.\n");
-                return -1;
+                report_error("Error: failed to start assembler.\n");
+            }
+        }
+
+        if (options.cache != NULL) {
+            evict_build_cache(options.cache);
+
+            if (options.verbose_mode) {
+                report("Cache: %lu hits, %lu misses.\n", (unsigned long)atomic_load(&options.cache->hit_count),
+                       (unsigned long)atomic_load(&options.cache->miss_count));
             }
+
+            dispose_build_cache(options.cache);
+        }
+
+        disconnect_from_job_server(options.job_server);
+
+        if (is_counting) {
+            report_performance_counters();
+            stop_performance_counters();
+        }
+
+        if (is_accounting_memory) {
+            report_memory_accounting();
+        }
+
+        if ((trace_path != NULL) && (stop_assembly_trace() < 0)) {
+            result = -1;
         }
 
-        free(index_for_file_names);
+        /* If it is 0, every failed file has already been reported. */
+        if (result <= 0) {
+            release_memory(index_for_file_names);
+            return -1;
+        }
+
+        release_memory(index_for_file_names);
 	}
 	else {
-        printf("Error: No input file defined.\n");
+        report_error("Error: No input file defined.\n");
         return -1;
 	}
 
 	return 0;
+}
+
+/* Converts a list such as 'hack,sym,lst' into its artifacts flags. */
+int get_artifacts_from_list(const char* list) {
+    const char* NAMES[] = { "hack", "bin", "sym", "lst" };
+    const int ARTIFACTS[] = { HACK_ARTIFACT, BINARY_ARTIFACT, SYMBOLS_ARTIFACT, LISTING_ARTIFACT };
+    const size_t ARTIFACTS_COUNT = sizeof(ARTIFACTS) / sizeof(ARTIFACTS[0]);
+
+    int artifacts = 0;
+    const char* name = list;
+
+    while (*name != '\0') {
+        size_t name_length = strcspn(name, ",");
+        int found = 0;
+
+        for (size_t i = 0; i < ARTIFACTS_COUNT; i++) {
+            if ((strlen(NAMES[i]) == name_length) && (strncmp(NAMES[i], name, name_length) == 0)) {
+                artifacts |= ARTIFACTS[i];
+                found = 1;
+            }
+        }
+
+        if (!found) {
+            return -1;
+        }
+
+        name += name_length;
+
+        if (*name == ',') {
+            name++;
+        }
+    }
+
+    return artifacts;
+}
+
+/* Returns what follows '=' if 'argument' is '<command>=<value>', or NULL otherwise. */
+const char* get_long_command_value(const char* argument, const char* command) {
+    size_t command_length = strlen(command);
+
+    if ((strncmp(argument, command, command_length) == 0) && (argument[command_length] == '=')) {
+        return argument + command_length + 1;
+    }
+
+    return NULL;
 }
\ No newline at end of file
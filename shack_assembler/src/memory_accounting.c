@@ -0,0 +1,470 @@
+//
+// memory_accounting.c: the allocator every module goes through, which can count the allocations, bytes, live bytes and
+// high-water mark of every assembly step and file, and report the blocks never released.
+//
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory_accounting.h"
+#include "diagnostics.h"
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+/* Allocations made outside of every step are charged to this one. */
+#define OTHER_STEP ASSEMBLY_STEP_COUNT
+
+/* The allocator itself, and the diagnostics it reports through, use the C library directly. */
+#undef allocate_memory
+#undef allocate_zeroed_memory
+#undef allocate_aligned_memory
+#undef reallocate_memory
+#undef duplicate_string
+#undef duplicate_string_prefix
+
+struct step_accounting {
+    atomic_size_t allocation_count;
+    atomic_size_t release_count;
+    atomic_size_t allocated_byte_count;
+    atomic_llong peak_live_byte_count; // The most bytes live at once, in the whole process, while the step was running.
+};
+
+typedef struct step_accounting t_step_accounting;
+
+struct live_block {
+    void* memory; // NULL if the slot is empty.
+    size_t size;
+    const char* file;
+    int line;
+};
+
+typedef struct live_block t_live_block;
+
+struct memory_accounting {
+    atomic_int is_accounting;
+    atomic_int is_tracking_leaks;
+
+    atomic_llong live_byte_count;
+    atomic_llong peak_live_byte_count;
+    t_step_accounting steps[ASSEMBLY_STEP_COUNT + 1];
+
+    /* Live blocks, by address, with linear probing. Only used while tracking leaks. */
+    pthread_mutex_t lock;
+    t_live_block* live_blocks;
+    size_t live_block_count;
+    size_t live_block_capacity;
+};
+
+typedef struct memory_accounting t_memory_accounting;
+
+static t_memory_accounting accounting = {
+    .is_accounting = 0,
+    .is_tracking_leaks = 0,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .live_blocks = NULL,
+    .live_block_count = 0L,
+    .live_block_capacity = 0L,
+};
+
+static _Thread_local int accounted_step = -1;
+static _Thread_local size_t nested_accounted_step_count = 0L;
+
+struct leak_site {
+    const char* file;
+    int line;
+    size_t block_count;
+    size_t byte_count;
+};
+
+typedef struct leak_site t_leak_site;
+
+size_t get_block_size(void* memory);
+void account_allocation(void* memory, const char* file, int line);
+void account_release(void* memory, size_t size);
+int forget_live_block(void* memory, t_live_block* block);
+void count_release(size_t size);
+void update_peak(atomic_llong* peak, long long value);
+int add_live_block(void* memory, size_t size, const char* file, int line);
+int remove_live_block(void* memory, t_live_block* block);
+size_t get_live_block_slot(const t_live_block* blocks, size_t capacity, const void* memory);
+int compare_leak_sites(const void* first, const void* second);
+
+void* allocate_memory_at(size_t size, const char* file, int line) {
+    void* memory = malloc(size);
+
+    if ((memory != NULL) && atomic_load_explicit(&accounting.is_accounting, memory_order_relaxed)) {
+        account_allocation(memory, file, line);
+    }
+
+    return memory;
+}
+
+void* allocate_zeroed_memory_at(size_t count, size_t size, const char* file, int line) {
+    void* memory = calloc(count, size);
+
+    if ((memory != NULL) && atomic_load_explicit(&accounting.is_accounting, memory_order_relaxed)) {
+        account_allocation(memory, file, line);
+    }
+
+    return memory;
+}
+
+void* allocate_aligned_memory_at(size_t alignment, size_t size, const char* file, int line) {
+    void* memory = aligned_alloc(alignment, size);
+
+    if ((memory != NULL) && atomic_load_explicit(&accounting.is_accounting, memory_order_relaxed)) {
+        account_allocation(memory, file, line);
+    }
+
+    return memory;
+}
+
+/* The old block leaves the leak table before 'realloc' frees it, since another thread may be given its address, and
+ * record it, as soon as it does. It is put back if 'realloc' fails, leaving it untouched. */
+void* reallocate_memory_at(void* memory, size_t size, const char* file, int line) {
+    if ((memory == NULL) || !atomic_load_explicit(&accounting.is_accounting, memory_order_relaxed)) {
+        void* new_memory = realloc(memory, size);
+
+        if ((new_memory != NULL) && atomic_load_explicit(&accounting.is_accounting, memory_order_relaxed)) {
+            account_allocation(new_memory, file, line);
+        }
+
+        return new_memory;
+    }
+
+    size_t previous_size = get_block_size(memory);
+    t_live_block previous_block = { .memory = NULL };
+    int was_live = forget_live_block(memory, &previous_block);
+
+    void* new_memory = realloc(memory, size);
+
+    if (new_memory == NULL) {
+        if (previous_block.memory != NULL) {
+            pthread_mutex_lock(&accounting.lock);
+            add_live_block(previous_block.memory, previous_block.size, previous_block.file, previous_block.line);
+            pthread_mutex_unlock(&accounting.lock);
+        }
+
+        return NULL;
+    }
+
+    if (was_live) {
+        count_release(previous_size);
+    }
+
+    account_allocation(new_memory, file, line);
+
+    return new_memory;
+}
+
+char* duplicate_string_at(const char* text, size_t length, const char* file, int line) {
+    length = (length == (size_t)-1) ? strlen(text) : strnlen(text, length);
+    char* copy = allocate_memory_at(sizeof(char) * (length + 1), file, line);
+
+    if (copy != NULL) {
+        memcpy(copy, text, length);
+        copy[length] = '\0';
+    }
+
+    return copy;
+}
+
+void release_memory(void* memory) {
+    if (memory == NULL) {
+        return;
+    }
+
+    if (atomic_load_explicit(&accounting.is_accounting, memory_order_relaxed)) {
+        account_release(memory, get_block_size(memory));
+    }
+
+    free(memory);
+}
+
+void start_memory_accounting(int is_tracking_leaks) {
+    for (size_t i = 0; i <= ASSEMBLY_STEP_COUNT; i++) {
+        atomic_init(&accounting.steps[i].allocation_count, 0);
+        atomic_init(&accounting.steps[i].release_count, 0);
+        atomic_init(&accounting.steps[i].allocated_byte_count, 0);
+        atomic_init(&accounting.steps[i].peak_live_byte_count, 0);
+    }
+
+    atomic_init(&accounting.live_byte_count, 0);
+    atomic_init(&accounting.peak_live_byte_count, 0);
+
+    atomic_store(&accounting.is_tracking_leaks, is_tracking_leaks);
+    atomic_store(&accounting.is_accounting, 1);
+}
+
+void begin_accounted_step(t_assembly_step step) {
+    if (accounted_step >= 0) {
+        nested_accounted_step_count++;
+    }
+    else {
+        accounted_step = (int)step;
+    }
+}
+
+/* Only the outer step is known, so nested steps are trusted to end in order. */
+void end_accounted_step(t_assembly_step step) {
+    if (nested_accounted_step_count > 0) {
+        nested_accounted_step_count--;
+        return;
+    }
+
+    if (accounted_step != (int)step) {
+        report_error("Internal Error: the '%s' step ended without having begun at 'end_accounted_step'.\n",
+                     get_assembly_step_name(step));
+    }
+
+    accounted_step = -1;
+}
+
+void report_memory_accounting(void) {
+    if (!atomic_load(&accounting.is_accounting)) {
+        return;
+    }
+
+    size_t allocation_count = 0L;
+    size_t release_count = 0L;
+    size_t allocated_byte_count = 0L;
+
+    report("Memory per step:\n");
+
+    for (size_t i = 0; i <= ASSEMBLY_STEP_COUNT; i++) {
+        t_step_accounting* step = &accounting.steps[i];
+
+        allocation_count += atomic_load(&step->allocation_count);
+        release_count += atomic_load(&step->release_count);
+        allocated_byte_count += atomic_load(&step->allocated_byte_count);
+
+        if ((atomic_load(&step->allocation_count) == 0) && (atomic_load(&step->release_count) == 0)) {
+            continue;
+        }
+
+        report("    %s: %zu allocations (%zu bytes), %zu releases, peak of %lld bytes live.\n",
+               (i < ASSEMBLY_STEP_COUNT) ? get_assembly_step_name((t_assembly_step)i) : "other",
+               atomic_load(&step->allocation_count), atomic_load(&step->allocated_byte_count),
+               atomic_load(&step->release_count), atomic_load(&step->peak_live_byte_count));
+    }
+
+    long long live_byte_count = atomic_load(&accounting.live_byte_count);
+
+    report("Memory in total: %zu allocations (%zu bytes), %zu releases, peak of %lld bytes live, %lld still live.\n",
+           allocation_count, allocated_byte_count, release_count, atomic_load(&accounting.peak_live_byte_count),
+           (live_byte_count > 0) ? live_byte_count : 0);
+}
+
+void report_memory_leaks(void) {
+    if (!atomic_load(&accounting.is_tracking_leaks)) {
+        return;
+    }
+
+    pthread_mutex_lock(&accounting.lock);
+
+    t_leak_site* sites = malloc(sizeof(t_leak_site) * (accounting.live_block_count + 1));
+    size_t site_count = 0L;
+
+    for (size_t i = 0; (sites != NULL) && (i < accounting.live_block_capacity); i++) {
+        const t_live_block* block = &accounting.live_blocks[i];
+        size_t site = 0L;
+
+        if (block->memory == NULL) {
+            continue;
+        }
+
+        while ((site < site_count) &&
+               ((sites[site].line != block->line) || (strcmp(sites[site].file, block->file) != 0))) {
+            site++;
+        }
+
+        if (site == site_count) {
+            sites[site_count++] = (t_leak_site){ .file = block->file, .line = block->line, .block_count = 0L,
+                                                 .byte_count = 0L };
+        }
+
+        sites[site].block_count++;
+        sites[site].byte_count += block->size;
+    }
+
+    pthread_mutex_unlock(&accounting.lock);
+
+    if (sites == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'sites' at 'report_memory_leaks'.\n");
+        return;
+    }
+
+    qsort(sites, site_count, sizeof(t_leak_site), compare_leak_sites);
+
+    for (size_t i = 0; i < site_count; i++) {
+        const char* file_name = strrchr(sites[i].file, '/');
+
+        report_warning("Warning: %zu blocks (%zu bytes) allocated at '%s:%d' were never "
+                       "released.\n", sites[i].block_count, sites[i].byte_count,
+                       (file_name != NULL) ? (file_name + 1) : sites[i].file, sites[i].line);
+    }
+
+    if (site_count == 0) {
+        report("Memory: every block was released.\n");
+    }
+
+    free(sites);
+}
+
+/* What the C library reserved for the block, which may be a bit more than requested. 0 where it can not be told. */
+size_t get_block_size(void* memory) {
+#ifdef __GLIBC__
+    return malloc_usable_size(memory);
+#else
+    return 0L;
+#endif
+}
+
+void account_allocation(void* memory, const char* file, int line) {
+    size_t size = get_block_size(memory);
+    size_t slot = (accounted_step >= 0) ? (size_t)accounted_step : OTHER_STEP;
+    t_step_accounting* step = &accounting.steps[slot];
+
+    long long live_byte_count = atomic_fetch_add_explicit(&accounting.live_byte_count, (long long)size,
+                                                          memory_order_relaxed) + (long long)size;
+
+    atomic_fetch_add_explicit(&step->allocation_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&step->allocated_byte_count, size, memory_order_relaxed);
+    update_peak(&step->peak_live_byte_count, live_byte_count);
+    update_peak(&accounting.peak_live_byte_count, live_byte_count);
+
+    record_memory_statistics(size, 0L);
+
+    if (atomic_load_explicit(&accounting.is_tracking_leaks, memory_order_relaxed)) {
+        pthread_mutex_lock(&accounting.lock);
+        add_live_block(memory, size, file, line);
+        pthread_mutex_unlock(&accounting.lock);
+    }
+}
+
+void account_release(void* memory, size_t size) {
+    if (forget_live_block(memory, NULL)) {
+        count_release(size);
+    }
+}
+
+/* Returns 1 if the release of 'memory' is to be counted. While tracking leaks, blocks allocated before the accounting
+ * started are told apart, and not counted, and the entry of the block is copied into 'block', if any. */
+int forget_live_block(void* memory, t_live_block* block) {
+    if (!atomic_load_explicit(&accounting.is_tracking_leaks, memory_order_relaxed)) {
+        return 1;
+    }
+
+    pthread_mutex_lock(&accounting.lock);
+    int was_live = remove_live_block(memory, block);
+    pthread_mutex_unlock(&accounting.lock);
+
+    return was_live;
+}
+
+void count_release(size_t size) {
+    size_t slot = (accounted_step >= 0) ? (size_t)accounted_step : OTHER_STEP;
+
+    atomic_fetch_sub_explicit(&accounting.live_byte_count, (long long)size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&accounting.steps[slot].release_count, 1, memory_order_relaxed);
+
+    record_memory_statistics(0L, size);
+}
+
+void update_peak(atomic_llong* peak, long long value) {
+    long long current = atomic_load_explicit(peak, memory_order_relaxed);
+
+    while ((value > current) &&
+           !atomic_compare_exchange_weak_explicit(peak, &current, value, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+/* Expects 'lock' to be taken. The table is kept at most half full. */
+int add_live_block(void* memory, size_t size, const char* file, int line) {
+    if (((accounting.live_block_count + 1) * 2) > accounting.live_block_capacity) {
+        size_t new_capacity = (accounting.live_block_capacity > 0) ? (accounting.live_block_capacity * 2) :
+                              LEAK_TABLE_CAPACITY;
+        t_live_block* new_blocks = calloc(new_capacity, sizeof(t_live_block));
+
+        if (new_blocks == NULL) {
+            return -1;
+        }
+
+        for (size_t i = 0; i < accounting.live_block_capacity; i++) {
+            if (accounting.live_blocks[i].memory != NULL) {
+                new_blocks[get_live_block_slot(new_blocks, new_capacity, accounting.live_blocks[i].memory)] =
+                    accounting.live_blocks[i];
+            }
+        }
+
+        free(accounting.live_blocks);
+        accounting.live_blocks = new_blocks;
+        accounting.live_block_capacity = new_capacity;
+    }
+
+    size_t slot = get_live_block_slot(accounting.live_blocks, accounting.live_block_capacity, memory);
+
+    if (accounting.live_blocks[slot].memory == NULL) {
+        accounting.live_block_count++;
+    }
+
+    accounting.live_blocks[slot] = (t_live_block){ .memory = memory, .size = size, .file = file, .line = line };
+
+    return 1;
+}
+
+/* Expects 'lock' to be taken. The blocks after the removed one are moved back, so that no probing chain breaks. */
+int remove_live_block(void* memory, t_live_block* block) {
+    if (accounting.live_block_capacity == 0) {
+        return 0;
+    }
+
+    size_t capacity = accounting.live_block_capacity;
+    size_t slot = get_live_block_slot(accounting.live_blocks, capacity, memory);
+
+    if (accounting.live_blocks[slot].memory == NULL) {
+        return 0;
+    }
+
+    if (block != NULL) {
+        *block = accounting.live_blocks[slot];
+    }
+
+    accounting.live_blocks[slot].memory = NULL;
+    accounting.live_block_count--;
+
+    for (size_t next = (slot + 1) % capacity; accounting.live_blocks[next].memory != NULL;
+         next = (next + 1) % capacity) {
+        t_live_block block = accounting.live_blocks[next];
+
+        accounting.live_blocks[next].memory = NULL;
+        accounting.live_blocks[get_live_block_slot(accounting.live_blocks, capacity, block.memory)] = block;
+    }
+
+    return 1;
+}
+
+/* The slot holding 'memory', or the empty one where it would go. */
+size_t get_live_block_slot(const t_live_block* blocks, size_t capacity, const void* memory) {
+    uintptr_t address = (uintptr_t)memory;
+    size_t slot = (size_t)((address >> 4) * 0x9e3779b97f4a7c15ull) % capacity;
+
+    while ((blocks[slot].memory != NULL) && (blocks[slot].memory != memory)) {
+        slot = (slot + 1) % capacity;
+    }
+
+    return slot;
+}
+
+/* The sites leaking the most bytes first. */
+int compare_leak_sites(const void* first, const void* second) {
+    const t_leak_site* first_site = first;
+    const t_leak_site* second_site = second;
+
+    return (first_site->byte_count < second_site->byte_count) - (first_site->byte_count > second_site->byte_count);
+}
@@ -0,0 +1,46 @@
+//
+// memory_accounting.h: the allocator every module goes through, which can count the allocations, bytes, live bytes and
+// high-water mark of every assembly step and file, and report the blocks never released.
+//
+
+#ifndef SHACK_ASSEMBLER_MEMORY_ACCOUNTING_H
+#define SHACK_ASSEMBLER_MEMORY_ACCOUNTING_H
+
+#include <stddef.h>
+
+#include "assembly_statistics.h"
+
+#define LEAK_TABLE_CAPACITY 4096
+
+/* Blocks are plain C library blocks, so one may still be released with 'free' (it is then only missed by the
+ * accounting), and the sites are only kept to report leaks. */
+#define allocate_memory(size) allocate_memory_at((size), __FILE__, __LINE__)
+#define allocate_zeroed_memory(count, size) allocate_zeroed_memory_at((count), (size), __FILE__, __LINE__)
+#define allocate_aligned_memory(alignment, size) allocate_aligned_memory_at((alignment), (size), __FILE__, __LINE__)
+#define reallocate_memory(memory, size) reallocate_memory_at((memory), (size), __FILE__, __LINE__)
+#define duplicate_string(text) duplicate_string_at((text), (size_t)-1, __FILE__, __LINE__)
+#define duplicate_string_prefix(text, length) duplicate_string_at((text), (length), __FILE__, __LINE__)
+
+void* allocate_memory_at(size_t size, const char* file, int line);
+void* allocate_zeroed_memory_at(size_t count, size_t size, const char* file, int line);
+void* allocate_aligned_memory_at(size_t alignment, size_t size, const char* file, int line);
+void* reallocate_memory_at(void* memory, size_t size, const char* file, int line);
+char* duplicate_string_at(const char* text, size_t length, const char* file, int line); // At most 'length' characters.
+void release_memory(void* memory);
+
+/* Nothing is counted until started. Tracking leaks also keeps every live block, with the site which allocated it, so
+ * that 'report_memory_leaks' can tell them apart. */
+void start_memory_accounting(int is_tracking_leaks);
+
+/* Allocations are charged to the step being accounted on the calling thread, if any. Steps begun while another one is
+ * accounted on the same thread are left to the outer one. */
+void begin_accounted_step(t_assembly_step step);
+void end_accounted_step(t_assembly_step step);
+
+/* Reports the allocations of every step, and the peak of live bytes reached while each one was running. */
+void report_memory_accounting(void);
+
+/* Reports the blocks still live, grouped by the site which allocated them. Meant to be called at exit. */
+void report_memory_leaks(void);
+
+#endif //SHACK_ASSEMBLER_MEMORY_ACCOUNTING_H
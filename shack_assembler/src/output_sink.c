@@ -0,0 +1,506 @@
+//
+// output_sink.c: writes the assembled code into files, already opened descriptors or memory buffers.
+//
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+#include "output_sink.h"
+#include "general_types.h"
+#include "diagnostics.h"
+#include "memory_accounting.h"
+
+#define OUTPUT_FILE_MODE 0666 // Before the umask, the same as 'fopen'.
+#define TEMPORARY_SUFFIX ".XXXXXX"
+#define DEFAULT_MEMORY_SINK_CAPACITY 4096
+#define COPY_CHUNK_SIZE 65536
+
+int create_output_sink(t_output_sink** sink, t_output_sink_type type);
+int ensure_memory_sink_capacity(t_output_sink* sink, size_t capacity);
+int write_all_to_descriptor(int descriptor, const char* bytes, size_t length, off_t offset, int positioned);
+int have_files_same_content(int new_file, const char* existing_file_path, size_t new_file_size);
+mode_t get_output_file_mode(const char* file_path);
+void read_file_creation_mask(void);
+
+static pthread_once_t file_creation_mask_once = PTHREAD_ONCE_INIT;
+static mode_t file_creation_mask = 022;
+
+int create_file_sink(t_output_sink** sink, const char* file_path) {
+    if (file_path == NULL) {
+        report_error("Internal Error: null 'file_path' at 'create_file_sink'.\n");
+        return -1;
+    }
+
+    if (create_output_sink(sink, FILE_SINK) < 0) {
+        return -1;
+    }
+
+    t_output_sink* file_sink = *sink;
+    size_t file_path_length = strlen(file_path);
+
+    file_sink->file_path = allocate_memory(sizeof(char) * (file_path_length + 1));
+    file_sink->temporary_file_path = allocate_memory(sizeof(char) * (file_path_length + strlen(TEMPORARY_SUFFIX) + 1));
+
+    if ((file_sink->file_path == NULL) || (file_sink->temporary_file_path == NULL)) {
+        dispose_output_sink(file_sink);
+        report_error("Internal Error: failed to allocate memory for the paths at 'create_file_sink'.\n");
+        return -1;
+    }
+
+    strcpy(file_sink->file_path, file_path);
+
+    /* The temporary file lives next to the output one, so 'rename' stays within the same file system. */
+    sprintf(file_sink->temporary_file_path, "%s%s", file_path, TEMPORARY_SUFFIX);
+
+    file_sink->descriptor = mkstemp(file_sink->temporary_file_path);
+
+    if (file_sink->descriptor < 0) {
+        release_memory(file_sink->temporary_file_path);
+        file_sink->temporary_file_path = NULL;
+        dispose_output_sink(file_sink);
+        report_error("Error: failed to create a temporary output file for '%s'.\n", file_path);
+        return -1;
+    }
+
+    /* 'mkstemp' creates the file as 0600, while the output file must keep its mode, or get the one 'fopen' would. */
+    if (fchmod(file_sink->descriptor, get_output_file_mode(file_path)) < 0) {
+        dispose_output_sink(file_sink);
+        report_error("Error: failed to set the permissions of the output file for '%s'.\n", file_path);
+        return -1;
+    }
+
+    return 1;
+}
+
+int create_descriptor_sink(t_output_sink** sink, int descriptor) {
+    if (descriptor < 0) {
+        report_error("Internal Error: invalid 'descriptor' at 'create_descriptor_sink'.\n");
+        return -1;
+    }
+
+    if (create_output_sink(sink, DESCRIPTOR_SINK) < 0) {
+        return -1;
+    }
+
+    (*sink)->descriptor = descriptor;
+
+    return 1;
+}
+
+int create_memory_sink(t_output_sink** sink) {
+    if (create_output_sink(sink, MEMORY_SINK) < 0) {
+        return -1;
+    }
+
+    if (ensure_memory_sink_capacity(*sink, DEFAULT_MEMORY_SINK_CAPACITY) < 0) {
+        dispose_output_sink(*sink);
+        return -1;
+    }
+
+    return 1;
+}
+
+int create_output_sink(t_output_sink** sink, t_output_sink_type type) {
+    if (sink == NULL) {
+        report_error("Internal Error: null 'sink' at 'create_output_sink'.\n");
+        return -1;
+    }
+
+    t_output_sink* output_sink = allocate_memory(sizeof(t_output_sink));
+
+    if (output_sink == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'output_sink' at 'create_output_sink'.\n");
+        return -1;
+    }
+
+    output_sink->type = type;
+    output_sink->file_path = NULL;
+    output_sink->temporary_file_path = NULL;
+    output_sink->descriptor = -1;
+    output_sink->buffer = NULL;
+    output_sink->capacity = 0L;
+    output_sink->length = 0L;
+    output_sink->mapping = NULL;
+    output_sink->mapping_length = 0L;
+
+    *sink = output_sink;
+
+    return 1;
+}
+
+int write_to_output_sink(t_output_sink* sink, const char* bytes, size_t length) {
+    if ((sink == NULL) || (bytes == NULL)) {
+        report_error("Internal Error: null arguments at 'write_to_output_sink'.\n");
+        return -1;
+    }
+
+    if (sink->type == MEMORY_SINK) {
+        if (ensure_memory_sink_capacity(sink, sink->length + length) < 0) {
+            return -1;
+        }
+
+        memcpy(sink->buffer + sink->length, bytes, length);
+    }
+    else if (write_all_to_descriptor(sink->descriptor, bytes, length, (off_t)sink->length, sink->type == FILE_SINK) < 0) {
+        report_error("Error: failed to write into the output.\n");
+        return -1;
+    }
+
+    sink->length += length;
+
+    return 1;
+}
+
+int write_file_to_output_sink(t_output_sink* sink, int descriptor, size_t length) {
+    if ((sink == NULL) || (descriptor < 0)) {
+        report_error("Internal Error: invalid arguments at 'write_file_to_output_sink'.\n");
+        return -1;
+    }
+
+    if (length == 0) {
+        return 1;
+    }
+
+    /* An empty file sink can take the whole file as it is, which may not even need to copy the data. */
+    if ((sink->type == FILE_SINK) && (sink->length == 0)) {
+        if (copy_file_contents(descriptor, sink->descriptor, length) < 0) {
+            report_error("Error: failed to write into the output.\n");
+            return -1;
+        }
+
+        sink->length = length;
+        return 1;
+    }
+
+    const char* content = mmap(NULL, length, PROT_READ, MAP_SHARED, descriptor, 0);
+
+    if (content == MAP_FAILED) {
+        report_error("Error: failed to map a file at 'write_file_to_output_sink'.\n");
+        return -1;
+    }
+
+    int result = write_to_output_sink(sink, content, length);
+
+    munmap((void*)content, length);
+    return result;
+}
+
+int copy_file_contents(int source_descriptor, int destination_descriptor, size_t length) {
+#ifdef __linux__
+    /* Copy on write file systems share the blocks of both files. */
+    if (ioctl(destination_descriptor, FICLONE, source_descriptor) == 0) {
+        return 1;
+    }
+
+    size_t copied = 0;
+    loff_t source_offset = 0;
+    loff_t destination_offset = 0;
+
+    while (copied < length) {
+        ssize_t result = copy_file_range(source_descriptor, &source_offset, destination_descriptor,
+                                         &destination_offset, length - copied, 0);
+
+        if (result <= 0) {
+            break;
+        }
+
+        copied += (size_t)result;
+    }
+
+    if (copied == length) {
+        return 1;
+    }
+#endif
+
+    char* chunk = allocate_memory(sizeof(char) * COPY_CHUNK_SIZE);
+
+    if (chunk == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'chunk' at 'copy_file_contents'.\n");
+        return -1;
+    }
+
+    for (size_t offset = 0; offset < length;) {
+        size_t chunk_length = ((length - offset) < COPY_CHUNK_SIZE) ? (length - offset) : COPY_CHUNK_SIZE;
+        ssize_t result = pread(source_descriptor, chunk, chunk_length, (off_t)offset);
+
+        if ((result <= 0) || (write_all_to_descriptor(destination_descriptor, chunk, (size_t)result, (off_t)offset, 1) < 0)) {
+            release_memory(chunk);
+            return -1;
+        }
+
+        offset += (size_t)result;
+    }
+
+    release_memory(chunk);
+    return 1;
+}
+
+int reserve_output_sink_region(t_output_sink* sink, size_t length, char** region) {
+    if ((sink == NULL) || (region == NULL)) {
+        report_error("Internal Error: null arguments at 'reserve_output_sink_region'.\n");
+        return -1;
+    }
+
+    if (sink->mapping != NULL) {
+        report_error("Internal Error: the sink already has a reserved region at 'reserve_output_sink_region'.\n");
+        return -1;
+    }
+
+    if (sink->type == DESCRIPTOR_SINK) {
+        return 0;
+    }
+
+    if (length == 0) {
+        *region = NULL;
+        return 1;
+    }
+
+    if (sink->type == MEMORY_SINK) {
+        if (ensure_memory_sink_capacity(sink, sink->length + length) < 0) {
+            return -1;
+        }
+
+        *region = sink->buffer + sink->length;
+        sink->length += length;
+
+        return 1;
+    }
+
+    /* The whole size is known beforehand, so the file gets extended only once. */
+    size_t mapping_length = sink->length + length;
+
+    if (ftruncate(sink->descriptor, (off_t)mapping_length) < 0) {
+        return 0;
+    }
+
+    char* mapping = mmap(NULL, mapping_length, PROT_READ | PROT_WRITE, MAP_SHARED, sink->descriptor, 0);
+
+    if (mapping == MAP_FAILED) {
+        if (ftruncate(sink->descriptor, (off_t)sink->length) < 0) {
+            return -1;
+        }
+
+        return 0;
+    }
+
+    sink->mapping = mapping;
+    sink->mapping_length = mapping_length;
+
+    *region = mapping + sink->length;
+    sink->length += length;
+
+    return 1;
+}
+
+int release_output_sink_region(t_output_sink* sink) {
+    if (sink == NULL) {
+        report_error("Internal Error: null 'sink' at 'release_output_sink_region'.\n");
+        return -1;
+    }
+
+    if (sink->mapping != NULL) {
+        int result = munmap(sink->mapping, sink->mapping_length);
+
+        sink->mapping = NULL;
+        sink->mapping_length = 0L;
+
+        if (result < 0) {
+            report_error("Error: failed to write into the output.\n");
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+int commit_output_sink(t_output_sink* sink) {
+    if (sink == NULL) {
+        report_error("Internal Error: null 'sink' at 'commit_output_sink'.\n");
+        return -1;
+    }
+
+    if (release_output_sink_region(sink) < 0) {
+        return -1;
+    }
+
+    if ((sink->type != FILE_SINK) || (sink->temporary_file_path == NULL)) {
+        return 1;
+    }
+
+    int result = have_files_same_content(sink->descriptor, sink->file_path, sink->length);
+
+    if (result > 0) {
+        /* Unchanged output: the existing file, and its modification time, are kept as they are. */
+        unlink(sink->temporary_file_path);
+    }
+    else if (rename(sink->temporary_file_path, sink->file_path) < 0) {
+        report_error("Error: failed to replace output file '%s'.\n", sink->file_path);
+        return -1;
+    }
+
+    release_memory(sink->temporary_file_path);
+    sink->temporary_file_path = NULL;
+
+    return 1;
+}
+
+void dispose_output_sink(t_output_sink* sink) {
+    if (sink == NULL) {
+        return;
+    }
+
+    release_output_sink_region(sink);
+
+    if (sink->type == FILE_SINK) {
+        /* Not committed: the existing output file is left untouched. */
+        if (sink->temporary_file_path != NULL) {
+            unlink(sink->temporary_file_path);
+            release_memory(sink->temporary_file_path);
+        }
+
+        if (sink->descriptor >= 0) {
+            close(sink->descriptor);
+        }
+    }
+
+    if (sink->file_path != NULL) {
+        release_memory(sink->file_path);
+    }
+
+    if (sink->buffer != NULL) {
+        release_memory(sink->buffer);
+    }
+
+    release_memory(sink);
+}
+
+int ensure_memory_sink_capacity(t_output_sink* sink, size_t capacity) {
+    if (sink->capacity >= capacity) {
+        return 1;
+    }
+
+    size_t new_capacity = (sink->capacity > 0) ? sink->capacity : DEFAULT_MEMORY_SINK_CAPACITY;
+
+    while (new_capacity < capacity) {
+        new_capacity *= 2;
+    }
+
+    char* new_buffer = reallocate_memory(sink->buffer, sizeof(char) * new_capacity);
+
+    if (new_buffer == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'buffer' at 'ensure_memory_sink_capacity'.\n");
+        return -1;
+    }
+
+    sink->buffer = new_buffer;
+    sink->capacity = new_capacity;
+
+    return 1;
+}
+
+int write_all_to_descriptor(int descriptor, const char* bytes, size_t length, off_t offset, int positioned) {
+    size_t written = 0;
+
+    while (written < length) {
+        ssize_t result = positioned ? pwrite(descriptor, bytes + written, length - written, offset + (off_t)written) :
+                         write(descriptor, bytes + written, length - written);
+
+        if (result <= 0) {
+            return -1;
+        }
+
+        written += (size_t)result;
+    }
+
+    return 1;
+}
+
+/* Returns 1 if 'existing_file_path' holds the same bytes as 'new_file', 0 if it differs or does not exist. */
+int have_files_same_content(int new_file, const char* existing_file_path, size_t new_file_size) {
+    int existing_file = open(existing_file_path, O_RDONLY);
+
+    if (existing_file < 0) {
+        return 0;
+    }
+
+    struct stat existing_file_status;
+
+    if ((fstat(existing_file, &existing_file_status) < 0) || !S_ISREG(existing_file_status.st_mode) ||
+        ((size_t)existing_file_status.st_size != new_file_size)) {
+        close(existing_file);
+        return 0;
+    }
+
+    if (new_file_size == 0) {
+        close(existing_file);
+        return 1;
+    }
+
+    const char* existing_content = mmap(NULL, new_file_size, PROT_READ, MAP_SHARED, existing_file, 0);
+    const char* new_content = mmap(NULL, new_file_size, PROT_READ, MAP_SHARED, new_file, 0);
+
+    /* If any of them can not be mapped, it is considered as changed. */
+    int result = ((existing_content != MAP_FAILED) && (new_content != MAP_FAILED) &&
+                  (memcmp(existing_content, new_content, new_file_size) == 0)) ? 1 : 0;
+
+    if (existing_content != MAP_FAILED) {
+        munmap((void*)existing_content, new_file_size);
+    }
+
+    if (new_content != MAP_FAILED) {
+        munmap((void*)new_content, new_file_size);
+    }
+
+    close(existing_file);
+    return result;
+}
+
+/* The mode of the existing output file, or the default one without the bits masked by the umask. */
+mode_t get_output_file_mode(const char* file_path) {
+    struct stat file_status;
+
+    if (stat(file_path, &file_status) == 0) {
+        return file_status.st_mode & 07777;
+    }
+
+    pthread_once(&file_creation_mask_once, read_file_creation_mask);
+
+    return OUTPUT_FILE_MODE & ~file_creation_mask;
+}
+
+/* Read from '/proc', since 'umask' can only read the mask by replacing it, which would leave the files created by
+ * other threads meanwhile without one. Where it can not be read, the usual 022 is kept. */
+void read_file_creation_mask(void) {
+    FILE* status = fopen("/proc/self/status", "r");
+    char line[256];
+
+    if (status == NULL) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), status) != NULL) {
+        unsigned int mask;
+
+        if (sscanf(line, "Umask: %o", &mask) == 1) {
+            file_creation_mask = (mode_t)(mask & 0777);
+            break;
+        }
+    }
+
+    fclose(status);
+}
@@ -0,0 +1,58 @@
+//
+// output_sink.h: destinations where the assembled code can be written to (files, descriptors or memory).
+//
+
+#ifndef SHACK_ASSEMBLER_OUTPUT_SINK_H
+#define SHACK_ASSEMBLER_OUTPUT_SINK_H
+
+#include <stddef.h>
+
+enum output_sink_type {
+    FILE_SINK,
+    DESCRIPTOR_SINK,
+    MEMORY_SINK,
+};
+
+typedef enum output_sink_type t_output_sink_type;
+
+struct output_sink {
+    t_output_sink_type type;
+
+    /* FILE_SINK: the content goes to a temporary file which replaces 'file_path' once committed. */
+    char* file_path;
+    char* temporary_file_path;
+
+    /* FILE_SINK and DESCRIPTOR_SINK. */
+    int descriptor;
+
+    /* MEMORY_SINK. */
+    char* buffer;
+    size_t capacity;
+
+    size_t length;
+
+    char* mapping;
+    size_t mapping_length;
+};
+
+typedef struct output_sink t_output_sink;
+
+int create_file_sink(t_output_sink** sink, const char* file_path);
+int create_descriptor_sink(t_output_sink** sink, int descriptor);
+int create_memory_sink(t_output_sink** sink);
+
+int write_to_output_sink(t_output_sink* sink, const char* bytes, size_t length);
+
+/* Appends the first 'length' bytes of an open file, cloning it instead of copying whenever the file system allows it. */
+int write_file_to_output_sink(t_output_sink* sink, int descriptor, size_t length);
+int copy_file_contents(int source_descriptor, int destination_descriptor, size_t length);
+
+/* Reserves 'length' bytes at the end of the sink and returns them through 'region', so they can be filled in place.
+ * Returns 0 if the sink can not be written in place (e.g. pipes), in which case 'write_to_output_sink' must be used. */
+int reserve_output_sink_region(t_output_sink* sink, size_t length, char** region);
+int release_output_sink_region(t_output_sink* sink);
+
+int commit_output_sink(t_output_sink* sink);
+void dispose_output_sink(t_output_sink* sink);
+
+#endif //SHACK_ASSEMBLER_OUTPUT_SINK_H
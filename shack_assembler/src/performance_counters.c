@@ -0,0 +1,336 @@
+//
+// performance_counters.c: counts cycles, instructions, cache misses and branch misses of every assembly step with
+// perf_event_open, to tell whether a step is bound by the branches, the caches or the system calls.
+//
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "performance_counters.h"
+#include "diagnostics.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+static const char* COUNTER_NAMES[PERFORMANCE_COUNTER_COUNT] = {
+    "cycles", "instructions", "cache misses", "branch misses",
+};
+
+/* The counters of a thread are opened as a single group, so that all of them are read at once. */
+struct counting_thread {
+    int state; // 0 until opened, 1 once open, and -1 if they could not be opened.
+    int group_descriptor;
+    int descriptors[PERFORMANCE_COUNTER_COUNT];
+    size_t counter_order[PERFORMANCE_COUNTER_COUNT]; // Which counter each value read from the group is.
+    size_t open_count;
+
+    int counted_step; // -1 if no step is being counted.
+    size_t nested_step_count;
+    uint64_t started_values[PERFORMANCE_COUNTER_COUNT];
+};
+
+typedef struct counting_thread t_counting_thread;
+
+struct performance_counters {
+    atomic_int is_counting;
+    int is_available[PERFORMANCE_COUNTER_COUNT];
+    int excludes_kernel; // Set if the kernel only allows counting the user space.
+    pthread_key_t thread_key; // Closes the counters of every thread which finishes.
+
+    atomic_uint_least64_t totals[ASSEMBLY_STEP_COUNT][PERFORMANCE_COUNTER_COUNT];
+    atomic_size_t step_counts[ASSEMBLY_STEP_COUNT];
+};
+
+typedef struct performance_counters t_performance_counters;
+
+static t_performance_counters counters = {
+    .is_counting = 0,
+};
+
+static _Thread_local t_counting_thread counting_thread = {
+    .state = 0,
+    .counted_step = -1,
+    .nested_step_count = 0L,
+};
+
+int open_thread_counters(t_counting_thread* thread);
+int read_thread_counters(t_counting_thread* thread, uint64_t* values);
+void close_thread_counters(void* thread);
+
+#ifdef __linux__
+
+int open_performance_counter(t_performance_counter counter, int group_descriptor, int excludes_kernel) {
+    const unsigned long long CONFIGS[PERFORMANCE_COUNTER_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+    };
+
+    struct perf_event_attr attributes;
+    memset(&attributes, 0, sizeof(attributes));
+
+    attributes.size = sizeof(attributes);
+    attributes.type = PERF_TYPE_HARDWARE;
+    attributes.config = CONFIGS[counter];
+    attributes.read_format = PERF_FORMAT_GROUP;
+    attributes.exclude_kernel = excludes_kernel ? 1 : 0;
+    attributes.exclude_hv = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attributes, 0, -1, group_descriptor, 0);
+}
+
+#else
+
+int open_performance_counter(t_performance_counter counter, int group_descriptor, int excludes_kernel) {
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
+
+int start_performance_counters(void) {
+    if (atomic_load(&counters.is_counting)) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < ASSEMBLY_STEP_COUNT; i++) {
+        for (size_t j = 0; j < PERFORMANCE_COUNTER_COUNT; j++) {
+            atomic_init(&counters.totals[i][j], 0);
+        }
+
+        atomic_init(&counters.step_counts[i], 0);
+    }
+
+    /* The kernel may only let unprivileged processes count their user space. */
+    int descriptor = open_performance_counter(CYCLES_COUNTER, -1, 0);
+    counters.excludes_kernel = 0;
+
+    if (descriptor < 0) {
+        descriptor = open_performance_counter(CYCLES_COUNTER, -1, 1);
+        counters.excludes_kernel = 1;
+    }
+
+    if (descriptor < 0) {
+        report_warning("Warning: hardware performance counters are not available (%s), so none will be reported.\n",
+                       strerror(errno));
+        return 0;
+    }
+
+    close(descriptor);
+
+    if (pthread_key_create(&counters.thread_key, close_thread_counters) != 0) {
+        report_error("Internal Error: could not create the key of the counters at 'start_performance_counters'.\n");
+        return -1;
+    }
+
+    /* Whatever the calling thread can open is what every thread counts. */
+    for (size_t i = 0; i < PERFORMANCE_COUNTER_COUNT; i++) {
+        counters.is_available[i] = 1;
+    }
+
+    if (open_thread_counters(&counting_thread) < 0) {
+        pthread_key_delete(counters.thread_key);
+        report_warning("Warning: hardware performance counters are not available (%s), so none will be reported.\n",
+                       strerror(errno));
+        return 0;
+    }
+
+    for (size_t i = 0; i < PERFORMANCE_COUNTER_COUNT; i++) {
+        counters.is_available[i] = 0;
+    }
+
+    for (size_t i = 0; i < counting_thread.open_count; i++) {
+        counters.is_available[counting_thread.counter_order[i]] = 1;
+    }
+
+    atomic_store_explicit(&counters.is_counting, 1, memory_order_release);
+
+    return 1;
+}
+
+/* Expected to be called once every counted thread is done. */
+void stop_performance_counters(void) {
+    if (!atomic_load(&counters.is_counting)) {
+        return;
+    }
+
+    atomic_store(&counters.is_counting, 0);
+
+    close_thread_counters(&counting_thread);
+    pthread_key_delete(counters.thread_key);
+}
+
+void begin_counted_step(t_assembly_step step) {
+    t_counting_thread* thread = &counting_thread;
+
+    if (!atomic_load_explicit(&counters.is_counting, memory_order_relaxed)) {
+        return;
+    }
+
+    if (thread->counted_step >= 0) {
+        thread->nested_step_count++;
+        return;
+    }
+
+    if ((open_thread_counters(thread) > 0) && (read_thread_counters(thread, thread->started_values) > 0)) {
+        thread->counted_step = (int)step;
+    }
+}
+
+void end_counted_step(t_assembly_step step) {
+    t_counting_thread* thread = &counting_thread;
+    uint64_t values[PERFORMANCE_COUNTER_COUNT];
+
+    if (thread->counted_step < 0) {
+        return;
+    }
+
+    if (thread->nested_step_count > 0) {
+        thread->nested_step_count--;
+        return;
+    }
+
+    thread->counted_step = -1;
+
+    if (read_thread_counters(thread, values) < 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < PERFORMANCE_COUNTER_COUNT; i++) {
+        atomic_fetch_add_explicit(&counters.totals[step][i], values[i] - thread->started_values[i],
+                                  memory_order_relaxed);
+    }
+
+    atomic_fetch_add_explicit(&counters.step_counts[step], 1, memory_order_relaxed);
+}
+
+void report_performance_counters(void) {
+    if (!atomic_load(&counters.is_counting)) {
+        return;
+    }
+
+    report("Counters per step (%s):\n", counters.excludes_kernel ? "user space only" : "user and kernel space");
+
+    for (size_t i = 0; i < ASSEMBLY_STEP_COUNT; i++) {
+        size_t step_count = atomic_load(&counters.step_counts[i]);
+        uint64_t values[PERFORMANCE_COUNTER_COUNT];
+
+        if (step_count == 0) {
+            continue;
+        }
+
+        for (size_t j = 0; j < PERFORMANCE_COUNTER_COUNT; j++) {
+            values[j] = atomic_load(&counters.totals[i][j]);
+        }
+
+        report("    %s, %lu times:", get_assembly_step_name((t_assembly_step)i), step_count);
+
+        for (size_t j = 0; j < PERFORMANCE_COUNTER_COUNT; j++) {
+            if (counters.is_available[j]) {
+                report("%s %llu %s", (j > 0) ? "," : "", (unsigned long long)values[j], COUNTER_NAMES[j]);
+            }
+        }
+
+        report(".\n");
+
+        if (!counters.is_available[INSTRUCTIONS_COUNTER] || (values[INSTRUCTIONS_COUNTER] == 0)) {
+            continue;
+        }
+
+        double kilo_instructions = (double)values[INSTRUCTIONS_COUNTER] / 1e3;
+
+        report("       ");
+
+        if (counters.is_available[CYCLES_COUNTER] && (values[CYCLES_COUNTER] > 0)) {
+            report(" %.2f IPC,", (double)values[INSTRUCTIONS_COUNTER] / (double)values[CYCLES_COUNTER]);
+        }
+
+        for (size_t j = CACHE_MISSES_COUNTER; j < PERFORMANCE_COUNTER_COUNT; j++) {
+            if (counters.is_available[j]) {
+                report(" %.2f %s,", (double)values[j] / kilo_instructions, COUNTER_NAMES[j]);
+            }
+        }
+
+        report(" per thousand instructions.\n");
+    }
+}
+
+/* Counters which can not be opened are left out, as long as at least one of them can. */
+int open_thread_counters(t_counting_thread* thread) {
+    if (thread->state != 0) {
+        return thread->state;
+    }
+
+    thread->group_descriptor = -1;
+    thread->open_count = 0L;
+
+    for (size_t i = 0; i < PERFORMANCE_COUNTER_COUNT; i++) {
+        thread->descriptors[i] = -1;
+
+        if (!counters.is_available[i]) {
+            continue;
+        }
+
+        int descriptor = open_performance_counter((t_performance_counter)i, thread->group_descriptor,
+                                                  counters.excludes_kernel);
+
+        if (descriptor < 0) {
+            continue;
+        }
+
+        if (thread->group_descriptor < 0) {
+            thread->group_descriptor = descriptor;
+        }
+
+        thread->descriptors[i] = descriptor;
+        thread->counter_order[thread->open_count++] = i;
+    }
+
+    if (thread->group_descriptor < 0) {
+        thread->state = -1;
+        return -1;
+    }
+
+    pthread_setspecific(counters.thread_key, thread);
+    thread->state = 1;
+
+    return 1;
+}
+
+/* Counters which are not open read as 0. */
+int read_thread_counters(t_counting_thread* thread, uint64_t* values) {
+    uint64_t group_values[PERFORMANCE_COUNTER_COUNT + 1]; // The number of values, and then the values.
+
+    if (read(thread->group_descriptor, group_values, sizeof(group_values)) < (ssize_t)sizeof(uint64_t)) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < PERFORMANCE_COUNTER_COUNT; i++) {
+        values[i] = 0L;
+    }
+
+    for (size_t i = 0; (i < group_values[0]) && (i < thread->open_count); i++) {
+        values[thread->counter_order[i]] = group_values[i + 1];
+    }
+
+    return 1;
+}
+
+void close_thread_counters(void* thread) {
+    t_counting_thread* counting = thread;
+
+    if (counting->state > 0) {
+        for (size_t i = 0; i < PERFORMANCE_COUNTER_COUNT; i++) {
+            if (counting->descriptors[i] >= 0) {
+                close(counting->descriptors[i]);
+            }
+        }
+    }
+
+    counting->state = 0;
+    counting->counted_step = -1;
+    counting->nested_step_count = 0L;
+}
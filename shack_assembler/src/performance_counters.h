@@ -0,0 +1,34 @@
+//
+// performance_counters.h: counts cycles, instructions, cache misses and branch misses of every assembly step with
+// perf_event_open, to tell whether a step is bound by the branches, the caches or the system calls.
+//
+
+#ifndef SHACK_ASSEMBLER_PERFORMANCE_COUNTERS_H
+#define SHACK_ASSEMBLER_PERFORMANCE_COUNTERS_H
+
+#include "assembly_statistics.h"
+
+enum performance_counter {
+    CYCLES_COUNTER,
+    INSTRUCTIONS_COUNTER,
+    CACHE_MISSES_COUNTER,
+    BRANCH_MISSES_COUNTER,
+    PERFORMANCE_COUNTER_COUNT,
+};
+
+typedef enum performance_counter t_performance_counter;
+
+/* Returns 1 once counting, or 0 (after a warning) if the counters are not available, in which case the rest of the
+ * calls do nothing. A counter the processor lacks is only left out of the report. */
+int start_performance_counters(void);
+void stop_performance_counters(void);
+
+/* Counted on the calling thread only. A step begun while another one is counted on the same thread is left to the
+ * outer one, so that nothing is counted twice. */
+void begin_counted_step(t_assembly_step step);
+void end_counted_step(t_assembly_step step);
+
+/* Reports the counters of every step, with their IPC and misses per thousand instructions. */
+void report_performance_counters(void);
+
+#endif //SHACK_ASSEMBLER_PERFORMANCE_COUNTERS_H
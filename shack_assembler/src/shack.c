@@ -0,0 +1,151 @@
+//
+// shack.c: embeddable interface of the assembler, on top of the same contexts used by the command line tool.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "shack.h"
+#include "assembler.h"
+#include "diagnostics.h"
+#include "memory_accounting.h"
+
+struct shack_assembler {
+    t_assembler_context* context;
+};
+
+int copy_diagnostics_into_image(const t_diagnostics* diagnostics, t_rom_image* image);
+
+int create_shack_assembler(t_shack_assembler** assembler) {
+    if (assembler == NULL) {
+        return -1;
+    }
+
+    t_shack_assembler* shack_assembler = allocate_memory(sizeof(t_shack_assembler));
+
+    if (shack_assembler == NULL) {
+        return -1;
+    }
+
+    /* Whatever goes wrong while creating it must not reach stdout either. */
+    t_diagnostics diagnostics;
+
+    initialize_diagnostics(&diagnostics);
+    begin_diagnostics_capture(&diagnostics);
+
+    shack_assembler->context = create_assembler_context(0);
+
+    end_diagnostics_capture();
+    dispose_diagnostics(&diagnostics);
+
+    if (shack_assembler->context == NULL) {
+        release_memory(shack_assembler);
+        return -1;
+    }
+
+    *assembler = shack_assembler;
+
+    return 1;
+}
+
+void dispose_shack_assembler(t_shack_assembler* assembler) {
+    if (assembler == NULL) {
+        return;
+    }
+
+    dispose_assembler_context(assembler->context);
+    release_memory(assembler);
+}
+
+int shack_assemble(t_shack_assembler* assembler, const char* source, size_t length, t_rom_image* image) {
+    if (image == NULL) {
+        return -1;
+    }
+
+    image->words = NULL;
+    image->word_count = 0L;
+    image->diagnostics = NULL;
+    image->diagnostics_length = 0L;
+
+    t_shack_assembler* temporary_assembler = NULL;
+
+    if (assembler == NULL) {
+        if (create_shack_assembler(&temporary_assembler) < 0) {
+            return -1;
+        }
+
+        assembler = temporary_assembler;
+    }
+
+    const t_assembler_options options = {
+        .verbose_mode = 0,
+        .artifacts = HACK_ARTIFACT,
+        .job_count = 1,
+        .output_to_standard_output = 0,
+        .output_file_path = NULL,
+        .cache = NULL,
+    };
+
+    t_diagnostics* diagnostics = &assembler->context->diagnostics;
+
+    clear_diagnostics(diagnostics);
+    begin_diagnostics_capture(diagnostics);
+
+    int result = -1;
+
+    if (source == NULL) {
+        report_error("Internal Error: 'source' is NULL at 'shack_assemble'.\n");
+    }
+    else {
+        result = assemble_source_to_words(&options, assembler->context, source, length, &image->words,
+                                          &image->word_count);
+    }
+
+    end_diagnostics_capture();
+
+    if (copy_diagnostics_into_image(diagnostics, image) < 0) {
+        result = -1;
+    }
+
+    dispose_shack_assembler(temporary_assembler);
+
+    if (result < 0) {
+        release_memory(image->words);
+        image->words = NULL;
+        image->word_count = 0L;
+        return -1;
+    }
+
+    return 1;
+}
+
+int copy_diagnostics_into_image(const t_diagnostics* diagnostics, t_rom_image* image) {
+    image->diagnostics = allocate_memory(sizeof(char) * (diagnostics->length + 1));
+
+    if (image->diagnostics == NULL) {
+        return -1;
+    }
+
+    if (diagnostics->length > 0) {
+        memcpy(image->diagnostics, diagnostics->buffer, diagnostics->length);
+    }
+
+    image->diagnostics[diagnostics->length] = '\0';
+    image->diagnostics_length = diagnostics->length;
+
+    return 1;
+}
+
+void dispose_rom_image(t_rom_image* image) {
+    if (image == NULL) {
+        return;
+    }
+
+    release_memory(image->words);
+    release_memory(image->diagnostics);
+
+    image->words = NULL;
+    image->word_count = 0L;
+    image->diagnostics = NULL;
+    image->diagnostics_length = 0L;
+}
@@ -0,0 +1,40 @@
+//
+// shack.h: embeddable interface of the assembler, which works on memory buffers only: no file is read or written, and
+// nothing is printed, every diagnostic being returned along with the assembled program instead.
+//
+
+#ifndef SHACK_ASSEMBLER_SHACK_H
+#define SHACK_ASSEMBLER_SHACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Only these functions are exported by a shared libshack, everything else being hidden. */
+#ifndef SHACK_API
+#define SHACK_API __attribute__((visibility("default")))
+#endif
+
+struct rom_image {
+    uint16_t* words;
+    size_t word_count;
+
+    char* diagnostics; // Ends with '\0', empty if nothing was reported.
+    size_t diagnostics_length;
+};
+
+typedef struct rom_image t_rom_image;
+
+/* Keeps the predefined symbols and the buffers of the assembler warm between calls. It must only be used by one thread
+ * at a time, so each thread should create its own. */
+typedef struct shack_assembler t_shack_assembler;
+
+SHACK_API int create_shack_assembler(t_shack_assembler** assembler);
+SHACK_API void dispose_shack_assembler(t_shack_assembler* assembler);
+
+/* Assembles 'length' bytes of source code. 'assembler' may be NULL, at the cost of building a new one for the call.
+ * Returns 1 on success, or -1 if the source could not be assembled, in which case 'image' holds no words but still
+ * holds the diagnostics explaining why. */
+SHACK_API int shack_assemble(t_shack_assembler* assembler, const char* source, size_t length, t_rom_image* image);
+SHACK_API void dispose_rom_image(t_rom_image* image);
+
+#endif //SHACK_ASSEMBLER_SHACK_H
@@ -0,0 +1,204 @@
+//
+// source_manifest.c: reads lists of source files, each one optionally with its own output path, from a file or stdin.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "source_manifest.h"
+#include "source_parser.h"
+#include "diagnostics.h"
+#include "memory_accounting.h"
+
+#define MANIFEST_CHUNK_SIZE 65536
+
+/* The entries are handed over while the manifest is still being read, so that the first files are already being
+ * assembled while a slow producer (e.g. 'find' through a pipe) is still writing the rest. */
+struct manifest_reader {
+    char* buffer;
+    size_t length;
+    size_t capacity;
+    char separator;
+    int is_separator_known; // Not until the first separator, or the end of the manifest, has been read.
+
+    t_manifest_entry_function on_entry;
+    void* argument;
+    long entry_count;
+};
+
+typedef struct manifest_reader t_manifest_reader;
+
+int handle_manifest_entries(t_manifest_reader* reader, int is_last_chunk);
+int handle_manifest_entry(t_manifest_reader* reader, char* entry, size_t length);
+
+long read_source_manifest(const char* manifest_path, t_manifest_entry_function on_entry, void* argument) {
+    if ((manifest_path == NULL) || (on_entry == NULL)) {
+        report_error("Internal Error: null arguments at 'read_source_manifest'.\n");
+        return -1;
+    }
+
+    int is_standard_input = (strcmp(manifest_path, STANDARD_INPUT_PATH) == 0);
+    int file = is_standard_input ? STDIN_FILENO : open(manifest_path, O_RDONLY | O_CLOEXEC);
+
+    if (file < 0) {
+        report_error("Error: failed to open manifest '%s'.\n", manifest_path);
+        return -1;
+    }
+
+    t_manifest_reader reader = {
+        .buffer = allocate_memory(sizeof(char) * MANIFEST_CHUNK_SIZE),
+        .length = 0L,
+        .capacity = MANIFEST_CHUNK_SIZE,
+        .separator = '\n',
+        .is_separator_known = 0,
+        .on_entry = on_entry,
+        .argument = argument,
+        .entry_count = 0L,
+    };
+
+    if (reader.buffer == NULL) {
+        if (!is_standard_input) {
+            close(file);
+        }
+
+        report_error("Internal Error: failed to allocate memory for 'buffer' at 'read_source_manifest'.\n");
+        return -1;
+    }
+
+    int result = 1;
+
+    while (result > 0) {
+        /* An entry longer than what is left of the buffer makes it grow. */
+        if (reader.length == reader.capacity) {
+            char* new_buffer = reallocate_memory(reader.buffer, sizeof(char) * reader.capacity * 2);
+
+            if (new_buffer == NULL) {
+                report_error("Internal Error: failed to allocate memory for 'buffer' at 'read_source_manifest'.\n");
+                result = -1;
+                break;
+            }
+
+            reader.buffer = new_buffer;
+            reader.capacity *= 2;
+        }
+
+        ssize_t count = read(file, reader.buffer + reader.length, reader.capacity - reader.length);
+
+        if (count < 0) {
+            report_error("Error: failed to read manifest '%s'.\n", manifest_path);
+            result = -1;
+            break;
+        }
+
+        if (!reader.is_separator_known) {
+            const char* chunk = reader.buffer + reader.length;
+
+            if (memchr(chunk, '\0', (size_t)count) != NULL) {
+                reader.separator = '\0';
+                reader.is_separator_known = 1;
+            }
+            else if ((memchr(chunk, '\n', (size_t)count) != NULL) || (count == 0)) {
+                reader.is_separator_known = 1;
+            }
+        }
+
+        reader.length += (size_t)count;
+
+        if (reader.is_separator_known) {
+            result = handle_manifest_entries(&reader, count == 0);
+        }
+
+        if (count == 0) {
+            break;
+        }
+    }
+
+    release_memory(reader.buffer);
+
+    if (!is_standard_input) {
+        close(file);
+    }
+
+    return (result < 0) ? -1 : reader.entry_count;
+}
+
+/* Handles every complete entry in the buffer, and moves what is left of the last one to its start. */
+int handle_manifest_entries(t_manifest_reader* reader, int is_last_chunk) {
+    size_t start = 0L;
+
+    while (start < reader->length) {
+        char* separator = memchr(reader->buffer + start, reader->separator, reader->length - start);
+
+        if (separator == NULL) {
+            if (!is_last_chunk) {
+                break;
+            }
+
+            /* The last entry does not need a separator, but it needs room for its terminator. */
+            if (reader->length == reader->capacity) {
+                char* new_buffer = reallocate_memory(reader->buffer, sizeof(char) * (reader->capacity + 1));
+
+                if (new_buffer == NULL) {
+                    report_error("Internal Error: failed to allocate memory for 'buffer' at "
+                                 "'handle_manifest_entries'.\n");
+                    return -1;
+                }
+
+                reader->buffer = new_buffer;
+                reader->capacity++;
+            }
+
+            separator = reader->buffer + reader->length;
+        }
+
+        size_t length = (size_t)(separator - (reader->buffer + start));
+
+        if (handle_manifest_entry(reader, reader->buffer + start, length) < 0) {
+            return -1;
+        }
+
+        start += length + 1;
+    }
+
+    if (start >= reader->length) {
+        reader->length = 0L;
+    }
+    else if (start > 0) {
+        memmove(reader->buffer, reader->buffer + start, reader->length - start);
+        reader->length -= start;
+    }
+
+    return 1;
+}
+
+int handle_manifest_entry(t_manifest_reader* reader, char* entry, size_t length) {
+    /* Manifests written on Windows end their lines with "\r\n". */
+    if ((reader->separator == '\n') && (length > 0) && (entry[length - 1] == '\r')) {
+        length--;
+    }
+
+    entry[length] = '\0';
+
+    /* Blank lines are allowed, so that manifests can be written by hand. */
+    if (length == 0) {
+        return 1;
+    }
+
+    char* output_file_path = memchr(entry, MANIFEST_OUTPUT_SEPARATOR, length);
+
+    if (output_file_path != NULL) {
+        *output_file_path = '\0';
+        output_file_path++;
+
+        if ((*entry == '\0') || (*output_file_path == '\0')) {
+            report_error("Error: invalid manifest entry '%s', expected a source path and an output path.\n", entry);
+            return -1;
+        }
+    }
+
+    reader->entry_count++;
+
+    return reader->on_entry(entry, output_file_path, reader->argument);
+}
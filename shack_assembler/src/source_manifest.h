@@ -0,0 +1,19 @@
+//
+// source_manifest.h: reads lists of source files, each one optionally with its own output path, from a file or stdin.
+//
+
+#ifndef SHACK_ASSEMBLER_SOURCE_MANIFEST_H
+#define SHACK_ASSEMBLER_SOURCE_MANIFEST_H
+
+#define MANIFEST_OUTPUT_SEPARATOR '\t'
+
+/* Called for every entry as soon as it is read, with 'output_file_path' being NULL if the entry does not give one.
+ * Returns a negative value to stop reading. */
+typedef int (*t_manifest_entry_function)(const char* file_path, const char* output_file_path, void* argument);
+
+/* Entries are separated by new lines, or by '\0' if the manifest contains any, as 'find -print0' writes them. An
+ * entry gives its output path after a tab. 'manifest_path' may be STANDARD_INPUT_PATH.
+ * Returns the number of entries read, or -1 on errors. */
+long read_source_manifest(const char* manifest_path, t_manifest_entry_function on_entry, void* argument);
+
+#endif //SHACK_ASSEMBLER_SOURCE_MANIFEST_H
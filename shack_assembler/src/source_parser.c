@@ -6,9 +6,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "source_parser.h"
 #include "instruction.h"
+#include "diagnostics.h"
+#include "memory_accounting.h"
 
 #define ASSIGNMENT_INSTRUCTION '='
 #define JUMP_SEPARATOR ';'
@@ -18,103 +23,208 @@
 #define OR_BITWISE_INSTRUCTION '|'
 #define NOT_BITWISE '!'
 
+#define DEFAULT_SOURCE_BUFFER_CAPACITY 4096
+
 #define AT_OPERATOR '@'
 #define JUMP_OPERATOR_START '('
 #define JUMP_OPERATOR_END ')'
 
+void close_source_file(int file);
 int contains_line_any_code(const char* line, size_t line_count);
 int format_code_line(char* formatted_line, const char* line, size_t line_count);
 t_instruction* retrieve_instruction_from_formatted_line(const char* formatted_line, size_t line_count);
 
 int read_source_file(int verbose_mode, const char* file_path, t_array_list* commands_buffer) {
-    if (file_path == NULL) {
-        printf("Internal Error: 'file_path' is NULL at 'read_source_file'.\n");
+    t_source_buffer source;
+
+    if (load_source_file(file_path, &source) < 0) {
         return -1;
     }
 
-    if (commands_buffer == NULL) {
-        printf("Internal Error: 'commands_buffer' is NULL at 'read_source_file'.\n");
+    int result = parse_source_buffer(verbose_mode, source.content, source.length, commands_buffer);
+
+    dispose_source_buffer(&source);
+    return result;
+}
+
+int load_source_file(const char* file_path, t_source_buffer* source) {
+    if ((file_path == NULL) || (source == NULL)) {
+        report_error("Internal Error: null arguments at 'load_source_file'.\n");
         return -1;
     }
 
-    if (commands_buffer->type != LIST) {
-        printf("Internal Error: 'commands_buffer' is not a list at 'read_source_file'.\n");
+    int is_standard_input = (strcmp(file_path, STANDARD_INPUT_PATH) == 0);
+    int file = is_standard_input ? STDIN_FILENO : open(file_path, O_RDONLY | O_CLOEXEC);
+
+    if (file < 0) {
+        report_error("Internal Error: failed to open file '%s'.\n", file_path);
         return -1;
     }
 
-    FILE* file = fopen(file_path, "r");
+    struct stat file_status;
+    size_t capacity = DEFAULT_SOURCE_BUFFER_CAPACITY;
 
-    if (file == NULL) {
-        printf("Internal Error: failed to open file '%s'.\n", file_path);
+    /* Regular files are read with a single buffer of their exact size. */
+    if ((fstat(file, &file_status) == 0) && S_ISREG(file_status.st_mode)) {
+        capacity = (size_t)file_status.st_size + 1;
+    }
+
+    source->content = allocate_memory(sizeof(char) * capacity);
+    source->length = 0L;
+
+    if (source->content == NULL) {
+        close_source_file(file);
+        report_error("Internal Error: failed to allocate memory for 'content' at 'load_source_file'.\n");
+        return -1;
+    }
+
+    while (1) {
+        if ((source->length + 1) >= capacity) {
+            char* new_content = reallocate_memory(source->content, sizeof(char) * capacity * 2);
+
+            if (new_content == NULL) {
+                dispose_source_buffer(source);
+                close_source_file(file);
+                report_error("Internal Error: failed to allocate memory for 'content' at 'load_source_file'.\n");
+                return -1;
+            }
+
+            source->content = new_content;
+            capacity *= 2;
+        }
+
+        ssize_t result = read(file, source->content + source->length, (capacity - 1) - source->length);
+
+        if (result == 0) {
+            break;
+        }
+        else if (result < 0) {
+            dispose_source_buffer(source);
+            close_source_file(file);
+            report_error("Error: failed to read file '%s'.\n", file_path);
+            return -1;
+        }
+
+        source->length += (size_t)result;
+    }
+
+    source->content[source->length] = '\0';
+    close_source_file(file);
+
+    return 1;
+}
+
+void dispose_source_buffer(t_source_buffer* source) {
+    if ((source != NULL) && (source->content != NULL)) {
+        release_memory(source->content);
+        source->content = NULL;
+        source->length = 0L;
+    }
+}
+
+int parse_source_buffer(int verbose_mode, const char* source, size_t source_length, t_array_list* commands_buffer) {
+    t_parse_position position = { .line_count = 0L, .source_line = 1L };
+
+    return parse_source_chunk(verbose_mode, source, source_length, &position, commands_buffer);
+}
+
+int parse_source_chunk(int verbose_mode, const char* source, size_t source_length, t_parse_position* parse_position,
+                       t_array_list* commands_buffer) {
+    if ((source == NULL) || (parse_position == NULL)) {
+        report_error("Internal Error: 'source' or 'parse_position' is NULL at 'parse_source_chunk'.\n");
+        return -1;
+    }
+
+    if (commands_buffer == NULL) {
+        report_error("Internal Error: 'commands_buffer' is NULL at 'parse_source_chunk'.\n");
+        return -1;
+    }
+
+    if (commands_buffer->type != LIST) {
+        report_error("Internal Error: 'commands_buffer' is not a list at 'parse_source_chunk'.\n");
         return -1;
     }
 
     const int MAX_CHARACTERS_PER_LINE = 256;
 
-    char* line = malloc(sizeof(char) * MAX_CHARACTERS_PER_LINE);
+    char* line = allocate_memory(sizeof(char) * MAX_CHARACTERS_PER_LINE);
 
     if (line == NULL) {
-        fclose(file);
-        printf("Internal Error: failed to allocate memory for 'line' at 'read_source_file.\n");
+        report_error("Internal Error: failed to allocate memory for 'line' at 'parse_source_chunk'.\n");
         return -1;
     }
 
-    char* formatted_line = malloc(sizeof(int) * MAX_CHARACTERS_PER_LINE);
+    char* formatted_line = allocate_memory(sizeof(int) * MAX_CHARACTERS_PER_LINE);
 
     if (formatted_line == NULL) {
-        free(line);
-        fclose(file);
-        printf("Internal Error: failed to allocate memory for 'formatted_line' at 'read_source_file.\n");
+        release_memory(line);
+        report_error("Internal Error: failed to allocate memory for 'formatted_line' at 'parse_source_chunk'.\n");
         return -1;
     }
 
-    size_t line_count = 0;
-    while (fgets(line, MAX_CHARACTERS_PER_LINE, file)) {
+    size_t line_count = parse_position->line_count;
+    size_t source_line = parse_position->source_line;
+    size_t position = 0;
+    while (position < source_length) {
+        /* Same pieces 'fgets' would read: up to, and including, the next new line, or the size of 'line'. */
+        size_t line_end = position;
+        size_t line_limit = position + (MAX_CHARACTERS_PER_LINE - 1);
+
+        while ((line_end < source_length) && (line_end < line_limit)) {
+            if (source[line_end++] == '\n') {
+                break;
+            }
+        }
+
+        memcpy(line, source + position, line_end - position);
+        line[line_end - position] = '\0';
+        position = line_end;
+
         int result = contains_line_any_code(line, line_count);
 
         if (result > 0) {
             result = format_code_line(formatted_line, line, line_count);
 
             if (result < 0) {
-                free(formatted_line);
+                release_memory(formatted_line);
                 if (formatted_line != line) {
-                    free(line);
+                    release_memory(line);
                 }
-                fclose(file);
                 return -1;
             }
 
             if (verbose_mode) {
-                printf("Analyzing instruction: %s\n", formatted_line);
+                report_debug("Analyzing instruction: %s\n", formatted_line);
             }
 
             t_instruction* instruction = retrieve_instruction_from_formatted_line(formatted_line, line_count);
 
             if (instruction == NULL) {
                 if (formatted_line != line) {
-                    free(formatted_line);
+                    release_memory(formatted_line);
                 }
-                free(line);
-                fclose(file);
-                printf("Internal Error: failed to retrieve instruction from formatted line at 'read_source_file'.\n");
+                release_memory(line);
+                report_error("Internal Error: failed to retrieve instruction from formatted line at "
+                             "'parse_source_chunk'.\n");
                 return -1;
             }
 
+            instruction->source_line = source_line;
+
             result = add_item_to_array_list(commands_buffer, instruction);
 
             if (result < 0) {
-                free(instruction);
+                release_memory(instruction);
                 if (formatted_line != line) {
-                    free(formatted_line);
+                    release_memory(formatted_line);
                 }
-                free(line);
-                fclose(file);
-                printf("Internal Error: failed to store instruction at 'read_source_file'.\n");
+                release_memory(line);
+                report_error("Internal Error: failed to store instruction at 'parse_source_chunk'.\n");
                 return -1;
             }
 
             if (verbose_mode) {
-                printf("Successfully stored instruction: %s\n", formatted_line);
+                report_debug("Successfully stored instruction: %s\n", formatted_line);
             }
 
             if (instruction->type != L_COMMAND) {
@@ -123,23 +233,35 @@ int read_source_file(int verbose_mode, const char* file_path, t_array_list* comm
         }
         else if (result < 0) {
             if (formatted_line != line) {
-                free(formatted_line);
+                release_memory(formatted_line);
             }
-            free(line);
-            fclose(file);
+            release_memory(line);
             return -1;
         }
+
+        /* Lines longer than the buffer are read in several pieces. */
+        if (strchr(line, '\n') != NULL) {
+            source_line++;
+        }
     }
 
     if (formatted_line != line) {
-        free(formatted_line);
+        release_memory(formatted_line);
     }
-    free(line);
-    fclose(file);
+    release_memory(line);
+
+    parse_position->line_count = line_count;
+    parse_position->source_line = source_line;
 
     return 1;
 }
 
+void close_source_file(int file) {
+    if (file != STDIN_FILENO) {
+        close(file);
+    }
+}
+
 int is_character_legal(char character) {
     if (isalnum(character)) {
         return 1;
@@ -168,7 +290,7 @@ int is_character_legal(char character) {
 
 int contains_line_any_code(const char* line, size_t line_count) {
     if (line == NULL) {
-        printf("Internal Error: 'line' is null at 'contains_line_any_code'.\n");
+        report_error("Internal Error: 'line' is null at 'contains_line_any_code'.\n");
         return -1;
     }
 
@@ -188,7 +310,7 @@ int contains_line_any_code(const char* line, size_t line_count) {
                         break;
                     }
                     else {
-                        printf("Error: invalid '/' symbol detected at line '%lu'.\n", line_count);
+                        report_error("Error: invalid '/' symbol detected at line '%lu'.\n", line_count);
                         return -1;
                     }
                 }
@@ -197,7 +319,7 @@ int contains_line_any_code(const char* line, size_t line_count) {
                 return 1;
             }
             else {
-                printf("Error: invalid '%c' symbol detected at line '%lu'.\n", character, line_count);
+                report_error("Error: invalid '%c' symbol detected at line '%lu'.\n", character, line_count);
                 return -1;
             }
         }
@@ -208,19 +330,19 @@ int contains_line_any_code(const char* line, size_t line_count) {
 
 int format_code_line(char* formatted_line, const char* line, size_t line_count) {
     if (formatted_line == NULL) {
-        printf("Internal Error: 'formatted_line' is null at 'format_code_line'.\n");
+        report_error("Internal Error: 'formatted_line' is null at 'format_code_line'.\n");
         return -1;
     }
 
     if (line == NULL) {
-        printf("Internal Error: 'line' is null at 'format_code_line'.\n");
+        report_error("Internal Error: 'line' is null at 'format_code_line'.\n");
         return -1;
     }
 
     const size_t line_length = strlen(line);
 
     if (line_length == 0L) {
-        printf("Internal Error: 'line' is empty.\n");
+        report_error("Internal Error: 'line' is empty.\n");
         return -1;
     }
 
@@ -235,7 +357,7 @@ int format_code_line(char* formatted_line, const char* line, size_t line_count)
                         break;
                     }
                     else {
-                        printf("Error: invalid '/' symbol detected at line '%lu'.\n", line_count);
+                        report_error("Error: invalid '/' symbol detected at line '%lu'.\n", line_count);
                         return -1;
                     }
                 }
@@ -244,7 +366,7 @@ int format_code_line(char* formatted_line, const char* line, size_t line_count)
                 formatted_line_length++;
             }
             else {
-                printf("Error: invalid '%c' symbol detected at line '%lu'.\n", character, line_count);
+                report_error("Error: invalid '%c' symbol detected at line '%lu'.\n", character, line_count);
                 return -1;
             }
         }
@@ -260,7 +382,7 @@ int format_code_line(char* formatted_line, const char* line, size_t line_count)
                         break;
                     }
                     else {
-                        printf("Error: invalid '/' symbol detected at line '%lu'.\n", line_count);
+                        report_error("Error: invalid '/' symbol detected at line '%lu'.\n", line_count);
                         return -1;
                     }
                 }
@@ -270,7 +392,7 @@ int format_code_line(char* formatted_line, const char* line, size_t line_count)
                 formatted_line_index++;
             }
             else {
-                printf("Error: invalid '%c' symbol detected at line '%lu'.\n", character, line_count);
+                report_error("Error: invalid '%c' symbol detected at line '%lu'.\n", character, line_count);
                 return -1;
             }
         }
@@ -283,19 +405,19 @@ int format_code_line(char* formatted_line, const char* line, size_t line_count)
 
 t_instruction* retrieve_instruction_from_formatted_line(const char* formatted_line, size_t line_count) {
     if (formatted_line == NULL) {
-        printf("Internal Error: 'formatted_line' is NULL at 'retrieve_instruction_from_formatted_line'.\n");
+        report_error("Internal Error: 'formatted_line' is NULL at 'retrieve_instruction_from_formatted_line'.\n");
         return NULL;
     }
 
     if (strlen(formatted_line) == 0L) {
-        printf("Internal Error: 'formatted_line' is empty at 'retrieve_instruction_from_formatted_line'.\n");
+        report_error("Internal Error: 'formatted_line' is empty at 'retrieve_instruction_from_formatted_line'.\n");
         return NULL;
     }
 
-    t_instruction* instruction = malloc(sizeof(t_instruction));
+    t_instruction* instruction = allocate_memory(sizeof(t_instruction));
 
     if (instruction == NULL) {
-        printf("Internal Error: failed to allocate memory for 'instruction' at 'retrieve_instruction_from_formatted_line'.\n");
+        report_error("Internal Error: failed to allocate memory for 'instruction' at 'retrieve_instruction_from_formatted_line'.\n");
         return NULL;
     }
 
@@ -317,11 +439,11 @@ t_instruction* retrieve_instruction_from_formatted_line(const char* formatted_li
         size_t operators_count = (type == A_COMMAND) ? 1 : 2;
 
         size_t symbol_length = strlen(formatted_line) - operators_count;
-        char* symbol = malloc(sizeof(char) * (symbol_length + 1)); // +1, in order to add '\0' at the end.
+        char* symbol = allocate_memory(sizeof(char) * (symbol_length + 1)); // +1, in order to add '\0' at the end.
 
         if (symbol == NULL) {
-            free(instruction);
-            printf("Internal Error: failed to allocate memory for 'symbol' at 'retrieve_instruction_from_formatted_line'.\n");
+            release_memory(instruction);
+            report_error("Internal Error: failed to allocate memory for 'symbol' at 'retrieve_instruction_from_formatted_line'.\n");
             return NULL;
         }
 
@@ -349,11 +471,11 @@ t_instruction* retrieve_instruction_from_formatted_line(const char* formatted_li
 
         if (strchr(formatted_line, ASSIGNMENT_INSTRUCTION) != NULL) {
             size_t destination_length = (strchr(formatted_line, ASSIGNMENT_INSTRUCTION) - formatted_line);
-            char* destination = malloc(sizeof(char) * (destination_length + 1)); // +1, in order to add '\0' at the end.
+            char* destination = allocate_memory(sizeof(char) * (destination_length + 1)); // +1, in order to add '\0' at the end.
 
             if (destination == NULL) {
-                free(instruction);
-                printf("Internal Error: failed to allocate memory for 'destination' at 'retrieve_instruction_from_formatted_line'.\n");
+                release_memory(instruction);
+                report_error("Internal Error: failed to allocate memory for 'destination' at 'retrieve_instruction_from_formatted_line'.\n");
                 return NULL;
             }
 
@@ -371,15 +493,15 @@ t_instruction* retrieve_instruction_from_formatted_line(const char* formatted_li
         if (strchr(formatted_line, JUMP_SEPARATOR) != NULL) {
             size_t jump_separator_position = (strchr(formatted_line, JUMP_SEPARATOR) - formatted_line);
             size_t jump_length = strlen(formatted_line) - (jump_separator_position + 1);
-            char* jump = malloc(sizeof(char) * (jump_length + 1)); // +1, in order to add '\0' at the end.
+            char* jump = allocate_memory(sizeof(char) * (jump_length + 1)); // +1, in order to add '\0' at the end.
 
             if (jump == NULL) {
                 if (instruction->destination != NULL) {
-                    free(instruction->destination);
+                    release_memory(instruction->destination);
                 }
 
-                free(instruction);
-                printf("Internal Error: failed to allocate memory for 'jump' at 'retrieve_instruction_from_formatted_line'.\n");
+                release_memory(instruction);
+                report_error("Internal Error: failed to allocate memory for 'jump' at 'retrieve_instruction_from_formatted_line'.\n");
                 return NULL;
             }
 
@@ -402,19 +524,19 @@ t_instruction* retrieve_instruction_from_formatted_line(const char* formatted_li
                                  ((strlen(formatted_line) - (instruction->jump_length + 1)) - 1);
 
         size_t computation_length = (end_computation - start_computation) + 1; // + 1, array positioning to characters count.
-        char* computation = malloc(sizeof(char) * (computation_length + 1)); // +1, in order to add '\0' at the end.
+        char* computation = allocate_memory(sizeof(char) * (computation_length + 1)); // +1, in order to add '\0' at the end.
 
         if (computation == NULL) {
             if (instruction->destination != NULL) {
-                free(instruction->destination);
+                release_memory(instruction->destination);
             }
 
             if (instruction->jump != NULL) {
-                free(instruction->jump);
+                release_memory(instruction->jump);
             }
 
-            free(instruction);
-            printf("Internal Error: failed to allocate memory for 'computation' at 'retrieve_instruction_from_formatted_line'.\n");
+            release_memory(instruction);
+            report_error("Internal Error: failed to allocate memory for 'computation' at 'retrieve_instruction_from_formatted_line'.\n");
             return NULL;
         }
 
@@ -435,12 +557,12 @@ t_instruction* retrieve_instruction_from_formatted_line(const char* formatted_li
 
 int dispose_commands_from_buffer(t_array_list* commands_buffer) {
     if (commands_buffer == NULL) {
-        printf("Internal Error: 'commands_buffer' is null at 'dispose_commands_from_buffer'.\n");
+        report_error("Internal Error: 'commands_buffer' is null at 'dispose_commands_from_buffer'.\n");
         return -1;
     }
 
     if (commands_buffer->type != LIST) {
-        printf("Internal Error: 'commands_buffer' is not a list at 'dispose_commands_from_buffer'.\n");
+        report_error("Internal Error: 'commands_buffer' is not a list at 'dispose_commands_from_buffer'.\n");
         return -1;
     }
 
@@ -448,40 +570,44 @@ int dispose_commands_from_buffer(t_array_list* commands_buffer) {
         t_instruction* instruction = commands_buffer->item[i];
 
         if (instruction == NULL) {
-            printf("Internal Error: 'commands_buffer' contains invalid data at 'dispose_commands_from_buffer'.\n");
+            report_error("Internal Error: 'commands_buffer' contains invalid data at "
+                         "'dispose_commands_from_buffer'.\n");
             return -1;
         }
 
         if ((instruction->type == A_COMMAND) || (instruction->type == L_COMMAND)) {
             if (instruction->symbol == NULL) {
-                printf("Internal Error: 'commands_buffer' contains invalid data at 'dispose_commands_from_buffer'.\n");
+                report_error("Internal Error: 'commands_buffer' contains invalid data at "
+                             "'dispose_commands_from_buffer'.\n");
                 return -1;
             }
 
-            free(instruction->symbol);
+            release_memory(instruction->symbol);
         }
         else if (instruction->type == C_COMMAND) {
             if (instruction->computation == NULL) {
-                printf("Internal Error: 'commands_buffer' contains invalid data at 'dispose_commands_from_buffer'.\n");
+                report_error("Internal Error: 'commands_buffer' contains invalid data at "
+                             "'dispose_commands_from_buffer'.\n");
                 return -1;
             }
 
-            free(instruction->computation);
+            release_memory(instruction->computation);
 
             if (instruction->destination != NULL) {
-                free(instruction->destination);
+                release_memory(instruction->destination);
             }
 
             if (instruction->jump != NULL) {
-                free(instruction->jump);
+                release_memory(instruction->jump);
             }
         }
         else {
-            printf("Internal Error: 'commands_buffer' contains invalid data at 'dispose_commands_from_buffer'.\n");
+            report_error("Internal Error: 'commands_buffer' contains invalid data at "
+                         "'dispose_commands_from_buffer'.\n");
             return -1;
         }
 
-        free(instruction);
+        release_memory(instruction);
     }
 
     return 1;
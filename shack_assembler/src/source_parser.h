@@ -7,7 +7,30 @@
 
 #include "general_types.h"
 
+#define STANDARD_INPUT_PATH "-"
+
+struct source_buffer {
+    char* content; // Always ended by '\0', which is not part of 'length'.
+    size_t length;
+};
+
+typedef struct source_buffer t_source_buffer;
+
+/* Where the parsing of a source split in several chunks continues. Every chunk but the last must end with '\n'. */
+struct parse_position {
+    size_t line_count; // Instructions parsed so far, labels excluded.
+    size_t source_line;
+};
+
+typedef struct parse_position t_parse_position;
+
 int read_source_file(int verbose_mode, const char* file_path, t_array_list* commands_buffer);
+
+int load_source_file(const char* file_path, t_source_buffer* source);
+void dispose_source_buffer(t_source_buffer* source);
+int parse_source_buffer(int verbose_mode, const char* source, size_t source_length, t_array_list* commands_buffer);
+int parse_source_chunk(int verbose_mode, const char* source, size_t source_length, t_parse_position* parse_position,
+                       t_array_list* commands_buffer);
 int dispose_commands_from_buffer(t_array_list* commands_buffer);
 
 #endif //SHACK_ASSEMBLER_SOURCE_PARSER_H
@@ -0,0 +1,291 @@
+//
+// source_partitions.c: splits the parsing and translation of a big source file into partitions, which any idle
+// worker can steal, so that a single huge file does not keep the rest of the workers waiting for it.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "source_partitions.h"
+#include "assembly_statistics.h"
+#include "assembly_trace.h"
+#include "command_transformer.h"
+#include "diagnostics.h"
+#include "instruction.h"
+#include "performance_counters.h"
+#include "source_parser.h"
+#include "symbol_handler.h"
+#include "worker_pool.h"
+#include "memory_accounting.h"
+
+struct source_partition {
+    /* Parsing: a piece of the source ending with a new line, parsed on its own as if it started the file. */
+    const char* content;
+    size_t length;
+    t_array_list* commands_buffer;
+    t_parse_position position;
+
+    /* Translating: a range of the commands of the whole file, and where its instructions go. */
+    const t_array_list* all_commands;
+    size_t first_command;
+    size_t last_command;
+    unsigned int* instructions;
+
+    int result;
+};
+
+typedef struct source_partition t_source_partition;
+
+size_t split_source_into_partitions(const char* content, size_t length, t_source_partition* partitions,
+                                    size_t partition_count);
+void run_partition_tasks(t_source_partition* partitions, size_t partition_count, t_task_function function);
+void parse_partition(void* argument, void* worker_context);
+void translate_partition(void* argument, void* worker_context);
+int merge_partition_commands(t_source_partition* partitions, size_t partition_count, t_array_list* commands_buffer);
+void dispose_partition_commands(t_source_partition* partitions, size_t partition_count);
+
+int translate_source_in_partitions(const char* content, size_t length, t_array_list* symbol_table,
+                                   t_array_list* commands_buffer, t_array_list* user_symbols,
+                                   unsigned int** instructions) {
+    size_t worker_count = get_current_worker_count();
+    size_t partition_count = worker_count * PARTITIONS_PER_WORKER;
+
+    if (partition_count > (length / MINIMUM_PARTITION_SIZE)) {
+        partition_count = length / MINIMUM_PARTITION_SIZE;
+    }
+
+    /* Without other workers to steal them, the partitions would only add work. */
+    if ((worker_count < 2) || (partition_count < 2)) {
+        return 0;
+    }
+
+    t_source_partition* partitions = allocate_memory(sizeof(t_source_partition) * partition_count);
+
+    if (partitions == NULL) {
+        return 0;
+    }
+
+    begin_assembly_step(PARSE_STEP);
+
+    partition_count = split_source_into_partitions(content, length, partitions, partition_count);
+
+    run_partition_tasks(partitions, partition_count, parse_partition);
+
+    for (size_t i = 0; i < partition_count; i++) {
+        if (partitions[i].result < 0) {
+            end_assembly_step(PARSE_STEP);
+            dispose_partition_commands(partitions, partition_count);
+            release_memory(partitions);
+            return 0;
+        }
+    }
+
+    int result = merge_partition_commands(partitions, partition_count, commands_buffer);
+
+    end_assembly_step(PARSE_STEP);
+
+    if (result < 0) {
+        dispose_partition_commands(partitions, partition_count);
+        release_memory(partitions);
+        report_error("Internal Error: failed to merge the parsed partitions at 'translate_source_in_partitions'.\n");
+        return -1;
+    }
+
+    /* Labels can be used before being defined, so the symbols of the whole file are synced at once. */
+    begin_assembly_step(SYNC_STEP);
+    result = sync_symbol_addresses_using_table(commands_buffer, symbol_table, user_symbols);
+    end_assembly_step(SYNC_STEP);
+
+    if (result < 0) {
+        release_memory(partitions);
+        return -1;
+    }
+
+    size_t instruction_count = 0L;
+
+    for (size_t i = 0; i < partition_count; i++) {
+        instruction_count += partitions[i].position.line_count;
+    }
+
+    unsigned int* buffer = allocate_memory(sizeof(unsigned int) * (instruction_count + 1));
+
+    if (buffer == NULL) {
+        release_memory(partitions);
+        report_error("Internal Error: could not allocate memory for 'buffer' at 'translate_source_in_partitions'.\n");
+        return -1;
+    }
+
+    for (size_t i = 0, first_instruction = 0; i < partition_count; i++) {
+        partitions[i].instructions = buffer + first_instruction;
+        first_instruction += partitions[i].position.line_count;
+    }
+
+    begin_assembly_step(TRANSLATE_STEP);
+    run_partition_tasks(partitions, partition_count, translate_partition);
+    end_assembly_step(TRANSLATE_STEP);
+
+    for (size_t i = 0; i < partition_count; i++) {
+        if (partitions[i].result < 0) {
+            release_memory(buffer);
+            release_memory(partitions);
+
+            /* Translated once more, serially, only to report the error. */
+            release_memory(translate_instructions_into_binary(commands_buffer));
+            return -1;
+        }
+    }
+
+    release_memory(partitions);
+
+    buffer[instruction_count] = -1;
+    *instructions = buffer;
+
+    return 1;
+}
+
+/* Partitions of about the same size, each one ending after a new line so that no line is split. */
+size_t split_source_into_partitions(const char* content, size_t length, t_source_partition* partitions,
+                                    size_t partition_count) {
+    size_t target_length = length / partition_count;
+    size_t count = 0L;
+    size_t start = 0L;
+
+    while ((start < length) && (count < partition_count)) {
+        size_t end = length;
+
+        if ((count + 1) < partition_count) {
+            const char* new_line = memchr(content + start + target_length, '\n',
+                                          (start + target_length < length) ? (length - start - target_length) : 0);
+
+            end = (new_line != NULL) ? (size_t)(new_line - content) + 1 : length;
+        }
+
+        partitions[count].content = content + start;
+        partitions[count].length = end - start;
+        partitions[count].commands_buffer = NULL;
+        partitions[count].result = -1;
+        count++;
+
+        start = end;
+    }
+
+    return count;
+}
+
+void run_partition_tasks(t_source_partition* partitions, size_t partition_count, t_task_function function) {
+    t_task_group group;
+
+    initialize_task_group(&group);
+
+    for (size_t i = 0; i < partition_count; i++) {
+        submit_task_to_group(&group, function, &partitions[i]);
+    }
+
+    wait_for_task_group(&group);
+}
+
+/* Whatever a partition reports is dropped, since it could run on any worker, and its line numbers are relative to the
+ * partition. The serial path reports it again if needed. */
+void parse_partition(void* argument, void* worker_context) {
+    (void)worker_context; // Partitions carry everything they need, and keep no state on the worker.
+
+    t_source_partition* partition = argument;
+    t_diagnostics diagnostics;
+    uint64_t traced_at = begin_trace_event();
+
+    begin_counted_step(PARSE_STEP);
+    begin_accounted_step(PARSE_STEP);
+    initialize_diagnostics(&diagnostics);
+    begin_diagnostics_capture(&diagnostics);
+
+    partition->position.line_count = 0L;
+    partition->position.source_line = 1L;
+    partition->result = create_array_list(&partition->commands_buffer);
+
+    if (partition->result > 0) {
+        partition->result = parse_source_chunk(0, partition->content, partition->length, &partition->position,
+                                               partition->commands_buffer);
+    }
+    else {
+        partition->commands_buffer = NULL;
+    }
+
+    end_diagnostics_capture();
+    dispose_diagnostics(&diagnostics);
+    end_accounted_step(PARSE_STEP);
+    end_counted_step(PARSE_STEP);
+
+    end_trace_event("parse partition", traced_at);
+}
+
+void translate_partition(void* argument, void* worker_context) {
+    (void)worker_context;
+
+    t_source_partition* partition = argument;
+    t_diagnostics diagnostics;
+    uint64_t traced_at = begin_trace_event();
+
+    begin_counted_step(TRANSLATE_STEP);
+    begin_accounted_step(TRANSLATE_STEP);
+    initialize_diagnostics(&diagnostics);
+    begin_diagnostics_capture(&diagnostics);
+
+    long instruction_count = translate_commands_into_binary(partition->all_commands, partition->first_command,
+                                                            partition->last_command, partition->instructions);
+
+    partition->result = (instruction_count < 0) ? -1 : 1;
+
+    end_diagnostics_capture();
+    dispose_diagnostics(&diagnostics);
+    end_accounted_step(TRANSLATE_STEP);
+    end_counted_step(TRANSLATE_STEP);
+
+    end_trace_event("translate partition", traced_at);
+}
+
+/* Moves the commands of every partition into 'commands_buffer', shifting their source lines, and the ROM addresses of
+ * the labels, by the lines and instructions of the partitions before them. */
+int merge_partition_commands(t_source_partition* partitions, size_t partition_count, t_array_list* commands_buffer) {
+    size_t line_offset = 0L;
+    size_t instruction_offset = 0L;
+
+    for (size_t i = 0; i < partition_count; i++) {
+        t_array_list* partition_commands = partitions[i].commands_buffer;
+
+        for (size_t j = 0; j < partition_commands->length; j++) {
+            t_instruction* command = partition_commands->item[j];
+
+            command->source_line += line_offset;
+
+            if (command->type != A_COMMAND) {
+                command->address += instruction_offset;
+            }
+        }
+
+        line_offset += partitions[i].position.source_line - 1;
+        instruction_offset += partitions[i].position.line_count;
+
+        partitions[i].all_commands = commands_buffer;
+        partitions[i].first_command = commands_buffer->length;
+        partitions[i].last_command = commands_buffer->length + partition_commands->length;
+
+        if (append_array_list(commands_buffer, partition_commands) < 0) {
+            return -1;
+        }
+
+        dispose_array_list(partition_commands);
+        partitions[i].commands_buffer = NULL;
+    }
+
+    return 1;
+}
+
+void dispose_partition_commands(t_source_partition* partitions, size_t partition_count) {
+    for (size_t i = 0; i < partition_count; i++) {
+        if (partitions[i].commands_buffer != NULL) {
+            dispose_commands_from_buffer(partitions[i].commands_buffer);
+            dispose_array_list(partitions[i].commands_buffer);
+            partitions[i].commands_buffer = NULL;
+        }
+    }
+}
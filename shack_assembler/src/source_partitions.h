@@ -0,0 +1,24 @@
+//
+// source_partitions.h: splits the parsing and translation of a big source file into partitions, which any idle
+// worker can steal, so that a single huge file does not keep the rest of the workers waiting for it.
+//
+
+#ifndef SHACK_ASSEMBLER_SOURCE_PARTITIONS_H
+#define SHACK_ASSEMBLER_SOURCE_PARTITIONS_H
+
+#include <stddef.h>
+
+#include "general_types.h"
+
+#define MINIMUM_PARTITION_SIZE (256 * 1024)
+#define PARTITIONS_PER_WORKER 4
+
+/* Parses 'content' into 'commands_buffer', syncs it, and translates it into 'instructions' (ended by -1), the same as
+ * the serial path would. Returns 0 without doing anything if the source is too small to be split, or if a partition
+ * fails to parse: the caller is then expected to go through the serial path, which reports the errors in order.
+ * Returns -1 if syncing or translating failed, after reporting it. */
+int translate_source_in_partitions(const char* content, size_t length, t_array_list* symbol_table,
+                                   t_array_list* commands_buffer, t_array_list* user_symbols,
+                                   unsigned int** instructions);
+
+#endif //SHACK_ASSEMBLER_SOURCE_PARTITIONS_H
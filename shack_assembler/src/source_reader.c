@@ -0,0 +1,529 @@
+//
+// source_reader.c: loads many source files at once, with as few system calls as the kernel allows.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "source_reader.h"
+#include "memory_accounting.h"
+
+#if defined(__linux__) && defined(HAVE_LINUX_IO_URING_H)
+#define USE_IO_URING 1
+#endif
+
+#ifdef USE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+/* Most source files fit in a single read of this size, the rest are finished with more reads. */
+#define FIRST_READ_SIZE 16384
+
+#ifdef USE_IO_URING
+
+/* The kernel side of the rings is only reached through raw system calls, so that no library is needed. */
+struct io_ring {
+    int descriptor;
+    unsigned int entries;
+
+    void* submission_ring;
+    size_t submission_ring_size;
+    unsigned int* submission_head;
+    unsigned int* submission_tail;
+    unsigned int* submission_mask;
+    unsigned int* submission_array;
+    struct io_uring_sqe* submission_entries;
+    size_t submission_entries_size;
+
+    void* completion_ring;
+    size_t completion_ring_size;
+    unsigned int* completion_head;
+    unsigned int* completion_tail;
+    unsigned int* completion_mask;
+    struct io_uring_cqe* completion_entries;
+};
+
+typedef struct io_ring t_io_ring;
+
+#endif
+
+struct source_reader {
+    t_source_reader_backend backend;
+
+#ifdef USE_IO_URING
+    t_io_ring ring;
+#endif
+};
+
+int load_source_file_quietly(const char* file_path, t_source_buffer* source);
+int finish_reading_source(int file, t_source_buffer* source, size_t capacity);
+void discard_source(t_source_buffer* source);
+
+#ifdef USE_IO_URING
+int create_io_ring(t_io_ring* ring, unsigned int entries);
+void dispose_io_ring(t_io_ring* ring);
+struct io_uring_sqe* get_io_ring_entry(t_io_ring* ring);
+int submit_io_ring_entries(t_io_ring* ring, unsigned int count, int* results);
+int load_source_files_with_io_ring(t_io_ring* ring, const char* const* file_paths, t_source_buffer* sources,
+                                   size_t count);
+#endif
+
+int create_source_reader(t_source_reader** reader) {
+    t_source_reader* source_reader = allocate_memory(sizeof(t_source_reader));
+
+    if (source_reader == NULL) {
+        return -1;
+    }
+
+    source_reader->backend = PREAD_SOURCE_READER;
+
+#ifdef USE_IO_URING
+    /* Kernels without io_uring, or sandboxes which forbid it, keep the plain reads. */
+    if (create_io_ring(&source_reader->ring, SOURCE_READ_BATCH_SIZE * 2) > 0) {
+        source_reader->backend = IO_URING_SOURCE_READER;
+    }
+#endif
+
+    *reader = source_reader;
+
+    return 1;
+}
+
+t_source_reader_backend get_source_reader_backend(const t_source_reader* reader) {
+    return reader->backend;
+}
+
+void load_source_files(t_source_reader* reader, const char* const* file_paths, t_source_buffer* sources, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        sources[i].content = NULL;
+        sources[i].length = 0L;
+    }
+
+    if (count > SOURCE_READ_BATCH_SIZE) {
+        count = SOURCE_READ_BATCH_SIZE;
+    }
+
+#ifdef USE_IO_URING
+    if (reader->backend == IO_URING_SOURCE_READER) {
+        if (load_source_files_with_io_ring(&reader->ring, file_paths, sources, count) > 0) {
+            return;
+        }
+
+        /* The kernel has io_uring, but not the operations needed. */
+        dispose_io_ring(&reader->ring);
+        reader->backend = PREAD_SOURCE_READER;
+    }
+#endif
+
+    for (size_t i = 0; i < count; i++) {
+        if ((sources[i].content == NULL) && (strcmp(file_paths[i], STANDARD_INPUT_PATH) != 0)) {
+            load_source_file_quietly(file_paths[i], &sources[i]);
+        }
+    }
+}
+
+void dispose_source_reader(t_source_reader* reader) {
+    if (reader == NULL) {
+        return;
+    }
+
+#ifdef USE_IO_URING
+    if (reader->backend == IO_URING_SOURCE_READER) {
+        dispose_io_ring(&reader->ring);
+    }
+#endif
+
+    release_memory(reader);
+}
+
+int load_source_file_quietly(const char* file_path, t_source_buffer* source) {
+    int file = open(file_path, O_RDONLY | O_CLOEXEC);
+
+    if (file < 0) {
+        return -1;
+    }
+
+    struct stat file_status;
+
+    if ((fstat(file, &file_status) < 0) || !S_ISREG(file_status.st_mode)) {
+        close(file);
+        return -1;
+    }
+
+    size_t capacity = (size_t)file_status.st_size + 1;
+
+    source->content = allocate_memory(sizeof(char) * capacity);
+    source->length = 0L;
+
+    if (source->content == NULL) {
+        close(file);
+        return -1;
+    }
+
+    int result = finish_reading_source(file, source, capacity);
+
+    close(file);
+    return result;
+}
+
+/* Reads from where 'source' was left until the end of the file, growing it whenever it gets full. */
+int finish_reading_source(int file, t_source_buffer* source, size_t capacity) {
+    while (1) {
+        if ((source->length + 1) >= capacity) {
+            char* new_content = reallocate_memory(source->content, sizeof(char) * capacity * 2);
+
+            if (new_content == NULL) {
+                discard_source(source);
+                return -1;
+            }
+
+            source->content = new_content;
+            capacity *= 2;
+        }
+
+        ssize_t count = pread(file, source->content + source->length, (capacity - 1) - source->length,
+                              (off_t)source->length);
+
+        if ((count < 0) && (errno == EINTR)) {
+            continue;
+        }
+
+        if (count < 0) {
+            discard_source(source);
+            return -1;
+        }
+
+        if (count == 0) {
+            break;
+        }
+
+        source->length += (size_t)count;
+    }
+
+    source->content[source->length] = '\0';
+
+    return 1;
+}
+
+void discard_source(t_source_buffer* source) {
+    release_memory(source->content);
+    source->content = NULL;
+    source->length = 0L;
+}
+
+#ifdef USE_IO_URING
+
+int create_io_ring(t_io_ring* ring, unsigned int entries) {
+    struct io_uring_params parameters;
+    memset(&parameters, 0, sizeof(parameters));
+
+    ring->descriptor = (int)syscall(__NR_io_uring_setup, entries, &parameters);
+
+    if (ring->descriptor < 0) {
+        return -1;
+    }
+
+    ring->entries = parameters.sq_entries;
+    ring->submission_ring_size = parameters.sq_off.array + (parameters.sq_entries * sizeof(unsigned int));
+    ring->completion_ring_size = parameters.cq_off.cqes + (parameters.cq_entries * sizeof(struct io_uring_cqe));
+
+    /* Newer kernels share a single mapping between both rings. */
+    int is_single_mapping = (parameters.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+    if (is_single_mapping && (ring->completion_ring_size > ring->submission_ring_size)) {
+        ring->submission_ring_size = ring->completion_ring_size;
+    }
+
+    ring->submission_ring = mmap(NULL, ring->submission_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                 ring->descriptor, IORING_OFF_SQ_RING);
+
+    if (ring->submission_ring == MAP_FAILED) {
+        close(ring->descriptor);
+        return -1;
+    }
+
+    ring->completion_ring = ring->submission_ring;
+
+    if (!is_single_mapping) {
+        ring->completion_ring = mmap(NULL, ring->completion_ring_size, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_POPULATE, ring->descriptor, IORING_OFF_CQ_RING);
+
+        if (ring->completion_ring == MAP_FAILED) {
+            munmap(ring->submission_ring, ring->submission_ring_size);
+            close(ring->descriptor);
+            return -1;
+        }
+    }
+
+    ring->submission_entries_size = parameters.sq_entries * sizeof(struct io_uring_sqe);
+    ring->submission_entries = mmap(NULL, ring->submission_entries_size, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, ring->descriptor, IORING_OFF_SQES);
+
+    if (ring->submission_entries == MAP_FAILED) {
+        if (ring->completion_ring != ring->submission_ring) {
+            munmap(ring->completion_ring, ring->completion_ring_size);
+        }
+
+        munmap(ring->submission_ring, ring->submission_ring_size);
+        close(ring->descriptor);
+        return -1;
+    }
+
+    char* submission_ring = ring->submission_ring;
+    char* completion_ring = ring->completion_ring;
+
+    ring->submission_head = (unsigned int*)(submission_ring + parameters.sq_off.head);
+    ring->submission_tail = (unsigned int*)(submission_ring + parameters.sq_off.tail);
+    ring->submission_mask = (unsigned int*)(submission_ring + parameters.sq_off.ring_mask);
+    ring->submission_array = (unsigned int*)(submission_ring + parameters.sq_off.array);
+    ring->completion_head = (unsigned int*)(completion_ring + parameters.cq_off.head);
+    ring->completion_tail = (unsigned int*)(completion_ring + parameters.cq_off.tail);
+    ring->completion_mask = (unsigned int*)(completion_ring + parameters.cq_off.ring_mask);
+    ring->completion_entries = (struct io_uring_cqe*)(completion_ring + parameters.cq_off.cqes);
+
+    return 1;
+}
+
+void dispose_io_ring(t_io_ring* ring) {
+    munmap(ring->submission_entries, ring->submission_entries_size);
+
+    if (ring->completion_ring != ring->submission_ring) {
+        munmap(ring->completion_ring, ring->completion_ring_size);
+    }
+
+    munmap(ring->submission_ring, ring->submission_ring_size);
+    close(ring->descriptor);
+}
+
+/* The entry is queued, but the kernel only sees it once it is submitted. */
+struct io_uring_sqe* get_io_ring_entry(t_io_ring* ring) {
+    unsigned int tail = *ring->submission_tail;
+    unsigned int index = tail & *ring->submission_mask;
+    struct io_uring_sqe* entry = &ring->submission_entries[index];
+
+    memset(entry, 0, sizeof(struct io_uring_sqe));
+    ring->submission_array[index] = index;
+
+    __atomic_store_n(ring->submission_tail, tail + 1, __ATOMIC_RELEASE);
+
+    return entry;
+}
+
+/* Submits the queued entries and waits for all of them. The result of each one is stored at its 'user_data' index. */
+int submit_io_ring_entries(t_io_ring* ring, unsigned int count, int* results) {
+    unsigned int submitted = 0;
+    unsigned int completed = 0;
+
+    while (completed < count) {
+        unsigned int to_submit = count - submitted;
+        int result = (int)syscall(__NR_io_uring_enter, ring->descriptor, to_submit, 1, IORING_ENTER_GETEVENTS, NULL,
+                                  0);
+
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        submitted += (unsigned int)result;
+
+        unsigned int head = *ring->completion_head;
+
+        while (head != __atomic_load_n(ring->completion_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* entry = &ring->completion_entries[head & *ring->completion_mask];
+
+            results[entry->user_data] = entry->res;
+            head++;
+            completed++;
+        }
+
+        __atomic_store_n(ring->completion_head, head, __ATOMIC_RELEASE);
+    }
+
+    return 1;
+}
+
+/* Opens, reads and closes the whole batch with four submissions. Returns -1 if the kernel does not support them. */
+int load_source_files_with_io_ring(t_io_ring* ring, const char* const* file_paths, t_source_buffer* sources,
+                                   size_t count) {
+    int descriptors[SOURCE_READ_BATCH_SIZE];
+    int results[SOURCE_READ_BATCH_SIZE];
+    unsigned int queued = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        descriptors[i] = -1;
+
+        /* The standard input can not be read ahead, its content is only read when it is assembled. */
+        if (strcmp(file_paths[i], STANDARD_INPUT_PATH) == 0) {
+            continue;
+        }
+
+        struct io_uring_sqe* entry = get_io_ring_entry(ring);
+
+        entry->opcode = IORING_OP_OPENAT;
+        entry->fd = AT_FDCWD;
+        entry->addr = (unsigned long)file_paths[i];
+        entry->open_flags = O_RDONLY | O_CLOEXEC;
+        entry->user_data = i;
+        results[i] = -1;
+        queued++;
+    }
+
+    if ((queued > 0) && (submit_io_ring_entries(ring, queued, results) < 0)) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(file_paths[i], STANDARD_INPUT_PATH) != 0) {
+            descriptors[i] = (results[i] >= 0) ? results[i] : -1;
+        }
+    }
+
+    /* Kernels older than 5.6 reject the operation itself, instead of failing to open the files. */
+    for (size_t i = 0; i < count; i++) {
+        if ((strcmp(file_paths[i], STANDARD_INPUT_PATH) != 0) && (results[i] == -EINVAL)) {
+            for (size_t j = 0; j < count; j++) {
+                if (descriptors[j] >= 0) {
+                    close(descriptors[j]);
+                }
+            }
+
+            return -1;
+        }
+    }
+
+    queued = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (descriptors[i] < 0) {
+            continue;
+        }
+
+        sources[i].content = allocate_memory(sizeof(char) * (FIRST_READ_SIZE + 1));
+
+        if (sources[i].content == NULL) {
+            continue;
+        }
+
+        struct io_uring_sqe* entry = get_io_ring_entry(ring);
+
+        entry->opcode = IORING_OP_READ;
+        entry->fd = descriptors[i];
+        entry->addr = (unsigned long)sources[i].content;
+        entry->len = FIRST_READ_SIZE;
+        entry->off = 0;
+        entry->user_data = i;
+        queued++;
+    }
+
+    if ((queued > 0) && (submit_io_ring_entries(ring, queued, results) < 0)) {
+        for (size_t i = 0; i < count; i++) {
+            discard_source(&sources[i]);
+        }
+
+        queued = 0;
+    }
+
+    for (size_t i = 0; (queued > 0) && (i < count); i++) {
+        if (sources[i].content == NULL) {
+            continue;
+        }
+
+        if (results[i] < 0) {
+            discard_source(&sources[i]);
+            continue;
+        }
+
+        sources[i].length = (size_t)results[i];
+        sources[i].content[sources[i].length] = '\0';
+
+        /* Only the few bigger files need more reads. */
+        if (sources[i].length == FIRST_READ_SIZE) {
+            finish_reading_source(descriptors[i], &sources[i], FIRST_READ_SIZE + 1);
+        }
+    }
+
+    /* A read can return less than it was asked for before the end of the file, so every file which got something is
+     * read once more, all of them together, until that read finds nothing left. */
+    queued = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if ((descriptors[i] < 0) || (sources[i].content == NULL) || (sources[i].length == 0) ||
+            (sources[i].length >= FIRST_READ_SIZE)) {
+            continue;
+        }
+
+        struct io_uring_sqe* entry = get_io_ring_entry(ring);
+
+        entry->opcode = IORING_OP_READ;
+        entry->fd = descriptors[i];
+        entry->addr = (unsigned long)(sources[i].content + sources[i].length);
+        entry->len = (unsigned int)(FIRST_READ_SIZE - sources[i].length);
+        entry->off = sources[i].length;
+        entry->user_data = i;
+        results[i] = -1;
+        queued++;
+    }
+
+    if ((queued > 0) && (submit_io_ring_entries(ring, queued, results) < 0)) {
+        for (size_t i = 0; i < count; i++) {
+            if ((sources[i].length > 0) && (sources[i].length < FIRST_READ_SIZE)) {
+                discard_source(&sources[i]);
+            }
+        }
+
+        queued = 0;
+    }
+
+    for (size_t i = 0; (queued > 0) && (i < count); i++) {
+        if ((descriptors[i] < 0) || (sources[i].content == NULL) || (sources[i].length == 0) ||
+            (sources[i].length >= FIRST_READ_SIZE)) {
+            continue;
+        }
+
+        if (results[i] < 0) {
+            discard_source(&sources[i]);
+            continue;
+        }
+
+        if (results[i] > 0) {
+            sources[i].length += (size_t)results[i];
+            finish_reading_source(descriptors[i], &sources[i], FIRST_READ_SIZE + 1);
+        }
+    }
+
+    queued = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (descriptors[i] < 0) {
+            continue;
+        }
+
+        struct io_uring_sqe* entry = get_io_ring_entry(ring);
+
+        entry->opcode = IORING_OP_CLOSE;
+        entry->fd = descriptors[i];
+        entry->user_data = i;
+        queued++;
+    }
+
+    if ((queued > 0) && (submit_io_ring_entries(ring, queued, results) < 0)) {
+        for (size_t i = 0; i < count; i++) {
+            if (descriptors[i] >= 0) {
+                close(descriptors[i]);
+            }
+        }
+    }
+
+    return 1;
+}
+
+#endif
@@ -0,0 +1,33 @@
+//
+// source_reader.h: loads many source files at once, with as few system calls as the kernel allows.
+//
+
+#ifndef SHACK_ASSEMBLER_SOURCE_READER_H
+#define SHACK_ASSEMBLER_SOURCE_READER_H
+
+#include <stddef.h>
+
+#include "source_parser.h"
+
+#define SOURCE_READ_BATCH_SIZE 32
+
+enum source_reader_backend {
+    IO_URING_SOURCE_READER, // A whole batch is opened, read and closed with one submission each.
+    PREAD_SOURCE_READER,    // One file at a time, used when io_uring is not available.
+};
+
+typedef enum source_reader_backend t_source_reader_backend;
+
+typedef struct source_reader t_source_reader;
+
+int create_source_reader(t_source_reader** reader);
+t_source_reader_backend get_source_reader_backend(const t_source_reader* reader);
+
+/* Loads up to SOURCE_READ_BATCH_SIZE files. Nothing is reported: a file which can not be loaded (or the standard
+ * input, which can not be read ahead) is left with a NULL content, so that it is loaded, and its errors reported,
+ * by 'load_source_file' when it gets assembled. */
+void load_source_files(t_source_reader* reader, const char* const* file_paths, t_source_buffer* sources, size_t count);
+
+void dispose_source_reader(t_source_reader* reader);
+
+#endif //SHACK_ASSEMBLER_SOURCE_READER_H
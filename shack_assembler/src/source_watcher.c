@@ -0,0 +1,565 @@
+//
+// source_watcher.c: re-assembles source files as soon as they change, until the process is interrupted.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "source_watcher.h"
+#include "diagnostics.h"
+#include "directory_walker.h"
+#include "general_types.h"
+#include "memory_accounting.h"
+
+#ifdef __linux__
+
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#define WATCHED_DIRECTORY_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE)
+#define WATCH_EVENTS_BUFFER_SIZE 65536
+
+/* Directories are watched instead of files, since editors usually save by replacing the file with a new one. */
+struct watched_directory {
+    int descriptor;
+    char* path;
+    struct watched_directory* next;
+};
+
+typedef struct watched_directory t_watched_directory;
+
+struct watched_source {
+    char* path;
+    const char* name; // Points into 'path'.
+    int directory_descriptor;
+
+    /* What was assembled last time, so that saving a file without changes costs nothing. Its commands and symbols are
+     * not kept: a file which did change is parsed again whole, since every symbol has to be resolved again anyway, and
+     * even files of tens of thousands of lines are parsed in a few milliseconds by the warm context. */
+    unsigned long long source_hash;
+    int is_assembled;
+
+    int is_pending;
+    struct timespec last_change;
+
+    struct watched_source* next;
+};
+
+typedef struct watched_source t_watched_source;
+
+struct source_watcher {
+    const t_assembler_options* options;
+    t_assembler_context* context; // Stays warm for the whole session.
+
+    int notifier;
+    int is_watching_tree;
+    long debounce_milliseconds;
+
+    t_watched_directory* first_directory;
+    t_watched_source* first_source;
+};
+
+typedef struct source_watcher t_source_watcher;
+
+static volatile sig_atomic_t is_watcher_stopping = 0;
+
+void stop_source_watcher(int signal_number);
+int add_directory_watch(t_source_watcher* watcher, const char* directory_path, int is_recursive);
+int add_watched_source(t_source_watcher* watcher, int directory_descriptor, const char* file_path,
+                       t_watched_source** source);
+t_watched_source* find_watched_source(t_source_watcher* watcher, int directory_descriptor, const char* name);
+t_watched_directory* find_watched_directory(t_source_watcher* watcher, int directory_descriptor);
+void mark_source_as_changed(t_watched_source* source, const struct timespec* now);
+int handle_watch_events(t_source_watcher* watcher);
+int handle_watch_event(t_source_watcher* watcher, const struct inotify_event* event, const struct timespec* now);
+int assemble_due_sources(t_source_watcher* watcher);
+void assemble_watched_source(t_source_watcher* watcher, t_watched_source* source);
+double get_milliseconds_between(const struct timespec* start, const struct timespec* end);
+char* get_parent_directory_path(const char* file_path);
+void dispose_source_watcher(t_source_watcher* watcher);
+
+int watch_source_files(const t_assembler_options* options, const char* root_path, int file_count, char** file_names,
+                       long debounce_milliseconds) {
+    if ((options == NULL) || ((root_path == NULL) && ((file_count <= 0) || (file_names == NULL)))) {
+        report_error("Internal Error: invalid arguments at 'watch_source_files'.\n");
+        return -1;
+    }
+
+    t_source_watcher watcher = {
+        .options = options,
+        .context = NULL,
+        .notifier = inotify_init1(IN_CLOEXEC | IN_NONBLOCK),
+        .is_watching_tree = (root_path != NULL),
+        .debounce_milliseconds = debounce_milliseconds,
+        .first_directory = NULL,
+        .first_source = NULL,
+    };
+
+    if (watcher.notifier < 0) {
+        report_error("Error: could not start watching files: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    watcher.context = create_assembler_context(0);
+
+    if (watcher.context == NULL) {
+        dispose_source_watcher(&watcher);
+        return -1;
+    }
+
+    /* Every file is assembled once at the start, which also records what it contains. */
+    int result = 1;
+
+    if (root_path != NULL) {
+        result = add_directory_watch(&watcher, root_path, 1);
+    }
+
+    for (int i = 0; (result >= 0) && (root_path == NULL) && (i < file_count); i++) {
+        char* directory_path = get_parent_directory_path(file_names[i]);
+
+        if (directory_path == NULL) {
+            result = -1;
+            break;
+        }
+
+        result = add_directory_watch(&watcher, directory_path, 0);
+        release_memory(directory_path);
+
+        t_watched_source* source;
+
+        if ((result >= 0) && (add_watched_source(&watcher, result, file_names[i], &source) < 0)) {
+            result = -1;
+        }
+    }
+
+    if (result < 0) {
+        dispose_source_watcher(&watcher);
+        return -1;
+    }
+
+    struct sigaction stop_action;
+    struct sigaction previous_interrupt_action;
+    struct sigaction previous_terminate_action;
+
+    memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = stop_source_watcher;
+    sigemptyset(&stop_action.sa_mask);
+
+    is_watcher_stopping = 0;
+    sigaction(SIGINT, &stop_action, &previous_interrupt_action);
+    sigaction(SIGTERM, &stop_action, &previous_terminate_action);
+
+    while (!is_watcher_stopping) {
+        struct pollfd notifier = {
+            .fd = watcher.notifier,
+            .events = POLLIN,
+        };
+
+        int timeout = assemble_due_sources(&watcher);
+
+        flush_diagnostics();
+
+        if (poll(&notifier, 1, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            report_error("Error: failed to wait for changes: %s.\n", strerror(errno));
+            result = -1;
+            break;
+        }
+
+        if ((notifier.revents & POLLIN) && (handle_watch_events(&watcher) < 0)) {
+            result = -1;
+            break;
+        }
+    }
+
+    sigaction(SIGINT, &previous_interrupt_action, NULL);
+    sigaction(SIGTERM, &previous_terminate_action, NULL);
+
+    dispose_source_watcher(&watcher);
+
+    return (result < 0) ? -1 : 1;
+}
+
+void stop_source_watcher(int signal_number) {
+    (void)signal_number; // Only installed for SIGINT and SIGTERM, which both stop watching.
+
+    is_watcher_stopping = 1;
+}
+
+/* Returns the watch descriptor of the directory. If it is recursive, its subdirectories are watched too, and the
+ * source files in them are marked as changed. */
+int add_directory_watch(t_source_watcher* watcher, const char* directory_path, int is_recursive) {
+    int descriptor = inotify_add_watch(watcher->notifier, directory_path,
+                                       WATCHED_DIRECTORY_EVENTS | IN_ONLYDIR | IN_DONT_FOLLOW);
+
+    if (descriptor < 0) {
+        report_error("Error: could not watch directory '%s': %s.\n", directory_path, strerror(errno));
+        return -1;
+    }
+
+    /* The same directory always gets the same descriptor. */
+    if (find_watched_directory(watcher, descriptor) == NULL) {
+        t_watched_directory* directory = allocate_memory(sizeof(t_watched_directory));
+
+        if (directory == NULL) {
+            report_error("Internal Error: failed to allocate memory for 'directory' at 'add_directory_watch'.\n");
+            return -1;
+        }
+
+        directory->descriptor = descriptor;
+        directory->path = duplicate_string(directory_path);
+        directory->next = watcher->first_directory;
+
+        if (directory->path == NULL) {
+            release_memory(directory);
+            report_error("Internal Error: failed to allocate memory for 'path' at 'add_directory_watch'.\n");
+            return -1;
+        }
+
+        watcher->first_directory = directory;
+    }
+
+    if (!is_recursive) {
+        return descriptor;
+    }
+
+    DIR* directory = opendir(directory_path);
+
+    if (directory == NULL) {
+        report_error("Error: could not open directory '%s'.\n", directory_path);
+        return descriptor;
+    }
+
+    int result = descriptor;
+    struct dirent* directory_entry;
+
+    while ((result >= 0) && ((directory_entry = readdir(directory)) != NULL)) {
+        const char* name = directory_entry->d_name;
+
+        if ((strcmp(name, ".") == 0) || (strcmp(name, "..") == 0)) {
+            continue;
+        }
+
+        char* path = join_paths(directory_path, name);
+        struct stat status;
+
+        if (path == NULL) {
+            result = -1;
+            break;
+        }
+
+        if (lstat(path, &status) == 0) {
+            if (S_ISDIR(status.st_mode)) {
+                /* A subdirectory which can not be watched has already been reported, and the rest still can. */
+                add_directory_watch(watcher, path, 1);
+            }
+            else if (S_ISREG(status.st_mode) && has_source_file_extension(name) &&
+                     (find_watched_source(watcher, descriptor, name) == NULL)) {
+                t_watched_source* source;
+
+                if (add_watched_source(watcher, descriptor, path, &source) < 0) {
+                    result = -1;
+                }
+            }
+        }
+
+        release_memory(path);
+    }
+
+    closedir(directory);
+
+    return result;
+}
+
+/* New sources are marked as changed, so that they get assembled right away. */
+int add_watched_source(t_source_watcher* watcher, int directory_descriptor, const char* file_path,
+                       t_watched_source** source) {
+    t_watched_source* watched_source = allocate_memory(sizeof(t_watched_source));
+
+    if (watched_source == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'watched_source' at 'add_watched_source'.\n");
+        return -1;
+    }
+
+    watched_source->path = duplicate_string(file_path);
+
+    if (watched_source->path == NULL) {
+        release_memory(watched_source);
+        report_error("Internal Error: failed to allocate memory for 'path' at 'add_watched_source'.\n");
+        return -1;
+    }
+
+    const char* separator = strrchr(watched_source->path, '/');
+
+    watched_source->name = (separator != NULL) ? separator + 1 : watched_source->path;
+    watched_source->directory_descriptor = directory_descriptor;
+    watched_source->source_hash = HASH_SEED;
+    watched_source->is_assembled = 0;
+    watched_source->is_pending = 0;
+    watched_source->next = watcher->first_source;
+    watcher->first_source = watched_source;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    mark_source_as_changed(watched_source, &now);
+
+    *source = watched_source;
+
+    return 1;
+}
+
+t_watched_source* find_watched_source(t_source_watcher* watcher, int directory_descriptor, const char* name) {
+    for (t_watched_source* source = watcher->first_source; source != NULL; source = source->next) {
+        if ((source->directory_descriptor == directory_descriptor) && (strcmp(source->name, name) == 0)) {
+            return source;
+        }
+    }
+
+    return NULL;
+}
+
+t_watched_directory* find_watched_directory(t_source_watcher* watcher, int directory_descriptor) {
+    for (t_watched_directory* directory = watcher->first_directory; directory != NULL; directory = directory->next) {
+        if (directory->descriptor == directory_descriptor) {
+            return directory;
+        }
+    }
+
+    return NULL;
+}
+
+void mark_source_as_changed(t_watched_source* source, const struct timespec* now) {
+    source->is_pending = 1;
+    source->last_change = *now;
+}
+
+int handle_watch_events(t_source_watcher* watcher) {
+    char buffer[WATCH_EVENTS_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (1) {
+        ssize_t length = read(watcher->notifier, buffer, sizeof(buffer));
+
+        if (length < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                return 1;
+            }
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            report_error("Error: failed to read the changes of the watched files: %s.\n", strerror(errno));
+            return -1;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        for (char* position = buffer; position < (buffer + length); ) {
+            const struct inotify_event* event = (const struct inotify_event*)position;
+
+            if (handle_watch_event(watcher, event, &now) < 0) {
+                return -1;
+            }
+
+            position += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+int handle_watch_event(t_source_watcher* watcher, const struct inotify_event* event, const struct timespec* now) {
+    /* Some changes were lost, so every file could have changed. */
+    if (event->mask & IN_Q_OVERFLOW) {
+        report_warning("Warning: too many changes at once, every watched file will be assembled again.\n");
+
+        for (t_watched_source* source = watcher->first_source; source != NULL; source = source->next) {
+            mark_source_as_changed(source, now);
+        }
+
+        return 1;
+    }
+
+    t_watched_directory* directory = find_watched_directory(watcher, event->wd);
+
+    if ((directory == NULL) || (event->len == 0)) {
+        return 1;
+    }
+
+    if (event->mask & IN_ISDIR) {
+        if (!watcher->is_watching_tree || !(event->mask & (IN_CREATE | IN_MOVED_TO))) {
+            return 1;
+        }
+
+        char* path = join_paths(directory->path, event->name);
+
+        if (path == NULL) {
+            report_error("Internal Error: failed to allocate memory for 'path' at 'handle_watch_event'.\n");
+            return -1;
+        }
+
+        /* Files might already be inside it, before it could be watched. */
+        int result = add_directory_watch(watcher, path, 1);
+
+        release_memory(path);
+        return (result < 0) ? -1 : 1;
+    }
+
+    /* A file which was just created is changed once it is closed. */
+    if (!(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))) {
+        return 1;
+    }
+
+    t_watched_source* source = find_watched_source(watcher, event->wd, event->name);
+
+    if (source != NULL) {
+        mark_source_as_changed(source, now);
+        return 1;
+    }
+
+    if (!watcher->is_watching_tree || !has_source_file_extension(event->name)) {
+        return 1;
+    }
+
+    char* path = join_paths(directory->path, event->name);
+
+    if (path == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'path' at 'handle_watch_event'.\n");
+        return -1;
+    }
+
+    int result = add_watched_source(watcher, event->wd, path, &source);
+
+    release_memory(path);
+    return result;
+}
+
+/* Assembles every source which has been quiet for long enough, and returns how many milliseconds to wait for the
+ * next one, or -1 if none is pending. */
+int assemble_due_sources(t_source_watcher* watcher) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double timeout = -1.0;
+
+    for (t_watched_source* source = watcher->first_source; source != NULL; source = source->next) {
+        if (!source->is_pending) {
+            continue;
+        }
+
+        double remaining = (double)watcher->debounce_milliseconds - get_milliseconds_between(&source->last_change, &now);
+
+        if (remaining <= 0.0) {
+            assemble_watched_source(watcher, source);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        }
+        else if ((timeout < 0.0) || (remaining < timeout)) {
+            timeout = remaining;
+        }
+    }
+
+    /* Rounded up, so that the source is due once it wakes up. */
+    return (timeout < 0.0) ? -1 : (int)timeout + 1;
+}
+
+void assemble_watched_source(t_source_watcher* watcher, t_watched_source* source) {
+    source->is_pending = 0;
+
+    t_source_buffer source_buffer;
+
+    /* It might have been removed, or renamed, since it changed. */
+    if (load_source_file(source->path, &source_buffer) < 0) {
+        return;
+    }
+
+    unsigned long long source_hash = get_hash_of_bytes(source_buffer.content, source_buffer.length, HASH_SEED);
+
+    if (source->is_assembled && (source_hash == source->source_hash)) {
+        dispose_source_buffer(&source_buffer);
+
+        if (watcher->options->verbose_mode) {
+            report("Skipped '%s', which did not change.\n", source->path);
+        }
+
+        return;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int result = assemble_loaded_source_file(watcher->options, watcher->context, source->path, &source_buffer);
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    dispose_source_buffer(&source_buffer);
+
+    if (result < 0) {
+        source->is_assembled = 0;
+        report_error("Error: failed to handle source file '%s'.\n", source->path);
+        return;
+    }
+
+    source->is_assembled = 1;
+    source->source_hash = source_hash;
+
+    report("Assembled '%s' in %.2f ms, %.2f ms after it changed.\n", source->path,
+           get_milliseconds_between(&start, &end), get_milliseconds_between(&source->last_change, &end));
+}
+
+double get_milliseconds_between(const struct timespec* start, const struct timespec* end) {
+    return ((double)(end->tv_sec - start->tv_sec) * 1e3) + ((double)(end->tv_nsec - start->tv_nsec) / 1e6);
+}
+
+char* get_parent_directory_path(const char* file_path) {
+    const char* separator = strrchr(file_path, '/');
+
+    if (separator == NULL) {
+        return duplicate_string(".");
+    }
+
+    /* The root directory keeps its separator. */
+    size_t length = (separator == file_path) ? 1 : (size_t)(separator - file_path);
+
+    return duplicate_string_prefix(file_path, length);
+}
+
+void dispose_source_watcher(t_source_watcher* watcher) {
+    while (watcher->first_source != NULL) {
+        t_watched_source* source = watcher->first_source;
+
+        watcher->first_source = source->next;
+        release_memory(source->path);
+        release_memory(source);
+    }
+
+    while (watcher->first_directory != NULL) {
+        t_watched_directory* directory = watcher->first_directory;
+
+        watcher->first_directory = directory->next;
+        release_memory(directory->path);
+        release_memory(directory);
+    }
+
+    dispose_assembler_context(watcher->context);
+    close(watcher->notifier);
+}
+
+#else
+
+int watch_source_files(const t_assembler_options* options, const char* root_path, int file_count, char** file_names,
+                       long debounce_milliseconds) {
+    report_error("Error: watching files is only supported on Linux.\n");
+    return -1;
+}
+
+#endif
@@ -0,0 +1,18 @@
+//
+// source_watcher.h: re-assembles source files as soon as they change, until the process is interrupted.
+//
+
+#ifndef SHACK_ASSEMBLER_SOURCE_WATCHER_H
+#define SHACK_ASSEMBLER_SOURCE_WATCHER_H
+
+#include "assembler.h"
+
+#define DEFAULT_WATCH_DEBOUNCE_MILLISECONDS 2
+
+/* Watches either every source file under 'root_path', including the ones created later, or, if it is NULL, the given
+ * files. A file is re-assembled once it has gone 'debounce_milliseconds' without changes, so that the several writes
+ * of an editor saving it are handled once. Returns 1 once SIGINT or SIGTERM stops it, or -1 on errors. */
+int watch_source_files(const t_assembler_options* options, const char* root_path, int file_count, char** file_names,
+                       long debounce_milliseconds);
+
+#endif //SHACK_ASSEMBLER_SOURCE_WATCHER_H
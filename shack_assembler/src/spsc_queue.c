@@ -0,0 +1,141 @@
+//
+// spsc_queue.c: bounded queue between exactly one producer thread and one consumer thread, without locks while it is
+// neither empty nor full.
+//
+
+#include <stdlib.h>
+
+#include "spsc_queue.h"
+#include "diagnostics.h"
+#include "memory_accounting.h"
+
+void wait_for_spsc_queue(t_spsc_queue* queue, atomic_int* is_waiting, int is_producer);
+void wake_up_spsc_queue(t_spsc_queue* queue, atomic_int* is_waiting);
+
+int create_spsc_queue(t_spsc_queue** queue, size_t capacity) {
+    t_spsc_queue* spsc_queue = allocate_aligned_memory(CACHE_LINE_SIZE, sizeof(t_spsc_queue));
+
+    if (spsc_queue == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'spsc_queue' at 'create_spsc_queue'.\n");
+        return -1;
+    }
+
+    size_t rounded_capacity = 1;
+
+    while (rounded_capacity < capacity) {
+        rounded_capacity *= 2;
+    }
+
+    spsc_queue->items = allocate_memory(sizeof(void*) * rounded_capacity);
+
+    if (spsc_queue->items == NULL) {
+        release_memory(spsc_queue);
+        report_error("Internal Error: failed to allocate memory for 'items' at 'create_spsc_queue'.\n");
+        return -1;
+    }
+
+    spsc_queue->mask = rounded_capacity - 1;
+    atomic_init(&spsc_queue->head, 0L);
+    atomic_init(&spsc_queue->tail, 0L);
+    atomic_init(&spsc_queue->is_consumer_waiting, 0);
+    atomic_init(&spsc_queue->is_producer_waiting, 0);
+    spsc_queue->push_count = 0L;
+    spsc_queue->full_stall_count = 0L;
+    spsc_queue->pop_count = 0L;
+    spsc_queue->empty_stall_count = 0L;
+    spsc_queue->occupancy_sum = 0L;
+
+    pthread_mutex_init(&spsc_queue->lock, NULL);
+    pthread_cond_init(&spsc_queue->changed, NULL);
+
+    *queue = spsc_queue;
+
+    return 1;
+}
+
+void push_to_spsc_queue(t_spsc_queue* queue, void* item) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    if ((tail - atomic_load_explicit(&queue->head, memory_order_acquire)) > queue->mask) {
+        queue->full_stall_count++;
+        wait_for_spsc_queue(queue, &queue->is_producer_waiting, 1);
+    }
+
+    queue->items[tail & queue->mask] = item;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+
+    if (item != NULL) {
+        queue->push_count++;
+    }
+
+    wake_up_spsc_queue(queue, &queue->is_consumer_waiting);
+}
+
+void* pop_from_spsc_queue(t_spsc_queue* queue) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t occupancy = atomic_load_explicit(&queue->tail, memory_order_acquire) - head;
+
+    if (occupancy == 0) {
+        queue->empty_stall_count++;
+        wait_for_spsc_queue(queue, &queue->is_consumer_waiting, 0);
+        occupancy = atomic_load_explicit(&queue->tail, memory_order_acquire) - head;
+    }
+
+    void* item = queue->items[head & queue->mask];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+
+    if (item != NULL) {
+        queue->pop_count++;
+        queue->occupancy_sum += occupancy;
+    }
+
+    wake_up_spsc_queue(queue, &queue->is_producer_waiting);
+
+    return item;
+}
+
+double get_spsc_queue_occupancy(const t_spsc_queue* queue) {
+    return (queue->pop_count > 0) ? ((double)queue->occupancy_sum / (double)queue->pop_count) : 0.0;
+}
+
+void dispose_spsc_queue(t_spsc_queue* queue) {
+    if (queue == NULL) {
+        return;
+    }
+
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->changed);
+    release_memory(queue->items);
+    release_memory(queue);
+}
+
+/* Sleeps until the queue is no longer full (producer) or empty (consumer). The flag is raised before checking the
+ * queue again, and the other side checks the flag after moving its index, so one of them always sees the other. */
+void wait_for_spsc_queue(t_spsc_queue* queue, atomic_int* is_waiting, int is_producer) {
+    pthread_mutex_lock(&queue->lock);
+    atomic_store(is_waiting, 1);
+
+    while (1) {
+        size_t head = atomic_load(&queue->head);
+        size_t tail = atomic_load(&queue->tail);
+
+        if (is_producer ? ((tail - head) <= queue->mask) : (tail != head)) {
+            break;
+        }
+
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    }
+
+    atomic_store(is_waiting, 0);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void wake_up_spsc_queue(t_spsc_queue* queue, atomic_int* is_waiting) {
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(is_waiting, memory_order_relaxed)) {
+        pthread_mutex_lock(&queue->lock);
+        pthread_cond_broadcast(&queue->changed);
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
@@ -0,0 +1,54 @@
+//
+// spsc_queue.h: bounded queue between exactly one producer thread and one consumer thread, without locks while it is
+// neither empty nor full.
+//
+
+#ifndef SHACK_ASSEMBLER_SPSC_QUEUE_H
+#define SHACK_ASSEMBLER_SPSC_QUEUE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define CACHE_LINE_SIZE 64
+
+struct spsc_queue {
+    void** items;
+    size_t mask; // The capacity is a power of two.
+
+    /* Each index is only written by one side, so they are kept apart to avoid sharing their cache line. */
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t head; // Next item to pop.
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t tail; // Next item to push.
+
+    /* Only taken to sleep on an empty or full queue, and to wake up the other side. */
+    _Alignas(CACHE_LINE_SIZE) pthread_mutex_t lock;
+    pthread_cond_t changed;
+    atomic_int is_consumer_waiting;
+    atomic_int is_producer_waiting;
+
+    /* Written by the producer. */
+    size_t push_count;
+    size_t full_stall_count;
+
+    /* Written by the consumer. */
+    size_t pop_count;
+    size_t empty_stall_count;
+    size_t occupancy_sum; // Items found in the queue at each pop.
+};
+
+typedef struct spsc_queue t_spsc_queue;
+
+/* 'capacity' is rounded up to a power of two. */
+int create_spsc_queue(t_spsc_queue** queue, size_t capacity);
+
+/* Both wait while the queue is full or empty. NULL items are allowed (e.g. to mark the end of a stream), but they are
+ * not counted. */
+void push_to_spsc_queue(t_spsc_queue* queue, void* item);
+void* pop_from_spsc_queue(t_spsc_queue* queue);
+
+/* Average number of items waiting in the queue, as seen by the consumer. */
+double get_spsc_queue_occupancy(const t_spsc_queue* queue);
+
+void dispose_spsc_queue(t_spsc_queue* queue);
+
+#endif //SHACK_ASSEMBLER_SPSC_QUEUE_H
@@ -10,8 +10,11 @@
 
 #include "symbol_handler.h"
 #include "instruction.h"
+#include "diagnostics.h"
+#include "assembly_statistics.h"
+#include "memory_accounting.h"
+#include "assembly_probes.h"
 
-#define RAM_SYMBOL_MAX_CHARACTERS 4
 #define RAM_SYMBOLS_COUNT 16
 #define VARIABLE_START_ADDRESS 16
 
@@ -32,125 +35,124 @@
 #define KEYBOARD_SYMBOL "KBD"
 #define KEYBOARD_VALUE 0b0110000000000000
 
-void dispose_array_of_strings(char** buffer, size_t length);
-void dispose_ram_addresses(t_array_list* symbol_table, char** ram_symbols);
+#define PREDEFINED_SYMBOLS_COUNT (7 + RAM_SYMBOLS_COUNT)
 
-int sync_symbol_addresses(t_array_list* commands_buffer) {
-    if (commands_buffer == NULL) {
-        printf("Internal Error: null 'commands_buffer' at 'sync_symbol_addresses'.\n");
-        return -1;
-    }
+/* Shared, read only, by every symbol table: the entries only point to them. */
+static const char* PREDEFINED_SYMBOLS[PREDEFINED_SYMBOLS_COUNT] = {
+    SP_SYMBOL, LCL_SYMBOL, ARG_SYMBOL, THIS_SYMBOL, THAT_SYMBOL, SCREEN_SYMBOL, KEYBOARD_SYMBOL,
+    "R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "R8", "R9", "R10", "R11", "R12", "R13", "R14", "R15",
+};
 
-    if (commands_buffer->type != LIST) {
-        printf("Internal Error: 'commands_buffer' is not a list at 'sync_symbol_addresses'.\n");
-        return -1;
-    }
+static size_t PREDEFINED_ADDRESSES[PREDEFINED_SYMBOLS_COUNT] = {
+    SP_ADDRESS, LCL_ADDRESS, ARG_VALUE, THIS_VALUE, THAT_VALUE, SCREEN_VALUE, KEYBOARD_VALUE,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+};
 
-    t_array_list* symbol_table;
+int add_symbols_of_commands(t_array_list* commands_buffer, t_array_list* symbol_table, t_array_list* user_symbols);
+void reset_symbol_table(t_array_list* symbol_table);
 
-    int result = create_hash_map(&symbol_table);
+int create_symbol_table(t_array_list** symbol_table) {
+    t_array_list* table;
 
-    if (result < 0) {
-        printf("Internal Error: failed to create 'symbol_table' at 'sync_symbol_addresses'.\n");
+    if (create_custom_array_list(&table, MAP, PREDEFINED_SYMBOLS_COUNT + DEFAULT_ARRAY_LIST_STEP,
+                                 DEFAULT_ARRAY_LIST_STEP) < 0) {
+        report_error("Internal Error: failed to create 'symbol_table' at 'create_symbol_table'.\n");
         return -1;
     }
 
-    size_t sp_address = SP_ADDRESS;
-    add_entry_to_array_list(symbol_table, SP_SYMBOL, strlen(SP_SYMBOL),
-                            &sp_address, 1);
+    for (size_t i = 0; i < PREDEFINED_SYMBOLS_COUNT; i++) {
+        if (add_entry_to_array_list(table, (void*)PREDEFINED_SYMBOLS[i], strlen(PREDEFINED_SYMBOLS[i]),
+                                    &PREDEFINED_ADDRESSES[i], 1) < 0) {
+            dispose_symbol_table(table);
+            report_error("Internal Error: failed to add predefined symbol '%s' at 'create_symbol_table'.\n",
+                         PREDEFINED_SYMBOLS[i]);
+            return -1;
+        }
+    }
 
-    size_t lcl_address = LCL_ADDRESS;
-    add_entry_to_array_list(symbol_table, LCL_SYMBOL, strlen(LCL_SYMBOL),
-                            &lcl_address, 1);
+    *symbol_table = table;
 
-    size_t arg_address = ARG_VALUE;
-    add_entry_to_array_list(symbol_table, ARG_SYMBOL, strlen(ARG_SYMBOL),
-                            &arg_address, 1);
+    return 1;
+}
 
-    size_t this_address = THIS_VALUE;
-    add_entry_to_array_list(symbol_table, THIS_SYMBOL, strlen(THIS_SYMBOL),
-                            &this_address, 1);
+void dispose_symbol_table(t_array_list* symbol_table) {
+    dispose_hash_map(symbol_table);
+}
 
-    size_t that_address = THAT_VALUE;
-    add_entry_to_array_list(symbol_table, THAT_SYMBOL, strlen(THAT_SYMBOL),
-                            &that_address, 1);
+int sync_symbol_addresses(t_array_list* commands_buffer, t_array_list* user_symbols) {
+    t_array_list* symbol_table;
 
-    size_t screen_address = SCREEN_VALUE;
-    add_entry_to_array_list(symbol_table, SCREEN_SYMBOL, strlen(SCREEN_SYMBOL),
-                            &screen_address, 1);
+    if (create_symbol_table(&symbol_table) < 0) {
+        return -1;
+    }
 
-    size_t keyboard_address = KEYBOARD_VALUE;
-    add_entry_to_array_list(symbol_table, KEYBOARD_SYMBOL, strlen(KEYBOARD_SYMBOL),
-                            &keyboard_address, 1);
+    int result = sync_symbol_addresses_using_table(commands_buffer, symbol_table, user_symbols);
 
-    const char RAM_START_SYMBOL = 'R';
-    char** RAM_SYMBOLS = malloc(sizeof(char*) * RAM_SYMBOLS_COUNT);
+    dispose_symbol_table(symbol_table);
+    return result;
+}
 
-    if (RAM_SYMBOLS == NULL) {
-        printf("Internal Error: failed to allocate memory for 'RAM_SYMBOLS' at 'translate_instructions_into_binary'.\n");
+int sync_symbol_addresses_using_table(t_array_list* commands_buffer, t_array_list* symbol_table,
+                                      t_array_list* user_symbols) {
+    if (commands_buffer == NULL) {
+        report_error("Internal Error: null 'commands_buffer' at 'sync_symbol_addresses'.\n");
         return -1;
     }
 
-    for (size_t i = 0; i < RAM_SYMBOLS_COUNT; i++) {
-        RAM_SYMBOLS[i] = malloc(sizeof(char) * RAM_SYMBOL_MAX_CHARACTERS * RAM_SYMBOLS_COUNT);
+    if (commands_buffer->type != LIST) {
+        report_error("Internal Error: 'commands_buffer' is not a list at 'sync_symbol_addresses'.\n");
+        return -1;
+    }
 
-        if (RAM_SYMBOLS[i] == NULL) {
-            dispose_array_list(symbol_table);
-            dispose_array_of_strings(RAM_SYMBOLS, RAM_SYMBOLS_COUNT);
-            free(RAM_SYMBOLS);
-            printf("Internal Error: failed to allocate memory for RAM_SYMBOLS[%lu] at 'translate_instructions_into_binary'.\n", i);
-            return -1;
-        }
+    if ((symbol_table == NULL) || (symbol_table->type != MAP) || (symbol_table->length < PREDEFINED_SYMBOLS_COUNT)) {
+        report_error("Internal Error: 'symbol_table' is not a symbol table at 'sync_symbol_addresses'.\n");
+        return -1;
+    }
 
-        size_t* ram_address = malloc(sizeof(size_t));
+    if ((user_symbols != NULL) && (user_symbols->type != MAP)) {
+        report_error("Internal Error: 'user_symbols' is not a map at 'sync_symbol_addresses'.\n");
+        return -1;
+    }
 
-        if (ram_address == NULL) {
-            printf("Internal Error: failed to allocate memory for 'ram_address' at 'translate_instructions_into_binary'.\n");
-            return -1;
-        }
+    int result = add_symbols_of_commands(commands_buffer, symbol_table, user_symbols);
 
-        *(ram_address) = i;
+    SHACK_PROBE2(symbols__synced, symbol_table->length - PREDEFINED_SYMBOLS_COUNT, commands_buffer->length);
 
-        sprintf(RAM_SYMBOLS[i], "%c%lu", RAM_START_SYMBOL, i);
+    /* Only the predefined symbols are kept for the next program. */
+    reset_symbol_table(symbol_table);
 
-        add_entry_to_array_list(symbol_table, RAM_SYMBOLS[i], strlen(RAM_SYMBOLS[i]),
-                                ram_address, 1);
-    }
+    return result;
+}
 
+int add_symbols_of_commands(t_array_list* commands_buffer, t_array_list* symbol_table, t_array_list* user_symbols) {
     const int ADDRESS_POINTER_LENGTH = 1;
 
     for (size_t i = 0; i < commands_buffer->length; i++) {
         t_instruction* instruction = commands_buffer->item[i];
 
         if (instruction == NULL) {
-            dispose_ram_addresses(symbol_table, RAM_SYMBOLS);
-            dispose_array_list(symbol_table);
-            dispose_array_of_strings(RAM_SYMBOLS, RAM_SYMBOLS_COUNT);
-            free(RAM_SYMBOLS);
-            printf("Internal Error: 'commands_buffer' contains invalid data at 'sync_symbol_addresses'.\n");
+            report_error("Internal Error: 'commands_buffer' contains invalid data at 'sync_symbol_addresses'.\n");
             return -1;
         }
 
         if (instruction->type == L_COMMAND) {
             if (instruction->symbol == NULL) {
-                dispose_array_list(symbol_table);
-                dispose_array_of_strings(RAM_SYMBOLS, RAM_SYMBOLS_COUNT);
-                free(RAM_SYMBOLS);
-                printf("Internal Error: 'commands_buffer' contains invalid data at 'sync_symbol_addresses'.\n");
+                report_error("Internal Error: 'commands_buffer' contains invalid data at 'sync_symbol_addresses'.\n");
                 return -1;
             }
 
             if (contains_str_key_array_list(symbol_table, instruction->symbol, instruction->symbol_length) > 0) {
-                dispose_ram_addresses(symbol_table, RAM_SYMBOLS);
-                dispose_array_list(symbol_table);
-                dispose_array_of_strings(RAM_SYMBOLS, RAM_SYMBOLS_COUNT);
-                free(RAM_SYMBOLS);
-                printf("Error: detected a repeated symbol definition of label '%s'.\n", instruction->symbol);
+                report_error("Error: detected a repeated symbol definition of label '%s'.\n", instruction->symbol);
                 return -1;
             }
 
             add_entry_to_array_list(symbol_table, instruction->symbol, instruction->symbol_length,
                                     &(instruction->address), ADDRESS_POINTER_LENGTH);
+
+            if (user_symbols != NULL) {
+                add_entry_to_array_list(user_symbols, instruction->symbol, instruction->symbol_length,
+                                        &(instruction->address), ADDRESS_POINTER_LENGTH);
+            }
         }
     }
 
@@ -159,22 +161,9 @@ int sync_symbol_addresses(t_array_list* commands_buffer) {
     for (size_t i = 0; i < commands_buffer->length; i++) {
         t_instruction* instruction = commands_buffer->item[i];
 
-        if (instruction == NULL) {
-            dispose_ram_addresses(symbol_table, RAM_SYMBOLS);
-            dispose_array_list(symbol_table);
-            dispose_array_of_strings(RAM_SYMBOLS, RAM_SYMBOLS_COUNT);
-            free(RAM_SYMBOLS);
-            printf("Internal Error: 'commands_buffer' contains invalid data at 'sync_symbol_addresses'.\n");
-            return -1;
-        }
-
         if (instruction->type == A_COMMAND) {
             if (instruction->symbol == NULL) {
-                dispose_ram_addresses(symbol_table, RAM_SYMBOLS);
-                dispose_array_list(symbol_table);
-                dispose_array_of_strings(RAM_SYMBOLS, RAM_SYMBOLS_COUNT);
-                free(RAM_SYMBOLS);
-                printf("Internal Error: 'commands_buffer' contains invalid data at 'sync_symbol_addresses'.\n");
+                report_error("Internal Error: 'commands_buffer' contains invalid data at 'sync_symbol_addresses'.\n");
                 return -1;
             }
 
@@ -182,59 +171,33 @@ int sync_symbol_addresses(t_array_list* commands_buffer) {
 
             // if it's not a digit, then we are facing a reference to a label.
             if (!isdigit(first_character)) {
-                result = contains_str_key_array_list(symbol_table, instruction->symbol, instruction->symbol_length);
-
-                if (result > 0) {
-                    size_t* label_address = get_value_with_str_key_from_array_list(symbol_table, instruction->symbol,
-                                                                                   instruction->symbol_length);
-
-                    if (label_address == NULL) {
-                        dispose_ram_addresses(symbol_table, RAM_SYMBOLS);
-                        dispose_array_list(symbol_table);
-                        dispose_array_of_strings(RAM_SYMBOLS, RAM_SYMBOLS_COUNT);
-                        free(RAM_SYMBOLS);
-                        printf("Internal Error: failed to retrieve a label's address at 'sync_symbol_addresses'.\n");
-                        return -1;
-                    }
+                size_t* label_address = get_value_with_str_key_from_array_list(symbol_table, instruction->symbol,
+                                                                               instruction->symbol_length);
 
+                if (label_address != NULL) {
                     instruction->address = *(label_address);
                 }
-                else if (result == 0) {
+                else {
                     instruction->address = variable_address;
 
                     add_entry_to_array_list(symbol_table, instruction->symbol, instruction->symbol_length,
-                                            &instruction->address, 1);
+                                            &instruction->address, ADDRESS_POINTER_LENGTH);
                     variable_address++;
+
+                    if (user_symbols != NULL) {
+                        add_entry_to_array_list(user_symbols, instruction->symbol, instruction->symbol_length,
+                                                &instruction->address, ADDRESS_POINTER_LENGTH);
+                    }
                 }
             }
         }
     }
 
-    dispose_array_list(symbol_table);
-    dispose_array_of_strings(RAM_SYMBOLS, RAM_SYMBOLS_COUNT);
-    free(RAM_SYMBOLS);
+    record_symbol_statistics(symbol_table->length - PREDEFINED_SYMBOLS_COUNT, variable_address - VARIABLE_START_ADDRESS);
+
     return 1;
 }
 
-void dispose_array_of_strings(char** buffer, size_t length) {
-    if (buffer != NULL) {
-        for (size_t i = 0; i < length; i++) {
-            if (buffer[i] != NULL) {
-                free(buffer[i]);
-            }
-        }
-    }
+void reset_symbol_table(t_array_list* symbol_table) {
+    truncate_hash_map(symbol_table, PREDEFINED_SYMBOLS_COUNT);
 }
-
-void dispose_ram_addresses(t_array_list* symbol_table, char** ram_symbols) {
-    if ((symbol_table != NULL) && (ram_symbols != NULL)) {
-        for (size_t i = 0; i < RAM_SYMBOLS_COUNT; i++) {
-            void* address = get_value_with_str_key_from_array_list(symbol_table, ram_symbols[i],
-                                                                   strlen(ram_symbols[i]));
-
-            if (address != NULL) {
-                free(address);
-            }
-        }
-    }
-}
\ No newline at end of file
@@ -7,6 +7,15 @@
 
 #include "general_types.h"
 
-int sync_symbol_addresses(t_array_list* commands_buffer);
+/* If 'user_symbols' is not NULL, the labels and variables of the program are added to it, in definition order, as
+ * entries pointing to the symbol and address of their defining instruction. */
+int sync_symbol_addresses(t_array_list* commands_buffer, t_array_list* user_symbols);
+
+/* A symbol table holds the predefined symbols, and can be reused to sync any number of programs, since the symbols of
+ * each program are removed from it once they have been synced. */
+int create_symbol_table(t_array_list** symbol_table);
+int sync_symbol_addresses_using_table(t_array_list* commands_buffer, t_array_list* symbol_table,
+                                      t_array_list* user_symbols);
+void dispose_symbol_table(t_array_list* symbol_table);
 
 #endif //SHACK_ASSEMBLER_SYMBOL_HANDLER_H
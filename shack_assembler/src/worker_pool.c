@@ -0,0 +1,417 @@
+//
+// worker_pool.c: runs submitted tasks on a fixed set of threads, each one owning its own context.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "worker_pool.h"
+#include "diagnostics.h"
+#include "memory_accounting.h"
+
+struct worker_arguments {
+    t_worker_pool* pool;
+    size_t worker_index;
+};
+
+typedef struct worker_arguments t_worker_arguments;
+
+static _Thread_local t_worker_pool* current_pool = NULL;
+static _Thread_local size_t current_worker_index = 0L;
+static _Thread_local void* current_worker_context = NULL;
+
+void* run_worker(void* arguments);
+void push_task_to_deque(t_worker_pool* pool, t_task* task);
+t_task* take_stealable_task(t_worker_pool* pool, size_t worker_index);
+void run_group_task(t_worker_pool* pool, t_task* task, void* worker_context);
+
+size_t get_available_processor_count(void) {
+    long processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (processor_count > 0) ? (size_t)processor_count : 1;
+}
+
+int create_worker_pool(t_worker_pool** pool, size_t worker_count, t_create_worker_context_function create_worker_context,
+                       t_dispose_worker_context_function dispose_worker_context) {
+    if (pool == NULL) {
+        report_error("Internal Error: null 'pool' at 'create_worker_pool'.\n");
+        return -1;
+    }
+
+    if (worker_count == 0) {
+        report_error("Internal Error: 'worker_count' is 0 at 'create_worker_pool'.\n");
+        return -1;
+    }
+
+    t_worker_pool* worker_pool = allocate_memory(sizeof(t_worker_pool));
+
+    if (worker_pool == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'worker_pool' at 'create_worker_pool'.\n");
+        return -1;
+    }
+
+    worker_pool->workers = allocate_memory(sizeof(pthread_t) * worker_count);
+    worker_pool->worker_contexts = allocate_zeroed_memory(worker_count, sizeof(void*));
+    worker_pool->deques = allocate_memory(sizeof(t_task_deque) * worker_count);
+
+    if ((worker_pool->workers == NULL) || (worker_pool->worker_contexts == NULL) || (worker_pool->deques == NULL)) {
+        release_memory(worker_pool->workers);
+        release_memory(worker_pool->worker_contexts);
+        release_memory(worker_pool->deques);
+        release_memory(worker_pool);
+        report_error("Internal Error: failed to allocate memory for the workers at 'create_worker_pool'.\n");
+        return -1;
+    }
+
+    worker_pool->worker_context_count = 0L;
+    worker_pool->worker_count = 0L;
+    worker_pool->dispose_worker_context = dispose_worker_context;
+    worker_pool->first_task = NULL;
+    worker_pool->last_task = NULL;
+    worker_pool->unfinished_task_count = 0L;
+    worker_pool->is_shutting_down = 0;
+    worker_pool->deque_count = worker_count;
+    atomic_init(&worker_pool->stealable_task_count, 0L);
+
+    for (size_t i = 0; i < worker_count; i++) {
+        pthread_mutex_init(&worker_pool->deques[i].lock, NULL);
+        worker_pool->deques[i].newest_task = NULL;
+        worker_pool->deques[i].oldest_task = NULL;
+    }
+
+    pthread_mutex_init(&worker_pool->lock, NULL);
+    pthread_cond_init(&worker_pool->task_available, NULL);
+    pthread_cond_init(&worker_pool->all_tasks_done, NULL);
+
+    for (size_t i = 0; i < worker_count; i++) {
+        if (create_worker_context != NULL) {
+            worker_pool->worker_contexts[i] = create_worker_context(i);
+
+            if (worker_pool->worker_contexts[i] == NULL) {
+                dispose_worker_pool(worker_pool);
+                report_error("Internal Error: failed to create a worker context at 'create_worker_pool'.\n");
+                return -1;
+            }
+
+            worker_pool->worker_context_count++;
+        }
+
+        t_worker_arguments* arguments = allocate_memory(sizeof(t_worker_arguments));
+
+        if (arguments == NULL) {
+            dispose_worker_pool(worker_pool);
+            report_error("Internal Error: failed to allocate memory for 'arguments' at 'create_worker_pool'.\n");
+            return -1;
+        }
+
+        arguments->pool = worker_pool;
+        arguments->worker_index = i;
+
+        if (pthread_create(&worker_pool->workers[i], NULL, run_worker, arguments) != 0) {
+            release_memory(arguments);
+            dispose_worker_pool(worker_pool);
+            report_error("Internal Error: failed to start a worker thread at 'create_worker_pool'.\n");
+            return -1;
+        }
+
+        worker_pool->worker_count++;
+    }
+
+    *pool = worker_pool;
+
+    return 1;
+}
+
+int submit_task_to_worker_pool(t_worker_pool* pool, t_task_function function, void* argument) {
+    if ((pool == NULL) || (function == NULL)) {
+        report_error("Internal Error: null arguments at 'submit_task_to_worker_pool'.\n");
+        return -1;
+    }
+
+    t_task* task = allocate_memory(sizeof(t_task));
+
+    if (task == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'task' at 'submit_task_to_worker_pool'.\n");
+        return -1;
+    }
+
+    task->function = function;
+    task->argument = argument;
+    task->group = NULL;
+    task->next = NULL;
+    task->previous = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->last_task == NULL) {
+        pool->first_task = task;
+    }
+    else {
+        pool->last_task->next = task;
+    }
+
+    pool->last_task = task;
+    pool->unfinished_task_count++;
+
+    pthread_cond_signal(&pool->task_available);
+    pthread_mutex_unlock(&pool->lock);
+
+    return 1;
+}
+
+void wait_for_worker_pool(t_worker_pool* pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (pool->unfinished_task_count > 0) {
+        pthread_cond_wait(&pool->all_tasks_done, &pool->lock);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* Waits for the pending tasks, stops the workers and releases their contexts. */
+void dispose_worker_pool(t_worker_pool* pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    wait_for_worker_pool(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->is_shutting_down = 1;
+    pthread_cond_broadcast(&pool->task_available);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->worker_count; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+
+    if (pool->dispose_worker_context != NULL) {
+        for (size_t i = 0; i < pool->worker_context_count; i++) {
+            pool->dispose_worker_context(pool->worker_contexts[i]);
+        }
+    }
+
+    for (size_t i = 0; i < pool->deque_count; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->task_available);
+    pthread_cond_destroy(&pool->all_tasks_done);
+
+    release_memory(pool->workers);
+    release_memory(pool->worker_contexts);
+    release_memory(pool->deques);
+    release_memory(pool);
+}
+
+void* run_worker(void* arguments) {
+    t_worker_pool* pool = ((t_worker_arguments*)arguments)->pool;
+    size_t worker_index = ((t_worker_arguments*)arguments)->worker_index;
+    void* worker_context = pool->worker_contexts[worker_index];
+
+    release_memory(arguments);
+
+    current_pool = pool;
+    current_worker_index = worker_index;
+    current_worker_context = worker_context;
+
+    while (1) {
+        t_task* stolen_task = take_stealable_task(pool, worker_index);
+
+        if (stolen_task != NULL) {
+            run_group_task(pool, stolen_task, worker_context);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+
+        while ((pool->first_task == NULL) && (atomic_load(&pool->stealable_task_count) == 0) &&
+               !pool->is_shutting_down) {
+            pthread_cond_wait(&pool->task_available, &pool->lock);
+        }
+
+        if (pool->first_task == NULL) {
+            pthread_mutex_unlock(&pool->lock);
+
+            if (atomic_load(&pool->stealable_task_count) > 0) {
+                continue;
+            }
+
+            break;
+        }
+
+        t_task* task = pool->first_task;
+        pool->first_task = task->next;
+
+        if (pool->first_task == NULL) {
+            pool->last_task = NULL;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+
+        task->function(task->argument, worker_context);
+        release_memory(task);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->unfinished_task_count--;
+
+        if (pool->unfinished_task_count == 0) {
+            pthread_cond_broadcast(&pool->all_tasks_done);
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+void initialize_task_group(t_task_group* group) {
+    atomic_init(&group->unfinished_count, 0L);
+}
+
+void submit_task_to_group(t_task_group* group, t_task_function function, void* argument) {
+    t_task* task = (current_pool != NULL) ? allocate_memory(sizeof(t_task)) : NULL;
+
+    if (task == NULL) {
+        function(argument, current_worker_context);
+        return;
+    }
+
+    task->function = function;
+    task->argument = argument;
+    task->group = group;
+    task->next = NULL;
+    task->previous = NULL;
+
+    atomic_fetch_add(&group->unfinished_count, 1);
+    push_task_to_deque(current_pool, task);
+}
+
+void wait_for_task_group(t_task_group* group) {
+    t_worker_pool* pool = current_pool;
+
+    if (pool == NULL) {
+        return;
+    }
+
+    /* Helping, instead of only waiting, also keeps the calling worker busy while the stolen tasks finish. */
+    while (atomic_load(&group->unfinished_count) > 0) {
+        t_task* task = take_stealable_task(pool, current_worker_index);
+
+        if (task != NULL) {
+            run_group_task(pool, task, current_worker_context);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+
+        while ((atomic_load(&group->unfinished_count) > 0) && (atomic_load(&pool->stealable_task_count) == 0)) {
+            pthread_cond_wait(&pool->task_available, &pool->lock);
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+size_t get_current_worker_count(void) {
+    return (current_pool != NULL) ? current_pool->deque_count : 1;
+}
+
+void push_task_to_deque(t_worker_pool* pool, t_task* task) {
+    t_task_deque* deque = &pool->deques[current_worker_index];
+
+    pthread_mutex_lock(&deque->lock);
+
+    task->next = deque->newest_task;
+
+    if (deque->newest_task != NULL) {
+        deque->newest_task->previous = task;
+    }
+    else {
+        deque->oldest_task = task;
+    }
+
+    deque->newest_task = task;
+
+    pthread_mutex_unlock(&deque->lock);
+
+    atomic_fetch_add(&pool->stealable_task_count, 1);
+
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->task_available);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* The newest task of the worker itself, whose data is the most likely to still be cached, or else the oldest task of
+ * any other worker, which is usually the biggest piece of work left. */
+t_task* take_stealable_task(t_worker_pool* pool, size_t worker_index) {
+    if (atomic_load(&pool->stealable_task_count) == 0) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < pool->deque_count; i++) {
+        t_task_deque* deque = &pool->deques[(worker_index + i) % pool->deque_count];
+        t_task* task = NULL;
+
+        pthread_mutex_lock(&deque->lock);
+
+        if (i == 0) {
+            task = deque->newest_task;
+
+            if (task != NULL) {
+                deque->newest_task = task->next;
+
+                if (deque->newest_task != NULL) {
+                    deque->newest_task->previous = NULL;
+                }
+                else {
+                    deque->oldest_task = NULL;
+                }
+            }
+        }
+        else {
+            task = deque->oldest_task;
+
+            if (task != NULL) {
+                deque->oldest_task = task->previous;
+
+                if (deque->oldest_task != NULL) {
+                    deque->oldest_task->next = NULL;
+                }
+                else {
+                    deque->newest_task = NULL;
+                }
+            }
+        }
+
+        pthread_mutex_unlock(&deque->lock);
+
+        if (task != NULL) {
+            atomic_fetch_sub(&pool->stealable_task_count, 1);
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+void run_group_task(t_worker_pool* pool, t_task* task, void* worker_context) {
+    t_task_group* group = task->group;
+
+    task->function(task->argument, worker_context);
+    release_memory(task);
+
+    /* The group may be released as soon as it is done, so only the pool is used afterwards. */
+    if (atomic_fetch_sub(&group->unfinished_count, 1) == 1) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->task_available);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
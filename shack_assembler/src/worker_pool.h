@@ -0,0 +1,88 @@
+//
+// worker_pool.h: runs submitted tasks on a fixed set of threads, each one owning its own context.
+//
+
+#ifndef SHACK_ASSEMBLER_WORKER_POOL_H
+#define SHACK_ASSEMBLER_WORKER_POOL_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <pthread.h>
+
+typedef void (*t_task_function)(void* argument, void* worker_context);
+typedef void* (*t_create_worker_context_function)(size_t worker_index);
+typedef void (*t_dispose_worker_context_function)(void* worker_context);
+
+struct task {
+    t_task_function function;
+    void* argument;
+    struct task_group* group; // NULL for the tasks submitted to the pool itself.
+    struct task* next;
+    struct task* previous;
+};
+
+typedef struct task t_task;
+
+/* Tasks split out of a running task, e.g. the partitions of a big source file. */
+struct task_group {
+    atomic_size_t unfinished_count;
+};
+
+typedef struct task_group t_task_group;
+
+/* The tasks split out by a worker. It takes the newest one itself, while idle workers steal the oldest one. */
+struct task_deque {
+    pthread_mutex_t lock;
+    t_task* newest_task;
+    t_task* oldest_task;
+};
+
+typedef struct task_deque t_task_deque;
+
+struct worker_pool {
+    pthread_t* workers;
+    void** worker_contexts;
+    size_t worker_context_count;
+    size_t worker_count;
+
+    t_dispose_worker_context_function dispose_worker_context;
+
+    pthread_mutex_t lock;
+    pthread_cond_t task_available;
+    pthread_cond_t all_tasks_done;
+
+    t_task* first_task;
+    t_task* last_task;
+    size_t unfinished_task_count;
+    int is_shutting_down;
+
+    t_task_deque* deques; // One per worker, even the ones which failed to start.
+    size_t deque_count;
+    atomic_size_t stealable_task_count;
+};
+
+typedef struct worker_pool t_worker_pool;
+
+size_t get_available_processor_count(void);
+
+int create_worker_pool(t_worker_pool** pool, size_t worker_count, t_create_worker_context_function create_worker_context,
+                       t_dispose_worker_context_function dispose_worker_context);
+int submit_task_to_worker_pool(t_worker_pool* pool, t_task_function function, void* argument);
+void wait_for_worker_pool(t_worker_pool* pool);
+void dispose_worker_pool(t_worker_pool* pool);
+
+/* Workers look for tasks to steal before taking the next task of the pool, so that the tasks already running, and
+ * split into groups, finish as soon as possible. */
+void initialize_task_group(t_task_group* group);
+
+/* Meant to be called from a task: 'function' runs either on the same worker, once it waits for the group, or on an
+ * idle worker which steals it. Outside of a worker, or if it can not be queued, it runs right away. */
+void submit_task_to_group(t_task_group* group, t_task_function function, void* argument);
+
+/* Runs the tasks of the group still queued, and waits for the ones stolen by other workers. */
+void wait_for_task_group(t_task_group* group);
+
+/* Workers of the pool running the calling thread, 1 outside of a worker. */
+size_t get_current_worker_count(void);
+
+#endif //SHACK_ASSEMBLER_WORKER_POOL_H
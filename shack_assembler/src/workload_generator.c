@@ -0,0 +1,327 @@
+//
+// workload_generator.c: generates Hack programs of a given size and shape, and scales up existing ones, so that the
+// assembler can be benchmarked on inputs which are the same on every run.
+//
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "workload_generator.h"
+#include "diagnostics.h"
+#include "memory_accounting.h"
+
+#define DEFAULT_WORKLOAD_TEXT_CAPACITY (64 * 1024)
+#define WORKLOAD_LINE_CAPACITY 256
+
+static const char* C_COMMANDS[] = {
+    "D=M", "D=A", "M=D", "A=M", "AM=M-1", "M=M+1", "M=M-1", "D=D+A", "D=D-A", "D=D+M", "D=M-D", "A=A-1", "MD=M+1",
+    "M=0", "M=-1", "M=!M", "D=D&M", "D=D|M", "D=-M", "D;JGT", "D;JEQ", "D;JLT", "D;JNE", "D;JGE", "0;JMP",
+};
+
+static const char* PREDEFINED_SYMBOLS[] = {
+    "SP", "LCL", "ARG", "THIS", "THAT", "R0", "R5", "R13", "R14", "R15", "SCREEN", "KBD",
+};
+
+struct workload_text {
+    char* content;
+    size_t length;
+    size_t capacity;
+};
+
+typedef struct workload_text t_workload_text;
+
+struct label_name {
+    const char* name;
+    size_t length;
+};
+
+typedef struct label_name t_label_name;
+
+uint64_t get_next_random_number(uint64_t* state);
+int append_workload_text(t_workload_text* text, const char* content, size_t length);
+int append_workload_line(t_workload_text* text, const char* line, size_t line_length);
+int is_workload_symbol_character(char character);
+size_t find_label_names(const char* content, size_t length, t_label_name* names);
+int compare_label_names(const void* first, const void* second);
+int append_scaled_line(t_workload_text* text, const char* line, size_t line_length, const t_label_name* names,
+                       size_t name_count, size_t copy_index);
+
+void initialize_workload_shape(t_workload_shape* shape) {
+    shape->instruction_count = DEFAULT_WORKLOAD_INSTRUCTION_COUNT;
+    shape->label_density = DEFAULT_WORKLOAD_LABEL_DENSITY;
+    shape->variable_count = DEFAULT_WORKLOAD_VARIABLE_COUNT;
+    shape->comment_ratio = DEFAULT_WORKLOAD_COMMENT_RATIO;
+    shape->line_length = 0L;
+    shape->a_command_ratio = DEFAULT_WORKLOAD_A_COMMAND_RATIO;
+    shape->seed = 1;
+}
+
+int generate_workload(const t_workload_shape* shape, char** content, size_t* length) {
+    if ((shape->comment_ratio >= 100) || (shape->a_command_ratio > 100) ||
+        (shape->variable_count > MAXIMUM_WORKLOAD_VARIABLE_COUNT) || (shape->line_length >= WORKLOAD_LINE_CAPACITY)) {
+        report_error("Error: invalid workload shape, comments must be below 100%%, A commands at most 100%%, variables "
+                     "at most %d, and lines shorter than %d characters.\n", MAXIMUM_WORKLOAD_VARIABLE_COUNT,
+                     WORKLOAD_LINE_CAPACITY);
+        return -1;
+    }
+
+    const size_t C_COMMAND_COUNT = sizeof(C_COMMANDS) / sizeof(C_COMMANDS[0]);
+    const size_t PREDEFINED_SYMBOL_COUNT = sizeof(PREDEFINED_SYMBOLS) / sizeof(PREDEFINED_SYMBOLS[0]);
+
+    t_workload_text text = { .content = NULL, .length = 0L, .capacity = 0L };
+    uint64_t state = shape->seed;
+    size_t label_count = (shape->instruction_count * shape->label_density) / 1000;
+    size_t next_label = 0L;
+    size_t comment_count = 0L;
+    char line[WORKLOAD_LINE_CAPACITY];
+    int result = 1;
+
+    for (size_t i = 0; (result > 0) && (i < shape->instruction_count); i++) {
+        /* Labels are spread evenly over the program, so that references to them reach both back and forward. */
+        while ((result > 0) && (next_label < label_count) &&
+               (((next_label * shape->instruction_count) / label_count) <= i)) {
+            result = append_workload_line(&text, line, (size_t)snprintf(line, sizeof(line), "(LABEL_%lu)", next_label));
+            next_label++;
+        }
+
+        while ((result > 0) && ((get_next_random_number(&state) % 100) < shape->comment_ratio)) {
+            result = append_workload_text(&text, line, (size_t)snprintf(line, sizeof(line), "// Comment %lu.\n",
+                                                                        comment_count++));
+        }
+
+        uint64_t random = get_next_random_number(&state);
+        int line_length;
+
+        if ((random % 100) >= shape->a_command_ratio) {
+            line_length = snprintf(line, sizeof(line), "%s", C_COMMANDS[(random >> 8) % C_COMMAND_COUNT]);
+        }
+        else if ((((random >> 8) % 4) == 0) && (label_count > 0)) {
+            line_length = snprintf(line, sizeof(line), "@LABEL_%lu", (size_t)((random >> 16) % label_count));
+        }
+        else if ((((random >> 8) % 4) == 1) && (shape->variable_count > 0)) {
+            line_length = snprintf(line, sizeof(line), "@variable_%lu",
+                                   (size_t)((random >> 16) % shape->variable_count));
+        }
+        else if (((random >> 8) % 4) == 2) {
+            line_length = snprintf(line, sizeof(line), "@%lu", (size_t)((random >> 16) % 32768));
+        }
+        else {
+            line_length = snprintf(line, sizeof(line), "@%s",
+                                   PREDEFINED_SYMBOLS[(random >> 16) % PREDEFINED_SYMBOL_COUNT]);
+        }
+
+        /* Padded with a trailing comment, such as '@SP // abcdef'. */
+        if (((size_t)line_length + 4) <= shape->line_length) {
+            memcpy(line + line_length, " // ", 4);
+
+            for (size_t j = (size_t)line_length + 4; j < shape->line_length; j++) {
+                line[j] = (char)('a' + (j % 26));
+            }
+
+            line_length = (int)shape->line_length;
+        }
+
+        if (result > 0) {
+            result = append_workload_line(&text, line, (size_t)line_length);
+        }
+    }
+
+    while ((result > 0) && (next_label < label_count)) {
+        result = append_workload_line(&text, line, (size_t)snprintf(line, sizeof(line), "(LABEL_%lu)", next_label));
+        next_label++;
+    }
+
+    if ((result > 0) && (text.content == NULL)) {
+        result = append_workload_text(&text, "", 0L);
+    }
+
+    if (result < 0) {
+        release_memory(text.content);
+        report_error("Internal Error: failed to allocate memory for the workload at 'generate_workload'.\n");
+        return -1;
+    }
+
+    *content = text.content;
+    *length = text.length;
+
+    return 1;
+}
+
+int scale_workload(const char* content, size_t length, size_t copy_count, char** scaled_content,
+                   size_t* scaled_length) {
+    t_workload_text text = { .content = NULL, .length = 0L, .capacity = 0L };
+    t_label_name* names = allocate_memory(sizeof(t_label_name) * ((length / 3) + 1)); // The shortest label is '(X)'.
+
+    if (names == NULL) {
+        report_error("Internal Error: failed to allocate memory for 'names' at 'scale_workload'.\n");
+        return -1;
+    }
+
+    size_t name_count = find_label_names(content, length, names);
+    int result = append_workload_text(&text, "", 0L);
+
+    qsort(names, name_count, sizeof(t_label_name), compare_label_names);
+
+    for (size_t i = 0; (result > 0) && (i < copy_count); i++) {
+        size_t position = 0L;
+
+        while ((result > 0) && (position < length)) {
+            const char* new_line = memchr(content + position, '\n', length - position);
+            size_t end = (new_line != NULL) ? (size_t)(new_line - content) : length;
+
+            if (i == 0) {
+                result = append_workload_line(&text, content + position, end - position);
+            }
+            else {
+                result = append_scaled_line(&text, content + position, end - position, names, name_count, i);
+            }
+
+            position = end + 1;
+        }
+    }
+
+    release_memory(names);
+
+    if (result < 0) {
+        release_memory(text.content);
+        report_error("Internal Error: failed to allocate memory for the workload at 'scale_workload'.\n");
+        return -1;
+    }
+
+    *scaled_content = text.content;
+    *scaled_length = text.length;
+
+    return 1;
+}
+
+/* xorshift64*, which is enough to vary the commands, and the same on every platform. */
+uint64_t get_next_random_number(uint64_t* state) {
+    uint64_t x = (*state != 0) ? *state : 0x9e3779b97f4a7c15ull;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+/* Keeps the content ended by '\0', which is not counted in its length. */
+int append_workload_text(t_workload_text* text, const char* content, size_t length) {
+    if ((text->length + length + 1) > text->capacity) {
+        size_t new_capacity = (text->capacity > 0) ? text->capacity : DEFAULT_WORKLOAD_TEXT_CAPACITY;
+
+        while ((text->length + length + 1) > new_capacity) {
+            new_capacity *= 2;
+        }
+
+        char* new_content = reallocate_memory(text->content, sizeof(char) * new_capacity);
+
+        if (new_content == NULL) {
+            return -1;
+        }
+
+        text->content = new_content;
+        text->capacity = new_capacity;
+    }
+
+    memcpy(text->content + text->length, content, length);
+    text->length += length;
+    text->content[text->length] = '\0';
+
+    return 1;
+}
+
+int append_workload_line(t_workload_text* text, const char* line, size_t line_length) {
+    if (append_workload_text(text, line, line_length) < 0) {
+        return -1;
+    }
+
+    return append_workload_text(text, "\n", 1L);
+}
+
+int is_workload_symbol_character(char character) {
+    return isalnum((unsigned char)character) || (character == '_') || (character == '.') || (character == '$') ||
+           (character == ':');
+}
+
+/* Names point into 'content', which must outlive them. */
+size_t find_label_names(const char* content, size_t length, t_label_name* names) {
+    size_t name_count = 0L;
+    size_t position = 0L;
+
+    while (position < length) {
+        const char* new_line = memchr(content + position, '\n', length - position);
+        size_t end = (new_line != NULL) ? (size_t)(new_line - content) : length;
+
+        while ((position < end) && isspace((unsigned char)content[position])) {
+            position++;
+        }
+
+        if ((position < end) && (content[position] == '(')) {
+            size_t name_end = position + 1;
+
+            while ((name_end < end) && is_workload_symbol_character(content[name_end])) {
+                name_end++;
+            }
+
+            names[name_count].name = content + position + 1;
+            names[name_count].length = name_end - position - 1;
+            name_count++;
+        }
+
+        position = end + 1;
+    }
+
+    return name_count;
+}
+
+int compare_label_names(const void* first, const void* second) {
+    const t_label_name* first_name = first;
+    const t_label_name* second_name = second;
+    size_t length = (first_name->length < second_name->length) ? first_name->length : second_name->length;
+    int result = memcmp(first_name->name, second_name->name, length);
+
+    if (result != 0) {
+        return result;
+    }
+
+    return (first_name->length > second_name->length) - (first_name->length < second_name->length);
+}
+
+/* Appends 'line' with the label it defines or references, if any, renamed after 'copy_index'. */
+int append_scaled_line(t_workload_text* text, const char* line, size_t line_length, const t_label_name* names,
+                       size_t name_count, size_t copy_index) {
+    size_t start = 0L;
+
+    while ((start < line_length) && isspace((unsigned char)line[start])) {
+        start++;
+    }
+
+    if ((start == line_length) || ((line[start] != '(') && (line[start] != '@'))) {
+        return append_workload_line(text, line, line_length);
+    }
+
+    t_label_name symbol = { .name = line + start + 1, .length = 0L };
+
+    while (((start + 1 + symbol.length) < line_length) && is_workload_symbol_character(symbol.name[symbol.length])) {
+        symbol.length++;
+    }
+
+    if (bsearch(&symbol, names, name_count, sizeof(t_label_name), compare_label_names) == NULL) {
+        return append_workload_line(text, line, line_length);
+    }
+
+    size_t name_end = start + 1 + symbol.length;
+    char suffix[32];
+    int suffix_length = snprintf(suffix, sizeof(suffix), ".%lu", copy_index);
+
+    if ((append_workload_text(text, line, name_end) < 0) ||
+        (append_workload_text(text, suffix, (size_t)suffix_length) < 0)) {
+        return -1;
+    }
+
+    return append_workload_line(text, line + name_end, line_length - name_end);
+}
@@ -0,0 +1,42 @@
+//
+// workload_generator.h: generates Hack programs of a given size and shape, and scales up existing ones, so that the
+// assembler can be benchmarked on inputs which are the same on every run.
+//
+
+#ifndef SHACK_ASSEMBLER_WORKLOAD_GENERATOR_H
+#define SHACK_ASSEMBLER_WORKLOAD_GENERATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEFAULT_WORKLOAD_INSTRUCTION_COUNT 200000
+#define DEFAULT_WORKLOAD_LABEL_DENSITY 30
+#define DEFAULT_WORKLOAD_VARIABLE_COUNT 64
+#define DEFAULT_WORKLOAD_COMMENT_RATIO 10
+#define DEFAULT_WORKLOAD_A_COMMAND_RATIO 50
+#define MAXIMUM_WORKLOAD_VARIABLE_COUNT 16000 // Variables take the RAM from address 16 up to the screen.
+
+struct workload_shape {
+    size_t instruction_count;
+    unsigned int label_density;   // Labels per thousand instructions.
+    size_t variable_count;        // Distinct variables referenced by the A commands.
+    unsigned int comment_ratio;   // Percentage of the lines which are only a comment, below 100.
+    size_t line_length;           // Code lines are padded with a trailing comment up to it, 0 for no padding.
+    unsigned int a_command_ratio; // Percentage of the instructions which are A commands.
+    uint64_t seed;                // The same seed and shape always generate the same program.
+};
+
+typedef struct workload_shape t_workload_shape;
+
+void initialize_workload_shape(t_workload_shape* shape);
+
+/* Every label is defined once, and every symbol referenced is either a label, a variable or a predefined symbol, so
+ * the program always assembles. The content must be released with 'release_memory'. */
+int generate_workload(const t_workload_shape* shape, char** content, size_t* length);
+
+/* Repeats 'content' 'copy_count' times, renaming the labels defined by every copy after the first one, so that the
+ * result still assembles. Variables and predefined symbols are shared by all the copies. */
+int scale_workload(const char* content, size_t length, size_t copy_count, char** scaled_content,
+                   size_t* scaled_length);
+
+#endif //SHACK_ASSEMBLER_WORKLOAD_GENERATOR_H